@@ -91,10 +91,10 @@ __interrupt_vector_table:
     .long   UART1Error_IRQHandler	/* UART1 error interrupt */
     .long   UART2_RX_TX_IRQHandler  /* UART2 receive/transmit interrupt */
     .long   UART2Error_IRQHandler	/* UART2 error interrupt */
-    .long	Reserved67_IRQHandler	/* Reserved interrupt 67 */
-    .long	Reserved68_IRQHandler	/* Reserved interrupt 68 */
-    .long	Reserved69_IRQHandler	/* Reserved interrupt 69 */
-    .long	Reserved70_IRQHandler	/* Reserved interrupt 70 */
+    .long   UART3_RX_TX_IRQHandler	/* UART3 receive/transmit interrupt */
+    .long   UART3Error_IRQHandler	/* UART3 error interrupt */
+    .long   UART4_RX_TX_IRQHandler	/* UART4 receive/transmit interrupt */
+    .long   UART4Error_IRQHandler	/* UART4 error interrupt */
     .long	Reserved71_IRQHandler	/* Reserved interrupt 71 */
     .long	Reserved72_IRQHandler	/* Reserved interrupt 72 */
     .long   ADC0_IRQHandler			/* ADC0 interrupt */
@@ -361,10 +361,10 @@ __interrupt_vector_table:
     .weak   UART1Error_IRQHandler		/* UART1 error interrupt */
     .weak   UART2_RX_TX_IRQHandler		/* UART2 receive/transmit interrupt */
     .weak   UART2Error_IRQHandler		/* UART2 error interrupt */
-    .weak	Reserved67_IRQHandler		/* Reserved interrupt 67 */
-    .weak	Reserved68_IRQHandler		/* Reserved interrupt 68 */
-    .weak	Reserved69_IRQHandler		/* Reserved interrupt 69 */
-    .weak	Reserved70_IRQHandler		/* Reserved interrupt 70 */
+    .weak   UART3_RX_TX_IRQHandler		/* UART3 receive/transmit interrupt */
+    .weak   UART3Error_IRQHandler		/* UART3 error interrupt */
+    .weak   UART4_RX_TX_IRQHandler		/* UART4 receive/transmit interrupt */
+    .weak   UART4Error_IRQHandler		/* UART4 error interrupt */
     .weak	Reserved71_IRQHandler		/* Reserved interrupt 71 */
     .weak	Reserved72_IRQHandler		/* Reserved interrupt 72 */
     .weak   ADC0_IRQHandler				/* ADC0 interrupt */
@@ -621,10 +621,10 @@ UART1_RX_TX_IRQHandler:
 UART1Error_IRQHandler:
 UART2_RX_TX_IRQHandler:
 UART2Error_IRQHandler:
-Reserved67_IRQHandler:
-Reserved68_IRQHandler:
-Reserved69_IRQHandler:
-Reserved70_IRQHandler:
+UART3_RX_TX_IRQHandler:
+UART3Error_IRQHandler:
+UART4_RX_TX_IRQHandler:
+UART4Error_IRQHandler:
 Reserved71_IRQHandler:
 Reserved72_IRQHandler:
 ADC0_IRQHandler:
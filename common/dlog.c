@@ -0,0 +1,145 @@
+/*
+ * File:        dlog.c
+ * Purpose:     Deferred binary logging: the device logs IDs and argument
+ *              words, the host turns them back into text
+ *
+ * Notes:
+ *  See dlog.h. Indices into the ring are free running word counts:
+ *
+ *    tail <= head <= reserve <= tail + DLOG_RING_WORDS
+ *
+ *  Writers move reserve to claim space, then fill it. Writers can only nest
+ *  (an interrupt runs to the end before whatever it interrupted goes on),
+ *  so the writer whose space starts at head is the outermost one still
+ *  busy, and everything reserved after it is done by the time it is. That
+ *  writer moves head up to reserve; the others leave head alone. The
+ *  LDREX/STREX pair around the move fails if an interrupt logs in
+ *  between, and the move is retried with the new reserve.
+ */
+
+#include "dlog.h"
+#include "atomic.h"
+
+#define  DLOG_MASK				(DLOG_RING_WORDS - 1)
+
+_Static_assert((DLOG_RING_WORDS & DLOG_MASK) == 0, "DLOG_RING_WORDS must be a power of two");
+_Static_assert((DLOG_MAX_ARGS + 1) * 4 <= TELEM_MAX_RECORD, "a log record must fit a telem record");
+
+static uint32_t				dlog_ring[DLOG_RING_WORDS];
+static volatile uint32_t	dlog_reserve;
+static volatile uint32_t	dlog_head;
+static volatile uint32_t	dlog_tail;
+
+static volatile uint32_t	dlog_lost;			// dropped since the last drain
+static volatile uint32_t	dlog_dropped;		// ...since the last dlog_stats()
+static volatile uint32_t	dlog_high_water;
+static uint32_t				dlog_records;
+
+
+
+/*
+ *  dlog_take      atomically reads and zeroes a counter
+ */
+static uint32_t  dlog_take(volatile uint32_t  *p)
+{
+	uint32_t				v;
+
+	do
+	{
+		v = atomic_ldrex(p);
+	} while (atomic_strex(p, 0));
+	return  v;
+}
+
+
+
+void  dlog_write(uint32_t  id, const uint32_t  *args, uint32_t  n)
+{
+	uint32_t				start;
+	uint32_t				used;
+	uint32_t				high;
+	uint32_t				i;
+
+	do
+	{
+		start = atomic_ldrex(&dlog_reserve);
+		used = start + 1 + n - dlog_tail;
+		if (used > DLOG_RING_WORDS)
+		{
+			atomic_clrex();
+			atomic_fetch_add(&dlog_lost, 1);
+			atomic_fetch_add(&dlog_dropped, 1);
+			return;
+		}
+	} while (atomic_strex(&dlog_reserve, start + 1 + n));
+
+	dlog_ring[start & DLOG_MASK] = (id & DLOG_ID_MASK) | (n << DLOG_NARGS_SHIFT);
+	for (i=0; i<n; i++)  dlog_ring[(start + 1 + i) & DLOG_MASK] = args[i];
+	atomic_barrier();
+
+	do
+	{
+		if (atomic_ldrex(&dlog_head) != start)
+		{
+			atomic_clrex();					// an outer writer will publish this
+			break;
+		}
+	} while (atomic_strex(&dlog_head, dlog_reserve));
+
+	while (used > (high = dlog_high_water))
+	{
+		if (atomic_cas(&dlog_high_water, high, used))  break;
+	}
+}
+
+
+
+uint32_t  dlog_drain(telem_tx_t  *tx)
+{
+	uint32_t				head;
+	uint32_t				tail;
+	uint32_t				lost;
+	uint32_t				moved = 0;
+	uint32_t				w;
+	uint32_t				n;
+	uint32_t				i;
+	uint8_t					*p;
+
+	lost = dlog_take(&dlog_lost);
+	if (lost)
+	{
+		p = telem_record(tx, DLOG_RECORD, 8);
+		telem_le32(p, 1 << DLOG_NARGS_SHIFT);	// ID 0, one argument
+		telem_le32(p + 4, lost);
+	}
+
+	head = atomic_load_acquire(&dlog_head);
+	tail = dlog_tail;
+	while (tail != head)
+	{
+		// as many whole log records as fit one telem record
+		for (w=0; tail + w != head; w += n)
+		{
+			n = 1 + ((dlog_ring[(tail + w) & DLOG_MASK] >> DLOG_NARGS_SHIFT) & DLOG_NARGS_MASK);
+			if ((w + n) * 4 > TELEM_MAX_RECORD)  break;
+			dlog_records++;
+		}
+
+		p = telem_record(tx, DLOG_RECORD, w * 4);
+		for (i=0; i<w; i++)  telem_le32(p + 4 * i, dlog_ring[(tail + i) & DLOG_MASK]);
+		tail += w;
+		moved += w;
+		atomic_store_release(&dlog_tail, tail);
+	}
+	return  moved;
+}
+
+
+
+void  dlog_stats(dlog_stats_t  *stats)
+{
+	stats->records = dlog_records;
+	stats->dropped = dlog_take(&dlog_dropped);
+	stats->high_water = dlog_high_water;
+	dlog_records = 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * File:        fir.c
+ * Purpose:     Q15 FIR filter and decimator for sample blocks
+ *
+ * Notes:
+ *  See fir.h. Input is copied FIR_CHUNK samples at a time onto the end of a
+ *  delay line holding the last taps - 1 inputs, and outputs are dot products
+ *  of the reversed coefficients with a run of the delay line. Outputs are
+ *  written back to buf no further along than the chunk just copied out, so
+ *  filtering in place never overwrites an input that is still needed.
+ */
+
+#include "fir.h"
+
+/* two adjacent samples as one word; the M4 allows unaligned LDR */
+typedef uint32_t	fir_pair_t __attribute__ ((aligned(2), may_alias));
+
+#define  FIR_ROUND			(1 << 14)
+
+
+
+int32_t  fir_init(fir_t  *fir, const int16_t  *coeffs, uint32_t  taps, uint32_t  decimate)
+{
+	uint32_t				k;
+	uint32_t				n;
+
+	if (taps == 0 || taps > FIR_MAX_TAPS || decimate == 0 || decimate > 255)  return  -1;
+
+	n = (taps + 1) & ~1;
+	for (k=0; k<n; k++)
+	{
+		if (k < taps)  fir->coeffs[n - 1 - k] = coeffs[k];
+		else  fir->coeffs[n - 1 - k] = 0;					// padding, oldest end
+	}
+	fir->taps = n;
+	fir->decimate = decimate;
+	fir->phase = 0;
+	for (k=0; k<FIR_MAX_TAPS - 1 + FIR_CHUNK; k++)  fir->state[k] = 0;
+	return  0;
+}
+
+
+
+/*
+ *  fir_dot_c      one output, plain C; the accumulator wraps like SMLAD's
+ */
+static inline int16_t  fir_dot_c(const int16_t  *h, const int16_t  *x, uint32_t  taps)
+{
+	uint32_t				acc = FIR_ROUND;
+	uint32_t				k;
+	int32_t					v;
+
+	for (k=0; k<taps; k++)
+	{
+		acc += (uint32_t) ((int32_t) h[k] * x[k]);
+	}
+	v = (int32_t) acc >> 15;
+	if (v > 32767)  v = 32767;
+	if (v < -32768)  v = -32768;
+	return  v;
+}
+
+
+
+#if defined(__ARM_FEATURE_DSP)
+#define  FIR_DSP
+
+static inline uint32_t  fir_smlad(uint32_t  h, uint32_t  x, uint32_t  acc)
+{
+	asm (" SMLAD %0, %1, %2, %3" : "=r" (acc) : "r" (h), "r" (x), "r" (acc));
+	return  acc;
+}
+
+static inline int32_t  fir_ssat(uint32_t  acc)
+{
+	int32_t					v;
+
+	asm (" SSAT %0, #16, %1, ASR #15" : "=r" (v) : "r" (acc));
+	return  v;
+}
+#elif defined(FIR_EMULATE_DSP)
+/*
+ *  C models of the two instructions, so a host build (tools/fir) runs the
+ *  same pairing, padding and unaligned loads as the M4 does
+ */
+#define  FIR_DSP
+
+static inline uint32_t  fir_smlad(uint32_t  h, uint32_t  x, uint32_t  acc)
+{
+	acc += (uint32_t) ((int32_t) (int16_t) h * (int16_t) x);
+	acc += (uint32_t) ((int32_t) (int16_t) (h >> 16) * (int16_t) (x >> 16));
+	return  acc;
+}
+
+static inline int32_t  fir_ssat(uint32_t  acc)
+{
+	int32_t					v = (int32_t) acc >> 15;
+
+	if (v > 32767)  v = 32767;
+	if (v < -32768)  v = -32768;
+	return  v;
+}
+#endif
+
+
+
+#if defined(FIR_DSP)
+/*
+ *  fir_dot_dsp      one output, two MACs per SMLAD; taps is even
+ */
+static inline int16_t  fir_dot_dsp(const int16_t  *h, const int16_t  *x, uint32_t  taps)
+{
+	uint32_t				acc = FIR_ROUND;
+	uint32_t				k;
+
+	for (k=0; k<taps; k+=2)
+	{
+		acc = fir_smlad(*(const fir_pair_t *) &h[k], *(const fir_pair_t *) &x[k], acc);
+	}
+	return  fir_ssat(acc);
+}
+#else
+#define  fir_dot_dsp		fir_dot_c
+#endif
+
+
+
+static inline __attribute__ ((always_inline))
+uint32_t  fir_run(fir_t  *fir, int16_t  *buf, uint32_t  length, uint32_t  dsp)
+{
+	uint32_t				history = fir->taps - 1;
+	uint32_t				in = 0;
+	uint32_t				out = 0;
+	uint32_t				n;
+	uint32_t				i;
+
+	while (in < length)
+	{
+		n = length - in;
+		if (n > FIR_CHUNK)  n = FIR_CHUNK;
+		for (i=0; i<n; i++)  fir->state[history + i] = buf[in + i];
+
+		// the output at input i covers state[i] to state[i + history]
+		for (i=fir->phase; i<n; i+=fir->decimate)
+		{
+			if (dsp)  buf[out++] = fir_dot_dsp(fir->coeffs, &fir->state[i], fir->taps);
+			else  buf[out++] = fir_dot_c(fir->coeffs, &fir->state[i], fir->taps);
+		}
+		fir->phase = i - n;
+
+		for (i=0; i<history; i++)  fir->state[i] = fir->state[n + i];
+		in += n;
+	}
+	return  out;
+}
+
+
+
+uint32_t  fir_decimate(fir_t  *fir, int16_t  *buf, uint32_t  length)
+{
+	return  fir_run(fir, buf, length, 1);
+}
+
+
+
+uint32_t  fir_decimate_ref(fir_t  *fir, int16_t  *buf, uint32_t  length)
+{
+	return  fir_run(fir, buf, length, 0);
+}
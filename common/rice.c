@@ -0,0 +1,185 @@
+/*
+ * File:        rice.c
+ * Purpose:     Lossless block codec for 16-bit sample streams
+ *
+ * Notes:
+ *  See rice.h. Bits are gathered in a 32-bit accumulator and moved out or
+ *  in 16 at a time, so nothing here needs 64-bit arithmetic. No code is
+ *  longer than 32 bits, so the encoder checks for room once per sample.
+ */
+
+#include "rice.h"
+
+#define  RICE_N_MASK			0x07ff
+#define  RICE_K_SHIFT			11
+#define  RICE_K_MASK			0x0f
+
+
+
+/*
+ *  rice_zigzag      difference of two samples, small of either sign to small
+ */
+static inline uint32_t  rice_zigzag(uint16_t  x, uint16_t  prev)
+{
+	int16_t					d = (int16_t) (x - prev);
+
+	return  (uint16_t) ((d << 1) ^ (d >> 15));
+}
+
+
+
+/*
+ *  rice_code      codes a block with parameter k in at most limit words;
+ *  returns the words written, or 0 if it did not fit
+ */
+static uint32_t  rice_code(const uint16_t  *in, uint32_t  n, uint16_t  *out, uint32_t  k, uint32_t  limit)
+{
+	uint32_t				acc = 0;
+	uint32_t				bits = 0;
+	uint32_t				w = 2;
+	uint32_t				i;
+	uint32_t				u;
+	uint32_t				q;
+
+/* appends the low nbits (at most 16) of v */
+#define  RICE_PUT(v, nbits) \
+	do { \
+		acc |= (uint32_t) (v) << bits; \
+		bits += (nbits); \
+		if (bits >= 16) \
+		{ \
+			out[w++] = acc; \
+			acc >>= 16; \
+			bits -= 16; \
+		} \
+	} while (0)
+
+	out[0] = RICE_CODED | (k << RICE_K_SHIFT) | n;
+	out[1] = in[0];
+	for (i=1; i<n; i++)
+	{
+		if (w + 2 > limit)  return  0;			// a code is at most 32 bits
+
+		u = rice_zigzag(in[i], in[i - 1]);
+		q = u >> k;
+		if (q < RICE_ESCAPE)
+		{
+			RICE_PUT(1u << q, q + 1);
+			RICE_PUT(u & ((1u << k) - 1), k);
+		}
+		else
+		{
+			RICE_PUT(0, RICE_ESCAPE);
+			RICE_PUT(u, 16);
+		}
+	}
+#undef  RICE_PUT
+
+	if (bits)
+	{
+		if (w == limit)  return  0;
+		out[w++] = acc;
+	}
+	return  w;
+}
+
+
+
+uint32_t  rice_encode(const uint16_t  *in, uint32_t  n, uint16_t  *out, uint32_t  capacity)
+{
+	uint32_t				sum = 0;
+	uint32_t				mean;
+	uint32_t				k;
+	uint32_t				w;
+	uint32_t				i;
+
+	if (n > RICE_MAX_SAMPLES || capacity < n + 1)  return  0;
+
+	if (n >= 2)
+	{
+		// k near log2 of the mean difference minimizes the code length
+		for (i=1; i<n; i++)  sum += rice_zigzag(in[i], in[i - 1]);
+		mean = sum / (n - 1);
+		k = mean ? 31 - __builtin_clz(mean) : 0;
+		if (k > RICE_K_MASK)  k = RICE_K_MASK;
+
+		// coded only if it is smaller than raw (n + 1 words)
+		w = rice_code(in, n, out, k, n);
+		if (w)  return  w;
+	}
+
+	out[0] = n;
+	for (i=0; i<n; i++)  out[i + 1] = in[i];
+	return  n + 1;
+}
+
+
+
+int32_t  rice_decode(const uint16_t  *in, uint32_t  words, uint16_t  *out, uint32_t  capacity)
+{
+	uint32_t				acc = 0;
+	uint32_t				bits = 0;
+	uint32_t				r = 2;
+	uint32_t				n;
+	uint32_t				k;
+	uint32_t				i;
+	uint32_t				u;
+	uint32_t				q;
+	uint16_t				prev;
+
+/* tops the accumulator up to at least 17 bits while there are words left */
+#define  RICE_FILL() \
+	while (bits <= 16 && r < words) \
+	{ \
+		acc |= (uint32_t) in[r++] << bits; \
+		bits += 16; \
+	}
+
+	if (words == 0)  return  -1;
+	n = in[0] & RICE_N_MASK;
+	k = (in[0] >> RICE_K_SHIFT) & RICE_K_MASK;
+	if (n > capacity)  return  -1;
+
+	if (!(in[0] & RICE_CODED))
+	{
+		if (k || words < n + 1)  return  -1;
+		for (i=0; i<n; i++)  out[i] = in[i + 1];
+		return  n;
+	}
+
+	if (n == 0)  return  0;
+	if (words < 2)  return  -1;
+	prev = out[0] = in[1];
+	for (i=1; i<n; i++)
+	{
+		RICE_FILL();
+		if ((acc & 0xffff) == 0)
+		{
+			if (bits < 16)  return  -1;
+			acc >>= RICE_ESCAPE;
+			bits -= RICE_ESCAPE;
+			RICE_FILL();
+			if (bits < 16)  return  -1;
+			u = acc & 0xffff;
+			acc >>= 16;
+			bits -= 16;
+		}
+		else
+		{
+			q = __builtin_ctz(acc);
+			if (q + 1 > bits)  return  -1;
+			acc >>= q + 1;
+			bits -= q + 1;
+			RICE_FILL();
+			if (k > bits)  return  -1;
+			u = (q << k) | (acc & ((1u << k) - 1));
+			acc >>= k;
+			bits -= k;
+		}
+		prev += (uint16_t) ((u >> 1) ^ -(u & 1));
+		out[i] = prev;
+	}
+#undef  RICE_FILL
+
+	return  n;
+}
@@ -0,0 +1,174 @@
+/*
+ * File:        slab.c
+ * Purpose:     Fixed-size block allocator with build-time size classes
+ *
+ * Notes:
+ *  See slab.h. A set bit in a class bitmap marks a free block. Allocation
+ *  claims the highest set bit of the first non-empty word (CLZ), freeing
+ *  sets the bit again; both are single LDREX/STREX read-modify-writes.
+ */
+
+#include "slab.h"
+#include "atomic.h"
+
+#ifndef NULL
+#define NULL	(0)
+#endif
+
+#define  SLAB_WORDS(count)		(((count) + 31) / 32)
+
+/*
+ *  Block storage and free bitmap for each class
+ */
+#define  SLAB_STORAGE(size, count) \
+	_Static_assert((size) % 4 == 0, "slab block sizes must be a multiple of 4"); \
+	static uint32_t				slab_blocks_##size[(size) / 4 * (count)]; \
+	static volatile uint32_t	slab_map_##size[SLAB_WORDS(count)];
+
+SLAB_CLASSES(SLAB_STORAGE)
+
+typedef struct
+{
+	uint8_t					*base;
+	uint32_t				size;
+	uint32_t				count;
+	volatile uint32_t		*map;
+} slab_class_t;
+
+#define  SLAB_ENTRY(size, count) \
+	{(uint8_t *) slab_blocks_##size, (size), (count), slab_map_##size},
+
+static const slab_class_t	slab_classes[SLAB_N_CLASSES] =
+{
+	SLAB_CLASSES(SLAB_ENTRY)
+};
+
+static volatile uint32_t	slab_in_use[SLAB_N_CLASSES];
+static volatile uint32_t	slab_high_water[SLAB_N_CLASSES];
+static volatile uint32_t	slab_failures[SLAB_N_CLASSES];
+
+
+
+void  slab_init(void)
+{
+	uint32_t				n;
+	uint32_t				w;
+	uint32_t				left;
+
+	for (n=0; n<SLAB_N_CLASSES; n++)
+	{
+		left = slab_classes[n].count;
+		for (w=0; w<SLAB_WORDS(slab_classes[n].count); w++)
+		{
+			if (left >= 32)  slab_classes[n].map[w] = 0xffffffff;
+			else  slab_classes[n].map[w] = (1u << left) - 1;
+			left -= (left >= 32) ? 32 : left;
+		}
+		slab_in_use[n] = 0;
+		slab_high_water[n] = 0;
+		slab_failures[n] = 0;
+	}
+	atomic_barrier();
+}
+
+
+
+/*
+ *  slab_account      counts a new allocation and raises the high-water mark
+ */
+static void  slab_account(uint32_t  n)
+{
+	uint32_t				used;
+	uint32_t				high;
+
+	used = atomic_fetch_add(&slab_in_use[n], 1) + 1;
+	do
+	{
+		high = atomic_ldrex(&slab_high_water[n]);
+		if (used <= high)
+		{
+			atomic_clrex();
+			return;
+		}
+	} while (atomic_strex(&slab_high_water[n], used));
+}
+
+
+
+void  *slab_alloc(uint32_t  size)
+{
+	const slab_class_t		*c;
+	uint32_t				n;
+	uint32_t				w;
+	uint32_t				v;
+	uint32_t				bit;
+
+	for (n=0; n<SLAB_N_CLASSES; n++)
+	{
+		if (size <= slab_classes[n].size)  break;
+	}
+	if (n == SLAB_N_CLASSES)  return  NULL;			// larger than any class
+
+	c = &slab_classes[n];
+	for (w=0; w<SLAB_WORDS(c->count); w++)
+	{
+		do
+		{
+			v = atomic_ldrex(&c->map[w]);
+			if (v == 0)								// this word is all taken
+			{
+				atomic_clrex();
+				break;
+			}
+			bit = 31 - __builtin_clz(v);
+		} while (atomic_strex(&c->map[w], v & ~(1u << bit)));
+
+		if (v)
+		{
+			atomic_barrier();
+			slab_account(n);
+			return  c->base + (w * 32 + bit) * c->size;
+		}
+	}
+
+	atomic_fetch_add(&slab_failures[n], 1);
+	return  NULL;
+}
+
+
+
+void  slab_free(void  *p)
+{
+	const slab_class_t		*c;
+	uint32_t				n;
+	uint32_t				i;
+
+	if (p == NULL)  return;
+
+	for (n=0; n<SLAB_N_CLASSES; n++)
+	{
+		c = &slab_classes[n];
+		if ((uint8_t *) p >= c->base && (uint8_t *) p < c->base + c->size * c->count)
+		{
+			i = ((uint8_t *) p - c->base) / c->size;
+			atomic_fetch_add(&slab_in_use[n], (uint32_t) -1);
+			atomic_fetch_or(&c->map[i / 32], 1u << (i % 32));
+			return;
+		}
+	}
+	// not one of ours; silently ignored like other errors in this library
+}
+
+
+
+int32_t  slab_stats(uint32_t  n, slab_stats_t  *stats)
+{
+	if (n >= SLAB_N_CLASSES)  return  -1;
+
+	stats->size = slab_classes[n].size;
+	stats->count = slab_classes[n].count;
+	stats->in_use = slab_in_use[n];
+	stats->high_water = slab_high_water[n];
+	stats->failures = slab_failures[n];
+	return  0;
+}
@@ -0,0 +1,315 @@
+/*
+ * File:        telem.c
+ * Purpose:     Framed, CRC-checked binary telemetry over any byte transport
+ *
+ * Notes:
+ *  See telem.h. A frame is built plain, CRC'd, then COBS encoded into a
+ *  second buffer so the transport gets the whole frame in one write. The
+ *  receiver collects wire bytes up to a zero and decodes them in place.
+ *
+ *  On the target the CRC comes from the K20 CRC module, which is shared:
+ *  only one context (main loop or one interrupt) may send or receive at a
+ *  time. The host has a table-driven CRC giving the same results.
+ */
+
+#include "telem.h"
+
+#if defined(__arm__)
+#include "common.h"
+#endif
+
+#define  TELEM_POLY				0x04c11db7
+#define  TELEM_POLY_REFLECTED	0xedb88320
+
+
+
+#if defined(__arm__)
+
+/*
+ *  The CRC module shifts a write in from bit 31 down, so a little-endian
+ *  32-bit write would go in byte 3 first.  Transposing bits and bytes on
+ *  write (TOT = 2, the Kinetis SDK setting for reflected input) reverses
+ *  the whole word, so byte 0 goes in first with its bits reflected; the
+ *  result is transposed the same way on read (TOTR = 2) and inverted
+ *  (FXOR).  Unaligned ends go in a byte at a time.
+ */
+uint32_t  telem_crc32(const uint8_t  *p, uint32_t  n)
+{
+	CRC_CTRL = CRC_CTRL_TCRC_MASK | CRC_CTRL_TOT(2) | CRC_CTRL_TOTR(2) | CRC_CTRL_FXOR_MASK;
+	CRC_GPOLY = TELEM_POLY;
+	CRC_CTRL |= CRC_CTRL_WAS_MASK;			// next write is the seed
+	CRC_CRC = 0xffffffff;
+	CRC_CTRL &= ~CRC_CTRL_WAS_MASK;
+
+	while (n && ((uint32_t) p & 3))
+	{
+		CRC_CRCLL = *p++;
+		n--;
+	}
+	while (n >= 4)
+	{
+		CRC_CRC = *(const uint32_t *) p;
+		p += 4;
+		n -= 4;
+	}
+	while (n--)  CRC_CRCLL = *p++;
+	return  CRC_CRC;
+}
+
+#else
+
+uint32_t  telem_crc32(const uint8_t  *p, uint32_t  n)
+{
+	static uint32_t			table[256];
+	uint32_t				crc;
+	uint32_t				i;
+	uint32_t				b;
+
+	if (table[1] == 0)
+	{
+		for (i=0; i<256; i++)
+		{
+			crc = i;
+			for (b=0; b<8; b++)  crc = (crc >> 1) ^ (TELEM_POLY_REFLECTED & -(crc & 1));
+			table[i] = crc;
+		}
+	}
+
+	crc = 0xffffffff;
+	while (n--)  crc = (crc >> 8) ^ table[(crc ^ *p++) & 0xff];
+	return  ~crc;
+}
+
+#endif
+
+
+
+/*
+ *  telem_cobs      COBS encodes n bytes from in into out and adds the zero
+ *  that ends the frame; returns the bytes written, at most n + n/254 + 2
+ */
+static uint32_t  telem_cobs(const uint8_t  *in, uint32_t  n, uint8_t  *out)
+{
+	uint32_t				code = 0;			// where the current block's length goes
+	uint32_t				w = 1;
+	uint32_t				i;
+
+	for (i=0; i<n; i++)
+	{
+		if (in[i])
+		{
+			out[w++] = in[i];
+			if (w - code < 0xff)  continue;
+		}
+		out[code] = w - code;				// zero, or a full 254-byte block
+		code = w++;
+	}
+	out[code] = w - code;
+	out[w++] = 0;
+	return  w;
+}
+
+
+
+/*
+ *  telem_uncobs      decodes n COBS bytes (without the ending zero) in place;
+ *  returns the decoded length, or -1 if the bytes are not valid COBS
+ */
+static int32_t  telem_uncobs(uint8_t  *buf, uint32_t  n)
+{
+	uint32_t				r = 0;
+	uint32_t				w = 0;
+	uint32_t				code;
+	uint32_t				i;
+
+	while (r < n)
+	{
+		code = buf[r++];
+		if (r - 1 + code > n)  return  -1;
+		for (i=1; i<code; i++)  buf[w++] = buf[r++];
+		if ((code < 0xff) && (r < n))  buf[w++] = 0;	// a full block has no zero after it
+	}
+	return  w;
+}
+
+
+
+void  telem_tx_init(telem_tx_t  *tx, telem_write_t  write)
+{
+#if defined(__arm__)
+	SIM_SCGC6 |= SIM_SCGC6_CRC_MASK;
+#endif
+	tx->write = write;
+	tx->seq = 0;
+	tx->len = 0;
+	tx->stats.frames = 0;
+	tx->stats.records = 0;
+	tx->stats.bytes = 0;
+}
+
+
+
+uint8_t  *telem_record(telem_tx_t  *tx, uint8_t  type, uint32_t  len)
+{
+	uint8_t					*p;
+
+	if (len > TELEM_MAX_RECORD)  return  0;
+	if (tx->len + 2 + len > TELEM_PAYLOAD)  telem_flush(tx);
+
+	p = tx->frame + 2 + tx->len;
+	p[0] = type;
+	p[1] = len;
+	tx->len += 2 + len;
+	tx->stats.records++;
+	return  p + 2;
+}
+
+
+
+int32_t  telem_put(telem_tx_t  *tx, uint8_t  type, const void  *data, uint32_t  len)
+{
+	uint8_t					*p;
+	uint32_t				i;
+
+	p = telem_record(tx, type, len);
+	if (p == 0)  return  -1;
+	for (i=0; i<len; i++)  p[i] = ((const uint8_t *) data)[i];
+	return  0;
+}
+
+
+
+int32_t  telem_flush(telem_tx_t  *tx)
+{
+	uint32_t				n;
+
+	if (tx->len == 0)  return  0;
+
+	n = 2 + tx->len;
+	telem_le16(tx->frame, tx->seq);
+	telem_le32(tx->frame + n, telem_crc32(tx->frame, n));
+	n = telem_cobs(tx->frame, n + 4, tx->wire);
+
+	tx->seq++;
+	tx->len = 0;
+	tx->stats.frames++;
+	tx->stats.bytes += n;
+	return  tx->write((const char *) tx->wire, n);
+}
+
+
+
+void  telem_tx_stats(telem_tx_t  *tx, telem_tx_stats_t  *stats)
+{
+	*stats = tx->stats;
+	tx->stats.frames = 0;
+	tx->stats.records = 0;
+	tx->stats.bytes = 0;
+}
+
+
+
+void  telem_rx_init(telem_rx_t  *rx, telem_record_t  record, void  *ctx)
+{
+#if defined(__arm__)
+	SIM_SCGC6 |= SIM_SCGC6_CRC_MASK;
+#endif
+	rx->record = record;
+	rx->ctx = ctx;
+	rx->len = 0;
+	rx->seq = 0;
+	rx->synced = 0;
+	rx->skip = 0;							// a partial first frame just counts as bad
+	rx->stats.frames = 0;
+	rx->stats.records = 0;
+	rx->stats.lost = 0;
+	rx->stats.crc = 0;
+	rx->stats.bad = 0;
+}
+
+
+
+/*
+ *  telem_rx_frame      checks and hands on the records of one frame of n
+ *  wire bytes
+ */
+static void  telem_rx_frame(telem_rx_t  *rx, uint32_t  n)
+{
+	uint8_t					*f = rx->wire;
+	int32_t					len;
+	uint32_t				i;
+	uint16_t				seq;
+
+	len = telem_uncobs(f, n);
+	if (len < 2 + 4)
+	{
+		rx->stats.bad++;
+		return;
+	}
+	len -= 4;
+	if (telem_crc32(f, len) != telem_get32(f + len))
+	{
+		rx->stats.crc++;
+		return;
+	}
+
+	for (i=2; i + 2 <= (uint32_t) len; i += 2 + f[i + 1]);
+	if (i != (uint32_t) len)				// records overrun the frame
+	{
+		rx->stats.bad++;
+		return;
+	}
+
+	seq = telem_get16(f);
+	if (rx->synced)  rx->stats.lost += (uint16_t) (seq - rx->seq);
+	rx->seq = seq + 1;
+	rx->synced = 1;
+	rx->stats.frames++;
+
+	for (i=2; i<(uint32_t) len; i += 2 + f[i + 1])
+	{
+		rx->stats.records++;
+		if (rx->record)  rx->record(rx->ctx, f[i], f + i + 2, f[i + 1]);
+	}
+}
+
+
+
+void  telem_rx_put(telem_rx_t  *rx, const uint8_t  *data, uint32_t  n)
+{
+	uint32_t				i;
+
+	for (i=0; i<n; i++)
+	{
+		if (data[i] == 0)
+		{
+			if (!rx->skip && rx->len)  telem_rx_frame(rx, rx->len);
+			rx->len = 0;
+			rx->skip = 0;
+		}
+		else if (!rx->skip)
+		{
+			if (rx->len == TELEM_WIRE)		// longer than any frame
+			{
+				rx->stats.bad++;
+				rx->skip = 1;
+			}
+			else
+			{
+				rx->wire[rx->len++] = data[i];
+			}
+		}
+	}
+}
+
+
+
+void  telem_rx_stats(telem_rx_t  *rx, telem_rx_stats_t  *stats)
+{
+	*stats = rx->stats;
+	rx->stats.frames = 0;
+	rx->stats.records = 0;
+	rx->stats.lost = 0;
+	rx->stats.crc = 0;
+	rx->stats.bad = 0;
+}
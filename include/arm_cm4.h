@@ -35,8 +35,28 @@ void set_irq_priority (int, int);
 
   /*!< Macro to disable all interrupts. */
 #define DisableInterrupts asm(" CPSID i");
+
+  /*!< Nonzero with interrupts disabled or from an exception handler, where
+   *   waiting on an interrupt may never end. */
+#define InterruptsBlocked() ({ uint32_t _primask, _ipsr; \
+  asm volatile (" MRS %0, PRIMASK" : "=r" (_primask)); \
+  asm volatile (" MRS %0, IPSR" : "=r" (_ipsr)); \
+  _primask || _ipsr; })
+
+  /*!< Nonzero with interrupts disabled (PRIMASK set), for code that masks
+   *   them and must put them back as it found them. */
+#define InterruptsDisabled() ({ uint32_t _primask; \
+  asm volatile (" MRS %0, PRIMASK" : "=r" (_primask)); \
+  _primask & 1; })
 /***********************************************************************/
 
+/*
+ * DWT cycle counter enables, missing from mk20d7.h
+ * (ARMv7-M ARM C1.6.5, C1.8.7)
+ */
+#define DEMCR_TRCENA_MASK       (1 << 24)
+#define DWT_CTRL_CYCCNTENA_MASK (1 << 0)
+
 
 /*
  * Misc. Defines
@@ -0,0 +1,145 @@
+/*
+ * File:        atomic.h
+ * Purpose:     Lock-free primitives for sharing data between the main loop
+ *              and interrupt handlers on the Cortex-M4
+ *
+ * Notes:
+ *  Read-modify-write helpers use the LDREX/STREX exclusive monitor, which
+ *  the core clears on every exception entry and return. If an interrupt
+ *  touches the same word between the LDREX and the STREX, the STREX fails
+ *  and the update is retried, so interrupts never need to be masked.
+ *
+ *  The acquire/release helpers order plain loads and stores with a DMB.
+ *  This is what a single-producer/single-consumer ring needs: the producer
+ *  writes a slot and then releases the new head; the consumer acquires the
+ *  head before it reads the slot. On a single M4 the barrier mostly keeps
+ *  the compiler from reordering, but it also covers DMA masters reading the
+ *  same memory.
+ */
+
+#ifndef _ATOMIC_H_
+#define _ATOMIC_H_
+
+#include  <stdint.h>
+
+#if defined(__arm__)
+
+#define atomic_barrier()  asm volatile (" DMB" : : : "memory")
+
+/* abandons an LDREX without storing */
+#define atomic_clrex()    asm volatile (" CLREX" : : : "memory")
+
+static inline uint32_t atomic_load_acquire(const volatile uint32_t *p)
+{
+	uint32_t	v = *p;
+
+	atomic_barrier();
+	return v;
+}
+
+static inline void atomic_store_release(volatile uint32_t *p, uint32_t v)
+{
+	atomic_barrier();
+	*p = v;
+}
+
+static inline uint32_t atomic_ldrex(volatile uint32_t *p)
+{
+	uint32_t	v;
+
+	asm volatile (" LDREX %0, [%1]" : "=r" (v) : "r" (p) : "memory");
+	return v;
+}
+
+/* returns zero if the store happened */
+static inline uint32_t atomic_strex(volatile uint32_t *p, uint32_t v)
+{
+	uint32_t	failed;
+
+	asm volatile (" STREX %0, %2, [%1]" : "=&r" (failed) : "r" (p), "r" (v) : "memory");
+	return failed;
+}
+
+#else
+
+/*
+ *  Host builds (the tools/ benches and simulators) get the same interface
+ *  from the compiler's atomics.  The exclusive pair becomes a compare and
+ *  swap against the value LDREX saw, which fails the same way when another
+ *  thread changed the word in between.
+ */
+#define atomic_barrier()  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#define atomic_clrex()    do { } while (0)
+
+static __thread uint32_t	atomic_ldrex_value;
+
+static inline uint32_t atomic_load_acquire(const volatile uint32_t *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void atomic_store_release(volatile uint32_t *p, uint32_t v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t atomic_ldrex(volatile uint32_t *p)
+{
+	atomic_ldrex_value = __atomic_load_n(p, __ATOMIC_RELAXED);
+	return atomic_ldrex_value;
+}
+
+/* returns zero if the store happened */
+static inline uint32_t atomic_strex(volatile uint32_t *p, uint32_t v)
+{
+	uint32_t	expected = atomic_ldrex_value;
+
+	return !__atomic_compare_exchange_n(p, &expected, v, 0,
+										__ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+}
+
+#endif
+
+/* adds n to *p and returns the previous value */
+static inline uint32_t atomic_fetch_add(volatile uint32_t *p, uint32_t n)
+{
+	uint32_t	v;
+
+	do
+	{
+		v = atomic_ldrex(p);
+	} while (atomic_strex(p, v + n));
+	atomic_barrier();
+	return v;
+}
+
+/* sets the bits of m in *p and returns the previous value */
+static inline uint32_t atomic_fetch_or(volatile uint32_t *p, uint32_t m)
+{
+	uint32_t	v;
+
+	do
+	{
+		v = atomic_ldrex(p);
+	} while (atomic_strex(p, v | m));
+	atomic_barrier();
+	return v;
+}
+
+/* stores v if *p still holds expected; returns nonzero on success */
+static inline uint32_t atomic_cas(volatile uint32_t *p, uint32_t expected, uint32_t v)
+{
+	do
+	{
+		if (atomic_ldrex(p) != expected)
+		{
+			atomic_clrex();
+			return 0;
+		}
+	} while (atomic_strex(p, v));
+	atomic_barrier();
+	return 1;
+}
+
+#endif /* _ATOMIC_H_ */
@@ -0,0 +1,84 @@
+/*
+ * File:        dlog.h
+ * Purpose:     Deferred binary logging: the device logs IDs and argument
+ *              words, the host turns them back into text
+ *
+ * Notes:
+ *  DLOG("adc: overrun on channel %u", channel) puts its format string in
+ *  the .dlog section, which the linker script marks INFO: it is kept in
+ *  the .elf but never loaded into flash. The string's address in that
+ *  section is its ID. At run time the call only stores a header word and
+ *  one word per argument in a RAM ring, which takes a few dozen cycles and
+ *  never formats anything, so it is fine in interrupt handlers.
+ *
+ *  Each record in the ring is
+ *
+ *    id | nargs << 16, then nargs argument words
+ *
+ *  Arguments are converted to uint32_t, so any integer or char works;
+ *  pointers need a cast, and %s cannot be used, since the host only sees
+ *  the pointer. At most DLOG_MAX_ARGS arguments.
+ *
+ *  dlog_drain() moves the ring into telem.h records of type DLOG_RECORD,
+ *  records whole, and tools/dlog prints them from the .elf built by
+ *  mk/makefile.inc. A record with ID 0 holds the count of records dropped
+ *  because the ring was full.
+ *
+ *  The ring is lock-free: writers reserve space with LDREX/STREX, and the
+ *  writer that reserved first publishes everything written once it is
+ *  done, so interrupts may log over the main loop (and each other) without
+ *  masking. There must be only one reader.
+ */
+
+#ifndef _DLOG_H_
+#define _DLOG_H_
+
+#include  <stdint.h>
+#include  "telem.h"
+
+#ifndef  DLOG_RING_WORDS
+#define  DLOG_RING_WORDS		512			// must be a power of two
+#endif
+
+#define  DLOG_MAX_ARGS			15
+#define  DLOG_RECORD			0xd1		// telem.h record type
+
+#define  DLOG_ID_MASK			0xffff
+#define  DLOG_NARGS_SHIFT		16
+#define  DLOG_NARGS_MASK		0x0f
+
+
+#define  DLOG(fmt, ...) \
+	do \
+	{ \
+		static const char  dlog_fmt_[] __attribute__ ((section (".dlog"))) = fmt; \
+		const uint32_t  dlog_args_[] = {0, ##__VA_ARGS__}; \
+		_Static_assert(sizeof(dlog_args_) / 4 - 1 <= DLOG_MAX_ARGS, "too many DLOG arguments"); \
+		dlog_write((uint32_t) dlog_fmt_, dlog_args_ + 1, sizeof(dlog_args_) / 4 - 1); \
+	} while (0)
+
+typedef struct
+{
+	uint32_t		records;		/* logged since the last call */
+	uint32_t		dropped;		/* lost to a full ring */
+	uint32_t		high_water;		/* most words ever waiting */
+} dlog_stats_t;
+
+/*
+ *  dlog_write      the work behind DLOG(); stores a record of id and n
+ *  words from args, or counts it dropped if the ring is full
+ */
+void			dlog_write(uint32_t  id, const uint32_t  *args, uint32_t  n);
+
+/*
+ *  dlog_drain      moves every record waiting into DLOG_RECORD records
+ *  batched on tx, without flushing; returns the words moved
+ */
+uint32_t		dlog_drain(telem_tx_t  *tx);
+
+/*
+ *  dlog_stats      copy out and clear the counts
+ */
+void			dlog_stats(dlog_stats_t  *stats);
+
+#endif /* _DLOG_H_ */
@@ -0,0 +1,59 @@
+/*
+ * File:        fir.h
+ * Purpose:     Q15 FIR filter and decimator for sample blocks
+ *
+ * Notes:
+ *  Filters a block of 16-bit samples and keeps every Nth output, writing
+ *  the results over the front of the same block. Filter history and the
+ *  decimation phase carry over from one block to the next, so a stream
+ *  split into blocks of any length gives the same output as one long block.
+ *
+ *  Each output is the sum of coefficient * sample products in a 32-bit
+ *  accumulator (wrapping, as SMLAD does), rounded, shifted down by 15 and
+ *  saturated to 16 bits. Coefficients are Q15, so a unity-gain filter has
+ *  coefficients summing to 32768.
+ *
+ *  fir_decimate() uses the Cortex-M4 dual 16-bit MAC (SMLAD) and SSAT when
+ *  built for a core that has them; fir_decimate_ref() is plain C. The two
+ *  give bit-identical results, and on any other target (a host build) both
+ *  are plain C, unless built with FIR_EMULATE_DSP: then fir_decimate() runs
+ *  the SMLAD/SSAT path on C models of the two instructions (tools/fir).
+ */
+
+#ifndef _FIR_H_
+#define _FIR_H_
+
+#include  <stdint.h>
+
+#define  FIR_MAX_TAPS			32
+#define  FIR_CHUNK				64			/* samples copied into the delay line at a time */
+
+typedef struct
+{
+	int16_t			coeffs[FIR_MAX_TAPS];	/* reversed, zero-padded to an even count */
+	uint8_t			taps;					/* even */
+	uint8_t			decimate;
+	uint8_t			phase;					/* inputs to skip before the next output */
+	int16_t			state[FIR_MAX_TAPS - 1 + FIR_CHUNK];
+} fir_t;
+
+/*
+ *  fir_init      sets up a filter from taps Q15 coefficients (in the usual
+ *  order, h[0] applied to the newest sample) keeping every decimate'th
+ *  output; clears the history. Returns 0, or -1 if taps or decimate is out
+ *  of range.
+ */
+int32_t			fir_init(fir_t  *fir, const int16_t  *coeffs, uint32_t  taps, uint32_t  decimate);
+
+/*
+ *  fir_decimate      filters length samples of buf in place; returns the
+ *  number of outputs now at the front of buf
+ */
+uint32_t		fir_decimate(fir_t  *fir, int16_t  *buf, uint32_t  length);
+
+/*
+ *  fir_decimate_ref      the same in portable C, for checking fir_decimate
+ */
+uint32_t		fir_decimate_ref(fir_t  *fir, int16_t  *buf, uint32_t  length);
+
+#endif /* _FIR_H_ */
@@ -0,0 +1,51 @@
+/*
+ * File:        rice.h
+ * Purpose:     Lossless block codec for 16-bit sample streams
+ *
+ * Notes:
+ *  Each sample is replaced by its difference from the one before (modulo
+ *  2^16), zigzag mapped so small differences of either sign become small
+ *  numbers, and Rice coded with one parameter k for the whole block. A
+ *  block that would not come out smaller is stored raw instead, so a block
+ *  never grows by more than its one-word header.
+ *
+ *  Blocks are arrays of 16-bit words (little-endian on the wire):
+ *
+ *    raw:    n, then the n samples
+ *    coded:  0x8000 | k << 11 | n, the first sample, then the Rice bits of
+ *            the other n - 1 differences, least significant bit first,
+ *            padded to a whole word
+ *
+ *  n is at most RICE_MAX_SAMPLES. A Rice code is q = u >> k zero bits, a one
+ *  bit, then the low k bits of u. A quotient of RICE_ESCAPE or more is sent
+ *  as RICE_ESCAPE zero bits and the 16 bits of u.
+ *
+ *  The same source builds for the target and the host, so the host side
+ *  decodes with exactly the code the device encodes with.
+ */
+
+#ifndef _RICE_H_
+#define _RICE_H_
+
+#include  <stdint.h>
+
+#define  RICE_MAX_SAMPLES		2047
+#define  RICE_ESCAPE			16
+
+#define  RICE_CODED				0x8000
+
+/*
+ *  rice_encode      codes n samples from in into out, which has room for
+ *  capacity words and must not overlap in; returns the words written, or 0
+ *  if n is too large or capacity is below n + 1
+ */
+uint32_t		rice_encode(const uint16_t  *in, uint32_t  n, uint16_t  *out, uint32_t  capacity);
+
+/*
+ *  rice_decode      decodes the block of words words at in into out, which
+ *  has room for capacity samples; returns the number of samples, or -1 if
+ *  the block is malformed or does not fit
+ */
+int32_t			rice_decode(const uint16_t  *in, uint32_t  words, uint16_t  *out, uint32_t  capacity);
+
+#endif /* _RICE_H_ */
@@ -0,0 +1,64 @@
+/*
+ * File:        slab.h
+ * Purpose:     Fixed-size block allocator with build-time size classes
+ *
+ * Notes:
+ *  All memory is static. Each project lists its size classes in
+ *  slab_config.h (found on the project's include path) as an X-macro:
+ *
+ *    #define SLAB_CLASSES(X) \
+ *      X(64, 16)      64-byte blocks, 16 of them
+ *      X(512, 4)
+ *      X(2048, 16)
+ *
+ *  in increasing size. slab_alloc() takes a block from the smallest class
+ *  that fits the request; it never falls back to a larger class, so one
+ *  user running out cannot starve another.
+ *
+ *  Free blocks are tracked in one bitmap per class and found with CLZ, so
+ *  allocate and free are O(1) in the block count. Bitmaps and counters are
+ *  updated with LDREX/STREX, so every call is safe from interrupt handlers
+ *  and never masks interrupts.
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include  <stdint.h>
+#include  "slab_config.h"
+
+#define  SLAB_CLASS_ID(size, count)		+ 1
+#define  SLAB_N_CLASSES					(0 SLAB_CLASSES(SLAB_CLASS_ID))
+
+typedef struct
+{
+	uint32_t		size;			/* bytes per block */
+	uint32_t		count;			/* blocks in the class */
+	uint32_t		in_use;			/* blocks allocated now */
+	uint32_t		high_water;		/* most blocks ever allocated at once */
+	uint32_t		failures;		/* requests that found the class empty */
+} slab_stats_t;
+
+/*
+ *  slab_init      marks every block free; call once before any allocation
+ */
+void			slab_init(void);
+
+/*
+ *  slab_alloc      returns a block of at least size bytes, 4-byte aligned,
+ *  or NULL if the class that fits is exhausted or size is too large
+ */
+void			*slab_alloc(uint32_t  size);
+
+/*
+ *  slab_free      returns a block to its class; NULL is ignored
+ */
+void			slab_free(void  *p);
+
+/*
+ *  slab_stats      fills stats for size class n (0 is the smallest);
+ *  returns 0, or -1 if there is no such class
+ */
+int32_t			slab_stats(uint32_t  n, slab_stats_t  *stats);
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,166 @@
+/*
+ * File:        telem.h
+ * Purpose:     Framed, CRC-checked binary telemetry over any byte transport
+ *
+ * Notes:
+ *  Small typed records are batched into frames. A frame is
+ *
+ *    seq (2 bytes), records, CRC-32 (4 bytes)
+ *
+ *  all little-endian, and each record is
+ *
+ *    type (1 byte), len (1 byte), len bytes of data
+ *
+ *  seq counts frames from each sender, so the receiver sees a gap for every
+ *  frame lost. The CRC is the usual CRC-32 (polynomial 0x04c11db7,
+ *  reflected, as zlib and Ethernet) over seq and the records; the firmware
+ *  computes it with the K20 CRC module.
+ *
+ *  On the wire a frame is COBS encoded, which removes every zero byte for
+ *  one byte of overhead per 254, and ends with a zero byte. A receiver can
+ *  join the stream anywhere and is back in step at the next zero.
+ *
+ *  Frames go out through a function with the signature of UARTWrite() and
+ *  usb_cdc_write(), so either (or anything else that takes bytes) can
+ *  carry them. The receiver takes bytes in whatever pieces they arrive.
+ *
+ *  The same source builds for the target and the host, so the host side
+ *  decodes with exactly the code the device encodes with.
+ */
+
+#ifndef _TELEM_H_
+#define _TELEM_H_
+
+#include  <stdint.h>
+
+#define  TELEM_PAYLOAD			250			// record bytes per frame
+#define  TELEM_MAX_RECORD		(TELEM_PAYLOAD - 2)
+#define  TELEM_FRAME			(2 + TELEM_PAYLOAD + 4)
+#define  TELEM_WIRE				(TELEM_FRAME + 2 + 1)	// COBS overhead and the zero
+
+typedef int32_t  (*telem_write_t)(const char  *ptr, int32_t  len);
+
+typedef void  (*telem_record_t)(void  *ctx, uint8_t  type, const uint8_t  *data, uint32_t  len);
+
+typedef struct
+{
+	uint32_t			frames;
+	uint32_t			records;
+	uint32_t			bytes;				// on the wire
+}  telem_tx_stats_t;
+
+typedef struct
+{
+	telem_write_t		write;
+	uint16_t			seq;
+	uint16_t			len;				// record bytes in the frame so far
+	uint8_t				frame[TELEM_FRAME];
+	uint8_t				wire[TELEM_WIRE];
+	telem_tx_stats_t	stats;
+}  telem_tx_t;
+
+typedef struct
+{
+	uint32_t			frames;				// good frames
+	uint32_t			records;
+	uint32_t			lost;				// frames missing from the sequence
+	uint32_t			crc;				// frames failing the CRC
+	uint32_t			bad;				// frames too long, short or malformed
+}  telem_rx_stats_t;
+
+typedef struct
+{
+	telem_record_t		record;
+	void				*ctx;
+	uint16_t			len;				// wire bytes of the frame so far
+	uint16_t			seq;				// expected next
+	uint8_t				synced;				// a good frame has been seen
+	uint8_t				skip;				// discarding to the next zero
+	uint8_t				wire[TELEM_WIRE];
+	telem_rx_stats_t	stats;
+}  telem_rx_t;
+
+
+/*
+ *  telem_le16, telem_le32      store a value little-endian, for building
+ *  record data
+ */
+static inline void  telem_le16(uint8_t  *p, uint16_t  v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void  telem_le32(uint8_t  *p, uint32_t  v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/*
+ *  telem_get16, telem_get32      load a little-endian value from record data
+ */
+static inline uint16_t  telem_get16(const uint8_t  *p)
+{
+	return  p[0] | (p[1] << 8);
+}
+
+static inline uint32_t  telem_get32(const uint8_t  *p)
+{
+	return  p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+
+/*
+ *  telem_crc32      CRC-32 of n bytes at p
+ */
+uint32_t		telem_crc32(const uint8_t  *p, uint32_t  n);
+
+/*
+ *  telem_tx_init      start a sender writing frames with write, seq from 0
+ */
+void			telem_tx_init(telem_tx_t  *tx, telem_write_t  write);
+
+/*
+ *  telem_record      make room for a record of len bytes in the frame being
+ *  batched, sending the frame first if it would not fit; returns where the
+ *  caller puts the len bytes of data, or 0 if len is over TELEM_MAX_RECORD
+ */
+uint8_t			*telem_record(telem_tx_t  *tx, uint8_t  type, uint32_t  len);
+
+/*
+ *  telem_put      telem_record() and copy in len bytes from data; returns 0,
+ *  or -1 if len is over TELEM_MAX_RECORD
+ */
+int32_t			telem_put(telem_tx_t  *tx, uint8_t  type, const void  *data, uint32_t  len);
+
+/*
+ *  telem_flush      send the records batched so far as one frame; returns
+ *  what the write function did, or 0 if there was nothing to send
+ */
+int32_t			telem_flush(telem_tx_t  *tx);
+
+/*
+ *  telem_tx_stats      copy out and clear a sender's counts
+ */
+void			telem_tx_stats(telem_tx_t  *tx, telem_tx_stats_t  *stats);
+
+/*
+ *  telem_rx_init      start a receiver calling record, with ctx, for every
+ *  record of every good frame
+ */
+void			telem_rx_init(telem_rx_t  *rx, telem_record_t  record, void  *ctx);
+
+/*
+ *  telem_rx_put      feed n bytes from the transport to a receiver
+ */
+void			telem_rx_put(telem_rx_t  *rx, const uint8_t  *data, uint32_t  n);
+
+/*
+ *  telem_rx_stats      copy out and clear a receiver's counts
+ */
+void			telem_rx_stats(telem_rx_t  *rx, telem_rx_stats_t  *stats);
+
+#endif /* _TELEM_H_ */
@@ -12,21 +12,87 @@
 #ifndef __UART_H__
 #define __UART_H__
 
+#define  UART_WRITE_BLOCK		0
+#define  UART_WRITE_DROP		1
+#define  UART_NO_DMA			0xff
+
+typedef struct uart_s  uart_t;
+
+typedef struct
+{
+	uint32_t			txchars;
+	uint32_t			rxchars;
+	uint32_t			irqs;
+	uint32_t			irqcycles;		// DWT cycles in the interrupt handler
+	uint32_t			overruns;		// interrupts that saw OR set
+	uint32_t			framing;		// ...FE
+	uint32_t			noise;			// ...NF
+	uint32_t			dropped;		// received chars lost to a full queue
+}  UART_STATS;
+
 
 /*
- *  These routines support access to all UARTs on the Teensy 3.x (K20).
- *  To use a UART, first call UARTInit() with the UART number (0-2) and
- *  a desired baud rate; this call marks the selected UART as active.
- *  You can then call UARTWrite() to send chars to the active UART.  Use
- *  UARTAvail() to check for received chars.  Use UARTRead() to read
- *  chars (with blocking) from the active UART.
+ *  Each UART (0-4; UART3 and UART4 only on the 100-pin K20) is a uart_t
+ *  with its own queues, DMA and stats, returned by uart_open(), and any
+ *  number of them can run at once.
+ *
+ *  Writes are queued and sent from the UART interrupt; uart_flush() waits
+ *  until they are out.  When the queue is full, uart_write() waits for
+ *  room (UART_WRITE_BLOCK) or drops the rest (UART_WRITE_DROP, for
+ *  interrupt handlers) as set by uart_set_write_mode().  Chars are queued
+ *  UART_XMT_CHUNK (16) at a time with interrupts masked, so the main loop
+ *  and interrupt handlers may share a UART; one writer's chars only come
+ *  between another's at chunk boundaries.
+ *
+ *  uart_init_dma() moves a UART over to DMA: the transmit queue goes out a
+ *  stretch at a time, uart_write_dma() sends from a caller's buffer
+ *  without copying, and received chars go round a circular buffer, with
+ *  the idle line interrupt calling the uart_set_idle_callback() function
+ *  once a burst.  UART4 has one DMA request for both directions, so it
+ *  can only use DMA one way, and uart_init_dma() returns -1 if given both.
  *
- *  To use a different UART as the active UART, call UARTAssignActiveUART().
+ *  The 8-char FIFOs of UART0 and UART1 are on; each receive interrupt
+ *  drains the FIFO, and uart_set_rx_watermark() sets how full it gets
+ *  first.  uart_read_available() reads whatever is waiting, without
+ *  blocking.
+ *
+ *  Baud divisors are picked for the lowest error; uart_open() fails if
+ *  the rate is beyond clock/16 (core clock for UART0/1, bus clock for the
+ *  rest).  uart_plan_baud() and uart_get_baud() give the rate achieved
+ *  and its error in ppm.  uart_autobaud() times a 0x00 sync char sent
+ *  after a quiet line with FTM0 input capture, from 1200 baud up, and
+ *  sets the rate to match; UART1 (RXD on PC3, FTM0_CH2) only.
+ */
+uart_t			*uart_open(uint32_t  uartnum, int32_t  baud);
+uint32_t		uart_plan_baud(uint32_t  clock, uint32_t  baud, uint16_t  *sbr, uint8_t  *brfa, int32_t  *ppm);
+uint32_t		uart_set_baud(uart_t  *uart, uint32_t  baud, int32_t  *ppm);
+uint32_t		uart_get_baud(uart_t  *uart, int32_t  *ppm);
+uint32_t		uart_autobaud(uart_t  *uart, uint32_t  timeout_ms);
+int32_t			uart_write(uart_t  *uart, const char  *ptr, int32_t  len);
+uint32_t		uart_set_write_mode(uart_t  *uart, uint32_t  mode);
+void			uart_flush(uart_t  *uart);
+int32_t			uart_avail(uart_t  *uart);
+int32_t			uart_read(uart_t  *uart, char  *ptr, int32_t  len);
+int32_t			uart_read_available(uart_t  *uart, char  *ptr, int32_t  len);
+uint32_t		uart_set_rx_watermark(uart_t  *uart, uint32_t  level);
+int32_t			uart_init_dma(uart_t  *uart, uint32_t  txchan, uint32_t  rxchan, char  *rxbuf, uint32_t  rxsize);
+int32_t			uart_write_dma(uart_t  *uart, const char  *ptr, int32_t  len, void  (*done)(uart_t  *uart));
+void			uart_set_idle_callback(uart_t  *uart, void  (*idle)(uart_t  *uart, int32_t  avail));
+void			uart_get_stats(uart_t  *uart, UART_STATS  *stats);
+
+
+/*
+ *  The original calls, on the active UART.  UARTInit() opens a UART and
+ *  makes it the active one; to use a different UART as the active UART,
+ *  call UARTAssignActiveUART().
  */
 void			UARTInit(uint32_t  uartnum, int32_t  baudrate);
 uint32_t		UARTAssignActiveUART(uint32_t  uartnum);
 int32_t			UARTWrite(const char *ptr, int32_t len);
+uint32_t		UARTSetWriteMode(uint32_t  mode);
+void			UARTFlush(void);
 int32_t			UARTAvail(void);
+int32_t			UARTReadAvailable(char *ptr, int32_t len);
 int32_t			UARTRead(char *ptr, int32_t len);
 
 
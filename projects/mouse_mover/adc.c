@@ -0,0 +1,331 @@
+/**
+ * PDB-triggered, DMA-driven ADC acquisition
+ */
+#include "adc.h"
+#include "atomic.h"
+#include "common.h"
+#include "dlog.h"
+
+// software trigger input for PDB0
+#define ADC_PDB_TRGSEL_SW 15
+
+#define ADC_SCRATCH 0xff
+
+// eDMA transfer control descriptor, as laid out in the channel's registers
+typedef struct {
+  uint32_t saddr;
+  int16_t soff;
+  uint16_t attr;
+  uint32_t nbytes;
+  int32_t slast;
+  uint32_t daddr;
+  int16_t doff;
+  uint16_t citer;
+  int32_t dlastsga;
+  uint16_t csr;
+  uint16_t biter;
+} adc_tcd_t;
+
+static const ADC_MemMapPtr adc_base[2] = { ADC0_BASE_PTR, ADC1_BASE_PTR };
+static const uint8_t adc_source[2] = { ADC_DMAMUX_ADC0, ADC_DMAMUX_ADC1 };
+
+// per converter, scatter/gather descriptors must be 32-byte aligned
+static adc_tcd_t adc_tcd[2][2] __attribute__ ((aligned(32)));
+
+// buffer behind each descriptor pair; kept across captures
+static uint16_t *adc_buf[2];
+static uint8_t adc_index[2] = { ADC_SCRATCH, ADC_SCRATCH };
+static uint8_t adc_done = 0;    //descriptor pair that completes next
+static uint8_t adc_finished = 0;        //converters through it so far, a bit each
+
+// where samples go when the pool is empty
+static uint16_t adc_scratch[2];
+
+static adc_mode_t adc_mode = ADC_SINGLE;
+static uint8_t adc_converters = 1;
+static uint32_t adc_counts;
+static adc_stats_t stats;
+
+uint32_t adc_plan(uint32_t rate, uint8_t * prescaler, uint32_t * counts)
+{
+  uint32_t bus = (uint32_t) periph_clk_khz * 1000;
+  uint32_t step, n;
+  uint8_t p;
+
+  if (rate == 0 || rate > bus)
+    return 0;
+
+  //the smallest prescaler keeps the most resolution for the timebase trim
+  for (p = 0; p < 8; p++) {
+    step = rate << p;
+    n = (bus + step / 2) / step;
+    if (n <= 65536)
+      break;
+  }
+  if (p == 8)
+    return 0;
+
+  *prescaler = p;
+  *counts = n;
+  step = n << p;
+  return (bus + step / 2) / step;
+}
+
+// CFG1 clock bits giving the fastest ADCK at or below max_khz
+static uint32_t adc_clock(uint32_t max_khz)
+{
+  uint8_t div;
+
+  for (div = 0; div < 4 && ((uint32_t) periph_clk_khz >> div) > max_khz; div++);
+  if (div < 4)
+    return ADC_CFG1_ADIV(div) | ADC_CFG1_ADICLK(0);
+  return ADC_CFG1_ADIV(3) | ADC_CFG1_ADICLK(1);       //bus / 2 / 8
+}
+
+// SC3 bits for a hardware average of n conversions
+static uint32_t adc_average(uint8_t n)
+{
+  uint8_t s;
+
+  if (n < 4)
+    return 0;
+  for (s = 0; s < 3 && (4 << s) < n; s++);
+  return ADC_SC3_AVGE_MASK | ADC_SC3_AVGS(s);
+}
+
+// The CAL sequence: software triggered, slow clock, 32x averaging. Returns
+// nonzero if it failed.
+static uint8_t adc_calibrate(ADC_MemMapPtr adc)
+{
+  uint16_t sum;
+
+  ADC_CFG1_REG(adc) = adc_clock(ADC_CAL_ADCK_KHZ) | ADC_CFG1_MODE(1);
+  ADC_SC2_REG(adc) = 0;
+  ADC_SC3_REG(adc) = ADC_SC3_CAL_MASK | adc_average(32);
+  while (ADC_SC3_REG(adc) & ADC_SC3_CAL_MASK);
+  if (ADC_SC3_REG(adc) & ADC_SC3_CALF_MASK)
+    return 1;
+
+  sum = ADC_CLPS_REG(adc) + ADC_CLP4_REG(adc) + ADC_CLP3_REG(adc)
+      + ADC_CLP2_REG(adc) + ADC_CLP1_REG(adc) + ADC_CLP0_REG(adc);
+  ADC_PG_REG(adc) = (sum / 2) | 0x8000;
+  sum = ADC_CLMS_REG(adc) + ADC_CLM4_REG(adc) + ADC_CLM3_REG(adc)
+      + ADC_CLM2_REG(adc) + ADC_CLM1_REG(adc) + ADC_CLM0_REG(adc);
+  ADC_MG_REG(adc) = (sum / 2) | 0x8000;
+  return 0;
+}
+
+// 12-bit single-ended, hardware triggered from the PDB (SIM_SOPT7 default),
+// one DMA request per result. Returns nonzero if calibration failed.
+static uint8_t adc_setup(ADC_MemMapPtr adc, uint8_t channel,
+                         const adc_config_t * config)
+{
+  if (config->calibrate && adc_calibrate(adc))
+    return 1;
+
+  ADC_CFG1_REG(adc) = adc_clock(ADC_MAX_ADCK_KHZ) | ADC_CFG1_MODE(1);
+  ADC_CFG2_REG(adc) = ADC_CFG2_ADHSC_MASK;
+  ADC_SC2_REG(adc) = ADC_SC2_ADTRG_MASK | ADC_SC2_DMAEN_MASK;
+  ADC_SC3_REG(adc) = adc_average(config->average);
+  ADC_SC1_REG(adc, 0) = ADC_SC1_ADCH(channel);
+  return 0;
+}
+
+// Points descriptor pair n at its buffer, taking the next free one if it has
+// none, or at the scratch words if the pool is empty
+static void adc_fill(uint8_t n)
+{
+  adc_tcd_t *tcd;
+  uint8_t c;
+
+  if (adc_index[n] == ADC_SCRATCH) {
+    adc_buf[n] = buffers_get_next_free(&adc_index[n]);
+    if (!adc_buf[n])
+      adc_index[n] = ADC_SCRATCH;
+  }
+
+  //each converter writes every adc_converters'th halfword
+  for (c = 0; c < adc_converters; c++) {
+    tcd = &adc_tcd[c][n];
+    if (adc_buf[n]) {
+      tcd->daddr = (uint32_t) (adc_buf[n] + c);
+      tcd->doff = adc_converters * sizeof(uint16_t);
+    } else {
+      tcd->daddr = (uint32_t) & adc_scratch[c];
+      tcd->doff = 0;
+    }
+    tcd->dlastsga = (int32_t) & adc_tcd[c][n ^ 1];
+  }
+
+  //the engine reads the descriptors, not the core
+  atomic_barrier();
+}
+
+// Every converter's channel interrupts. Which one stores its last result of
+// a buffer first depends on the mode (ADC1 converts later when interleaved,
+// but its channel wins arbitration when paired), so adc_complete() waits
+// for both.
+static void adc_tcd_init(uint8_t c, uint8_t n)
+{
+  adc_tcd_t *tcd = &adc_tcd[c][n];
+  uint16_t count = adc_converters == 1 ? BUFFER_LENGTH : ADC_PAIRS;
+
+  tcd->saddr = (uint32_t) & ADC_R_REG(adc_base[c], 0);
+  tcd->soff = 0;
+  tcd->attr = DMA_ATTR_SSIZE(1) | DMA_ATTR_DSIZE(1);    //16 bits each way
+  tcd->nbytes = sizeof(uint16_t);
+  tcd->slast = 0;
+  tcd->citer = count;
+  tcd->biter = count;
+  tcd->csr = DMA_CSR_ESG_MASK | DMA_CSR_INTMAJOR_MASK;
+}
+
+// Copies a descriptor into its DMA channel's registers
+static void adc_load(uint8_t c, uint8_t n)
+{
+  volatile uint32_t *hw = &DMA_SADDR_REG(DMA_BASE_PTR, ADC_DMA_CHANNEL + c);
+  uint32_t *tcd = (uint32_t *) & adc_tcd[c][n];
+  uint8_t i;
+
+  for (i = 0; i < sizeof(adc_tcd_t) / sizeof(uint32_t); i++)
+    hw[i] = tcd[i];
+}
+
+uint32_t adc_start(const adc_config_t * config)
+{
+  uint32_t achieved;
+  uint8_t prescaler;
+  uint8_t c, n;
+
+  achieved = adc_plan(config->rate, &prescaler, &adc_counts);
+  if (!achieved)
+    return 0;
+
+  SIM_SCGC3 |= SIM_SCGC3_ADC1_MASK;
+  SIM_SCGC6 |= SIM_SCGC6_PDB_MASK | SIM_SCGC6_DMAMUX_MASK | SIM_SCGC6_ADC0_MASK;
+  SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
+  adc_stop();
+
+  adc_mode = config->mode;
+  adc_converters = adc_mode == ADC_SINGLE ? 1 : 2;
+  for (c = 0; c < adc_converters; c++)
+    if (adc_setup(adc_base[c], config->channel[c], config))
+      return 0;
+
+  //resume with the descriptor pair that was due to complete, so buffers
+  //held from the last capture are still set ready in order
+  for (c = 0; c < adc_converters; c++)
+    for (n = 0; n < 2; n++)
+      adc_tcd_init(c, n);
+  adc_fill(adc_done);
+  adc_fill(adc_done ^ 1);
+  for (c = 0; c < adc_converters; c++) {
+    adc_load(c, adc_done);
+    DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, ADC_DMA_CHANNEL + c) =
+        DMAMUX_CHCFG_SOURCE(adc_source[c]) | DMAMUX_CHCFG_ENBL_MASK;
+    DMA_SERQ = ADC_DMA_CHANNEL + c;
+    enable_irq(IRQ(INT_DMA0 + ADC_DMA_CHANNEL + c));
+  }
+
+  //continuous, one pre-trigger per converter per period. The first load is
+  //immediate; later period changes wait for the counter to wrap.
+  PDB0_SC = PDB_SC_PDBEN_MASK | PDB_SC_CONT_MASK
+      | PDB_SC_TRGSEL(ADC_PDB_TRGSEL_SW) | PDB_SC_PRESCALER(prescaler);
+  PDB0_MOD = adc_counts - 1;
+  PDB0_IDLY = 0;
+  PDB0_CH0DLY0 = 0;
+  PDB0_CH0C1 = PDB_C1_EN(1) | PDB_C1_TOS(1);
+  if (adc_converters == 2) {
+    PDB0_CH1DLY0 = adc_mode == ADC_INTERLEAVED ? adc_counts / 2 : 0;
+    PDB0_CH1C1 = PDB_C1_EN(1) | PDB_C1_TOS(1);
+  } else {
+    PDB0_CH1C1 = 0;
+  }
+  PDB0_SC |= PDB_SC_LDOK_MASK;
+  PDB0_SC |= PDB_SC_LDMOD(1);
+  PDB0_SC |= PDB_SC_SWTRIG_MASK;
+
+  return achieved;
+}
+
+void adc_stop(void)
+{
+  uint8_t c;
+
+  DisableInterrupts;
+  PDB0_SC = 0;
+  for (c = 0; c < 2; c++) {
+    DMA_CERQ = ADC_DMA_CHANNEL + c;
+    DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, ADC_DMA_CHANNEL + c) = 0;
+    DMA_CINT = ADC_DMA_CHANNEL + c;
+    disable_irq(IRQ(INT_DMA0 + ADC_DMA_CHANNEL + c));
+  }
+  adc_finished = 0;
+  EnableInterrupts;
+}
+
+uint32_t adc_period(void)
+{
+  return adc_counts;
+}
+
+void adc_pdb_period(uint32_t period)
+{
+  PDB0_MOD = period - 1;
+  if (adc_mode == ADC_INTERLEAVED)
+    PDB0_CH1DLY0 = period / 2;
+  PDB0_SC |= PDB_SC_LDOK_MASK;
+}
+
+void adc_stats(adc_stats_t * out)
+{
+  DisableInterrupts;
+  *out = stats;
+  stats.buffers = 0;
+  stats.overruns = 0;
+  EnableInterrupts;
+}
+
+// Major loop complete: the engine has already loaded the other descriptor
+// pair, so once every converter is through, this one is free to hand over
+// and refill. Both channels' handlers run at the same priority, so neither
+// interrupts the other.
+static void adc_complete(uint8_t channel)
+{
+  uint8_t n = adc_done;
+
+  //a completion that raced adc_stop() was cleared there
+  if (!(DMA_INT & (1 << channel)))
+    return;
+  DMA_CINT = channel;
+
+  adc_finished |= 1 << (channel - ADC_DMA_CHANNEL);
+  if (adc_finished != (1 << adc_converters) - 1)
+    return;
+  adc_finished = 0;
+
+  if (adc_index[n] == ADC_SCRATCH) {
+    stats.overruns++;
+    DLOG("adc: overrun on DMA channel %u after %lu buffers", channel,
+         stats.buffers);
+  } else {
+    if (adc_converters == 2)
+      buffers_set_length(adc_index[n], ADC_PAIRS * 2);
+    buffers_set_ready(adc_index[n]);
+    adc_index[n] = ADC_SCRATCH;
+    adc_buf[n] = NULL;
+    stats.buffers++;
+  }
+  adc_fill(n);
+  adc_done = n ^ 1;
+}
+
+void DMA0_IRQHandler()
+{
+  adc_complete(ADC_DMA_CHANNEL);
+}
+
+void DMA1_IRQHandler()
+{
+  adc_complete(ADC_DMA_CHANNEL + 1);
+}
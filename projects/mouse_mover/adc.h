@@ -0,0 +1,114 @@
+/**
+ * PDB-triggered, DMA-driven ADC acquisition
+ *
+ * PDB0 runs continuously and fires the ADC hardware triggers once per sample
+ * period. Each conversion raises a DMA request, and eDMA copies the result
+ * into the current buffer from the shared pool (buffers.h). The CPU is only
+ * involved once per buffer: when a major loop completes, the DMA interrupt
+ * sets that buffer ready and queues a fresh one. In the dual modes each
+ * converter's channel interrupts, and the buffer goes once both are done.
+ *
+ * A capture uses ADC0 alone or both converters:
+ *  - ADC_SINGLE: ADC0 only, BUFFER_LENGTH 16-bit samples per buffer
+ *  - ADC_PAIRED: ADC0 and ADC1 convert on the same edge, for phase-aligned
+ *    two-channel capture
+ *  - ADC_INTERLEAVED: ADC1 converts half a period after ADC0. Pair both
+ *    converters with the same pin (A10 is ADC0 channel 0 and ADC1 channel 3)
+ *    to sample it at twice the rate.
+ * In the dual modes each buffer holds ADC_PAIRS 32-bit words, ADC0's result
+ * in the low half and ADC1's in the high half, so the words are also in time
+ * order when interleaved. Those buffers are ADC_PAIRS * 2 samples long.
+ *
+ * Two transfer descriptors per DMA channel alternate through the eDMA
+ * scatter/gather link, so the engine has always already moved on to the next
+ * buffer by the time the interrupt runs. If the pool is empty the descriptors
+ * are pointed at a scratch word instead and a buffer's worth of samples is
+ * dropped (and counted).
+ *
+ * This module is the buffer pool's only producer.
+ */
+#ifndef _ADC_H_
+#define _ADC_H_
+
+#include "arm_cm4.h"
+#include "buffers.h"
+
+// ADC0 uses this channel and ADC1 the next; must match the handlers in adc.c
+#define ADC_DMA_CHANNEL 0
+
+// DMAMUX request sources
+#define ADC_DMAMUX_ADC0 40
+#define ADC_DMAMUX_ADC1 41
+
+// ADCK must stay at or below this in 12-bit mode
+#define ADC_MAX_ADCK_KHZ 18000
+
+// and at or below this while calibrating
+#define ADC_CAL_ADCK_KHZ 4000
+
+// 32-bit words per buffer in the dual modes
+#define ADC_PAIRS (BUFFER_LENGTH / 2)
+
+typedef enum {
+  ADC_SINGLE,
+  ADC_PAIRED,
+  ADC_INTERLEAVED
+} adc_mode_t;
+
+typedef struct {
+  adc_mode_t mode;
+  uint8_t channel[2];           //ADCH for ADC0 and, in the dual modes, ADC1
+  uint32_t rate;                //conversions per second on each converter
+  uint8_t calibrate;            //run the CAL sequence before starting
+  uint8_t average;              //hardware average of 4, 8, 16 or 32; 0 is off
+} adc_config_t;
+
+/**
+ * Works out the PDB settings for a sample rate. The PDB counts the bus clock
+ * through a 2^prescaler divider and wraps every counts ticks.
+ *
+ * @param rate Wanted sample rate in Hz
+ * @param prescaler Filled with the PDB prescaler setting (0 to 7)
+ * @param counts Filled with the period in prescaled ticks (1 to 65536)
+ * @return The rate actually achieved in Hz, or 0 if it is out of range
+ */
+uint32_t adc_plan(uint32_t rate, uint8_t * prescaler, uint32_t * counts);
+
+/**
+ * Starts a capture into the buffer pool, after buffers_init(). Averaging
+ * multiplies the conversion time, so it limits the usable rate.
+ *
+ * @param config Mode, channels, rate, calibration and averaging
+ * @return The rate actually achieved on each converter in Hz, or 0 if the
+ * rate could not be set or calibration failed
+ */
+uint32_t adc_start(const adc_config_t * config);
+
+/**
+ * Stops the capture. The buffers in flight are kept, not set ready, and
+ * refilled from the start by the next capture.
+ */
+void adc_stop(void);
+
+/**
+ * Nominal sample period in prescaled PDB ticks, for timebase_init()
+ */
+uint32_t adc_period(void);
+
+/**
+ * Loads a new PDB period at the next counter wrap. Matches timebase_period_t,
+ * so the sample clock can be locked to the host's frame clock.
+ */
+void adc_pdb_period(uint32_t period);
+
+typedef struct {
+  uint32_t buffers;             //buffers filled and set ready
+  uint32_t overruns;            //buffers dropped because the pool was empty
+} adc_stats_t;
+
+/**
+ * Copies out and clears the statistics
+ */
+void adc_stats(adc_stats_t * stats);
+
+#endif                          // _ADC_H_
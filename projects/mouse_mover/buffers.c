@@ -1,87 +1,143 @@
 /**
  * Shared oscilloscope memory buffers
+ *
+ * Buffer indices move between two single-producer/single-consumer rings, so
+ * nothing here masks interrupts or scans. The free ring is filled by whoever
+ * frees buffers (the USB side) and drained by buffers_get_next_free (the
+ * sampling side). The ready ring goes the other way. Each ring counter has
+ * exactly one writer, so publishing it with a release store is enough.
+ *
+ * With a stage installed, buffers set ready go to a third ring instead, and
+ * buffers_process() moves them on to the ready ring. The producer only
+ * picks the ring when it sets a buffer ready, and the stage is only changed
+ * while it is stopped, so each ring keeps a single writer.
+ *
+ * The buffers themselves are 2048-byte slab blocks, taken at init.
  */
 #include "buffers.h"
+#include "atomic.h"
+#include "slab.h"
 
 #define N_BUFFERS 16            //we have 32K of buffers...that's a lot of buffers
-
-#define PREV(I) (I == 0 ? N_BUFFERS - 1 : I - 1)
-#define NEXT(I) (I >= N_BUFFERS - 1 ? 0 : I + 1)
-
-typedef enum { BUF_FREE, BUF_IN_USE, BUF_READY } buffer_state_t;
+                                //must be a power of two (ring indexing)
 
 typedef struct {
-  buffer_state_t state;
-  uint16_t buffer[BUFFER_LENGTH];
-} buffer_t;
+  volatile uint32_t head;       //written by the producer only
+  volatile uint32_t tail;       //written by the consumer only
+  uint8_t index[N_BUFFERS];
+} ring_t;
 
 // all the buffers!
-static buffer_t buffers[N_BUFFERS];
-static uint8_t last_free = 0;
-static uint8_t last_ready = 0;
+static uint16_t *buffers[N_BUFFERS];
+static uint16_t lengths[N_BUFFERS];
+static ring_t free_ring;
+static ring_t stage_ring;
+static ring_t ready_ring;
 
-/**
- * Gets the next buffer with a given state
- * @param state State the buffer should be in
- * @param next State the buffer should be set to
- * @param last Last index to start at and update when looking through our buffers
- */
-static uint16_t *buffer_get_next_like(buffer_state_t state,
-                                      buffer_state_t next, uint8_t * last)
+static buffers_stage_t stage = NULL;
+
+static void ring_put(ring_t * ring, uint8_t index)
 {
-  uint8_t i;
-  uint16_t *buf = NULL;
+  uint32_t head = ring->head;
 
-  DisableInterrupts;
+  ring->index[head & (N_BUFFERS - 1)] = index;
+  atomic_store_release(&ring->head, head + 1);
+}
 
-  for (i = *last; i != PREV(*last); i = NEXT(i)) {
-    if (buffers[i].state == state) {
-      *last = i;
-      buffers[i].state = next;
-      buf = buffers[i].buffer;
-      goto done;
-    }
-  }
+// Returns the oldest entry without removing it, or -1 if the ring is empty
+static int32_t ring_peek(ring_t * ring)
+{
+  uint32_t tail = ring->tail;
+
+  if (atomic_load_acquire(&ring->head) == tail)
+    return -1;
+  return ring->index[tail & (N_BUFFERS - 1)];
+}
 
-done:
-  EnableInterrupts;
-  return buf;
+static void ring_drop(ring_t * ring)
+{
+  atomic_store_release(&ring->tail, ring->tail + 1);
 }
 
 void buffers_init(void)
 {
+  uint8_t i;
+
+  free_ring.head = free_ring.tail = 0;
+  stage_ring.head = stage_ring.tail = 0;
+  ready_ring.head = ready_ring.tail = 0;
+  for (i = 0; i < N_BUFFERS; i++) {
+    if (buffers[i] == NULL)
+      buffers[i] = slab_alloc(BUFFER_CAPACITY * sizeof(uint16_t));
+    //run with fewer buffers if the slab is short
+    if (buffers[i] != NULL)
+      ring_put(&free_ring, i);
+  }
 }
 
 uint16_t *buffers_get_next_free(uint8_t * index)
 {
-  uint16_t *buf = buffer_get_next_like(BUF_FREE, BUF_IN_USE, &last_free);
-  *index = last_free;
+  int32_t i = ring_peek(&free_ring);
+
+  if (i < 0)
+    return NULL;
+
+  ring_drop(&free_ring);
+  lengths[i] = BUFFER_LENGTH;
+  *index = i;
+  return buffers[i];
+}
+
+void buffers_set_length(uint8_t index, uint16_t length)
+{
+  lengths[index] = length;
+}
 
-  return buf;
+uint16_t buffers_length(uint8_t index)
+{
+  return lengths[index];
 }
 
 void buffers_set_ready(uint8_t index)
 {
-  DisableInterrupts;
-  if (buffers[index].state == BUF_IN_USE) {
-    buffers[index].state = BUF_READY;
+  ring_put(stage ? &stage_ring : &ready_ring, index);
+}
+
+void buffers_set_stage(buffers_stage_t s)
+{
+  buffers_process();
+  stage = s;
+}
+
+void buffers_process(void)
+{
+  int32_t i;
+
+  while ((i = ring_peek(&stage_ring)) >= 0) {
+    lengths[i] = stage(buffers[i], lengths[i]);
+    ring_drop(&stage_ring);
+    ring_put(&ready_ring, i);
   }
-  EnableInterrupts;
 }
 
 uint16_t *buffers_get_next_ready(uint8_t * index)
 {
-  uint16_t *buf = buffer_get_next_like(BUF_READY, BUF_READY, &last_ready);
-  *index = last_ready;
+  int32_t i = ring_peek(&ready_ring);
+
+  if (i < 0)
+    return NULL;
 
-  return buf;
+  *index = i;
+  return buffers[i];
 }
 
-void buffer_free(uint8_t index)
+int32_t buffer_free(uint8_t index)
 {
-  DisableInterrupts;
-  if (buffers[index].state == BUF_READY) {
-    buffers[index].state = BUF_FREE;
-  }
-  EnableInterrupts;
+  //only the buffer at the front of the ready ring can be freed
+  if (ring_peek(&ready_ring) != index)
+    return -1;
+
+  ring_drop(&ready_ring);
+  ring_put(&free_ring, index);
+  return 0;
 }
@@ -8,6 +8,18 @@
  * buffers_get_next_ready, the next ready buffer is returned. Once the USB
  * module has transmitted the buffer, buffers_free can be called and the buffer
  * is returned to the free pool.
+ *
+ * There is one producer (requests buffers and sets them ready) and one
+ * consumer (reads and frees them), each of which may be the main loop or an
+ * interrupt handler. Buffers must be set ready and freed in the order they
+ * were handed out. None of these calls mask interrupts.
+ *
+ * A buffer is filled with up to BUFFER_LENGTH samples; the producer can set
+ * fewer before setting it ready, and a stage can leave up to BUFFER_CAPACITY.
+ * Consumers free empty buffers without sending them. An optional stage (a
+ * filter, say) can sit between
+ * the two: with one installed, buffers set ready are only handed to the
+ * consumer once buffers_process() has run the stage on them.
  */
 
 #ifndef _BUFFERS_H_
@@ -16,6 +28,7 @@
 #include "arm_cm4.h"
 
 #define BUFFER_LENGTH 1023      //we avoid 1024 because of a stupid 2048-length bug
+#define BUFFER_CAPACITY 1024    //room in each buffer; a stage may grow one to this
 
 /**
  * Initializes the shared buffers
@@ -36,6 +49,39 @@ uint16_t *buffers_get_next_free(uint8_t * index);
  */
 void buffers_set_ready(uint8_t index);
 
+/**
+ * Sets how many samples a buffer holds; BUFFER_LENGTH until changed. Only
+ * the buffer's current owner may call this.
+ */
+void buffers_set_length(uint8_t index, uint16_t length);
+
+/**
+ * Gets how many samples a buffer holds
+ */
+uint16_t buffers_length(uint8_t index);
+
+/**
+ * Processes a buffer in place
+ *
+ * @param buf Samples
+ * @param length Number of samples
+ * @return Number of samples left at the front of buf
+ */
+typedef uint16_t (*buffers_stage_t) (uint16_t * buf, uint16_t length);
+
+/**
+ * Installs or (with NULL) removes the stage. Call from the context that runs
+ * buffers_process(), with the producer stopped; buffers waiting for the old
+ * stage are put through it first.
+ */
+void buffers_set_stage(buffers_stage_t stage);
+
+/**
+ * Runs the stage on every buffer set ready since the last call and hands
+ * them to the consumer. Call this from the main loop.
+ */
+void buffers_process(void);
+
 /**
  * Gets the next ready buffer. The buffer state is not changed.
  *
@@ -47,7 +93,8 @@ uint16_t *buffers_get_next_ready(uint8_t * index);
 /**
  * Frees a buffer
  * @param index Buffer index to mark as free
+ * @return 0, or -1 if index is not the oldest ready buffer (nothing is freed)
  */
-void buffer_free(uint8_t index);
+int32_t buffer_free(uint8_t index);
 
 #endif                          // _BUFFERS_H_
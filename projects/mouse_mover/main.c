@@ -1,18 +1,374 @@
 #include "common.h"
 #include "arm_cm4.h"
 #include "usb.h"
+#include "usb_hid.h"
+#include "usb_msc.h"
+#include "usb_iso.h"
+#include "timebase.h"
+#include "adc.h"
+#include "buffers.h"
+#include "slab.h"
+#include "fir.h"
+#include "trigger.h"
+#include "rice.h"
+#include "telem.h"
+#include "dlog.h"
+#include "termio.h"
+#ifdef PRINTF_BENCH
+#include "xprintf_ref.h"
+#endif
+#include "spi.h"
+#include "sdcard.h"
+
+// sample A10 into the stream; it is ADC0 channel 0 and ADC1 channel 3, so
+// the dual modes ('d' on the console) pair the converters on the same pin
+static adc_config_t capture = {
+  .mode = ADC_SINGLE,
+  .channel = {0, 3},
+  .rate = 200000,
+  .calibrate = 1,
+  .average = 0
+};
+
+// 'f' on the console filters a single-channel stream: 15-tap low-pass at
+// 0.1 fs (Q15, Hamming-windowed sinc, summing to 32768 for unity gain at
+// DC), keeping every FIR_DECIMATE'th sample. It is -6 dB at 0.1 fs, -10 dB
+// at the decimated Nyquist of 0.125 fs and below -34 dB from 0.2 fs.
+#define FIR_DECIMATE 4
+static const int16_t lowpass[15] = {
+  -118, -133, 0, 696, 2205, 4257, 6075, 6804,
+  6075, 4257, 2205, 696, 0, -133, -118
+};
+
+// 'g' keeps only a buffer's worth around each rising crossing of mid-scale
+static const trigger_config_t scope = {
+  .mode = TRIGGER_RISING,
+  .level = 2048,
+  .pre = 256,
+  .post = BUFFER_LENGTH - 256
+};
+
+// 'z' compresses every buffer into one rice.h block (tools/rice decodes)
+static uint16_t coded[BUFFER_CAPACITY];
+
+// 'y' sends the counters as one frame of telem.h records (tools/telem
+// decodes); each record is the stats struct as it is in memory. Any DLOG()
+// records waiting go in the same frame (tools/dlog prints them).
+#define TELEM_ADC      1
+#define TELEM_TRIGGER  2
+#define TELEM_TIMEBASE 3
+static telem_tx_t telem;
+
+static fir_t fir;
+static uint8_t filtering = 0;
+static uint8_t triggering = 0;
+static uint8_t compressing = 0;
+static uint32_t fir_cycles;     //for the last buffer
+static uint32_t rice_cycles;
+static uint32_t rice_in, rice_out;      //words since the last 'a'
+
+// The buffers.c stage: filter, trigger on the filtered samples, compress
+static uint16_t stream_stage(uint16_t * buf, uint16_t length)
+{
+  uint32_t start = DWT_CYCCNT;
+  uint16_t i;
+
+  if (filtering) {
+    length = fir_decimate(&fir, (int16_t *) buf, length);
+    fir_cycles = DWT_CYCCNT - start;
+  }
+  if (triggering)
+    length = trigger_stage(buf, length);
+  if (compressing && length) {
+    start = DWT_CYCCNT;
+    rice_in += length;
+    length = rice_encode(buf, length, coded, BUFFER_CAPACITY);
+    for (i = 0; i < length; i++)
+      buf[i] = coded[i];
+    rice_out += length;
+    rice_cycles = DWT_CYCCNT - start;
+  }
+  return length;
+}
+
+// Times the SMLAD filter against the plain C one on the same block and
+// checks they agree
+static void fir_bench(void)
+{
+  int16_t *a = slab_alloc(512);
+  int16_t *b = slab_alloc(512);
+  uint32_t i, n, start, dsp, ref;
+  fir_t bench;
+
+  if (a && b) {
+    for (i = 0; i < 256; i++)
+      a[i] = b[i] = (int16_t) (i * 2731) ^ (i << 7);
+
+    fir_init(&bench, lowpass, 15, FIR_DECIMATE);
+    start = DWT_CYCCNT;
+    n = fir_decimate(&bench, a, 256);
+    dsp = DWT_CYCCNT - start;
+
+    fir_init(&bench, lowpass, 15, FIR_DECIMATE);
+    start = DWT_CYCCNT;
+    fir_decimate_ref(&bench, b, 256);
+    ref = DWT_CYCCNT - start;
+
+    for (i = 0; i < n && a[i] == b[i]; i++);
+    xprintf("\r\nfir: 256 in, %lu out; %lu cycles, C %lu cycles, %s\r\n",
+            n, dsp, ref, i == n ? "match" : "MISMATCH");
+  }
+  slab_free(a);
+  slab_free(b);
+}
+
+// A slow triangle with a few LSBs of noise, like the ADC sees
+static uint16_t bench_sample(uint32_t i)
+{
+  uint32_t t = i & 127;
+
+  return 2048 + (i & 128 ? 127 - t : t) * 8 + ((i * 2731) >> 5 & 7);
+}
+
+// Times a codec round trip and checks it is lossless
+static void rice_bench(void)
+{
+  uint16_t *a = slab_alloc(512);
+  uint16_t *b = slab_alloc(512);
+  uint32_t i, w, start, enc, dec;
+  int32_t n;
+
+  if (a && b) {
+    for (i = 0; i < 255; i++)
+      a[i] = bench_sample(i);
+
+    start = DWT_CYCCNT;
+    w = rice_encode(a, 255, b, 256);
+    enc = DWT_CYCCNT - start;
+
+    start = DWT_CYCCNT;
+    n = rice_decode(b, w, a, 256);
+    dec = DWT_CYCCNT - start;
+
+    for (i = 0; n == 255 && i < 255 && a[i] == bench_sample(i); i++);
+    xprintf("rice: 255 samples in %lu words; encode %lu cycles, decode %lu "
+            "cycles, %s\r\n", w, enc, dec, i == 255 ? "match" : "MISMATCH");
+  }
+  slab_free(a);
+  slab_free(b);
+}
+
+static uint8_t telem_wire[TELEM_WIRE];
+static uint32_t telem_wire_len;
+static uint32_t telem_matched;
+
+// Stands in for the transport: keeps the frame for the decoder
+static int32_t telem_capture(const char *ptr, int32_t len)
+{
+  int32_t i;
+
+  for (i = 0; i < len; i++)
+    telem_wire[i] = ptr[i];
+  telem_wire_len = len;
+  return len;
+}
+
+// Record type t holds samples 16t to 16t + 15
+static void telem_check(void *ctx, uint8_t type, const uint8_t * data,
+                        uint32_t len)
+{
+  uint32_t i;
+
+  for (i = 0; i < 16 && len == 32; i++)
+    if (telem_get16(data + 2 * i) != bench_sample(type * 16 + i))
+      return;
+  telem_matched++;
+}
+
+// Times batching 8 records into a frame (hardware CRC and COBS included)
+// and decoding it again, and checks every record comes back. Encoding and
+// decoding share the hardware CRC, so it is also checked against the
+// CRC-32 check value, from each alignment so both the byte and the word
+// writes are used.
+static void telem_bench(void)
+{
+  static telem_tx_t tx;
+  static telem_rx_t rx;
+  static uint32_t aligned[4];
+  uint8_t *kat = (uint8_t *) aligned;
+  uint32_t i, j, start, enc, dec, crc_bad = 0;
+  uint8_t *p;
+
+  for (i = 0; i < 4; i++) {
+    for (j = 0; j < 9; j++)
+      kat[i + j] = '1' + j;
+    if (telem_crc32(kat + i, 9) != 0xcbf43926)
+      crc_bad++;
+  }
+  xprintf("telem: crc32(\"123456789\") %s\r\n",
+          crc_bad ? "WRONG" : "0xCBF43926");
+
+  telem_tx_init(&tx, telem_capture);
+  telem_rx_init(&rx, telem_check, NULL);
+  telem_matched = 0;
+
+  start = DWT_CYCCNT;
+  for (i = 0; i < 8; i++) {
+    p = telem_record(&tx, i, 32);
+    for (j = 0; j < 16; j++)
+      telem_le16(p + 2 * j, bench_sample(i * 16 + j));
+  }
+  telem_flush(&tx);
+  enc = DWT_CYCCNT - start;
+
+  start = DWT_CYCCNT;
+  telem_rx_put(&rx, telem_wire, telem_wire_len);
+  dec = DWT_CYCCNT - start;
+
+  xprintf("telem: 8 records in %lu bytes; encode %lu cycles, decode %lu "
+          "cycles, %s\r\n", telem_wire_len, enc, dec,
+          telem_matched == 8 ? "match" : "MISMATCH");
+}
+
+// Times a two-argument DLOG() against xprintf() of the same line into a
+// dropped-output sink; the record stays in the ring for the next 'y'
+static uint32_t bench_writes;   //calls into the sink
+
+static int32_t bench_discard(const char *ptr, int32_t len)
+{
+  bench_writes++;
+  return len;
+}
+
+static void dlog_bench(void)
+{
+  uint32_t start, logged, printed;
+
+  start = DWT_CYCCNT;
+  DLOG("bench: %lu cycles at %lu", 12345, start);
+  logged = DWT_CYCCNT - start;
+
+  xdev_out(bench_discard);
+  start = DWT_CYCCNT;
+  xprintf("bench: %lu cycles at %lu\r\n", 12345, start);
+  printed = DWT_CYCCNT - start;
+  xdev_out(usb_cdc_write);
+
+  xprintf("dlog: 12 bytes in %lu cycles, xprintf %lu cycles\r\n", logged,
+          printed);
+}
+
+#ifdef PRINTF_BENCH
+// Times a typical console line through the buffered xprintf() and the
+// original char-at-a-time one (tools/termio/xprintf_ref.c, linked only in
+// a PRINTF_BENCH=1 build), counting the writes each makes, then checks
+// xsnprintf() on the widest %llu and a %p
+static void printf_bench(void)
+{
+  char line[40];
+  uint32_t start, buffered, ref, writes, ref_writes;
+  int32_t n;
+
+  xdev_out(bench_discard);
+  bench_writes = 0;
+  start = DWT_CYCCNT;
+  xprintf("adc: mode %u, %lu Hz, %lu buffers, %lu overruns\r\n", 2, 200000,
+          4294967, 0);
+  buffered = DWT_CYCCNT - start;
+  writes = bench_writes;
+
+  bench_writes = 0;
+  start = DWT_CYCCNT;
+  xprintf_ref("adc: mode %u, %lu Hz, %lu buffers, %lu overruns\r\n", 2,
+              200000, 4294967, 0);
+  ref = DWT_CYCCNT - start;
+  ref_writes = bench_writes;
+  xdev_out(usb_cdc_write);
+
+  n = xsnprintf(line, sizeof(line), "%llu %p", 18446744073709551615ull,
+                (void *) 0x1fff8000);
+  xprintf("xprintf: a line in %lu cycles, %lu writes; was %lu cycles, %lu "
+          "writes; %s\r\n", buffered, writes, ref, ref_writes,
+          n == 31 && line[19] == '5' && line[30] == '0' ? "match" : "MISMATCH");
+}
+#endif
 
 #define LED_ON  GPIOC_PSOR=(1<<5)
 #define LED_OFF GPIOC_PCOR=(1<<5)
 #define LED2_ON  GPIOC_PSOR=(1<<7)
 #define LED2_OFF GPIOC_PCOR=(1<<7)
 
+// SD card on SPI0 (which takes over the LED pins PC5 and PC7), CS on PD0
+#define SD_SPI 0
+#define SD_CS_HIGH GPIOD_PSOR=(1<<0)
+#define SD_CS_LOW  GPIOD_PCOR=(1<<0)
+
+static void sd_select(void)
+{
+  SD_CS_LOW;
+}
+
+static void sd_deselect(void)
+{
+  SD_CS_HIGH;
+}
+
+static char sd_xchg(char c)
+{
+  return SPIExchange(SD_SPI, c);
+}
+
+// Card size in 512-byte sectors from the CSD, or 0 if there is no card
+static uint32_t sd_init(void)
+{
+  uint8_t csd[16];
+  uint32_t c_size, mult;
+
+  PORTD_PCR0 = PORT_PCR_MUX(0x1);
+  GPIOD_PDDR |= (1 << 0);
+  SD_CS_HIGH;
+
+  //cards must be brought up below 400 kHz
+  SPIInit(SD_SPI, 400, 8);
+  SDRegisterSPI(sd_select, sd_xchg, sd_deselect);
+  if (SDInit() != SDCARD_OK || SDReadCSD(csd) != SDCARD_OK)
+    return 0;
+  SPIInit(SD_SPI, 12000, 8);
+
+  if ((csd[0] >> 6) == 1) {
+    //CSD version 2.0 (SDHC): (C_SIZE + 1) * 512 KiB
+    c_size = ((csd[7] & 0x3f) << 16) | (csd[8] << 8) | csd[9];
+    return (c_size + 1) << 10;
+  }
+
+  //CSD version 1.0: (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^READ_BL_LEN bytes
+  c_size = ((csd[6] & 0x03) << 10) | (csd[7] << 2) | (csd[8] >> 6);
+  mult = ((csd[9] & 0x03) << 1) | (csd[10] >> 7);
+  return (c_size + 1) << (mult + 2 + (csd[5] & 0x0f) - 9);
+}
+
 int main(void)
 {
   volatile uint32_t n;
   uint32_t v;
   uint32_t s;
   uint8_t mask;
+  uint32_t i;
+  uint32_t rate;
+#ifdef STREAM_RAMP
+  uint8_t index;
+  uint16_t *buf;
+  uint16_t sample = 0;
+#endif
+  char c;
+  usb_hid_latency_t latency;
+  usb_msc_stats_t msc;
+  timebase_stats_t tb;
+  usb_iso_stats_t iso;
+  usb_irq_stats_t irq;
+  adc_stats_t adc;
+  trigger_stats_t trig;
+  slab_stats_t slab;
 
   PORTC_PCR5 = PORT_PCR_MUX(0x1);     // LED is on PC5 (pin 13), config as GPIO (alt = 1)
   PORTC_PCR7 = PORT_PCR_MUX(0x1);     // LED2 is on PC7 (pin 12), config as GPIO (alt = 1)
@@ -26,22 +382,170 @@ int main(void)
   s = (uint32_t) mcg_clk_hz / 16;
 
   //enable the PIT clock
-  SIM_SCGC3 |= SIM_SCGC3_ADC1_MASK;
-  SIM_SCGC6 |= SIM_SCGC6_PIT_MASK | SIM_SCGC6_ADC0_MASK;
+  SIM_SCGC6 |= SIM_SCGC6_PIT_MASK;
 
   // turn on PIT
   PIT_MCR = 0x00;
-  // Timer 1
-  PIT_LDVAL1 = 0x0003E7FF;          // setup timer 1 for 256000 cycles
+  // Timer 1 runs every 256000 cycles
+  PIT_LDVAL1 = 0x0003E800 - 1;
   PIT_TCTRL1 = PIT_TCTRL_TIE_MASK;  // enable Timer 1 interrupts
   PIT_TCTRL1 |= PIT_TCTRL_TEN_MASK; // start Timer 1
 
+  slab_init();
+  buffers_init();
   usb_init();
 
+#ifdef STREAM_RAMP
+  rate = 0;
+#else
+  // the sample clock is locked to the host's frame clock
+  rate = adc_start(&capture);
+  if (rate)
+    timebase_init(adc_pdb_period, adc_period());
+#endif
+
+  // console goes to the USB virtual serial port rather than a UART
+  xdev_out(usb_cdc_write);
+  xdev_in(usb_cdc_read, usb_cdc_avail);
+  telem_tx_init(&telem, usb_cdc_write);
+  DLOG("mouse_mover: %lu MHz, adc %lu Hz", v, rate);
+
+  // the SD card shows up as a USB drive
+  usb_msc_media(SDReadBlock, SDWriteBlock, sd_init());
+
   // NOTE uncomment to enable blinky lights via interrupt
   //enable_irq(IRQ(INT_PIT1));
 
   EnableInterrupts while (1) {
+#ifdef STREAM_RAMP
+    // make RAMP=1 streams a 16-bit ramp instead of the ADC so the host can
+    // check for dropped samples (see tools/stream_rx)
+    buf = buffers_get_next_free(&index);
+    if (buf) {
+      for (i = 0; i < BUFFER_LENGTH; i++)
+        buf[i] = sample++;
+      buffers_set_ready(index);
+    }
+#endif
+
+    // filter anything the producer has set ready
+    buffers_process();
+
+    // one sector of any USB drive transfer in progress
+    usb_msc_task();
+
+    // echo the console, 'l' dumps the mouse report latency probe, 'm' the
+    // USB drive throughput since the last 'm' and 't' the host clock lock
+    if (xavail()) {
+      c = xgetc();
+      if (c == 's') {
+        // slab usage per size class
+        xprintf("\r\n");
+        for (i = 0; slab_stats(i, &slab) == 0; i++)
+          xprintf("slab %lu: %lu/%lu in use, high water %lu, %lu failed\r\n",
+                  slab.size, slab.in_use, slab.count, slab.high_water,
+                  slab.failures);
+      } else if (c == 'u') {
+        // USB interrupt cost since the last 'u', in cycles
+        usb_irq_stats(&irq);
+        xprintf("\r\nusb irq: %lu calls, %lu avg, %lu max; %lu tokens, %lu avg,"
+                " ep max", irq.calls, irq.calls ? irq.cycles / irq.calls : 0,
+                irq.max, irq.tokens,
+                irq.tokens ? irq.token_cycles / irq.tokens : 0);
+        for (i = 0; i < 8; i++)
+          xprintf(" %lu", irq.endp_max[i]);
+        xprintf("\r\n");
+      } else if (c == 'i') {
+        // isochronous frame fill since the last 'i' (make ISO=1 only)
+        usb_iso_stats(&iso);
+        xprintf("\r\niso: %lu frames, %lu full, %lu partial, %lu underruns, "
+                "%lu bytes, last %u\r\n", iso.frames, iso.full, iso.partial,
+                iso.underruns, iso.bytes, iso.last);
+      } else if (c == 'a') {
+        // acquisition since the last 'a'
+        adc_stats(&adc);
+        xprintf("\r\nadc: mode %u, %lu Hz, %lu buffers, %lu overruns, "
+                "filter %lu cycles, codec %lu to %lu words in %lu cycles\r\n",
+                capture.mode, rate, adc.buffers, adc.overruns,
+                filtering ? fir_cycles : 0, rice_in, rice_out,
+                compressing ? rice_cycles : 0);
+        rice_in = rice_out = 0;
+#ifndef STREAM_RAMP
+      } else if (c == 'd') {
+        // next capture mode: single, paired, interleaved. The rate is kept,
+        // so the timebase's nominal period still holds.
+        capture.mode = capture.mode == ADC_INTERLEAVED ? ADC_SINGLE
+            : capture.mode + 1;
+        rate = adc_start(&capture);
+        xprintf("\r\nadc: mode %u, %lu Hz\r\n", capture.mode, rate);
+      } else if (c == 'f' || c == 'g' || c == 'z') {
+        // filter, trigger or compression on or off; the stage can only
+        // change with the capture stopped
+        adc_stop();
+        if (c == 'f') {
+          filtering = !filtering;
+          fir_init(&fir, lowpass, 15, FIR_DECIMATE);
+        } else if (c == 'g') {
+          triggering = !triggering;
+          trigger_init(&scope);
+        } else {
+          compressing = !compressing;
+        }
+        buffers_set_stage(filtering || triggering || compressing
+                          ? stream_stage : NULL);
+        rate = adc_start(&capture);
+        xprintf("\r\nfilter %s, trigger %s, compression %s\r\n",
+                filtering ? "on" : "off", triggering ? "on" : "off",
+                compressing ? "on" : "off");
+#endif
+      } else if (c == 'r') {
+        // trigger rate and latency since the last 'r'
+        trigger_stats(&trig);
+        xprintf("\r\ntrigger: %lu triggers, %lu windows, %lu samples, "
+                "latency %lu/%lu us\r\n", trig.triggers, trig.windows,
+                trig.samples, trig.latency_last / v, trig.latency_max / v);
+      } else if (c == 'b') {
+        fir_bench();
+        rice_bench();
+        telem_bench();
+        dlog_bench();
+#ifdef PRINTF_BENCH
+        printf_bench();
+#endif
+      } else if (c == 'y') {
+        // the 'a', 'r' and 't' counters, binary, batched into one frame
+        adc_stats(&adc);
+        trigger_stats(&trig);
+        timebase_stats(&tb);
+        usb_cdc_write("", 1);   // a zero ends any console text before it
+        telem_put(&telem, TELEM_ADC, &adc, sizeof(adc));
+        telem_put(&telem, TELEM_TRIGGER, &trig, sizeof(trig));
+        telem_put(&telem, TELEM_TIMEBASE, &tb, sizeof(tb));
+        dlog_drain(&telem);
+        telem_flush(&telem);
+      } else if (c == 't') {
+        timebase_stats(&tb);
+        xprintf("\r\ntimebase: frame %lu, %d ppm, %lu windows, %lu rejected\r\n",
+                tb.frame, tb.ppm, tb.windows, tb.rejected);
+      } else if (c == 'm') {
+        usb_msc_stats(&msc);
+        xprintf("\r\nmsc: read %lu sectors in %lu ms (%lu kB/s), "
+                "wrote %lu sectors in %lu ms (%lu kB/s), %lu errors\r\n",
+                msc.read_sectors, msc.read_ms,
+                msc.read_ms ? msc.read_sectors * 512 / msc.read_ms : 0,
+                msc.write_sectors, msc.write_ms,
+                msc.write_ms ? msc.write_sectors * 512 / msc.write_ms : 0,
+                msc.errors);
+      } else if (c == 'l') {
+        usb_hid_latency(&latency);
+        xprintf("\r\nhid: %lu reports, %lu saturated, latency %lu/%lu us\r\n",
+                latency.reports, latency.saturated, latency.last / v,
+                latency.max / v);
+      } else {
+        xprintf("%c", c);
+      }
+    }
+
     // NOTE uncomment to enable blinky lights via main loop
     // LED_ON;
     // for (n = 0; n < 1000000; n++);
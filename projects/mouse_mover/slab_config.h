@@ -0,0 +1,13 @@
+/**
+ * Size classes for the slab allocator (common/slab.c), smallest first
+ */
+#ifndef _SLAB_CONFIG_H_
+#define _SLAB_CONFIG_H_
+
+// X(block size in bytes, number of blocks)
+#define SLAB_CLASSES(X) \
+  X(64, 4)                      /* USB packets */ \
+  X(512, 4)                     /* SD sectors */ \
+  X(2048, 16)                   /* sample buffers (buffers.c) */
+
+#endif                          // _SLAB_CONFIG_H_
@@ -0,0 +1,108 @@
+/**
+ * Host-disciplined sample clock
+ */
+#include "timebase.h"
+#include "usb.h"
+#include "common.h"
+
+static timebase_period_t timebase_set = NULL;
+static uint32_t timebase_period;
+
+// start of the current measurement window
+static uint8_t timebase_started = 0;
+static uint32_t timebase_frame;
+static uint32_t timebase_cycles;
+
+// our clock's error against the host, in parts per 2^32, filtered
+static int32_t timebase_ratio = 0;
+static int64_t timebase_acc = 0;        //dither error, in 2^-32 counts
+
+static timebase_stats_t stats;
+
+// Measures one window. Returns nonzero if the ratio was updated.
+static uint8_t timebase_measure(uint32_t frames, uint32_t cycles)
+{
+  uint32_t nominal = (uint32_t) core_clk_khz * frames;
+  uint32_t limit = nominal / (1000000 / TIMEBASE_MAX_PPM);
+  int32_t diff = (int32_t) (cycles - nominal);
+  int32_t ratio;
+  uint32_t recip;
+
+  if (diff > (int32_t) limit || diff < -(int32_t) limit)
+    return 0;
+
+  //diff / nominal in parts per 2^32, without a 64-bit divide:
+  //recip is 2^40 / nominal
+  recip = 0xffffffff / (nominal >> 8);
+  ratio = (int32_t) (((int64_t) diff * recip) >> 8);
+
+  if (stats.windows == 0)
+    timebase_ratio = ratio;
+  else
+    timebase_ratio += (ratio - timebase_ratio) / 8;
+  return 1;
+}
+
+static void timebase_sof(uint32_t frame, uint32_t cycles)
+{
+  uint32_t frames = frame - timebase_frame;
+  int32_t d;
+
+  if (!timebase_started) {
+    timebase_started = 1;
+    timebase_frame = frame;
+    timebase_cycles = cycles;
+  } else if (frames >= TIMEBASE_WINDOW) {
+    //a gap much longer than a window may have wrapped the cycle counter
+    if (frames <= 2 * TIMEBASE_WINDOW
+        && timebase_measure(frames, cycles - timebase_cycles))
+      stats.windows++;
+    else
+      stats.rejected++;
+    timebase_frame = frame;
+    timebase_cycles = cycles;
+  }
+
+  //spread the fractional trim over frames, whole counts at a time
+  timebase_acc += (int64_t) timebase_period * timebase_ratio;
+  d = (int32_t) ((timebase_acc + (1LL << 31)) >> 32);
+  timebase_acc -= (int64_t) d << 32;
+  timebase_set(timebase_period + d);
+}
+
+void timebase_init(timebase_period_t set, uint32_t period)
+{
+  static const timebase_stats_t no_stats;
+
+  //a new rate starts from scratch: the next SOF opens a fresh window and
+  //the first one measured sets the ratio
+  DisableInterrupts;
+  timebase_set = set;
+  timebase_period = period;
+  timebase_started = 0;
+  timebase_frame = 0;
+  timebase_cycles = 0;
+  timebase_ratio = 0;
+  timebase_acc = 0;
+  stats = no_stats;
+  EnableInterrupts;
+
+  set(period);
+  usb_sof_handler(timebase_sof);
+}
+
+void timebase_pit1(uint32_t period)
+{
+  PIT_LDVAL1 = period - 1;
+}
+
+void timebase_stats(timebase_stats_t * out)
+{
+  uint32_t frame = usb_frame(NULL);
+
+  DisableInterrupts;
+  *out = stats;
+  out->frame = frame;
+  out->ppm = (int32_t) (((int64_t) timebase_ratio * 1000000) >> 32);
+  EnableInterrupts;
+}
@@ -0,0 +1,52 @@
+/**
+ * Host-disciplined sample clock
+ *
+ * The host's 1 ms start of frame is the reference. Our crystal's error
+ * against it is measured with the DWT cycle counter over TIMEBASE_WINDOW
+ * frames, and the sample-rate generator's period is trimmed to match, so a
+ * stream produces exactly as many samples as the host consumes however long
+ * it runs.
+ *
+ * The trim is usually well below one timer count per sample period, so it is
+ * applied by sigma-delta dithering: each frame the generator period is set
+ * to the nominal period, one count longer, or one count shorter.
+ */
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+#include "arm_cm4.h"
+
+// frames per measurement
+#define TIMEBASE_WINDOW 1024
+
+// measurements further off than this are discarded (suspend, bus reset)
+#define TIMEBASE_MAX_PPM 1000
+
+/**
+ * Sets the generator period, in timer counts. Called from the USB interrupt.
+ */
+typedef void (*timebase_period_t) (uint32_t period);
+
+/**
+ * Starts disciplining a sample-rate generator
+ *
+ * @param set Function loading a new period into the generator
+ * @param period Nominal period in timer counts
+ */
+void timebase_init(timebase_period_t set, uint32_t period);
+
+/**
+ * Loads a PIT channel's period; PIT_LDVAL takes effect on the next reload
+ */
+void timebase_pit1(uint32_t period);
+
+typedef struct {
+  uint32_t frame;               //host frames since power up
+  int32_t ppm;                  //our clock relative to the host's, filtered
+  uint32_t windows;             //measurements used
+  uint32_t rejected;            //measurements discarded
+} timebase_stats_t;
+
+void timebase_stats(timebase_stats_t * stats);
+
+#endif                          // _TIMEBASE_H_
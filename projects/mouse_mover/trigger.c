@@ -0,0 +1,100 @@
+/**
+ * Oscilloscope-style trigger with pre-trigger capture
+ *
+ * Each sample is written into the delay line and the sample pre places
+ * behind it comes out, so when a trigger is seen the first sample of its
+ * window is the one just coming out. Window samples are written back no
+ * further along the buffer than the sample just read, so the stage works in
+ * place.
+ */
+#include "trigger.h"
+
+#define HISTORY_MASK (TRIGGER_HISTORY - 1)
+
+static trigger_config_t trigger;
+static uint16_t history[TRIGGER_HISTORY];
+static uint32_t written = 0;    //samples into the delay line
+static uint16_t previous = 0;   //last sample, for the edge modes
+static uint32_t remaining = 0;  //window samples still to keep
+static uint32_t started;        //DWT cycles when the window triggered
+
+static trigger_stats_t stats;
+
+int32_t trigger_init(const trigger_config_t * config)
+{
+  uint32_t i;
+
+  if (config->pre >= TRIGGER_HISTORY || config->post == 0)
+    return -1;
+
+  trigger = *config;
+  for (i = 0; i < TRIGGER_HISTORY; i++)
+    history[i] = 0;
+  written = 0;
+  previous = 0;
+  remaining = 0;
+  return 0;
+}
+
+static uint8_t trigger_hit(uint16_t x)
+{
+  switch (trigger.mode) {
+  case TRIGGER_RISING:
+    return previous < trigger.level && x >= trigger.level;
+  case TRIGGER_FALLING:
+    return previous > trigger.level && x <= trigger.level;
+  case TRIGGER_LEVEL:
+    return x >= trigger.level;
+  case TRIGGER_WINDOW:
+    return x < trigger.low || x > trigger.high;
+  }
+  return 0;
+}
+
+uint16_t trigger_stage(uint16_t * buf, uint16_t length)
+{
+  uint16_t i, out = 0;
+  uint16_t x;
+  uint8_t ended = 0;
+  uint32_t ended_started = 0;
+
+  for (i = 0; i < length; i++) {
+    x = buf[i];
+    history[written & HISTORY_MASK] = x;
+
+    if (!remaining && trigger_hit(x)) {
+      stats.triggers++;
+      started = DWT_CYCCNT;
+      remaining = trigger.pre + trigger.post;
+    }
+    if (remaining) {
+      buf[out++] = history[(written - trigger.pre) & HISTORY_MASK];
+      if (--remaining == 0) {
+        stats.windows++;
+        ended = 1;
+        ended_started = started;
+      }
+    }
+
+    previous = x;
+    written++;
+  }
+  stats.samples += out;
+
+  //a window that ended in this buffer is committed as soon as we return
+  if (ended) {
+    stats.latency_last = DWT_CYCCNT - ended_started;
+    if (stats.latency_last > stats.latency_max)
+      stats.latency_max = stats.latency_last;
+  }
+  return out;
+}
+
+void trigger_stats(trigger_stats_t * out)
+{
+  *out = stats;
+  stats.triggers = 0;
+  stats.windows = 0;
+  stats.samples = 0;
+  stats.latency_max = 0;
+}
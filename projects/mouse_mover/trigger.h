@@ -0,0 +1,68 @@
+/**
+ * Oscilloscope-style trigger with pre-trigger capture
+ *
+ * Runs as a buffers.c stage: every sample goes through a delay line of
+ * TRIGGER_HISTORY samples, and only the window around each trigger, pre
+ * samples before it and post from it on, is written back into the buffers.
+ * Anything outside a window is dropped, so buffers can come out short or
+ * empty, and a window can span several of them. The next trigger is looked
+ * for as soon as a window ends.
+ *
+ * Every sample is compared as it passes, so triggers are found to the exact
+ * sample. The compare is a few cycles per sample, cheaper here than the
+ * hardware alternatives: the ADC compare function discards the conversions
+ * that do not match, which would break the DMA stream and the history, and
+ * the CMP0 inputs are not the ADC pins.
+ *
+ * Samples are taken as one unsigned channel; in the dual ADC modes they are
+ * alternately ADC0 and ADC1.
+ */
+#ifndef _TRIGGER_H_
+#define _TRIGGER_H_
+
+#include "arm_cm4.h"
+
+// delay line length; must be a power of two
+#define TRIGGER_HISTORY 512
+
+typedef enum {
+  TRIGGER_RISING,               //crosses level going up
+  TRIGGER_FALLING,              //crosses level going down
+  TRIGGER_LEVEL,                //at or above level
+  TRIGGER_WINDOW                //outside low to high
+} trigger_mode_t;
+
+typedef struct {
+  trigger_mode_t mode;
+  uint16_t level;
+  uint16_t low, high;
+  uint16_t pre;                 //samples kept before the trigger, below TRIGGER_HISTORY
+  uint16_t post;                //samples kept from the trigger on, at least 1
+} trigger_config_t;
+
+/**
+ * Sets the trigger and clears the history. Call with the stage idle.
+ *
+ * @return Zero, or -1 if pre or post is out of range
+ */
+int32_t trigger_init(const trigger_config_t * config);
+
+/**
+ * The stage itself; matches buffers_stage_t
+ */
+uint16_t trigger_stage(uint16_t * buf, uint16_t length);
+
+typedef struct {
+  uint32_t triggers;            //windows started
+  uint32_t windows;             //windows completed
+  uint32_t samples;             //samples kept
+  uint32_t latency_last;        //cycles from trigger to its window's commit
+  uint32_t latency_max;
+} trigger_stats_t;
+
+/**
+ * Copies out and clears the statistics. Call from the stage's context.
+ */
+void trigger_stats(trigger_stats_t * stats);
+
+#endif                          // _TRIGGER_H_
@@ -1,224 +1,71 @@
+/**
+ * USB device core
+ *
+ * Owns the buffer descriptor table, endpoint 0 and the interrupt handler.
+ * Everything product-specific (descriptors, which class drivers are present,
+ * which endpoints they use) comes from usb_descriptors.c and usb_config.h.
+ */
 #include "usb.h"
+#include "usb_dev.h"
 #include "arm_cm4.h"
 
-#include "buffers.h"
-
-/*
- * Endpoint message types and sizes
- */
-
-#define PID_OUT   0x1
-#define PID_IN    0x9
-#define PID_SOF   0x5
-#define PID_SETUP 0xd
-
-#define ENDP0_SIZE 8
-#define ENDP1_SIZE 4
-
 // TODO remove after debugging
 #define LED_ON  GPIOC_PSOR=(1<<5)
 #define LED_OFF GPIOC_PCOR=(1<<5)
 
-/*
- * Struct definitions
- */
-
-typedef struct {
-  union {
-    struct {
-      uint8_t bmRequestType;
-      uint8_t bRequest;
-    };
-    uint16_t wRequestAndType;
-  };
-  uint16_t wValue;
-  uint16_t wIndex;
-  uint16_t wLength;
-} setup_t;
-
-typedef struct {
-  uint8_t bLength;
-  uint8_t bDescriptorType;
-  uint16_t wString[];
-} str_descriptor_t;
-
-typedef struct {
-  uint16_t wValue;
-  uint16_t wIndex;
-  const void *addr;
-  uint8_t length;
-} descriptor_entry_t;
-
-/*
- * Buffer Description Tables
- */
-
-#define BDT_BC_SHIFT   16
-#define BDT_OWN_MASK   0x80
-#define BDT_DATA1_MASK 0x40
-#define BDT_KEEP_MASK  0x20
-#define BDT_NINC_MASK  0x10
-#define BDT_DTS_MASK   0x08
-#define BDT_STALL_MASK 0x04
-
-#define BDT_DESC(count, data) ((count << BDT_BC_SHIFT) | BDT_OWN_MASK | (data ? BDT_DATA1_MASK : 0x00) | BDT_DTS_MASK)
-#define BDT_PID(desc) ((desc >> 2) & 0xF)
-
-// Buffer Descriptor Table entry
-// NOTE: There are two entries per direction per endpoint (4 total)
-typedef struct {
-  uint32_t desc;
-  void *addr;
-} bdt_t;
-
-// we enforce a max of 15 endpoints (15 + 1 control = 16)
-#define USB_N_ENDPOINTS 15
-
-//determines an appropriate BDT index for the given conditions (see fig. 41-3)
-#define RX 0
-#define TX 1
-#define EVEN 0
-#define ODD  1
-#define BDT_INDEX(endpoint, tx, odd) ((endpoint << 2) | (tx << 1) | odd)
-
 // Buffer descriptor table, aligned to a 512-byte boundary (see linker file)
 __attribute__ ((aligned(512), used))
-static bdt_t table[(USB_N_ENDPOINTS + 1) * 4];  //max endpoints is 15 + 1 control
+bdt_t usb_bdt[(USB_N_ENDPOINTS + 1) * 4];  //max endpoints is 15 + 1 control
 
 /*
- * Descriptors
+ * ENDPOINT 0
+ *
+ * Control transfers run through a small state machine:
+ *
+ *   SETUP -> [DATA_IN  ... ] -> STATUS_OUT -> IDLE   (device-to-host data)
+ *   SETUP -> [DATA_OUT ... ] -> STATUS_IN  -> IDLE   (host-to-device data)
+ *   SETUP ------------------->  STATUS_IN  -> IDLE   (no data stage)
+ *
+ * Lengths are 16 bits throughout, so descriptors and data stages of any size
+ * are sent or received in ENDP0_SIZE packets. Standard requests are handled
+ * here; class and vendor requests go to the class driver owning the
+ * interface they are addressed to.
  */
 
-static uint8_t dev_descriptor[] = {
-  18,                           //bLength
-  1,                            //bDescriptorType
-  0x10, 0x01,                   //bcdUSB
-  0x00,                         //bDeviceClass
-  0x00,                         //bDeviceSubClass
-  0x00,                         //bDeviceProtocl
-  ENDP0_SIZE,                   //bMaxPacketSize0
-  0x62, 0x0f,                   //idVendor
-  0x01, 0x10,                   //idProduct
-  0x01, 0x00,                   //bcdDevice
-  1,                            //iManufacturer
-  2,                            //iProduct
-  0,                            //iSerialNumber,
-  1,                            //bNumConfigurations
-};
-
-static uint8_t cfg_descriptor[] = {
-  9,                            //bLength
-  2,                            //bDescriptorType
-  34, 0x00,                     //wTotalLength
-  1,                            //bNumInterfaces
-  1,                            //bConfigurationValue,
-  0,                            //iConfiguration
-  0xa0,                         //bmAttributes (0x80, 0x40 = power, 0x20 = wakeup)
-  50,                           //bMaxPower (50 = 100mA)
-  /* INTERFACE 0 BEGIN */
-  9,                            //bLength
-  4,                            //bDescriptorType
-  0,                            //bInterfaceNumber
-  0,                            //bAlternateSetting
-  2,                            //bNumEndpoints
-  0x03,                         //bInterfaceClass (HID)
-  0x01,                         //bInterfaceSubClass (Boot interface)
-  0x02,                         //bInterfaceProtocol (Mouse)
-  0,                            //iInterface
-  /* INTERFACE 0, HID BEGIN */
-  9,                            //bLength
-  0x21,                         //bDescriptorType (HID)
-  0x10, 0x01,                   //bcdHID
-  0,                            //bCountryCode
-  1,                            //bNumDescriptors
-  34,                           //bDescriptorType (REPORT)
-  52, 0,                        //wDescriptorLength
-  /* INTERFACE 0, ENDPOINT 1 BEGIN */
-  7,                            //bLength
-  5,                            //bDescriptorType (Endpoint)
-  0x81,                         //bEndpointAddress (endpoint 1, in)
-  0x03,                         //bmAttributes (interrupt)
-  ENDP1_SIZE, 0x00,             //wMaxPacketSize
-  0x0a,                         //bInterval (10ms)
-  /* INTERFACE 0, ENDPOINT 1 END */
-  /* INTERFACE 0 END */
-};
-
-static uint8_t report_descriptor[] = {
-  0x05, 0x01,                   // Usage Page (Generic Desktop)
-  0x09, 0x02,                   // Usage (Mouse)
-  0xA1, 0x01,                   // Collection (Application)
-  0x09, 0x01,                   // Usage (Pointer)
-  0xA1, 0x00,                   // Collection (Physical)
-  0x05, 0x09,                   // Usage Page (Buttons)
-  0x19, 0x01,                   // Usage Minimum (01)
-  0x29, 0x05,                   // Usage Maximum (01)
-  0x15, 0x00,                   // Logical Minimum (0)
-  0x25, 0x01,                   // Logical Maximum (1)
-  0x95, 0x05,                   // Report Count (5)
-  0x75, 0x01,                   // Report Size (1)
-  0x81, 0x02,                   // Input (Data, Variable, Absolute)
-  0x95, 0x01,                   // Report Count (1)
-  0x75, 0x03,                   // Report Size (3)
-  0x81, 0x01,                   // Input (Constant) for padding
-  0x05, 0x01,                   // Usage Page (Generic Desktop)
-  0x09, 0x30,                   // Usage (X)
-  0x09, 0x31,                   // Usage (Y)
-  0x09, 0x38,                   // Usage (Wheel)
-  0x15, 0x81,                   // Logical Minimum (-127)
-  0x25, 0x7F,                   // Logical Maximum (127)
-  0x75, 0x08,                   // Report Size (8)
-  0x95, 0x03,                   // Report Count (3)
-  0x81, 0x06,                   // Input (Data, Variable, Relative)
-  0xC0,                         // End Collection (Physical)
-  0xC0                          // End Collection (Application)
-};
-
-static str_descriptor_t lang_descriptor = {
-  .bLength = 4,
-  .bDescriptorType = 3,
-  .wString = {0x0409}           //english (US)
-};
-
-static str_descriptor_t manuf_descriptor = {
-  .bLength = 2 + 12 * 2,
-  .bDescriptorType = 3,
-  .wString = {'M', 'i', 'k', 'e', ' ', 'C', 'l', 'e', 'm', 'e', 'n', 't'}
-};
-
-static str_descriptor_t product_descriptor = {
-  .bLength = 2 + 17 * 2,
-  .bDescriptorType = 3,
-  .wString = {'T', 'e', 'e', 'n', 's', 'y', ' ', 'M', 'o', 'u', 's', 'e',
-              'M', 'o', 'v', 'e', 'r'}
-};
-
-static const descriptor_entry_t descriptors[] = {
-  {0x0100, 0x0000, dev_descriptor, sizeof(dev_descriptor)}
-  ,
-  {0x0200, 0x0000, cfg_descriptor, sizeof(cfg_descriptor)}
-  ,
-  {0x0300, 0x0000, &lang_descriptor, 4}
-  ,
-  {0x0301, 0x0409, &manuf_descriptor, 2 + 12 * 2}
-  ,
-  {0x0302, 0x0409, &product_descriptor, 2 + 17 * 2}
-  ,
-  {0x2200, 0x0000, report_descriptor, sizeof(report_descriptor)}
-  ,
-  {0x0000, 0x0000, NULL, 0}
-};
+typedef enum {
+  EP0_IDLE,
+  EP0_DATA_IN,
+  EP0_DATA_OUT,
+  EP0_STATUS_IN,
+  EP0_STATUS_OUT
+} endp0_state_t;
 
-/*
- * ENDPOINT 0
- */
+volatile uint8_t usb_configured = 0;
+
+// SOF timebase
+static volatile uint32_t usb_frame_count = 0;
+static volatile uint32_t usb_frame_cycles = 0;
+static uint16_t usb_frame_number;       //last 11-bit FRMNUM seen
+static uint8_t usb_frame_synced = 0;
+static usb_sof_callback_t usb_sof_callback = NULL;
+
+// interrupt cost, see usb_irq_stats()
+static usb_irq_stats_t usb_irq_stats_now;
 
 // Receive buffers
 static uint8_t endp0_rx[2][ENDP0_SIZE];
 
-// Send buffers
-static const uint8_t *endp0_tx_dataptr = NULL;  //pointer to current transmit chunk
-static uint16_t endp0_tx_datalen = 0; //length of data remaining to send
+static struct {
+  endp0_state_t state;
+  setup_t setup;                //request being processed
+  const request_entry_t *request; //class or vendor entry, if any
+  const uint8_t *tx_ptr;        //next chunk to send, NULL when all queued
+  uint16_t tx_remaining;        //bytes left to queue
+  uint8_t tx_zlp;               //end the data stage with a zero length packet
+  uint8_t tx_pending;           //packets owned by the USB module
+  uint8_t *rx_ptr;              //where the next OUT data goes
+  uint16_t rx_remaining;        //bytes of OUT data still expected
+} endp0;
 
 // NOTE: used in interrupt handler below, need to be global
 static uint8_t endp0_odd, endp0_data = 0;
@@ -226,245 +73,342 @@ static uint8_t endp0_odd, endp0_data = 0;
 // Transmit some data
 static void usb_endp0_transmit(const void *data, uint8_t length)
 {
-  table[BDT_INDEX(0, TX, endp0_odd)].addr = (void *) data;
-  table[BDT_INDEX(0, TX, endp0_odd)].desc = BDT_DESC(length, endp0_data);
+  usb_bdt[BDT_INDEX(0, TX, endp0_odd)].addr = (void *) data;
+  usb_bdt[BDT_INDEX(0, TX, endp0_odd)].desc = BDT_DESC(length, endp0_data);
   //toggle the odd and data bits
   endp0_odd ^= 1;
   endp0_data ^= 1;
+  endp0.tx_pending++;
 }
 
-// Setup handler
-static void usb_endp0_handle_setup(setup_t * packet)
+// Queue data stage packets until both ping-pong entries are busy
+static void usb_endp0_fill(void)
 {
-  const descriptor_entry_t *entry;
-  const uint8_t *data = NULL;
-  uint8_t data_length = 0;
-  uint32_t size = 0;
-
-  switch (packet->wRequestAndType) {
-  case 0x0500:                 //set address (wait for IN packet)
-    break;
-  case 0x0900:                 //set configuration
-    //we only have one configuration at this time
-    break;
-  case 0x0680:                 //get descriptor
-  case 0x0681:
-    for (entry = descriptors; 1; entry++) {
-      if (entry->addr == NULL)
-        break;
-
-      if (packet->wValue == entry->wValue
-          && packet->wIndex == entry->wIndex) {
-        //this is the descriptor to send
-        data = entry->addr;
-        data_length = entry->length;
-        goto send;
-      }
-    }
-    goto stall;
-    break;
-  default:
-    goto stall;
+  uint32_t size;
+
+  while (endp0.tx_pending < 2 && endp0.tx_ptr) {
+    size = endp0.tx_remaining;
+    if (size > ENDP0_SIZE)
+      size = ENDP0_SIZE;
+    usb_endp0_transmit(endp0.tx_ptr, size);
+    endp0.tx_ptr += size;
+    endp0.tx_remaining -= size;
+
+    //a short packet ends the stage; a full one only if nothing else follows
+    if (size < ENDP0_SIZE || (endp0.tx_remaining == 0 && !endp0.tx_zlp))
+      endp0.tx_ptr = NULL;
   }
+}
 
-  //if we are sent here, we need to send some data
-send:
-  //truncate the data length to whatever the setup packet is expecting
-  if (data_length > packet->wLength)
-    data_length = packet->wLength;
-
-  //transmit 1st chunk
-  size = data_length;
-  if (size > ENDP0_SIZE)
-    size = ENDP0_SIZE;
-  usb_endp0_transmit(data, size);
-  data += size;                 //move the pointer down
-  data_length -= size;          //move the size down
-  if (data_length == 0 && size < ENDP0_SIZE)
-    return;                     //all done!
-
-  //transmit 2nd chunk
-  size = data_length;
-  if (size > ENDP0_SIZE)
-    size = ENDP0_SIZE;
-  usb_endp0_transmit(data, size);
-  data += size;                 //move the pointer down
-  data_length -= size;          //move the size down
-  if (data_length == 0 && size < ENDP0_SIZE)
-    return;                     //all done!
-
-  //if any data remains to be transmitted, we need to store it
-  endp0_tx_dataptr = data;
-  endp0_tx_datalen = data_length;
-  return;
-
-  //if we make it here, we are not able to send data and have stalled
-stall:
+static void usb_endp0_stall(void)
+{
+  endp0.state = EP0_IDLE;
   USB0_ENDPT0 =
       USB_ENDPT_EPSTALL_MASK | USB_ENDPT_EPRXEN_MASK |
       USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPHSHK_MASK;
 }
 
-// Endpoint 0 handler
-void usb_endp0_handler(uint8_t stat)
+// Calls every class driver's configure hook
+static void usb_configure(uint8_t config)
 {
-  static setup_t last_setup;
+  const usb_class_t *const *c;
+  uint8_t i;
+
+  //every endpoint starts over on EVEN; endpoint 0 has nothing in flight
+  USB0_CTL |= USB_CTL_ODDRST_MASK;
+  endp0_odd = 0;
+
+  usb_configured = config;
+  for (i = 0; i < usb_n_interfaces; i++)
+    usb_alt_settings[i] = 0;
+  for (c = usb_classes; *c != NULL; c++)
+    (*c)->configure(config);
+}
 
-  const uint8_t *data = NULL;
-  uint32_t size = 0;
+// Selects an alternate setting; returns nonzero if it exists
+static uint8_t usb_set_interface(uint8_t interface, uint8_t alt)
+{
+  const usb_class_t *owner;
 
-  //determine which bdt we are looking at here
-  bdt_t *bdt =
-      &table[BDT_INDEX(0, (stat & USB_STAT_TX_MASK) >> USB_STAT_TX_SHIFT,
-                       (stat & USB_STAT_ODD_MASK) >> USB_STAT_ODD_SHIFT)];
+  if (interface >= usb_n_interfaces)
+    return 0;
 
-  switch (BDT_PID(bdt->desc)) {
-  case PID_SETUP:
-    //extract the setup token
-    last_setup = *((setup_t *) (bdt->addr));
+  owner = usb_interfaces[interface];
+  if (owner->set_interface == NULL) {
+    if (alt != 0)
+      return 0;
+  } else if (!owner->set_interface(interface, alt)) {
+    return 0;
+  }
 
-    //we are now done with the buffer
-    bdt->desc = BDT_DESC(ENDP0_SIZE, 1);
+  usb_alt_settings[interface] = alt;
+  return 1;
+}
 
-    //clear any pending IN stuff
-    table[BDT_INDEX(0, TX, EVEN)].desc = 0;
-    table[BDT_INDEX(0, TX, ODD)].desc = 0;
-    endp0_data = 1;
+// Class-specific descriptor owned by an interface, or NULL
+static const descriptor_entry_t *usb_class_descriptor(const setup_t *
+                                                      packet)
+{
+  const descriptor_entry_t *entry;
 
-    //cast the data into our setup type and run the setup
-    usb_endp0_handle_setup(&last_setup);  //&last_setup);
+  if (packet->wIndex >= usb_n_interfaces)
+    return NULL;
 
-    //unfreeze this endpoint
-    USB0_CTL = USB_CTL_USBENSOFEN_MASK;
-    break;
-  case PID_IN:
-    //continue sending any pending transmit data
-    data = endp0_tx_dataptr;
-    if (data) {
-      size = endp0_tx_datalen;
-      if (size > ENDP0_SIZE)
-        size = ENDP0_SIZE;
-      usb_endp0_transmit(data, size);
-      data += size;
-      endp0_tx_datalen -= size;
-      endp0_tx_dataptr = (endp0_tx_datalen > 0
-                          || size == ENDP0_SIZE) ? data : NULL;
-    }
+  entry = usb_interfaces[packet->wIndex]->descriptors;
+  for (; entry && entry->addr != NULL; entry++) {
+    if (packet->wValue == entry->wValue && packet->wIndex == entry->wIndex)
+      return entry;
+  }
+  return NULL;
+}
 
-    if (last_setup.wRequestAndType == 0x0500) {
-      USB0_ADDR = last_setup.wValue;
+// Standard requests; returns nonzero if the request was accepted
+static uint8_t usb_endp0_standard(const setup_t * packet,
+                                  const uint8_t ** data, uint16_t * length)
+{
+  static uint8_t reply[2];
+  const descriptor_entry_t *entry;
+  const usb_class_t *const *c;
+  uint8_t index = packet->wValue & 0xff;
+
+  switch (packet->wRequestAndType) {
+  case 0x0080:                 //get status (device)
+  case 0x0081:                 //get status (interface)
+    reply[0] = reply[1] = 0;
+    *data = reply;
+    *length = 2;
+    return 1;
+  case 0x0082:                 //get status (endpoint), bit 0 is halt
+    reply[0] = (USB_ENDPT_REG(USB0_BASE_PTR, packet->wIndex & 0x0f) &
+                USB_ENDPT_EPSTALL_MASK) ? 1 : 0;
+    reply[1] = 0;
+    *data = reply;
+    *length = 2;
+    return 1;
+  case 0x0102:                 //clear feature (endpoint halt)
+    if (packet->wValue != 0 || (packet->wIndex & 0x0f) == 0)
+      return 1;
+    USB_ENDPT_REG(USB0_BASE_PTR, packet->wIndex & 0x0f) &=
+        ~USB_ENDPT_EPSTALL_MASK;
+    //the host restarts the endpoint at DATA0, so must we
+    for (c = usb_classes; *c != NULL; c++) {
+      if ((*c)->clear_halt)
+        (*c)->clear_halt(packet->wIndex & 0x8f);
     }
-    break;
-  case PID_OUT:
-    //nothing to do here..just give the buffer back
-    bdt->desc = BDT_DESC(ENDP0_SIZE, 1);
-    break;
-  case PID_SOF:
-    break;
+    return 1;
+  case 0x0302:                 //set feature (endpoint halt)
+    if (packet->wValue != 0 || (packet->wIndex & 0x0f) == 0)
+      return 1;
+    USB_ENDPT_REG(USB0_BASE_PTR, packet->wIndex & 0x0f) |=
+        USB_ENDPT_EPSTALL_MASK;
+    return 1;
+  case 0x0500:                 //set address (applied after the status stage)
+    return 1;
+  case 0x0680:                 //get descriptor
+  case 0x0681:
+    switch (packet->wValue >> 8) {
+    case 1:                    //device
+      *data = dev_descriptor;
+      *length = dev_descriptor[0];
+      return 1;
+    case 2:                    //configuration
+      *data = cfg_descriptor;
+      *length = cfg_descriptor[2] | (cfg_descriptor[3] << 8);
+      return index == 0;
+    case 3:                    //string
+      if (index >= usb_n_str_descriptors)
+        return 0;
+      *data = (const uint8_t *) str_descriptors[index];
+      *length = str_descriptors[index]->bLength;
+      return 1;
+    default:                   //class-specific, ask the interface
+      entry = usb_class_descriptor(packet);
+      if (entry == NULL)
+        return 0;
+      *data = entry->addr;
+      *length = entry->length;
+      return 1;
+    }
+  case 0x0880:                 //get configuration
+    reply[0] = usb_configured;
+    *data = reply;
+    *length = 1;
+    return 1;
+  case 0x0900:                 //set configuration
+    //we only have one configuration at this time
+    if (packet->wValue > 1)
+      return 0;
+    usb_configure(packet->wValue);
+    return 1;
+  case 0x0a81:                 //get interface
+    if (packet->wIndex >= usb_n_interfaces)
+      return 0;
+    reply[0] = usb_alt_settings[packet->wIndex];
+    *data = reply;
+    *length = 1;
+    return 1;
+  case 0x0b01:                 //set interface
+    return usb_set_interface(packet->wIndex, packet->wValue);
+  default:
+    return 0;
   }
-
-  USB0_CTL = USB_CTL_USBENSOFEN_MASK;
 }
 
-/*
- * ENDPOINT 1
- */
+// Setup handler
+static void usb_endp0_handle_setup(const setup_t * packet)
+{
+  const request_entry_t *entry = NULL;
+  uint8_t *data = NULL;
+  uint16_t length = 0;
+  uint8_t ok = 0;
+  uint8_t interface = packet->wIndex & 0xff;
+
+  endp0.request = NULL;
+  if (packet->bmRequestType & 0x60) {
+    //class or vendor request, handled by the class owning the interface
+    if ((packet->bmRequestType & 0x1f) == 0x01 && interface < usb_n_interfaces)
+      entry = usb_interfaces[interface]->requests;
+    for (; entry && entry->handler != NULL; entry++) {
+      if (entry->wRequestAndType == packet->wRequestAndType) {
+        endp0.request = entry;
+        ok = entry->handler(packet, &data, &length);
+        break;
+      }
+    }
+  } else {
+    ok = usb_endp0_standard(packet, (const uint8_t **) &data, &length);
+  }
 
-static uint8_t endp1_rx[2][ENDP1_SIZE];
+  if (!ok) {
+    usb_endp0_stall();
+    return;
+  }
 
-static uint8_t endp1_odd, endp1_data = 0;
+  //never move more than the host asked for
+  if (length > packet->wLength)
+    length = packet->wLength;
+
+  if (packet->wLength == 0) {
+    //no data stage, acknowledge straight away
+    endp0.state = EP0_STATUS_IN;
+    usb_endp0_transmit(NULL, 0);
+  } else if (packet->bmRequestType & 0x80) {
+    //device-to-host data stage
+    endp0.state = EP0_DATA_IN;
+    endp0.tx_ptr = data;
+    endp0.tx_remaining = length;
+    endp0.tx_zlp = (length < packet->wLength && length % ENDP0_SIZE == 0);
+    usb_endp0_fill();
+  } else {
+    //host-to-device data stage
+    endp0.state = EP0_DATA_OUT;
+    endp0.rx_ptr = data;
+    endp0.rx_remaining = length;
+  }
+}
 
-static void usb_endp1_transmit(const void *data, uint8_t length)
+uint8_t usb_tx_restart(uint8_t endpoint, uint8_t odd, uint8_t pending)
 {
-  table[BDT_INDEX(1, TX, endp1_odd)].addr = (void *) data;
-  table[BDT_INDEX(1, TX, endp1_odd)].desc = BDT_DESC(length, endp1_data);
-  //toggle the odd and data bits
-  endp1_odd ^= 1;
-  endp1_data ^= 1;
+  bdt_t *bdt;
+  uint8_t i;
+
+  //the oldest packet is in the descriptor queued first
+  odd ^= pending & 1;
+  for (i = 0; i < pending; i++) {
+    bdt = &usb_bdt[BDT_INDEX(endpoint, TX, odd)];
+    bdt->desc = (bdt->desc & ~BDT_DATA1_MASK) | ((i & 1) ? BDT_DATA1_MASK : 0);
+    odd ^= 1;
+  }
+  return pending & 1;
 }
 
-// Endpoint 1 handler
-void usb_endp1_handler(uint8_t stat)
+// Endpoint 0 handler
+void usb_endp0_handler(uint8_t stat)
 {
-  static uint8_t report[] = {0x00, 0x01, 0x00, 0x00};
+  const uint8_t *data;
+  uint32_t size, i;
+  uint8_t odd = (stat & USB_STAT_ODD_MASK) >> USB_STAT_ODD_SHIFT;
 
   //determine which bdt we are looking at here
   bdt_t *bdt =
-      &table[BDT_INDEX(1, (stat & USB_STAT_TX_MASK) >> USB_STAT_TX_SHIFT,
-                       (stat & USB_STAT_ODD_MASK) >> USB_STAT_ODD_SHIFT)];
+      &usb_bdt[BDT_INDEX(0, (stat & USB_STAT_TX_MASK) >> USB_STAT_TX_SHIFT,
+                       odd)];
 
   switch (BDT_PID(bdt->desc)) {
   case PID_SETUP:
-    break;
-  case PID_SOF:
+    //extract the setup token
+    endp0.setup = *((setup_t *) (bdt->addr));
+
+    //the next OUT (data or status) is DATA1 and lands in the other buffer,
+    //the one after that is DATA0 and lands in this one
+    bdt->desc = BDT_DESC(ENDP0_SIZE, 0);
+    usb_bdt[BDT_INDEX(0, RX, odd ^ 1)].desc = BDT_DESC(ENDP0_SIZE, 1);
+
+    //clear any pending IN stuff; packets never sent did not move the
+    //ping-pong pointer
+    usb_bdt[BDT_INDEX(0, TX, EVEN)].desc = 0;
+    usb_bdt[BDT_INDEX(0, TX, ODD)].desc = 0;
+    endp0_odd ^= endp0.tx_pending & 1;
+    endp0_data = 1;
+    endp0.tx_ptr = NULL;
+    endp0.tx_pending = 0;
+
+    usb_endp0_handle_setup(&endp0.setup);
+
+    //unfreeze this endpoint
+    USB0_CTL = USB_CTL_USBENSOFEN_MASK;
     break;
   case PID_IN:
-    usb_endp1_transmit(report, sizeof(report));
+    if (endp0.tx_pending)
+      endp0.tx_pending--;
+
+    if (endp0.state == EP0_DATA_IN) {
+      usb_endp0_fill();
+      if (endp0.tx_ptr == NULL && endp0.tx_pending == 0)
+        endp0.state = EP0_STATUS_OUT;
+    } else if (endp0.state == EP0_STATUS_IN) {
+      //the host has our acknowledgement, the request is complete
+      if (endp0.setup.wRequestAndType == 0x0500)
+        USB0_ADDR = endp0.setup.wValue;
+      endp0.state = EP0_IDLE;
+    }
     break;
   case PID_OUT:
-    bdt->desc = BDT_DESC(ENDP1_SIZE, 1);
+    if (endp0.state == EP0_DATA_OUT) {
+      data = bdt->addr;
+      size = BDT_BC(bdt->desc);
+      if (size > endp0.rx_remaining)
+        size = endp0.rx_remaining;
+      for (i = 0; i < size; i++)
+        endp0.rx_ptr[i] = data[i];
+      endp0.rx_ptr += size;
+      endp0.rx_remaining -= size;
+
+      if (endp0.rx_remaining == 0 || BDT_BC(bdt->desc) < ENDP0_SIZE) {
+        if (endp0.request && endp0.request->complete)
+          endp0.request->complete(&endp0.setup);
+        endp0.state = EP0_STATUS_IN;
+        usb_endp0_transmit(NULL, 0);
+      }
+    } else {
+      //status stage of an IN transfer (possibly cut short by the host)
+      usb_bdt[BDT_INDEX(0, TX, EVEN)].desc = 0;
+      usb_bdt[BDT_INDEX(0, TX, ODD)].desc = 0;
+      endp0_odd ^= endp0.tx_pending & 1;
+      endp0.tx_ptr = NULL;
+      endp0.tx_pending = 0;
+      endp0.state = EP0_IDLE;
+    }
+    //give the buffer back; the packet after next has the same toggle
+    bdt->desc = BDT_DESC(ENDP0_SIZE, bdt->desc & BDT_DATA1_MASK);
+    break;
+  case PID_SOF:
     break;
   }
-}
-
-/*
- * Register endpoint handlers
- */
 
-static void (*handlers[16]) (uint8_t) = {
-  usb_endp0_handler,
-  usb_endp1_handler,
-  usb_endp2_handler,
-  usb_endp3_handler,
-  usb_endp4_handler,
-  usb_endp5_handler,
-  usb_endp6_handler,
-  usb_endp7_handler,
-  usb_endp8_handler,
-  usb_endp9_handler,
-  usb_endp10_handler,
-  usb_endp11_handler,
-  usb_endp12_handler,
-  usb_endp13_handler,
-  usb_endp14_handler,
-  usb_endp15_handler,
-};
-
-// Default handler for USB endpoints that does nothing
-static void usb_endp_default_handler(uint8_t stat)
-{
+  USB0_CTL = USB_CTL_USBENSOFEN_MASK;
 }
 
-// weak aliases as "defaults" for the usb endpoint handlers
-void usb_endp2_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp3_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp4_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp5_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp6_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp7_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp8_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp9_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp10_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp11_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp12_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp13_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp14_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-void usb_endp15_handler(uint8_t)
-    __attribute__ ((weak, alias("usb_endp_default_handler")));
-
 /*
  * Device initialization
  */
@@ -473,10 +417,14 @@ void usb_init(void)
 {
   uint32_t i;
 
+  //SOF timestamps come from the cycle counter
+  DEMCR |= DEMCR_TRCENA_MASK;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
   //reset the buffer descriptors
   for (i = 0; i < (USB_N_ENDPOINTS + 1) * 4; i++) {
-    table[i].desc = 0;
-    table[i].addr = 0;
+    usb_bdt[i].desc = 0;
+    usb_bdt[i].addr = 0;
   }
 
   //1: Select clock source
@@ -491,9 +439,9 @@ void usb_init(void)
   while (USB0_USBTRC0 & USB_USBTRC0_USBRESET_MASK) ;
 
   //4: Set BDT base registers
-  USB0_BDTPAGE1 = ((uint32_t) table) >> 8;  //bits 15-9
-  USB0_BDTPAGE2 = ((uint32_t) table) >> 16; //bits 23-16
-  USB0_BDTPAGE3 = ((uint32_t) table) >> 24; //bits 31-24
+  USB0_BDTPAGE1 = ((uint32_t) usb_bdt) >> 8;  //bits 15-9
+  USB0_BDTPAGE2 = ((uint32_t) usb_bdt) >> 16; //bits 23-16
+  USB0_BDTPAGE3 = ((uint32_t) usb_bdt) >> 24; //bits 31-24
 
   //5: Clear all ISR flags and enable weak pull downs
   USB0_ISTAT = 0xFF;
@@ -513,14 +461,57 @@ void usb_init(void)
   USB0_CONTROL = USB_CONTROL_DPPULLUPNONOTG_MASK;
 }
 
+/*
+ * SOF timebase
+ */
+
+// Advances the frame counter and timestamps the frame. The counter follows
+// the 11-bit frame number in the SOF packet, so frames whose interrupt we
+// were too busy to see are still counted.
+static void usb_sof(void)
+{
+  uint32_t cycles = DWT_CYCCNT;
+  uint16_t number = (USB0_FRMNUMH << 8) | USB0_FRMNUML;
+
+  if (usb_frame_synced)
+    usb_frame_count += (number - usb_frame_number) & 0x7ff;
+  else
+    usb_frame_count++;
+  usb_frame_number = number;
+  usb_frame_synced = 1;
+  usb_frame_cycles = cycles;
+
+  if (usb_sof_callback)
+    usb_sof_callback(usb_frame_count, cycles);
+}
+
+uint32_t usb_frame(uint32_t * cycles)
+{
+  uint32_t frame;
+
+  DisableInterrupts;
+  frame = usb_frame_count;
+  if (cycles)
+    *cycles = usb_frame_cycles;
+  EnableInterrupts;
+  return frame;
+}
+
+void usb_sof_handler(usb_sof_callback_t callback)
+{
+  usb_sof_callback = callback;
+}
+
 /*
  * USB interrupt handler
  */
 
-void USBOTG_IRQHandler(void)
+static void usb_irq(void)
 {
+  const usb_class_t *const *c;
   uint8_t status;
-  uint8_t stat, endpoint;
+  uint8_t stat;
+  uint32_t start, cycles;
 
   status = USB0_ISTAT;
 
@@ -530,21 +521,21 @@ void USBOTG_IRQHandler(void)
     //initialize endpoint 0 ping-pong buffers
     USB0_CTL |= USB_CTL_ODDRST_MASK;
     endp0_odd = 0;
-    table[BDT_INDEX(0, RX, EVEN)].desc = BDT_DESC(ENDP0_SIZE, 0);
-    table[BDT_INDEX(0, RX, EVEN)].addr = endp0_rx[0];
-    table[BDT_INDEX(0, RX, ODD)].desc = BDT_DESC(ENDP0_SIZE, 0);
-    table[BDT_INDEX(0, RX, ODD)].addr = endp0_rx[1];
-    table[BDT_INDEX(0, TX, EVEN)].desc = 0;
-    table[BDT_INDEX(0, TX, ODD)].desc = 0;
-
-    //initialize endpoint 1 buffers
-    endp1_odd = 0;
-    table[BDT_INDEX(1, RX, EVEN)].desc = BDT_DESC(ENDP1_SIZE, 0);
-    table[BDT_INDEX(1, RX, EVEN)].addr = endp1_rx[0];
-    table[BDT_INDEX(1, RX, ODD)].desc = BDT_DESC(ENDP1_SIZE, 0);
-    table[BDT_INDEX(1, RX, ODD)].addr = endp1_rx[1];
-    table[BDT_INDEX(1, TX, EVEN)].desc = 0;
-    table[BDT_INDEX(1, TX, ODD)].desc = 0;
+    endp0.state = EP0_IDLE;
+    endp0.tx_ptr = NULL;
+    endp0.tx_pending = 0;
+    usb_bdt[BDT_INDEX(0, RX, EVEN)].desc = BDT_DESC(ENDP0_SIZE, 0);
+    usb_bdt[BDT_INDEX(0, RX, EVEN)].addr = endp0_rx[0];
+    usb_bdt[BDT_INDEX(0, RX, ODD)].desc = BDT_DESC(ENDP0_SIZE, 0);
+    usb_bdt[BDT_INDEX(0, RX, ODD)].addr = endp0_rx[1];
+    usb_bdt[BDT_INDEX(0, TX, EVEN)].desc = 0;
+    usb_bdt[BDT_INDEX(0, TX, ODD)].desc = 0;
+
+    //class endpoints stay disabled until the host configures us
+    usb_configure(0);
+
+    //the frame number restarts, resync the frame counter on the next SOF
+    usb_frame_synced = 0;
 
     //initialize endpoint0 to 0x0d (41.5.23)
     //transmit, recieve, and handshake
@@ -552,12 +543,6 @@ void USBOTG_IRQHandler(void)
         USB_ENDPT_EPRXEN_MASK | USB_ENDPT_EPTXEN_MASK |
         USB_ENDPT_EPHSHK_MASK;
 
-    // TODO determine if USB_ENDPT_EPHSHK_MASK should be set
-    // Without it, endpoint1 requests appear to come in but are not processed
-    // With it, the first request comes in, and then traffic stalls (crashes?)
-    USB0_ENDPT1 =
-        USB_ENDPT_EPRXEN_MASK | USB_ENDPT_EPTXEN_MASK;
-
     //clear all interrupts...this is a reset
     USB0_ERRSTAT = 0xff;
     USB0_ISTAT = 0xff;
@@ -580,6 +565,11 @@ void USBOTG_IRQHandler(void)
   }
   if (status & USB_ISTAT_SOFTOK_MASK) {
     //handle start of frame token
+    usb_sof();
+    for (c = usb_classes; *c != NULL; c++) {
+      if ((*c)->sof)
+        (*c)->sof();
+    }
     USB0_ISTAT = USB_ISTAT_SOFTOK_MASK;
   }
 
@@ -587,8 +577,13 @@ void USBOTG_IRQHandler(void)
   while (status & USB_ISTAT_TOKDNE_MASK) {
     //handle completion of current token being processed
     stat = USB0_STAT;
-    endpoint = stat >> 4;
-    handlers[endpoint & 0xf] (stat);
+    start = DWT_CYCCNT;
+    usb_endp_handlers[stat >> 4] (stat);
+    cycles = DWT_CYCCNT - start;
+    usb_irq_stats_now.tokens++;
+    usb_irq_stats_now.token_cycles += cycles;
+    if (cycles > usb_irq_stats_now.endp_max[stat >> 4])
+      usb_irq_stats_now.endp_max[stat >> 4] = cycles;
 
     USB0_ISTAT = USB_ISTAT_TOKDNE_MASK;
     status = USB0_ISTAT;
@@ -604,3 +599,31 @@ void USBOTG_IRQHandler(void)
     USB0_ISTAT = USB_ISTAT_STALL_MASK;
   }
 }
+
+void USBOTG_IRQHandler(void)
+{
+  uint32_t start = DWT_CYCCNT;
+  uint32_t cycles;
+
+  usb_irq();
+
+  cycles = DWT_CYCCNT - start;
+  usb_irq_stats_now.calls++;
+  usb_irq_stats_now.cycles += cycles;
+  if (cycles > usb_irq_stats_now.max)
+    usb_irq_stats_now.max = cycles;
+}
+
+void usb_irq_stats(usb_irq_stats_t * stats)
+{
+  uint32_t i;
+
+  DisableInterrupts;
+  *stats = usb_irq_stats_now;
+  usb_irq_stats_now.calls = usb_irq_stats_now.cycles = 0;
+  usb_irq_stats_now.max = 0;
+  usb_irq_stats_now.tokens = usb_irq_stats_now.token_cycles = 0;
+  for (i = 0; i <= USB_N_ENDPOINTS; i++)
+    usb_irq_stats_now.endp_max[i] = 0;
+  EnableInterrupts;
+}
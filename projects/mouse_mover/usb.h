@@ -6,27 +6,50 @@
 #define _USB_H_
 
 #include "arm_cm4.h"
+#include "usb_cdc.h"
 
 /**
  * Initializes the USB module
  */
 void usb_init(void);
 
-void usb_endp0_handler(uint8_t);
-void usb_endp1_handler(uint8_t);
-void usb_endp2_handler(uint8_t);
-void usb_endp3_handler(uint8_t);
-void usb_endp4_handler(uint8_t);
-void usb_endp5_handler(uint8_t);
-void usb_endp6_handler(uint8_t);
-void usb_endp7_handler(uint8_t);
-void usb_endp8_handler(uint8_t);
-void usb_endp9_handler(uint8_t);
-void usb_endp10_handler(uint8_t);
-void usb_endp11_handler(uint8_t);
-void usb_endp12_handler(uint8_t);
-void usb_endp13_handler(uint8_t);
-void usb_endp14_handler(uint8_t);
-void usb_endp15_handler(uint8_t);
+/**
+ * Called from the USB interrupt on every start of frame with the frame
+ * counter and the DWT cycle count at which the SOF was serviced
+ */
+typedef void (*usb_sof_callback_t) (uint32_t frame, uint32_t cycles);
+
+/**
+ * Returns the 1 ms frame counter, which counts host frames since power up.
+ * It only advances while the host is sending SOFs (not while suspended).
+ *
+ * @param cycles If not NULL, filled with the DWT cycle count of the last SOF
+ */
+uint32_t usb_frame(uint32_t * cycles);
+
+/**
+ * Sets the function called on every start of frame, or NULL for none
+ */
+void usb_sof_handler(usb_sof_callback_t callback);
+
+/**
+ * Cost of the USB interrupt in core clock cycles (DWT CYCCNT), including
+ * the cycle counter reads themselves. Token figures cover the endpoint
+ * handler dispatched for each completed token, and are broken down by
+ * endpoint number so a slow class driver stands out.
+ */
+typedef struct {
+  uint32_t calls;               //USBOTG_IRQHandler invocations
+  uint32_t cycles;              //total over all calls
+  uint32_t max;                 //longest single call
+  uint32_t tokens;              //tokens handled
+  uint32_t token_cycles;        //total spent in endpoint handlers
+  uint32_t endp_max[16];        //longest handler run, by endpoint
+} usb_irq_stats_t;
+
+/**
+ * Copies out and clears the interrupt cost counters
+ */
+void usb_irq_stats(usb_irq_stats_t * stats);
 
 #endif                          // _USB_H_
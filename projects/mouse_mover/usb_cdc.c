@@ -0,0 +1,320 @@
+/**
+ * CDC-ACM virtual serial port class driver
+ *
+ * The notification endpoint is never used (it just NAKs). The data OUT and
+ * data IN endpoints each use both their EVEN and ODD buffer descriptors.
+ *
+ * The two receive packet buffers come from the slab allocator while the
+ * device is configured.
+ *
+ * Transmit data is queued in a ring and sent from the ring in place; each
+ * in-flight packet is a contiguous run of the ring that is only released once
+ * the IN completes. Received packets are copied into a second ring. When that
+ * ring cannot take another full packet, the buffer descriptor is not handed
+ * back and the host is NAKed until usb_cdc_read() makes room.
+ */
+#include "usb_cdc.h"
+#include "usb_config.h"
+#include "slab.h"
+
+#define EP_NOTIFY USB_CDC_ENDPOINT
+#define EP_OUT    (USB_CDC_ENDPOINT + 1)
+#define EP_IN     (USB_CDC_ENDPOINT + 2)
+
+#define CDC_TX_SIZE 512         //must be a power of two
+#define CDC_RX_SIZE 256         //must be a power of two
+
+// CDC line coding: dwDTERate, bCharFormat, bParityType, bDataBits
+static uint8_t cdc_line_coding[7] = {0x00, 0xc2, 0x01, 0x00, 0, 0, 8};
+static uint16_t cdc_line_state = 0; //DTR (bit 0) and RTS (bit 1)
+
+static volatile uint8_t cdc_tx_ring[CDC_TX_SIZE];
+static volatile uint32_t cdc_tx_head = 0; //next byte written by the application
+static volatile uint32_t cdc_tx_queued = 0; //next byte handed to the USB module
+static volatile uint32_t cdc_tx_tail = 0; //oldest byte not yet acknowledged
+static uint16_t cdc_tx_len[2];           //length of each in-flight packet
+static uint8_t cdc_tx_pending = 0;       //packets owned by the USB module
+static uint8_t cdc_tx_zlp = 0;           //last packet was full, end the transfer
+
+static volatile uint8_t cdc_rx_ring[CDC_RX_SIZE];
+static volatile uint32_t cdc_rx_head = 0;
+static volatile uint32_t cdc_rx_tail = 0;
+static uint8_t cdc_rx_held = 0;          //mask of RX descriptors we are holding
+static uint8_t cdc_rx_odd = 0;           //descriptor the next packet lands in
+static uint8_t cdc_rx_data = 0;          //toggle of the next packet
+
+// receive packet buffers, taken from the slab while configured
+static uint8_t *cdc_rx[2];
+
+static uint8_t cdc_tx_odd, cdc_tx_data = 0;
+
+/*
+ * Class requests
+ */
+
+static uint8_t cdc_set_line_coding(const setup_t * setup, uint8_t ** data,
+                                   uint16_t * length)
+{
+  *data = cdc_line_coding;
+  *length = sizeof(cdc_line_coding);
+  return 1;
+}
+
+static uint8_t cdc_get_line_coding(const setup_t * setup, uint8_t ** data,
+                                   uint16_t * length)
+{
+  *data = cdc_line_coding;
+  *length = sizeof(cdc_line_coding);
+  return 1;
+}
+
+static uint8_t cdc_set_control_line_state(const setup_t * setup,
+                                          uint8_t ** data, uint16_t * length)
+{
+  cdc_line_state = setup->wValue;
+  return 1;
+}
+
+static const request_entry_t requests[] = {
+  {0x2021, cdc_set_line_coding, NULL},
+  {0x21a1, cdc_get_line_coding, NULL},
+  {0x2221, cdc_set_control_line_state, NULL},
+  {0x0000, NULL, NULL}
+};
+
+/*
+ * Endpoints
+ */
+
+// Hand one receive buffer (EVEN or ODD) back to the USB module. Packets
+// alternate between the two, so the one after next takes the other toggle.
+static void usb_cdc_rx_release(uint8_t odd)
+{
+  usb_bdt[BDT_INDEX(EP_OUT, RX, odd)].addr = cdc_rx[odd];
+  usb_bdt[BDT_INDEX(EP_OUT, RX, odd)].desc =
+      BDT_DESC(USB_CDC_PACKET_SIZE, cdc_rx_data ^ (odd != cdc_rx_odd));
+}
+
+static void usb_cdc_transmit(const void *data, uint8_t length)
+{
+  usb_bdt[BDT_INDEX(EP_IN, TX, cdc_tx_odd)].addr = (void *) data;
+  usb_bdt[BDT_INDEX(EP_IN, TX, cdc_tx_odd)].desc =
+      BDT_DESC(length, cdc_tx_data);
+  //toggle the odd and data bits
+  cdc_tx_odd ^= 1;
+  cdc_tx_data ^= 1;
+}
+
+// Queue ring data until both ping-pong entries are busy
+static void usb_cdc_tx_fill(void)
+{
+  uint32_t start, size;
+
+  while (cdc_tx_pending < 2) {
+    size = cdc_tx_head - cdc_tx_queued;
+    if (size == 0 && !cdc_tx_zlp)
+      break;
+
+    //packets never wrap around the end of the ring
+    start = cdc_tx_queued & (CDC_TX_SIZE - 1);
+    if (size > CDC_TX_SIZE - start)
+      size = CDC_TX_SIZE - start;
+    if (size > USB_CDC_PACKET_SIZE)
+      size = USB_CDC_PACKET_SIZE;
+
+    usb_cdc_transmit((const void *) &cdc_tx_ring[start], size);
+    cdc_tx_len[cdc_tx_pending] = size;
+    cdc_tx_queued += size;
+    cdc_tx_pending++;
+    cdc_tx_zlp = (size == USB_CDC_PACKET_SIZE);
+  }
+}
+
+static void usb_cdc_configure(uint8_t config)
+{
+  usb_bdt[BDT_INDEX(EP_NOTIFY, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_NOTIFY, TX, ODD)].desc = 0;
+
+  usb_bdt[BDT_INDEX(EP_OUT, RX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, ODD)].desc = 0;
+  cdc_rx_held = 0;
+  cdc_rx_odd = cdc_rx_data = 0;
+  cdc_rx_head = cdc_rx_tail = 0;
+
+  usb_bdt[BDT_INDEX(EP_IN, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_IN, TX, ODD)].desc = 0;
+  cdc_tx_odd = cdc_tx_data = 0;
+  cdc_tx_head = cdc_tx_queued = cdc_tx_tail = 0;
+  cdc_tx_pending = 0;
+  cdc_tx_zlp = 0;
+
+  if (config == 0) {
+    USB_ENDPT_REG(USB0_BASE_PTR, EP_NOTIFY) = 0;
+    USB_ENDPT_REG(USB0_BASE_PTR, EP_OUT) = 0;
+    USB_ENDPT_REG(USB0_BASE_PTR, EP_IN) = 0;
+    slab_free(cdc_rx[EVEN]);
+    slab_free(cdc_rx[ODD]);
+    cdc_rx[EVEN] = cdc_rx[ODD] = NULL;
+    return;
+  }
+
+  if (cdc_rx[EVEN] == NULL)
+    cdc_rx[EVEN] = slab_alloc(USB_CDC_PACKET_SIZE);
+  if (cdc_rx[ODD] == NULL)
+    cdc_rx[ODD] = slab_alloc(USB_CDC_PACKET_SIZE);
+
+  USB_ENDPT_REG(USB0_BASE_PTR, EP_NOTIFY) =
+      USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+  //without receive buffers the data OUT endpoint stays off
+  if (cdc_rx[EVEN] && cdc_rx[ODD]) {
+    usb_cdc_rx_release(EVEN);
+    usb_cdc_rx_release(ODD);
+    USB_ENDPT_REG(USB0_BASE_PTR, EP_OUT) =
+        USB_ENDPT_EPRXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+  }
+  USB_ENDPT_REG(USB0_BASE_PTR, EP_IN) =
+      USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+}
+
+// Data OUT
+static void usb_cdc_rx_handler(uint8_t stat)
+{
+  uint8_t odd = (stat & USB_STAT_ODD_MASK) >> USB_STAT_ODD_SHIFT;
+  bdt_t *bdt = &usb_bdt[BDT_INDEX(EP_OUT, RX, odd)];
+  uint32_t i, count;
+
+  if (BDT_PID(bdt->desc) != PID_OUT)
+    return;
+  cdc_rx_odd = odd ^ 1;
+  cdc_rx_data = (bdt->desc & BDT_DATA1_MASK) ? 0 : 1;
+
+  count = BDT_BC(bdt->desc);
+  for (i = 0; i < count; i++)
+    cdc_rx_ring[(cdc_rx_head + i) & (CDC_RX_SIZE - 1)] = cdc_rx[odd][i];
+  cdc_rx_head += count;
+
+  //only take another packet if there is room for a full one
+  if (CDC_RX_SIZE - (cdc_rx_head - cdc_rx_tail) >= 2 * USB_CDC_PACKET_SIZE)
+    usb_cdc_rx_release(odd);
+  else
+    cdc_rx_held |= 1 << odd;
+}
+
+// Data IN
+static void usb_cdc_tx_handler(uint8_t stat)
+{
+  bdt_t *bdt = &usb_bdt[BDT_STAT_INDEX(stat)];
+
+  if (BDT_PID(bdt->desc) != PID_IN || cdc_tx_pending == 0)
+    return;
+
+  //packets complete in the order they were queued
+  cdc_tx_tail += cdc_tx_len[0];
+  cdc_tx_len[0] = cdc_tx_len[1];
+  cdc_tx_pending--;
+  usb_cdc_tx_fill();
+}
+
+void usb_cdc_handler(uint8_t stat)
+{
+  switch (stat >> 4) {
+  case EP_OUT:
+    usb_cdc_rx_handler(stat);
+    break;
+  case EP_IN:
+    usb_cdc_tx_handler(stat);
+    break;
+  }
+}
+
+static void usb_cdc_clear_halt(uint8_t endpoint)
+{
+  if (endpoint == USB_EP_IN(EP_IN)) {
+    cdc_tx_data = usb_tx_restart(EP_IN, cdc_tx_odd, cdc_tx_pending);
+  } else if (endpoint == USB_EP_OUT(EP_OUT)) {
+    //re-prime the buffers the module still owns with the new toggles
+    cdc_rx_data = 0;
+    if (cdc_rx[EVEN] && !(cdc_rx_held & (1 << EVEN)))
+      usb_cdc_rx_release(EVEN);
+    if (cdc_rx[ODD] && !(cdc_rx_held & (1 << ODD)))
+      usb_cdc_rx_release(ODD);
+  }
+}
+
+const usb_class_t usb_cdc_class = {
+  .configure = usb_cdc_configure,
+  .sof = NULL,
+  .clear_halt = usb_cdc_clear_halt,
+  .set_interface = NULL,
+  .requests = requests,
+  .descriptors = NULL,
+};
+
+/*
+ * Application interface
+ */
+
+int32_t usb_cdc_write(const char *ptr, int32_t len)
+{
+  int32_t n = 0;
+  uint32_t space;
+  //only the USB interrupt drains the ring, so when it cannot run just queue
+  //what fits; all handlers share one priority, so none preempts us either
+  uint8_t blocked = InterruptsBlocked();
+
+  while (n < len) {
+    if (!usb_configured)
+      break;                    //nobody listening, drop the rest
+
+    space = CDC_TX_SIZE - (cdc_tx_head - cdc_tx_tail);
+    if (space == 0 && blocked)
+      break;
+    while (space > 0 && n < len) {
+      cdc_tx_ring[cdc_tx_head & (CDC_TX_SIZE - 1)] = ptr[n++];
+      cdc_tx_head++;
+      space--;
+    }
+
+    //leave a caller's interrupt mask as it was
+    if (blocked) {
+      usb_cdc_tx_fill();
+    } else {
+      DisableInterrupts;
+      usb_cdc_tx_fill();
+      EnableInterrupts;
+    }
+  }
+
+  return n;
+}
+
+int32_t usb_cdc_avail(void)
+{
+  return cdc_rx_head - cdc_rx_tail;
+}
+
+int32_t usb_cdc_read(char *ptr, int32_t len)
+{
+  int32_t n;
+
+  for (n = 0; n < len; n++) {
+    while (cdc_rx_head == cdc_rx_tail) ;  //lock until a char arrives
+    ptr[n] = cdc_rx_ring[cdc_rx_tail & (CDC_RX_SIZE - 1)];
+    cdc_rx_tail++;
+  }
+
+  //hand back any receive buffers we held while the ring was full
+  DisableInterrupts;
+  if (cdc_rx_held
+      && CDC_RX_SIZE - (cdc_rx_head - cdc_rx_tail) >=
+      2 * USB_CDC_PACKET_SIZE) {
+    if (cdc_rx_held & (1 << EVEN))
+      usb_cdc_rx_release(EVEN);
+    if (cdc_rx_held & (1 << ODD))
+      usb_cdc_rx_release(ODD);
+    cdc_rx_held = 0;
+  }
+  EnableInterrupts;
+
+  return n;
+}
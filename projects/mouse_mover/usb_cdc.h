@@ -0,0 +1,66 @@
+/**
+ * CDC-ACM virtual serial port class driver
+ *
+ * Uses two interfaces starting at USB_CDC_INTERFACE (communication, data)
+ * and three endpoints starting at USB_CDC_ENDPOINT (notification IN, data
+ * OUT, data IN), all assigned in usb_config.h.
+ */
+#ifndef _USB_CDC_H_
+#define _USB_CDC_H_
+
+#include "usb_dev.h"
+
+#define USB_CDC_N_INTERFACES 2
+#define USB_CDC_N_ENDPOINTS  3
+
+#define USB_CDC_NOTIFY_SIZE 8
+#define USB_CDC_PACKET_SIZE 64
+
+#define USB_CDC_DESC_SIZE \
+  (USB_DESC_IAD_SIZE + USB_DESC_INTERFACE_SIZE + 5 + 5 + 4 + 5 + \
+   USB_DESC_ENDPOINT_SIZE + USB_DESC_INTERFACE_SIZE + \
+   2 * USB_DESC_ENDPOINT_SIZE)
+
+#define USB_CDC_DESC(iface, ep) \
+  USB_DESC_IAD(iface, 2, 0x02, 0x02, 0x01), /* CDC, ACM, AT commands */ \
+  USB_DESC_INTERFACE(iface, 0, 1, 0x02, 0x02, 0x01), \
+  5, 0x24, 0x00, 0x10, 0x01,    /* Header, bcdCDC 1.10 */ \
+  5, 0x24, 0x01, 0x01, (iface) + 1, /* Call Management */ \
+  4, 0x24, 0x02, 0x02,          /* ACM, line coding and state */ \
+  5, 0x24, 0x06, iface, (iface) + 1, /* Union */ \
+  USB_DESC_ENDPOINT(USB_EP_IN(ep), USB_EP_INTERRUPT, USB_CDC_NOTIFY_SIZE, 64), \
+  USB_DESC_INTERFACE((iface) + 1, 0, 2, 0x0a, 0x00, 0x00), /* CDC data */ \
+  USB_DESC_ENDPOINT(USB_EP_OUT((ep) + 1), USB_EP_BULK, USB_CDC_PACKET_SIZE, 0), \
+  USB_DESC_ENDPOINT(USB_EP_IN((ep) + 2), USB_EP_BULK, USB_CDC_PACKET_SIZE, 0)
+
+#define USB_CDC_CLASS usb_cdc_class
+#define USB_CDC_HANDLER usb_cdc_handler
+
+extern const usb_class_t usb_cdc_class;
+void usb_cdc_handler(uint8_t stat);
+
+/**
+ * Writes len chars to the CDC-ACM virtual serial port, waiting for ring space
+ * as needed. Data is dropped while the device is not configured, and with
+ * interrupts disabled or from an interrupt handler, whatever does not fit
+ * in the ring is dropped rather than waited for.
+ *
+ * Signature matches UARTWrite so this can be handed to xdev_out().
+ *
+ * @return Number of chars queued
+ */
+int32_t usb_cdc_write(const char *ptr, int32_t len);
+
+/**
+ * Returns the number of received chars waiting to be read
+ */
+int32_t usb_cdc_avail(void);
+
+/**
+ * Reads (with blocking) len chars from the CDC-ACM virtual serial port
+ *
+ * @return Number of chars read
+ */
+int32_t usb_cdc_read(char *ptr, int32_t len);
+
+#endif                          // _USB_CDC_H_
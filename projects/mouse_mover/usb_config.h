@@ -0,0 +1,58 @@
+/**
+ * USB composition for the mouse mover
+ *
+ * Lists the class drivers making up this composite device and the interface
+ * and endpoint numbers each one starts at. Every driver takes the
+ * USB_<NAME>_N_INTERFACES interfaces and USB_<NAME>_N_ENDPOINTS endpoints
+ * following its base numbers, so ranges must not overlap. usb_descriptors.c
+ * builds the configuration descriptor and dispatch tables from this list;
+ * usb.c does not change between products.
+ */
+#ifndef _USB_CONFIG_H_
+#define _USB_CONFIG_H_
+
+#include "usb_hid.h"
+#include "usb_stream.h"
+#include "usb_iso.h"
+#include "usb_cdc.h"
+#include "usb_msc.h"
+
+#define USB_VENDOR_ID  0x0f62
+#define USB_PRODUCT_ID 0x1001
+
+#define USB_HID_INTERFACE    0
+#define USB_HID_ENDPOINT     1
+
+// the sample stream goes out as best-effort bulk, or with -DUSB_STREAM_ISO
+// as isochronous with reserved bandwidth; both take the same slot
+#define USB_STREAM_INTERFACE 1
+#define USB_STREAM_ENDPOINT  2
+#define USB_ISO_INTERFACE    1
+#define USB_ISO_ENDPOINT     2
+
+#define USB_CDC_INTERFACE    2
+#define USB_CDC_ENDPOINT     3
+
+#define USB_MSC_INTERFACE    4
+#define USB_MSC_ENDPOINT     6
+
+#ifdef USB_STREAM_ISO
+#define USB_SAMPLES(X) X(ISO)
+#else
+#define USB_SAMPLES(X) X(STREAM)
+#endif
+
+// a test build can append class drivers of its own
+#ifndef USB_EXTRA_FUNCTIONS
+#define USB_EXTRA_FUNCTIONS(X)
+#endif
+
+// X(NAME) for each class driver, in interface order
+#define USB_FUNCTIONS(X) \
+  X(HID) \
+  USB_SAMPLES(X) \
+  X(CDC) \
+  X(MSC) \
+  USB_EXTRA_FUNCTIONS(X)
+
+#endif                          // _USB_CONFIG_H_
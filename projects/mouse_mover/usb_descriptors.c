@@ -0,0 +1,113 @@
+/**
+ * Descriptors and dispatch tables for the composite device
+ *
+ * Everything here is generated at compile time from USB_FUNCTIONS in
+ * usb_config.h: the configuration descriptor is the concatenation of each
+ * class driver's descriptor macro, and the endpoint and interface maps are
+ * dense tables indexed by number.
+ */
+#include "usb.h"
+#include "usb_config.h"
+
+
+#define DESC_SIZE(name) + USB_##name##_DESC_SIZE
+#define DESC_BYTES(name) USB_##name##_DESC(USB_##name##_INTERFACE, USB_##name##_ENDPOINT),
+#define N_INTERFACES(name) + USB_##name##_N_INTERFACES
+
+#define USB_N_INTERFACES (0 USB_FUNCTIONS(N_INTERFACES))
+#define CFG_TOTAL_LENGTH (USB_DESC_CONFIG_SIZE USB_FUNCTIONS(DESC_SIZE))
+
+const uint8_t dev_descriptor[] = {
+  18,                           //bLength
+  1,                            //bDescriptorType
+  0x10, 0x01,                   //bcdUSB
+  0xef,                         //bDeviceClass (Miscellaneous)
+  0x02,                         //bDeviceSubClass (Common Class)
+  0x01,                         //bDeviceProtocl (Interface Association)
+  ENDP0_SIZE,                   //bMaxPacketSize0
+  USB_LSB(USB_VENDOR_ID), USB_MSB(USB_VENDOR_ID), //idVendor
+  USB_LSB(USB_PRODUCT_ID), USB_MSB(USB_PRODUCT_ID), //idProduct
+  0x01, 0x00,                   //bcdDevice
+  1,                            //iManufacturer
+  2,                            //iProduct
+  0,                            //iSerialNumber,
+  1,                            //bNumConfigurations
+};
+
+const uint8_t cfg_descriptor[] = {
+  USB_DESC_CONFIG(CFG_TOTAL_LENGTH, USB_N_INTERFACES,
+                  0xa0,         //bmAttributes (0x80, 0x40 = power, 0x20 = wakeup)
+                  50),          //bMaxPower (50 = 100mA)
+  USB_FUNCTIONS(DESC_BYTES)
+};
+
+_Static_assert(sizeof(cfg_descriptor) == CFG_TOTAL_LENGTH,
+               "class descriptor size does not match its byte list");
+
+static const str_descriptor_t lang_descriptor = {
+  .bLength = 4,
+  .bDescriptorType = 3,
+  .wString = {0x0409}           //english (US)
+};
+
+static const str_descriptor_t manuf_descriptor = {
+  .bLength = 2 + 12 * 2,
+  .bDescriptorType = 3,
+  .wString = {'M', 'i', 'k', 'e', ' ', 'C', 'l', 'e', 'm', 'e', 'n', 't'}
+};
+
+static const str_descriptor_t product_descriptor = {
+  .bLength = 2 + 17 * 2,
+  .bDescriptorType = 3,
+  .wString = {'T', 'e', 'e', 'n', 's', 'y', ' ', 'M', 'o', 'u', 's', 'e',
+              'M', 'o', 'v', 'e', 'r'}
+};
+
+// indexed by string descriptor index
+const str_descriptor_t *const str_descriptors[] = {
+  &lang_descriptor,
+  &manuf_descriptor,
+  &product_descriptor,
+};
+
+const uint8_t usb_n_str_descriptors =
+    sizeof(str_descriptors) / sizeof(str_descriptors[0]);
+
+/*
+ * Dispatch tables
+ */
+
+#define CLASS_ENTRY(name) &USB_##name##_CLASS,
+#define ENDPOINT_ENTRIES(name) \
+  [USB_##name##_ENDPOINT ... USB_##name##_ENDPOINT + USB_##name##_N_ENDPOINTS - 1] = USB_##name##_HANDLER,
+#define INTERFACE_ENTRIES(name) \
+  [USB_##name##_INTERFACE ... USB_##name##_INTERFACE + USB_##name##_N_INTERFACES - 1] = &USB_##name##_CLASS,
+
+const usb_class_t *const usb_classes[] = {
+  USB_FUNCTIONS(CLASS_ENTRY)
+  NULL
+};
+
+// Default handler for USB endpoints that does nothing
+static void usb_endp_default_handler(uint8_t stat)
+{
+}
+
+// indexed by endpoint number, every entry is valid
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+const endp_handler_t usb_endp_handlers[USB_N_ENDPOINTS + 1] = {
+  [0 ... USB_N_ENDPOINTS] = usb_endp_default_handler,
+  [0] = usb_endp0_handler,
+  USB_FUNCTIONS(ENDPOINT_ENTRIES)
+};
+#pragma GCC diagnostic pop
+
+// indexed by interface number
+const usb_class_t *const usb_interfaces[] = {
+  USB_FUNCTIONS(INTERFACE_ENTRIES)
+};
+
+const uint8_t usb_n_interfaces = USB_N_INTERFACES;
+
+uint8_t usb_alt_settings[USB_N_INTERFACES];
@@ -0,0 +1,243 @@
+/**
+ * Internal interface between the USB core (usb.c) and its class drivers
+ *
+ * A class driver owns a contiguous range of interfaces and endpoints, given
+ * to it by usb_config.h. It supplies its part of the configuration
+ * descriptor as a byte-list macro and a usb_class_t that the core calls into.
+ */
+#ifndef _USB_DEV_H_
+#define _USB_DEV_H_
+
+#include "arm_cm4.h"
+
+/*
+ * Endpoint message types
+ */
+
+#define PID_OUT   0x1
+#define PID_IN    0x9
+#define PID_SOF   0x5
+#define PID_SETUP 0xd
+
+/*
+ * Struct definitions
+ */
+
+typedef struct {
+  union {
+    struct {
+      uint8_t bmRequestType;
+      uint8_t bRequest;
+    };
+    uint16_t wRequestAndType;
+  };
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+} setup_t;
+
+typedef struct {
+  uint8_t bLength;
+  uint8_t bDescriptorType;
+  uint16_t wString[];
+} str_descriptor_t;
+
+typedef struct {
+  uint16_t wValue;
+  uint16_t wIndex;
+  const void *addr;
+  uint16_t length;
+} descriptor_entry_t;
+
+/**
+ * Class or vendor request handler
+ *
+ * For device-to-host requests, point *data at the reply and set *length. For
+ * host-to-device requests with a data stage, point *data at a buffer of at
+ * least *length bytes to receive into; the entry's complete callback runs
+ * once all of it has arrived.
+ *
+ * @return Nonzero to accept the request, zero to stall it
+ */
+typedef uint8_t (*request_handler_t) (const setup_t * setup,
+                                      uint8_t ** data, uint16_t * length);
+
+typedef struct {
+  uint16_t wRequestAndType;
+  request_handler_t handler;
+  void (*complete) (const setup_t * setup);
+} request_entry_t;
+
+/**
+ * Endpoint handler, called with the USB0_STAT value of a completed token
+ */
+typedef void (*endp_handler_t) (uint8_t stat);
+
+/**
+ * Class driver
+ */
+typedef struct {
+  /**
+   * Called with the new configuration value on SET_CONFIGURATION, and with
+   * zero on bus reset. Enables or disables the class endpoints (USB0_ENDPTn)
+   * and (re)primes their buffer descriptors. Every endpoint's data toggle
+   * and EVEN/ODD pointer start over from DATA0 and EVEN.
+   */
+  void (*configure) (uint8_t config);
+
+  /**
+   * Called on every start of frame, may be NULL
+   */
+  void (*sof) (void);
+
+  /**
+   * Called on CLEAR_FEATURE(ENDPOINT_HALT) with the endpoint address
+   * (direction in bit 7) once the stall is lifted. The host restarts that
+   * endpoint at DATA0; its EVEN/ODD pointer carries on. Every class sees
+   * every endpoint, so ignore the ones that are not ours. May be NULL.
+   */
+  void (*clear_halt) (uint8_t endpoint);
+
+  /**
+   * Called on SET_INTERFACE for one of our interfaces, and returns nonzero
+   * if the alternate setting exists. May be NULL if every interface only
+   * has alternate setting 0. Alternate settings fall back to 0 on
+   * configure.
+   */
+  uint8_t (*set_interface) (uint8_t interface, uint8_t alt);
+
+  /**
+   * Class and vendor requests addressed to our interfaces, terminated by an
+   * entry with a NULL handler. May be NULL.
+   */
+  const request_entry_t *requests;
+
+  /**
+   * Class-specific descriptors (HID, report) fetched with an interface
+   * GET_DESCRIPTOR, terminated by an entry with a NULL addr. May be NULL.
+   */
+  const descriptor_entry_t *descriptors;
+} usb_class_t;
+
+/*
+ * Buffer Description Tables
+ */
+
+#define BDT_BC_SHIFT   16
+#define BDT_OWN_MASK   0x80
+#define BDT_DATA1_MASK 0x40
+#define BDT_KEEP_MASK  0x20
+#define BDT_NINC_MASK  0x10
+#define BDT_DTS_MASK   0x08
+#define BDT_STALL_MASK 0x04
+
+#define BDT_DESC(count, data) ((count << BDT_BC_SHIFT) | BDT_OWN_MASK | (data ? BDT_DATA1_MASK : 0x00) | BDT_DTS_MASK)
+#define BDT_PID(desc) ((desc >> 2) & 0xF)
+#define BDT_BC(desc) ((desc >> BDT_BC_SHIFT) & 0x3FF)
+
+// Buffer Descriptor Table entry
+// NOTE: There are two entries per direction per endpoint (4 total)
+typedef struct {
+  uint32_t desc;
+  void *addr;
+} bdt_t;
+
+// we enforce a max of 15 endpoints (15 + 1 control = 16)
+#define USB_N_ENDPOINTS 15
+
+//determines an appropriate BDT index for the given conditions (see fig. 41-3)
+#define RX 0
+#define TX 1
+#define EVEN 0
+#define ODD  1
+#define BDT_INDEX(endpoint, tx, odd) (((endpoint) << 2) | ((tx) << 1) | (odd))
+
+// the buffer descriptor entry a USB0_STAT value refers to
+#define BDT_STAT_INDEX(stat) ((stat) >> 2)
+
+extern bdt_t usb_bdt[(USB_N_ENDPOINTS + 1) * 4];
+
+// Nonzero once the host has selected our configuration
+extern volatile uint8_t usb_configured;
+
+// endpoint 0 packet size, also bMaxPacketSize0 of the device descriptor;
+// 8, 16, 32 or 64
+#ifndef ENDP0_SIZE
+#define ENDP0_SIZE 64
+#endif
+
+void usb_endp0_handler(uint8_t stat);
+
+/**
+ * Restarts an IN endpoint at DATA0 after a cleared halt. Packets still
+ * queued on it go out as DATA0, DATA1, ... in the order they were queued.
+ * Only call from the clear_halt hook, while the SIE is suspended.
+ *
+ * @param odd The descriptor the next packet will be queued in
+ * @param pending Packets queued and not yet sent (0 to 2)
+ * @return Data toggle for the next packet queued
+ */
+uint8_t usb_tx_restart(uint8_t endpoint, uint8_t odd, uint8_t pending);
+
+/*
+ * Tables built from usb_config.h by usb_descriptors.c
+ */
+
+extern const uint8_t dev_descriptor[];
+extern const uint8_t cfg_descriptor[];
+extern const str_descriptor_t *const str_descriptors[];
+extern const uint8_t usb_n_str_descriptors;
+
+// NULL-terminated list of the class drivers present
+extern const usb_class_t *const usb_classes[];
+
+// endpoint number to handler
+extern const endp_handler_t usb_endp_handlers[USB_N_ENDPOINTS + 1];
+
+// interface number to the class driver owning it
+extern const usb_class_t *const usb_interfaces[];
+extern const uint8_t usb_n_interfaces;
+
+// current alternate setting of each interface
+extern uint8_t usb_alt_settings[];
+
+/*
+ * Descriptor builder
+ *
+ * Each macro expands to the bytes of one descriptor, so a configuration
+ * descriptor can be assembled from class driver macros at compile time.
+ */
+
+#define USB_LSB(v) ((v) & 0xff)
+#define USB_MSB(v) (((v) >> 8) & 0xff)
+
+#define USB_EP_CONTROL     0x00
+#define USB_EP_ISOCHRONOUS 0x01
+#define USB_EP_BULK        0x02
+#define USB_EP_INTERRUPT   0x03
+
+// isochronous synchronisation types
+#define USB_EP_ASYNC    0x04
+#define USB_EP_ADAPTIVE 0x08
+#define USB_EP_SYNC     0x0c
+
+#define USB_EP_IN(n)  (0x80 | (n))
+#define USB_EP_OUT(n) (n)
+
+#define USB_DESC_CONFIG_SIZE 9
+#define USB_DESC_CONFIG(total, interfaces, attributes, power) \
+  9, 2, USB_LSB(total), USB_MSB(total), interfaces, 1, 0, attributes, power
+
+#define USB_DESC_IAD_SIZE 8
+#define USB_DESC_IAD(first, count, class, subclass, protocol) \
+  8, 11, first, count, class, subclass, protocol, 0
+
+#define USB_DESC_INTERFACE_SIZE 9
+#define USB_DESC_INTERFACE(number, alt, endpoints, class, subclass, protocol) \
+  9, 4, number, alt, endpoints, class, subclass, protocol, 0
+
+#define USB_DESC_ENDPOINT_SIZE 7
+#define USB_DESC_ENDPOINT(address, attributes, size, interval) \
+  7, 5, address, attributes, USB_LSB(size), USB_MSB(size), interval
+
+#endif                          // _USB_DEV_H_
@@ -0,0 +1,225 @@
+/**
+ * HID boot mouse class driver
+ */
+#include "usb_hid.h"
+#include "usb_config.h"
+
+#define EP USB_HID_ENDPOINT
+
+static const uint8_t report_descriptor[] = {
+  0x05, 0x01,                   // Usage Page (Generic Desktop)
+  0x09, 0x02,                   // Usage (Mouse)
+  0xA1, 0x01,                   // Collection (Application)
+  0x09, 0x01,                   // Usage (Pointer)
+  0xA1, 0x00,                   // Collection (Physical)
+  0x05, 0x09,                   // Usage Page (Buttons)
+  0x19, 0x01,                   // Usage Minimum (01)
+  0x29, 0x05,                   // Usage Maximum (01)
+  0x15, 0x00,                   // Logical Minimum (0)
+  0x25, 0x01,                   // Logical Maximum (1)
+  0x95, 0x05,                   // Report Count (5)
+  0x75, 0x01,                   // Report Size (1)
+  0x81, 0x02,                   // Input (Data, Variable, Absolute)
+  0x95, 0x01,                   // Report Count (1)
+  0x75, 0x03,                   // Report Size (3)
+  0x81, 0x01,                   // Input (Constant) for padding
+  0x05, 0x01,                   // Usage Page (Generic Desktop)
+  0x09, 0x30,                   // Usage (X)
+  0x09, 0x31,                   // Usage (Y)
+  0x09, 0x38,                   // Usage (Wheel)
+  0x15, 0x81,                   // Logical Minimum (-127)
+  0x25, 0x7F,                   // Logical Maximum (127)
+  0x75, 0x08,                   // Report Size (8)
+  0x95, 0x03,                   // Report Count (3)
+  0x81, 0x06,                   // Input (Data, Variable, Relative)
+  0xC0,                         // End Collection (Physical)
+  0xC0                          // End Collection (Application)
+};
+
+static const uint8_t hid_descriptor[] = {
+  USB_HID_DESC(USB_HID_INTERFACE, EP)
+};
+
+static const descriptor_entry_t descriptors[] = {
+  {0x2100, USB_HID_INTERFACE, hid_descriptor + USB_DESC_INTERFACE_SIZE, 9},
+  {0x2200, USB_HID_INTERFACE, report_descriptor, sizeof(report_descriptor)},
+  {0x0000, 0x0000, NULL, 0}
+};
+
+static uint8_t hid_set_idle(const setup_t * setup, uint8_t ** data,
+                            uint16_t * length)
+{
+  //we only ever report on change, so the idle rate is irrelevant
+  return 1;
+}
+
+static const request_entry_t requests[] = {
+  {0x0a21, hid_set_idle, NULL},
+  {0x0000, NULL, NULL}
+};
+
+static uint8_t hid_odd, hid_data = 0;
+
+// the report the endpoint owns while hid_busy is set
+static uint8_t report[USB_HID_REPORT_SIZE];
+static volatile uint8_t hid_busy = 0;
+
+// motion queued since the last report was built
+static int32_t pending_x, pending_y, pending_wheel;
+static uint8_t buttons, sent_buttons;
+
+// latency probe
+static uint8_t pending_stamped;
+static uint32_t pending_stamp, report_stamp;
+static usb_hid_latency_t latency;
+
+static void usb_hid_transmit(const void *data, uint8_t length)
+{
+  usb_bdt[BDT_INDEX(EP, TX, hid_odd)].addr = (void *) data;
+  usb_bdt[BDT_INDEX(EP, TX, hid_odd)].desc = BDT_DESC(length, hid_data);
+  //toggle the odd and data bits
+  hid_odd ^= 1;
+  hid_data ^= 1;
+}
+
+// Takes at most +/-127 off an accumulator
+static int8_t usb_hid_take(int32_t * pending)
+{
+  int32_t v = *pending;
+
+  if (v > 127)
+    v = 127;
+  else if (v < -127)
+    v = -127;
+  *pending -= v;
+  return (int8_t) v;
+}
+
+// Builds and queues a report if there is anything to say and the endpoint is
+// free. Called with interrupts disabled or from the USB interrupt.
+static void usb_hid_kick(void)
+{
+  if (hid_busy || !usb_configured)
+    return;
+  if (!pending_x && !pending_y && !pending_wheel && buttons == sent_buttons)
+    return;
+
+  report[0] = buttons;
+  report[1] = usb_hid_take(&pending_x);
+  report[2] = usb_hid_take(&pending_y);
+  report[3] = usb_hid_take(&pending_wheel);
+  sent_buttons = buttons;
+
+  //what is left over gets stamped as new input for the next report
+  report_stamp = pending_stamped ? pending_stamp : DWT_CYCCNT;
+  pending_stamp = DWT_CYCCNT;
+  pending_stamped = pending_x || pending_y || pending_wheel;
+  if (pending_stamped)
+    latency.saturated++;
+
+  hid_busy = 1;
+  usb_hid_transmit(report, sizeof(report));
+}
+
+static void usb_hid_stamp(void)
+{
+  if (!pending_stamped) {
+    pending_stamp = DWT_CYCCNT;
+    pending_stamped = 1;
+  }
+}
+
+void usb_hid_move(int16_t dx, int16_t dy, int8_t wheel)
+{
+  uint32_t masked = InterruptsDisabled();
+
+  //leave a caller's interrupt mask as it was
+  DisableInterrupts;
+  usb_hid_stamp();
+  pending_x += dx;
+  pending_y += dy;
+  pending_wheel += wheel;
+  usb_hid_kick();
+  if (!masked)
+    EnableInterrupts;
+}
+
+void usb_hid_buttons(uint8_t state)
+{
+  uint32_t masked = InterruptsDisabled();
+
+  //leave a caller's interrupt mask as it was
+  DisableInterrupts;
+  usb_hid_stamp();
+  buttons = state;
+  usb_hid_kick();
+  if (!masked)
+    EnableInterrupts;
+}
+
+void usb_hid_latency(usb_hid_latency_t * out)
+{
+  DisableInterrupts;
+  *out = latency;
+  latency.max = 0;
+  EnableInterrupts;
+}
+
+static void usb_hid_configure(uint8_t config)
+{
+  usb_bdt[BDT_INDEX(EP, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP, TX, ODD)].desc = 0;
+  hid_odd = hid_data = 0;
+  hid_busy = 0;
+  if (config == 0) {
+    USB_ENDPT_REG(USB0_BASE_PTR, EP) = 0;
+    return;
+  }
+
+  //the cycle counter timestamps the latency probe
+  DEMCR |= DEMCR_TRCENA_MASK;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
+  //with nothing to report the buffer descriptor stays ours and the host
+  //is NAKed; without handshaking it would get no answer at all
+  USB_ENDPT_REG(USB0_BASE_PTR, EP) =
+      USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+
+  //the host may have missed whatever was sent before it reconfigured us
+  sent_buttons = ~buttons;
+  usb_hid_kick();
+}
+
+void usb_hid_handler(uint8_t stat)
+{
+  bdt_t *bdt = &usb_bdt[BDT_STAT_INDEX(stat)];
+  uint32_t cycles;
+
+  if (BDT_PID(bdt->desc) != PID_IN)
+    return;
+
+  //the host has collected the report
+  cycles = DWT_CYCCNT - report_stamp;
+  latency.last = cycles;
+  if (cycles > latency.max)
+    latency.max = cycles;
+  latency.reports++;
+
+  hid_busy = 0;
+  usb_hid_kick();
+}
+
+static void usb_hid_clear_halt(uint8_t endpoint)
+{
+  if (endpoint == USB_EP_IN(EP))
+    hid_data = usb_tx_restart(EP, hid_odd, hid_busy);
+}
+
+const usb_class_t usb_hid_class = {
+  .configure = usb_hid_configure,
+  .sof = NULL,
+  .clear_halt = usb_hid_clear_halt,
+  .set_interface = NULL,
+  .requests = requests,
+  .descriptors = descriptors,
+};
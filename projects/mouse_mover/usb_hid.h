@@ -0,0 +1,76 @@
+/**
+ * HID boot mouse class driver
+ *
+ * Uses one interface (USB_HID_INTERFACE) and one interrupt IN endpoint
+ * (USB_HID_ENDPOINT), both assigned in usb_config.h.
+ *
+ * The host polls every millisecond. Motion queued between polls is summed
+ * and sent as a single report; anything beyond the +/-127 a report can
+ * carry stays queued for the following polls, so no motion is lost.
+ */
+#ifndef _USB_HID_H_
+#define _USB_HID_H_
+
+#include "usb_dev.h"
+
+#define USB_HID_N_INTERFACES 1
+#define USB_HID_N_ENDPOINTS  1
+
+#define USB_HID_REPORT_SIZE 4
+
+// polling interval in frames (ms)
+#define USB_HID_INTERVAL 1
+
+#define USB_HID_BUTTON_LEFT   0x01
+#define USB_HID_BUTTON_RIGHT  0x02
+#define USB_HID_BUTTON_MIDDLE 0x04
+
+#define USB_HID_DESC_SIZE \
+  (USB_DESC_INTERFACE_SIZE + 9 + USB_DESC_ENDPOINT_SIZE)
+
+#define USB_HID_DESC(iface, ep) \
+  USB_DESC_INTERFACE(iface, 0, 1, 0x03, 0x01, 0x02), /* HID, boot, mouse */ \
+  9,                            /* bLength */ \
+  0x21,                         /* bDescriptorType (HID) */ \
+  0x10, 0x01,                   /* bcdHID */ \
+  0,                            /* bCountryCode */ \
+  1,                            /* bNumDescriptors */ \
+  0x22,                         /* bDescriptorType (REPORT) */ \
+  52, 0,                        /* wDescriptorLength */ \
+  USB_DESC_ENDPOINT(USB_EP_IN(ep), USB_EP_INTERRUPT, USB_HID_REPORT_SIZE, \
+                    USB_HID_INTERVAL)
+
+#define USB_HID_CLASS usb_hid_class
+#define USB_HID_HANDLER usb_hid_handler
+
+extern const usb_class_t usb_hid_class;
+void usb_hid_handler(uint8_t stat);
+
+/**
+ * Queues relative pointer motion. Safe to call from interrupts.
+ */
+void usb_hid_move(int16_t dx, int16_t dy, int8_t wheel);
+
+/**
+ * Sets the button state (USB_HID_BUTTON_*), sent with the next report.
+ * Safe to call from interrupts.
+ */
+void usb_hid_buttons(uint8_t buttons);
+
+/**
+ * Input-to-report latency, in core clock cycles (DWT CYCCNT), from the first
+ * input merged into a report to the host collecting that report
+ */
+typedef struct {
+  uint32_t last;
+  uint32_t max;
+  uint32_t reports;             //reports collected by the host
+  uint32_t saturated;           //reports that left motion queued
+} usb_hid_latency_t;
+
+/**
+ * Copies out the latency probe and clears its maximum
+ */
+void usb_hid_latency(usb_hid_latency_t * latency);
+
+#endif                          // _USB_HID_H_
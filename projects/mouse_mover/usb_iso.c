@@ -0,0 +1,163 @@
+/**
+ * Vendor isochronous IN sample stream class driver
+ *
+ * Ready buffers are sent in place, half a buffer (USB_ISO_PACKET_SIZE bytes)
+ * per frame. Isochronous IN gets exactly one packet per frame, so only one
+ * is queued at a time: it is replaced as soon as the previous one completes,
+ * a whole frame before the host comes back for it. The packet boundary does
+ * not fall on a sample boundary; the host reassembles the byte stream.
+ *
+ * If nothing is ready when a frame starts, an empty packet is queued so the
+ * host sees a defined, counted underrun rather than a missing packet.
+ */
+#include "usb_iso.h"
+#include "usb_config.h"
+#include "buffers.h"
+
+#define EP USB_ISO_ENDPOINT
+
+// isochronous transfers are always DATA0 and never toggle
+#define BDT_DESC_ISO(count) (((count) << BDT_BC_SHIFT) | BDT_OWN_MASK)
+
+static uint8_t iso_odd;
+static uint8_t iso_streaming = 0;         //alternate setting 1 selected
+
+static const uint8_t *iso_ptr = NULL;     //next packet to queue, NULL when idle
+static uint16_t iso_remaining = 0;        //bytes of the buffer not yet queued
+static uint8_t iso_index;                 //pool index of the buffer being sent
+static uint8_t iso_pending = 0;           //a packet is owned by the USB module
+static uint16_t iso_length;               //size of that packet
+
+static usb_iso_stats_t iso_stats;
+
+static void usb_iso_transmit(const void *data, uint16_t length)
+{
+  usb_bdt[BDT_INDEX(EP, TX, iso_odd)].addr = (void *) data;
+  usb_bdt[BDT_INDEX(EP, TX, iso_odd)].desc = BDT_DESC_ISO(length);
+  iso_odd ^= 1;
+  iso_length = length;
+  iso_pending = 1;
+}
+
+// Queue the next slice, moving on to the next ready buffer as needed.
+// Returns zero if there was nothing to send.
+static uint8_t usb_iso_fill(void)
+{
+  const uint16_t *buf;
+  uint16_t size;
+
+  if (iso_pending)
+    return 1;
+
+  if (iso_ptr == NULL) {
+    buf = buffers_get_next_ready(&iso_index);
+    while (buf != NULL && buffers_length(iso_index) == 0) {
+      buffer_free(iso_index);
+      buf = buffers_get_next_ready(&iso_index);
+    }
+    if (buf == NULL)
+      return 0;
+    iso_ptr = (const uint8_t *) buf;
+    iso_remaining = buffers_length(iso_index) * sizeof(uint16_t);
+  }
+
+  size = iso_remaining;
+  if (size > USB_ISO_PACKET_SIZE)
+    size = USB_ISO_PACKET_SIZE;
+  usb_iso_transmit(iso_ptr, size);
+  iso_ptr += size;
+  iso_remaining -= size;
+  return 1;
+}
+
+// Abandon any transfer in progress; the buffer stays ready and is resent
+static void usb_iso_stop(void)
+{
+  usb_bdt[BDT_INDEX(EP, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP, TX, ODD)].desc = 0;
+  iso_odd ^= iso_pending;
+  iso_pending = 0;
+  iso_ptr = NULL;
+  iso_remaining = 0;
+  iso_streaming = 0;
+}
+
+static void usb_iso_configure(uint8_t config)
+{
+  usb_iso_stop();
+  iso_odd = 0;
+  //alternate setting 0 has no endpoint
+  USB_ENDPT_REG(USB0_BASE_PTR, EP) = 0;
+}
+
+static uint8_t usb_iso_set_interface(uint8_t interface, uint8_t alt)
+{
+  if (alt > 1)
+    return 0;
+
+  usb_iso_stop();
+  if (alt == 0) {
+    USB_ENDPT_REG(USB0_BASE_PTR, EP) = 0;
+    return 1;
+  }
+
+  //no handshake on isochronous endpoints
+  USB_ENDPT_REG(USB0_BASE_PTR, EP) = USB_ENDPT_EPTXEN_MASK;
+  iso_streaming = 1;
+  usb_iso_fill();
+  return 1;
+}
+
+// A new frame: make sure the host finds a packet when it asks
+static void usb_iso_sof(void)
+{
+  if (!iso_streaming || usb_iso_fill())
+    return;
+
+  usb_iso_transmit(NULL, 0);
+}
+
+void usb_iso_handler(uint8_t stat)
+{
+  bdt_t *bdt = &usb_bdt[BDT_STAT_INDEX(stat)];
+
+  if (BDT_PID(bdt->desc) != PID_IN || !iso_pending)
+    return;
+
+  iso_pending = 0;
+  iso_stats.frames++;
+  iso_stats.bytes += iso_length;
+  iso_stats.last = iso_length;
+  if (iso_length == USB_ISO_PACKET_SIZE)
+    iso_stats.full++;
+  else if (iso_length > 0)
+    iso_stats.partial++;
+  else
+    iso_stats.underruns++;
+
+  if (iso_ptr != NULL && iso_remaining == 0) {
+    //last slice of the buffer is out, hand it back
+    buffer_free(iso_index);
+    iso_ptr = NULL;
+  }
+  usb_iso_fill();
+}
+
+const usb_class_t usb_iso_class = {
+  .configure = usb_iso_configure,
+  //queues an empty packet if the stream has run dry
+  .sof = usb_iso_sof,
+  .clear_halt = NULL,
+  .set_interface = usb_iso_set_interface,
+  .requests = NULL,
+  .descriptors = NULL,
+};
+
+void usb_iso_stats(usb_iso_stats_t * stats)
+{
+  DisableInterrupts;
+  *stats = iso_stats;
+  iso_stats.frames = iso_stats.full = iso_stats.partial = 0;
+  iso_stats.underruns = iso_stats.bytes = 0;
+  EnableInterrupts;
+}
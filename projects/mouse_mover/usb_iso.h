@@ -0,0 +1,56 @@
+/**
+ * Vendor isochronous IN sample stream class driver
+ *
+ * An alternative to usb_stream.c with reserved bandwidth: one packet of up
+ * to USB_ISO_PACKET_SIZE bytes goes out in every 1 ms frame, so latency is
+ * bounded and a busy bus cannot starve the stream. Uses one vendor-specific
+ * interface (USB_ISO_INTERFACE) and one isochronous IN endpoint
+ * (USB_ISO_ENDPOINT), assigned in usb_config.h.
+ *
+ * Alternate setting 0 has no endpoints and reserves no bandwidth; the host
+ * selects alternate setting 1 to start streaming.
+ */
+#ifndef _USB_ISO_H_
+#define _USB_ISO_H_
+
+#include "usb_dev.h"
+
+#define USB_ISO_N_INTERFACES 1
+#define USB_ISO_N_ENDPOINTS  1
+
+// one buffers.c buffer (BUFFER_LENGTH samples) goes out every two frames
+#define USB_ISO_PACKET_SIZE 1023
+
+#define USB_ISO_DESC_SIZE \
+  (2 * USB_DESC_INTERFACE_SIZE + USB_DESC_ENDPOINT_SIZE)
+
+#define USB_ISO_DESC(iface, ep) \
+  USB_DESC_INTERFACE(iface, 0, 0, 0xff, 0x00, 0x00), /* idle */ \
+  USB_DESC_INTERFACE(iface, 1, 1, 0xff, 0x00, 0x00), /* streaming */ \
+  USB_DESC_ENDPOINT(USB_EP_IN(ep), USB_EP_ISOCHRONOUS | USB_EP_ASYNC, \
+                    USB_ISO_PACKET_SIZE, 1)
+
+#define USB_ISO_CLASS usb_iso_class
+#define USB_ISO_HANDLER usb_iso_handler
+
+extern const usb_class_t usb_iso_class;
+void usb_iso_handler(uint8_t stat);
+
+/**
+ * Per-frame fill counters, counted over the frames the host collected
+ */
+typedef struct {
+  uint32_t frames;
+  uint32_t full;                //USB_ISO_PACKET_SIZE bytes
+  uint32_t partial;             //some data, less than a full packet
+  uint32_t underruns;           //no data ready, an empty packet went out
+  uint32_t bytes;
+  uint16_t last;                //bytes in the most recent frame
+} usb_iso_stats_t;
+
+/**
+ * Copies out and clears the fill counters
+ */
+void usb_iso_stats(usb_iso_stats_t * stats);
+
+#endif                          // _USB_ISO_H_
@@ -0,0 +1,793 @@
+/**
+ * USB mass storage (Bulk-Only Transport, SCSI transparent) class driver
+ *
+ * Sector data is never copied: BDT entries point straight at 64-byte slices
+ * of a ring of sector buffers, and the media reads or writes those same
+ * buffers. For READ(10) the main loop reads the next sector while the
+ * interrupt sends the current one; for WRITE(10) the interrupt receives the
+ * next sector while the main loop writes the current one. When the ring is
+ * empty (read) or full (write) the BDT is simply not handed over and the host
+ * is NAKed until the main loop catches up.
+ *
+ * Only the commands a host needs to mount and use a plain disk are
+ * implemented. Anything else fails with ILLEGAL REQUEST, and data phases the
+ * device cannot fill are ended with a STALL as the BOT spec requires.
+ */
+#include "usb_msc.h"
+#include "usb_config.h"
+#include "common.h"
+#include "slab.h"
+
+#define EP_OUT USB_MSC_ENDPOINT
+#define EP_IN  (USB_MSC_ENDPOINT + 1)
+
+#define MSC_N_BUFFERS 2         //sector buffers, must be a power of two
+
+#define CBW_SIGNATURE 0x43425355
+#define CSW_SIGNATURE 0x53425355
+#define CBW_SIZE      31
+#define CSW_SIZE      13
+
+// CSW status
+#define CSW_PASSED      0
+#define CSW_FAILED      1
+#define CSW_PHASE_ERROR 2
+
+// sense keys and additional sense codes
+#define SENSE_NOT_READY       0x02
+#define SENSE_MEDIUM_ERROR    0x03
+#define SENSE_ILLEGAL_REQUEST 0x05
+#define SENSE_UNIT_ATTENTION  0x06
+#define SENSE_ABORTED_COMMAND 0x0b
+#define ASC_WRITE_FAULT       0x03
+#define ASC_READ_ERROR        0x11
+#define ASC_INVALID_COMMAND   0x20
+#define ASC_LBA_OUT_OF_RANGE  0x21
+#define ASC_MEDIUM_CHANGED    0x28
+#define ASC_MEDIUM_NOT_PRESENT 0x3a
+#define ASC_DATA_PHASE_ERROR  0x4b
+
+#define LE32(p) ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16) | ((uint32_t) (p)[3] << 24))
+#define BE32(p) (((uint32_t) (p)[0] << 24) | ((p)[1] << 16) | ((p)[2] << 8) | (p)[3])
+#define BE16(p) (((p)[0] << 8) | (p)[1])
+
+typedef enum {
+  MSC_CBW,                      //waiting for a command
+  MSC_DATA_IN,                  //sending a reply or sectors
+  MSC_DATA_OUT,                 //receiving sectors
+  MSC_CSW,                      //sending the status
+  MSC_HALTED,                   //status waits for the host to clear IN
+  MSC_RESET                     //bad command, waiting for a BOT reset
+} msc_state_t;
+
+static volatile msc_state_t msc_state = MSC_CBW;
+static volatile uint32_t msc_seq = 0; //bumped on every command and reset
+
+// media
+static usb_msc_block_t msc_read, msc_write;
+static uint32_t msc_sectors = 0;
+
+// current command
+static uint8_t msc_cbw[USB_MSC_PACKET_SIZE] __attribute__ ((aligned(4)));
+static uint8_t msc_csw[CSW_SIZE];
+static uint8_t msc_reply[36];
+static uint32_t msc_expected;   //dCBWDataTransferLength
+static uint32_t msc_residue;
+static uint8_t msc_dir_in;      //host expects data from us
+static uint8_t msc_short;       //data phase ended with a short packet
+static uint8_t msc_status;      //CSW status held while IN is halted
+static uint8_t msc_sense_key, msc_asc;
+
+// sector ring, counted in sectors from the start of the command; the
+// buffers come from the slab once media is attached
+static uint8_t *msc_buffers[MSC_N_BUFFERS];
+static uint8_t msc_reading;     //DATA_IN carries sectors rather than a reply
+static uint32_t msc_lba;
+static uint32_t msc_total;
+static volatile uint32_t msc_head;  //read: read from media, write: received
+static volatile uint32_t msc_next;  //sectors handed to the USB module
+static volatile uint32_t msc_tail;  //read: sent, write: written to media
+static uint32_t msc_start;      //DWT_CYCCNT when the command arrived
+
+// bulk IN
+static uint8_t msc_in_odd, msc_in_data = 0;
+static const uint8_t *msc_in_ptr;
+static uint32_t msc_in_remaining = 0;
+static uint8_t msc_in_pending = 0;
+static uint8_t msc_in_last[2];  //in-flight packet ends its chunk
+static uint8_t msc_in_len[2];   //and its length
+static uint32_t msc_in_sent;    //data phase bytes the host has taken
+static uint8_t msc_in_halted = 0;
+
+// bulk OUT
+static uint8_t msc_out_odd, msc_out_data = 0;
+static uint8_t *msc_out_ptr;
+static uint32_t msc_out_remaining = 0;
+static uint8_t msc_out_pending = 0;
+static uint8_t msc_out_last[2];
+static uint8_t msc_out_halted = 0;
+
+static usb_msc_stats_t msc_stats;
+static uint32_t msc_read_cycles, msc_write_cycles; //remainders below 1 ms
+
+static void usb_msc_receive_cbw(void);
+
+/*
+ * Class requests
+ */
+
+static uint8_t msc_get_max_lun(const setup_t * setup, uint8_t ** data,
+                               uint16_t * length)
+{
+  static uint8_t max_lun = 0;
+
+  *data = &max_lun;
+  *length = 1;
+  return 1;
+}
+
+// Bulk-Only Mass Storage Reset
+static uint8_t msc_reset(const setup_t * setup, uint8_t ** data,
+                         uint16_t * length)
+{
+  //drop whatever was queued; the BDT ping-pong pointer only moves on
+  //completion, so step back over the entries we reclaim
+  usb_bdt[BDT_INDEX(EP_IN, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_IN, TX, ODD)].desc = 0;
+  msc_in_odd ^= msc_in_pending & 1;
+  msc_in_pending = 0;
+  msc_in_remaining = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, ODD)].desc = 0;
+  msc_out_odd ^= msc_out_pending & 1;
+  msc_out_pending = 0;
+  msc_out_remaining = 0;
+
+  msc_seq++;
+  msc_state = MSC_CBW;
+  if (!msc_out_halted)
+    usb_msc_receive_cbw();
+  return 1;
+}
+
+static const request_entry_t requests[] = {
+  {0xfea1, msc_get_max_lun, NULL},
+  {0xff21, msc_reset, NULL},
+  {0x0000, NULL, NULL}
+};
+
+/*
+ * Bulk IN
+ */
+
+static void usb_msc_transmit(const void *data, uint8_t length)
+{
+  usb_bdt[BDT_INDEX(EP_IN, TX, msc_in_odd)].addr = (void *) data;
+  usb_bdt[BDT_INDEX(EP_IN, TX, msc_in_odd)].desc =
+      BDT_DESC(length, msc_in_data);
+  //toggle the odd and data bits
+  msc_in_odd ^= 1;
+  msc_in_data ^= 1;
+}
+
+// Picks up the next ready sector to send; returns zero if there is none
+static uint8_t usb_msc_in_next(void)
+{
+  if (msc_state != MSC_DATA_IN || !msc_reading || msc_next == msc_head)
+    return 0;
+
+  msc_in_ptr = msc_buffers[msc_next & (MSC_N_BUFFERS - 1)];
+  msc_in_remaining = USB_MSC_SECTOR_SIZE;
+  msc_next++;
+  return 1;
+}
+
+// Queue packets until both ping-pong entries are busy
+static void usb_msc_in_fill(void)
+{
+  uint32_t size;
+
+  while (msc_in_pending < 2) {
+    if (msc_in_remaining == 0 && !usb_msc_in_next())
+      break;
+
+    size = msc_in_remaining;
+    if (size > USB_MSC_PACKET_SIZE)
+      size = USB_MSC_PACKET_SIZE;
+    usb_msc_transmit(msc_in_ptr, size);
+    msc_in_ptr += size;
+    msc_in_remaining -= size;
+    msc_in_len[msc_in_pending] = size;
+    msc_in_last[msc_in_pending++] = (msc_in_remaining == 0);
+  }
+}
+
+// Data phase bytes the host has taken, including packets it acknowledged
+// whose token the interrupt has not handled yet
+static uint32_t usb_msc_in_taken(void)
+{
+  uint32_t taken = msc_in_sent;
+  uint8_t i, odd;
+
+  for (i = 0; i < msc_in_pending; i++) {
+    odd = msc_in_odd ^ ((msc_in_pending - i) & 1);
+    if (usb_bdt[BDT_INDEX(EP_IN, TX, odd)].desc & BDT_OWN_MASK)
+      break;
+    taken += msc_in_len[i];
+  }
+  return taken;
+}
+
+static void usb_msc_halt_in(void)
+{
+  usb_bdt[BDT_INDEX(EP_IN, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_IN, TX, ODD)].desc = 0;
+  msc_in_odd ^= msc_in_pending & 1;
+  msc_in_pending = 0;
+  msc_in_remaining = 0;
+  msc_in_halted = 1;
+  USB_ENDPT_REG(USB0_BASE_PTR, EP_IN) |= USB_ENDPT_EPSTALL_MASK;
+}
+
+/*
+ * Bulk OUT
+ */
+
+static void usb_msc_receive(void *data, uint8_t length)
+{
+  usb_bdt[BDT_INDEX(EP_OUT, RX, msc_out_odd)].addr = data;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, msc_out_odd)].desc =
+      BDT_DESC(length, msc_out_data);
+  msc_out_odd ^= 1;
+  msc_out_data ^= 1;
+}
+
+// Claims the next free sector buffer to receive into; zero if there is none
+static uint8_t usb_msc_out_next(void)
+{
+  if (msc_state != MSC_DATA_OUT || msc_next == msc_total
+      || msc_next - msc_tail == MSC_N_BUFFERS)
+    return 0;
+
+  msc_out_ptr = msc_buffers[msc_next & (MSC_N_BUFFERS - 1)];
+  msc_out_remaining = USB_MSC_SECTOR_SIZE;
+  msc_next++;
+  return 1;
+}
+
+// Hand out receive slices until both ping-pong entries are busy
+static void usb_msc_out_fill(void)
+{
+  while (msc_out_pending < 2) {
+    if (msc_out_remaining == 0 && !usb_msc_out_next())
+      break;
+
+    usb_msc_receive(msc_out_ptr, USB_MSC_PACKET_SIZE);
+    msc_out_ptr += USB_MSC_PACKET_SIZE;
+    msc_out_remaining -= USB_MSC_PACKET_SIZE;
+    msc_out_last[msc_out_pending++] = (msc_out_remaining == 0);
+  }
+}
+
+// A command block is one packet, so only one entry is handed out for it
+static void usb_msc_receive_cbw(void)
+{
+  usb_msc_receive(msc_cbw, sizeof(msc_cbw));
+  msc_out_last[msc_out_pending++] = 1;
+}
+
+static void usb_msc_halt_out(void)
+{
+  usb_bdt[BDT_INDEX(EP_OUT, RX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, ODD)].desc = 0;
+  msc_out_odd ^= msc_out_pending & 1;
+  msc_out_pending = 0;
+  msc_out_remaining = 0;
+  msc_out_halted = 1;
+  USB_ENDPT_REG(USB0_BASE_PTR, EP_OUT) |= USB_ENDPT_EPSTALL_MASK;
+}
+
+/*
+ * Command and status
+ */
+
+// Adds cycles to a millisecond total, carrying the remainder
+static void usb_msc_account(uint32_t * ms, uint32_t * cycles, uint32_t n)
+{
+  uint32_t per_ms = (uint32_t) mcg_clk_hz / 1000;
+
+  *cycles += n;
+  *ms += *cycles / per_ms;
+  *cycles %= per_ms;
+}
+
+// Queues the CSW
+static void usb_msc_status(uint8_t status)
+{
+  uint32_t cycles = DWT_CYCCNT - msc_start;
+
+  if (msc_total > 0 && msc_reading) {
+    msc_stats.read_sectors += msc_tail;
+    usb_msc_account(&msc_stats.read_ms, &msc_read_cycles, cycles);
+  } else if (msc_total > 0) {
+    msc_stats.write_sectors += msc_tail;
+    usb_msc_account(&msc_stats.write_ms, &msc_write_cycles, cycles);
+  }
+  msc_total = 0;
+
+  msc_csw[0] = CSW_SIGNATURE & 0xff;
+  msc_csw[1] = (CSW_SIGNATURE >> 8) & 0xff;
+  msc_csw[2] = (CSW_SIGNATURE >> 16) & 0xff;
+  msc_csw[3] = (CSW_SIGNATURE >> 24) & 0xff;
+  msc_csw[4] = msc_cbw[4];      //dCSWTag echoes dCBWTag
+  msc_csw[5] = msc_cbw[5];
+  msc_csw[6] = msc_cbw[6];
+  msc_csw[7] = msc_cbw[7];
+  msc_csw[8] = msc_residue & 0xff;
+  msc_csw[9] = (msc_residue >> 8) & 0xff;
+  msc_csw[10] = (msc_residue >> 16) & 0xff;
+  msc_csw[11] = (msc_residue >> 24) & 0xff;
+  msc_csw[12] = status;
+
+  msc_state = MSC_CSW;
+  msc_in_ptr = msc_csw;
+  msc_in_remaining = CSW_SIZE;
+  usb_msc_in_fill();
+}
+
+// Ends the command. If the host expected more data than was moved and the
+// data phase did not already end on a short packet, the endpoint the host is
+// using is halted first (BOT 6.7).
+static void usb_msc_finish(uint8_t status)
+{
+  if (msc_residue > 0 && !msc_short) {
+    if (msc_dir_in) {
+      msc_status = status;
+      msc_state = MSC_HALTED;
+      usb_msc_halt_in();
+      return;                   //status goes out once the host clears IN
+    }
+    usb_msc_halt_out();
+  }
+  usb_msc_status(status);
+}
+
+static void usb_msc_fail(uint8_t key, uint8_t asc)
+{
+  msc_sense_key = key;
+  msc_asc = asc;
+  msc_residue = msc_expected;
+  usb_msc_finish(CSW_FAILED);
+}
+
+static void usb_msc_pass(void)
+{
+  msc_residue = msc_expected;
+  usb_msc_finish(CSW_PASSED);
+}
+
+// Sends a reply of up to one packet as the data phase
+static void usb_msc_reply(const void *data, uint32_t length)
+{
+  if (!msc_dir_in) {
+    msc_residue = msc_expected;
+    usb_msc_finish(CSW_PHASE_ERROR);
+    return;
+  }
+
+  if (length > msc_expected)
+    length = msc_expected;
+  msc_residue = msc_expected - length;
+  msc_short = length < USB_MSC_PACKET_SIZE && length > 0;
+  if (length == 0) {
+    usb_msc_finish(CSW_PASSED);
+    return;
+  }
+
+  msc_state = MSC_DATA_IN;
+  msc_reading = 0;
+  msc_in_ptr = data;
+  msc_in_remaining = length;
+  usb_msc_in_fill();
+}
+
+// Starts a READ(10) or WRITE(10) data phase
+static void usb_msc_transfer(const uint8_t * cb, uint8_t reading)
+{
+  uint32_t lba = BE32(&cb[2]);
+  uint32_t blocks = BE16(&cb[7]);
+
+  if (msc_sectors == 0) {
+    usb_msc_fail(SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+    return;
+  }
+  if (lba >= msc_sectors || blocks > msc_sectors - lba) {
+    usb_msc_fail(SENSE_ILLEGAL_REQUEST, ASC_LBA_OUT_OF_RANGE);
+    return;
+  }
+  if (blocks * USB_MSC_SECTOR_SIZE != msc_expected
+      || msc_dir_in != reading) {
+    //host and device disagree about the data phase
+    msc_residue = msc_expected;
+    usb_msc_finish(CSW_PHASE_ERROR);
+    return;
+  }
+  if (blocks == 0) {
+    usb_msc_pass();
+    return;
+  }
+
+  msc_lba = lba;
+  msc_total = blocks;
+  msc_head = msc_next = msc_tail = 0;
+  msc_residue = 0;
+  msc_reading = reading;
+  if (reading) {
+    msc_state = MSC_DATA_IN;    //the main loop starts reading
+  } else {
+    msc_state = MSC_DATA_OUT;
+    usb_msc_out_fill();
+  }
+}
+
+static void usb_msc_command(void)
+{
+  static const uint8_t inquiry[36] = {
+    0x00,                       //direct access block device
+    0x80,                       //removable
+    0x04,                       //SPC-2
+    0x02,                       //response data format
+    31, 0, 0, 0,                //additional length
+    'T', 'e', 'e', 'n', 's', 'y', ' ', ' ',
+    'm', 'o', 'u', 's', 'e', '_', 'm', 'o', 'v', 'e', 'r', ' ', 'S', 'D',
+    ' ', ' ',
+    '1', '.', '0', ' '
+  };
+  const uint8_t *cb = &msc_cbw[15];
+  uint32_t last;
+  uint8_t i;
+
+  msc_seq++;
+  msc_start = DWT_CYCCNT;
+  msc_expected = LE32(&msc_cbw[8]);
+  msc_dir_in = (msc_cbw[12] & 0x80) != 0;
+  msc_short = 0;
+  msc_total = 0;
+  msc_in_sent = 0;
+
+  switch (cb[0]) {
+  case 0x00:                   //TEST UNIT READY
+    if (msc_sectors == 0)
+      usb_msc_fail(SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+    else
+      usb_msc_pass();
+    break;
+  case 0x03:                   //REQUEST SENSE
+    for (i = 0; i < 18; i++)
+      msc_reply[i] = 0;
+    msc_reply[0] = 0x70;        //current error, fixed format
+    msc_reply[2] = msc_sense_key;
+    msc_reply[7] = 10;          //additional length
+    msc_reply[12] = msc_asc;
+    msc_sense_key = msc_asc = 0;
+    usb_msc_reply(msc_reply, 18);
+    break;
+  case 0x12:                   //INQUIRY
+    usb_msc_reply(inquiry, sizeof(inquiry));
+    break;
+  case 0x1a:                   //MODE SENSE(6), no pages, not write protected
+    msc_reply[0] = 3;
+    msc_reply[1] = msc_reply[2] = msc_reply[3] = 0;
+    usb_msc_reply(msc_reply, 4);
+    break;
+  case 0x1b:                   //START STOP UNIT
+  case 0x1e:                   //PREVENT ALLOW MEDIUM REMOVAL
+  case 0x2f:                   //VERIFY(10)
+    usb_msc_pass();
+    break;
+  case 0x23:                   //READ FORMAT CAPACITIES
+  case 0x25:                   //READ CAPACITY(10)
+    if (msc_sectors == 0) {
+      usb_msc_fail(SENSE_NOT_READY, ASC_MEDIUM_NOT_PRESENT);
+      break;
+    }
+    i = 0;
+    if (cb[0] == 0x23) {
+      //capacity list header, then one formatted-media descriptor
+      msc_reply[i++] = 0;
+      msc_reply[i++] = 0;
+      msc_reply[i++] = 0;
+      msc_reply[i++] = 8;
+      last = msc_sectors;
+    } else {
+      last = msc_sectors - 1;
+    }
+    msc_reply[i++] = last >> 24;
+    msc_reply[i++] = last >> 16;
+    msc_reply[i++] = last >> 8;
+    msc_reply[i++] = last;
+    msc_reply[i++] = (cb[0] == 0x23) ? 0x02 : 0;
+    msc_reply[i++] = 0;
+    msc_reply[i++] = USB_MSC_SECTOR_SIZE >> 8;
+    msc_reply[i++] = USB_MSC_SECTOR_SIZE & 0xff;
+    usb_msc_reply(msc_reply, i);
+    break;
+  case 0x28:                   //READ(10)
+    usb_msc_transfer(cb, 1);
+    break;
+  case 0x2a:                   //WRITE(10)
+    usb_msc_transfer(cb, 0);
+    break;
+  default:
+    usb_msc_fail(SENSE_ILLEGAL_REQUEST, ASC_INVALID_COMMAND);
+    break;
+  }
+}
+
+// A packet arrived while waiting for a command
+static void usb_msc_cbw(uint32_t count)
+{
+  if (count != CBW_SIZE || LE32(msc_cbw) != CBW_SIGNATURE
+      || (msc_cbw[13] & 0x0f) != 0 || msc_cbw[14] < 1 || msc_cbw[14] > 16) {
+    //not a meaningful command, stall both ways until the host resets us
+    msc_state = MSC_RESET;
+    usb_msc_halt_in();
+    usb_msc_halt_out();
+    return;
+  }
+  usb_msc_command();
+}
+
+// Every sector received has been written
+static void usb_msc_out_done(void)
+{
+  msc_residue = msc_expected - msc_tail * USB_MSC_SECTOR_SIZE;
+  if (msc_residue == 0) {
+    usb_msc_status(CSW_PASSED);
+    return;
+  }
+  //a short packet cut the data phase off part way
+  msc_sense_key = SENSE_ABORTED_COMMAND;
+  msc_asc = ASC_DATA_PHASE_ERROR;
+  usb_msc_status(CSW_FAILED);
+}
+
+// The host ended the data phase with a short packet. Sectors it completed
+// are still written; the one it cut off is dropped, and the status waits
+// for the main loop to catch up.
+static void usb_msc_out_short(void)
+{
+  //step back over the entry we reclaim, its toggle was never used
+  usb_bdt[BDT_INDEX(EP_OUT, RX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, ODD)].desc = 0;
+  msc_out_odd ^= msc_out_pending & 1;
+  msc_out_data ^= msc_out_pending & 1;
+  msc_out_pending = 0;
+  msc_out_remaining = 0;
+
+  msc_short = 1;
+  msc_total = msc_next = msc_head;
+  if (msc_tail == msc_head)
+    usb_msc_out_done();
+}
+
+/*
+ * Endpoints
+ */
+
+static void usb_msc_in_handler(void)
+{
+  uint8_t last;
+
+  if (msc_in_pending == 0)
+    return;
+
+  //packets complete in the order they were queued
+  last = msc_in_last[0];
+  msc_in_last[0] = msc_in_last[1];
+  msc_in_sent += msc_in_len[0];
+  msc_in_len[0] = msc_in_len[1];
+  msc_in_pending--;
+
+  if (last && msc_state == MSC_CSW) {
+    msc_state = MSC_CBW;
+    if (!msc_out_halted)
+      usb_msc_receive_cbw();
+    return;
+  }
+  if (last && msc_state == MSC_DATA_IN) {
+    if (!msc_reading)
+      usb_msc_finish(CSW_PASSED);
+    else if (++msc_tail == msc_total)
+      usb_msc_finish(CSW_PASSED);
+  }
+  usb_msc_in_fill();
+}
+
+static void usb_msc_out_handler(uint8_t stat)
+{
+  bdt_t *bdt = &usb_bdt[BDT_STAT_INDEX(stat)];
+  uint8_t last;
+
+  if (BDT_PID(bdt->desc) != PID_OUT || msc_out_pending == 0)
+    return;
+
+  last = msc_out_last[0];
+  msc_out_last[0] = msc_out_last[1];
+  msc_out_pending--;
+
+  if (msc_state == MSC_CBW) {
+    usb_msc_cbw(BDT_BC(bdt->desc));
+    return;
+  }
+  if (msc_state == MSC_DATA_OUT) {
+    if (BDT_BC(bdt->desc) < USB_MSC_PACKET_SIZE) {
+      usb_msc_out_short();
+      return;
+    }
+    //the main loop writes the sector once all of it is in
+    if (last)
+      msc_head++;
+    usb_msc_out_fill();
+  }
+}
+
+void usb_msc_handler(uint8_t stat)
+{
+  switch (stat >> 4) {
+  case EP_OUT:
+    usb_msc_out_handler(stat);
+    break;
+  case EP_IN:
+    if (BDT_PID(usb_bdt[BDT_STAT_INDEX(stat)].desc) == PID_IN)
+      usb_msc_in_handler();
+    break;
+  }
+}
+
+// The host cleared a halt; that also resets the data toggle
+static void usb_msc_clear_halt(uint8_t endpoint)
+{
+  if (endpoint == USB_EP_IN(EP_IN) && msc_in_halted) {
+    msc_in_halted = 0;
+    msc_in_data = 0;
+    if (msc_state == MSC_HALTED)
+      usb_msc_status(msc_status);
+  }
+  if (endpoint == USB_EP_OUT(EP_OUT) && msc_out_halted) {
+    msc_out_halted = 0;
+    msc_out_data = 0;
+    if (msc_state == MSC_CBW)
+      usb_msc_receive_cbw();
+  }
+}
+
+static void usb_msc_configure(uint8_t config)
+{
+  usb_bdt[BDT_INDEX(EP_IN, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_IN, TX, ODD)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP_OUT, RX, ODD)].desc = 0;
+  msc_in_odd = msc_out_odd = 0;
+  msc_in_data = msc_out_data = 0;
+  msc_in_pending = msc_out_pending = 0;
+  msc_in_remaining = msc_out_remaining = 0;
+  msc_in_halted = msc_out_halted = 0;
+  msc_total = 0;
+  msc_seq++;
+  msc_state = MSC_CBW;
+
+  if (config == 0) {
+    USB_ENDPT_REG(USB0_BASE_PTR, EP_OUT) = 0;
+    USB_ENDPT_REG(USB0_BASE_PTR, EP_IN) = 0;
+    return;
+  }
+
+  USB_ENDPT_REG(USB0_BASE_PTR, EP_OUT) =
+      USB_ENDPT_EPRXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+  USB_ENDPT_REG(USB0_BASE_PTR, EP_IN) =
+      USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+  usb_msc_receive_cbw();
+}
+
+const usb_class_t usb_msc_class = {
+  .configure = usb_msc_configure,
+  .sof = NULL,
+  //status waiting on a cleared halt goes out from here
+  .clear_halt = usb_msc_clear_halt,
+  .set_interface = NULL,
+  .requests = requests,
+  .descriptors = NULL,
+};
+
+/*
+ * Application interface
+ */
+
+void usb_msc_media(usb_msc_block_t read, usb_msc_block_t write,
+                   uint32_t sectors)
+{
+  uint8_t i;
+
+  //the cycle counter times transfers for usb_msc_stats
+  DEMCR |= DEMCR_TRCENA_MASK;
+  DWT_CTRL |= DWT_CTRL_CYCCNTENA_MASK;
+
+  for (i = 0; i < MSC_N_BUFFERS && sectors > 0; i++) {
+    if (msc_buffers[i] == NULL)
+      msc_buffers[i] = slab_alloc(USB_MSC_SECTOR_SIZE);
+    if (msc_buffers[i] == NULL)
+      sectors = 0;              //out of memory, the drive shows up empty
+  }
+
+  DisableInterrupts;
+  msc_read = read;
+  msc_write = write;
+  msc_sectors = (read && write) ? sectors : 0;
+  msc_sense_key = SENSE_UNIT_ATTENTION; //tell the host the medium changed
+  msc_asc = ASC_MEDIUM_CHANGED;
+  EnableInterrupts;
+}
+
+void usb_msc_task(void)
+{
+  uint32_t seq = msc_seq;
+  uint32_t sector;
+  uint8_t *buf;
+  int32_t result;
+
+  if (msc_state == MSC_DATA_IN && msc_reading && msc_head < msc_total
+      && msc_head - msc_tail < MSC_N_BUFFERS) {
+    //read ahead into the next free buffer while the last one is sent
+    sector = msc_head;
+    buf = msc_buffers[sector & (MSC_N_BUFFERS - 1)];
+    result = msc_read(msc_lba + sector, buf);
+
+    DisableInterrupts;
+    if (seq == msc_seq) {
+      if (result == 0) {
+        msc_head++;
+        usb_msc_in_fill();
+      } else {
+        msc_stats.errors++;
+        //whatever the host has not taken yet is dropped by the halt
+        msc_residue = msc_expected - usb_msc_in_taken();
+        msc_sense_key = SENSE_MEDIUM_ERROR;
+        msc_asc = ASC_READ_ERROR;
+        usb_msc_finish(CSW_FAILED);
+      }
+    }
+    EnableInterrupts;
+  } else if (msc_state == MSC_DATA_OUT && msc_tail != msc_head) {
+    //write the oldest received sector while the next one comes in
+    sector = msc_tail;
+    buf = msc_buffers[sector & (MSC_N_BUFFERS - 1)];
+    result = msc_write(msc_lba + sector, buf);
+
+    DisableInterrupts;
+    if (seq == msc_seq) {
+      if (result != 0) {
+        msc_stats.errors++;
+        msc_residue = msc_expected - sector * USB_MSC_SECTOR_SIZE;
+        msc_sense_key = SENSE_MEDIUM_ERROR;
+        msc_asc = ASC_WRITE_FAULT;
+        usb_msc_finish(CSW_FAILED);
+      } else if (++msc_tail == msc_total) {
+        usb_msc_out_done();
+      } else {
+        usb_msc_out_fill();     //a buffer just came free
+      }
+    }
+    EnableInterrupts;
+  }
+}
+
+void usb_msc_stats(usb_msc_stats_t * stats)
+{
+  DisableInterrupts;
+  *stats = msc_stats;
+  msc_stats.read_sectors = msc_stats.read_ms = 0;
+  msc_stats.write_sectors = msc_stats.write_ms = 0;
+  msc_stats.errors = 0;
+  EnableInterrupts;
+}
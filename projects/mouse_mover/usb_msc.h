@@ -0,0 +1,76 @@
+/**
+ * USB mass storage (Bulk-Only Transport, SCSI transparent) class driver
+ *
+ * Exposes a block device, normally the SD card, as a single LUN. Uses one
+ * interface (USB_MSC_INTERFACE) and two bulk endpoints starting at
+ * USB_MSC_ENDPOINT (data OUT, data IN), assigned in usb_config.h.
+ *
+ * The media is slow and blocking (SPI), so sectors are never read or written
+ * from the USB interrupt. usb_msc_task() does that from the main loop while
+ * the interrupt moves packets straight between the BDT and the sector buffers.
+ */
+#ifndef _USB_MSC_H_
+#define _USB_MSC_H_
+
+#include "usb_dev.h"
+
+#define USB_MSC_N_INTERFACES 1
+#define USB_MSC_N_ENDPOINTS  2
+
+#define USB_MSC_PACKET_SIZE 64
+#define USB_MSC_SECTOR_SIZE 512
+
+#define USB_MSC_DESC_SIZE \
+  (USB_DESC_INTERFACE_SIZE + 2 * USB_DESC_ENDPOINT_SIZE)
+
+#define USB_MSC_DESC(iface, ep) \
+  USB_DESC_INTERFACE(iface, 0, 2, 0x08, 0x06, 0x50), /* MSC, SCSI, BOT */ \
+  USB_DESC_ENDPOINT(USB_EP_OUT(ep), USB_EP_BULK, USB_MSC_PACKET_SIZE, 0), \
+  USB_DESC_ENDPOINT(USB_EP_IN((ep) + 1), USB_EP_BULK, USB_MSC_PACKET_SIZE, 0)
+
+#define USB_MSC_CLASS usb_msc_class
+#define USB_MSC_HANDLER usb_msc_handler
+
+extern const usb_class_t usb_msc_class;
+void usb_msc_handler(uint8_t stat);
+
+/**
+ * Sector access functions, same signatures and return codes as SDReadBlock
+ * and SDWriteBlock (zero on success)
+ */
+typedef int32_t (*usb_msc_block_t) (uint32_t block, uint8_t * buff);
+
+/**
+ * Attaches the media. Until this is called (or with sectors == 0) the host
+ * sees an empty drive.
+ *
+ * @param read Reads one 512-byte sector
+ * @param write Writes one 512-byte sector
+ * @param sectors Size of the media in sectors
+ */
+void usb_msc_media(usb_msc_block_t read, usb_msc_block_t write,
+                   uint32_t sectors);
+
+/**
+ * Reads or writes at most one sector. Call this from the main loop.
+ */
+void usb_msc_task(void);
+
+/**
+ * Transfer statistics. Time runs from the command arriving until its status
+ * is queued, so it covers both the media and the bus.
+ */
+typedef struct {
+  uint32_t read_sectors;
+  uint32_t read_ms;
+  uint32_t write_sectors;
+  uint32_t write_ms;
+  uint32_t errors;              //commands that failed at the media
+} usb_msc_stats_t;
+
+/**
+ * Copies out and clears the statistics
+ */
+void usb_msc_stats(usb_msc_stats_t * stats);
+
+#endif                          // _USB_MSC_H_
@@ -0,0 +1,126 @@
+/**
+ * Vendor bulk IN sample stream class driver
+ *
+ * Ready buffers are sent in place: the BDT entries point straight at
+ * consecutive 64-byte slices of the buffer, so samples never pass through an
+ * intermediate copy. A full buffer is 2046 bytes, so its final slice is a
+ * short packet and marks the buffer boundary for the host; a shortened
+ * buffer that fills its last packet exactly is followed by an empty one. The
+ * buffer is freed once that last packet has gone out.
+ */
+#include "usb_stream.h"
+#include "usb_config.h"
+#include "buffers.h"
+
+#define EP USB_STREAM_ENDPOINT
+
+static uint8_t stream_odd, stream_data = 0;
+
+static const uint8_t *stream_ptr = NULL;  //next slice to queue, NULL when idle
+static uint16_t stream_remaining = 0;     //bytes of the buffer not yet queued
+static uint8_t stream_zlp = 0;            //an empty packet must end the buffer
+static uint8_t stream_index;              //pool index of the buffer being sent
+static uint8_t stream_pending = 0;        //packets owned by the USB module
+
+static void usb_stream_transmit(const void *data, uint8_t length)
+{
+  usb_bdt[BDT_INDEX(EP, TX, stream_odd)].addr = (void *) data;
+  usb_bdt[BDT_INDEX(EP, TX, stream_odd)].desc = BDT_DESC(length, stream_data);
+  //toggle the odd and data bits
+  stream_odd ^= 1;
+  stream_data ^= 1;
+}
+
+// Queue slices of the current buffer until both ping-pong entries are busy
+static void usb_stream_fill(void)
+{
+  uint32_t size;
+
+  while (stream_pending < 2 && (stream_remaining > 0 || stream_zlp)) {
+    if (stream_remaining == 0)
+      stream_zlp = 0;
+    size = stream_remaining;
+    if (size > USB_STREAM_PACKET_SIZE)
+      size = USB_STREAM_PACKET_SIZE;
+    usb_stream_transmit(stream_ptr, size);
+    stream_ptr += size;
+    stream_remaining -= size;
+    stream_pending++;
+  }
+}
+
+// Start on the next ready buffer if the stream is idle
+static void usb_stream_poll(void)
+{
+  const uint16_t *buf;
+
+  if (!usb_configured || stream_ptr != NULL)
+    return;
+
+  //a stage may have emptied a buffer entirely; nothing to send for it
+  buf = buffers_get_next_ready(&stream_index);
+  while (buf != NULL && buffers_length(stream_index) == 0) {
+    buffer_free(stream_index);
+    buf = buffers_get_next_ready(&stream_index);
+  }
+  if (buf == NULL)
+    return;
+
+  stream_ptr = (const uint8_t *) buf;
+  stream_remaining = buffers_length(stream_index) * sizeof(uint16_t);
+  stream_zlp = stream_remaining % USB_STREAM_PACKET_SIZE == 0;
+  usb_stream_fill();
+}
+
+// Abandon any transfer in progress; the buffer stays ready and is resent
+static void usb_stream_configure(uint8_t config)
+{
+  usb_bdt[BDT_INDEX(EP, TX, EVEN)].desc = 0;
+  usb_bdt[BDT_INDEX(EP, TX, ODD)].desc = 0;
+  stream_odd = stream_data = 0;
+  stream_ptr = NULL;
+  stream_remaining = 0;
+  stream_zlp = 0;
+  stream_pending = 0;
+
+  if (config == 0) {
+    USB_ENDPT_REG(USB0_BASE_PTR, EP) = 0;
+  } else {
+    USB_ENDPT_REG(USB0_BASE_PTR, EP) =
+        USB_ENDPT_EPTXEN_MASK | USB_ENDPT_EPHSHK_MASK;
+  }
+}
+
+void usb_stream_handler(uint8_t stat)
+{
+  bdt_t *bdt = &usb_bdt[BDT_STAT_INDEX(stat)];
+
+  if (BDT_PID(bdt->desc) != PID_IN || stream_pending == 0)
+    return;
+
+  stream_pending--;
+  if (stream_remaining > 0 || stream_zlp) {
+    usb_stream_fill();
+  } else if (stream_pending == 0 && stream_ptr != NULL) {
+    //last packet of the buffer is out, hand it back and move on
+    buffer_free(stream_index);
+    stream_ptr = NULL;
+    usb_stream_poll();
+  }
+}
+
+static void usb_stream_clear_halt(uint8_t endpoint)
+{
+  if (endpoint == USB_EP_IN(EP))
+    stream_data = usb_tx_restart(EP, stream_odd, stream_pending);
+}
+
+const usb_class_t usb_stream_class = {
+  .configure = usb_stream_configure,
+  //pick up any buffers that became ready while the stream was idle
+  .sof = usb_stream_poll,
+  .clear_halt = usb_stream_clear_halt,
+  .set_interface = NULL,
+  .requests = NULL,
+  .descriptors = NULL,
+};
@@ -0,0 +1,31 @@
+/**
+ * Vendor bulk IN sample stream class driver
+ *
+ * Sends READY buffers from the buffers.c pool to the host without copying.
+ * Uses one vendor-specific interface (USB_STREAM_INTERFACE) and one bulk IN
+ * endpoint (USB_STREAM_ENDPOINT), both assigned in usb_config.h.
+ */
+#ifndef _USB_STREAM_H_
+#define _USB_STREAM_H_
+
+#include "usb_dev.h"
+
+#define USB_STREAM_N_INTERFACES 1
+#define USB_STREAM_N_ENDPOINTS  1
+
+#define USB_STREAM_PACKET_SIZE 64
+
+#define USB_STREAM_DESC_SIZE \
+  (USB_DESC_INTERFACE_SIZE + USB_DESC_ENDPOINT_SIZE)
+
+#define USB_STREAM_DESC(iface, ep) \
+  USB_DESC_INTERFACE(iface, 0, 1, 0xff, 0x00, 0x00), /* vendor specific */ \
+  USB_DESC_ENDPOINT(USB_EP_IN(ep), USB_EP_BULK, USB_STREAM_PACKET_SIZE, 0)
+
+#define USB_STREAM_CLASS usb_stream_class
+#define USB_STREAM_HANDLER usb_stream_handler
+
+extern const usb_class_t usb_stream_class;
+void usb_stream_handler(uint8_t stat);
+
+#endif                          // _USB_STREAM_H_
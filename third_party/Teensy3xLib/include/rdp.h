@@ -0,0 +1,137 @@
+/*
+ *  rdp.h      header file for the recursive-descent integer expression parser (librdp.a)
+ *
+ *  The parser handles 32-bit signed integer expressions with the operators,
+ *  from lowest to highest precedence:
+ *
+ *    &  |  ^            bitwise AND, OR, XOR
+ *    +  -               add, subtract
+ *    %                  modulus
+ *    *  /               multiply, divide
+ *    **                 integer exponent
+ *    -  +  ~            unary negate, plus, 1's complement
+ *    ( )                grouping
+ *
+ *  Numbers may be decimal (123), hex (0x7b), binary (0b1111011) or a
+ *  single ASCII char in quotes ('{').
+ *
+ *  There are two ways to use the parser.  rdp() parses and evaluates a
+ *  string in one step; use it for a string you need the value of once.
+ *
+ *  For an expression you need to evaluate over and over, such as a
+ *  threshold or a scale factor typed in at the console and applied to
+ *  every sample, call rdp_compile() once to turn the string into a short
+ *  stack program, then call rdp_eval() on that program each time you
+ *  need the value.  A compiled expression may also use variables, each
+ *  named by a single lower-case letter; the caller supplies their values
+ *  to rdp_eval().  For example:
+ *
+ *    rdp_code_t   scale;
+ *    int32_t      x, y;
+ *
+ *    rdp_compile("(x - 2048) * 3 / 4", "x", &scale);  // once, in the main loop
+ *    ...
+ *    rdp_eval(&scale, &x, &y);                        // per sample, x is variable 0
+ *
+ *  rdp_eval() does not use any globals or recurse, so it can run from an
+ *  ISR, and several ISRs can evaluate programs at once.  rdp() and
+ *  rdp_compile() share the parser's globals and must not be called from
+ *  more than one context.
+ */
+
+#ifndef  RDP_H
+#define  RDP_H
+
+#include  <stdint.h>
+
+
+/*
+ *  Error codes returned by rdp(), rdp_compile() and rdp_eval()
+ */
+#define  RDP_OK					0		// expression parsed and evaluated
+#define  RDP_NO_EXP				1		// string holds no expression
+#define  RDP_SYNTAX				2		// bad number or operator, or junk after the expression
+#define  RDP_UNBAL_PARENS		3		// ( without a matching )
+#define  RDP_DIVIDE_0			4		// divide or modulus by zero
+#define  RDP_TOO_LONG			5		// expression does not fit an rdp_code_t
+#define  RDP_NO_VAR				6		// variable not in the list passed to rdp_compile()
+
+
+/*
+ *  Token types, used inside the parser
+ */
+#define  RDP_UNKNOWN			0
+#define  RDP_DELIMITER			1
+#define  RDP_NUMBER				2
+#define  RDP_HEXNUMBER			3
+#define  RDP_BINNUMBER			4
+#define  RDP_ASCNUMBER			5
+#define  RDP_VARIABLE			6
+
+#define  DELIMITERS				"+-*/%&|^~()"
+
+
+/*
+ *  Limits on a compiled expression.  RDP_MAX_STACK also sets how much
+ *  stack rdp_eval() uses (four bytes per entry).
+ */
+#define  RDP_MAX_OPS			64		// operators, numbers and variables
+#define  RDP_MAX_LITS			16		// numbers
+#define  RDP_MAX_STACK			16		// values waiting at once
+
+
+/*
+ *  rdp_code_t      a compiled expression
+ *
+ *  Each op is one byte; a number's value is kept in lit[], in the order
+ *  the numbers are used.  Treat the contents as private.
+ */
+typedef struct
+{
+	uint8_t				ops;				// bytes used in op[]
+	uint8_t				lits;				// entries used in lit[]
+	uint8_t				depth;				// most values on the stack at once
+	uint8_t				vars;				// highest variable used, plus one
+	uint8_t				op[RDP_MAX_OPS];
+	int32_t				lit[RDP_MAX_LITS];
+}  rdp_code_t;
+
+
+
+/*
+ *  rdp      parse and evaluate the expression in str
+ *
+ *  The result is written to answer.  Returns RDP_OK if the expression
+ *  parsed and evaluated, else one of the error codes above.  Variables
+ *  are not allowed.
+ */
+uint32_t		rdp(char  *str, int32_t  *answer);
+
+
+
+/*
+ *  rdp_compile      parse the expression in str into code
+ *
+ *  Argument vars lists the letters the expression may use as variables,
+ *  such as "xy"; a letter's position in the list is the index of its
+ *  value in the array passed to rdp_eval().  Pass 0 or "" if the
+ *  expression has no variables.
+ *
+ *  Returns RDP_OK if the expression compiled, else one of the error codes
+ *  above.  Divide by zero is only found when the program is evaluated.
+ *  Unlike rdp(), anything left over after the expression is an error.
+ */
+uint32_t		rdp_compile(char  *str, const char  *vars, rdp_code_t  *code);
+
+
+
+/*
+ *  rdp_eval      evaluate a compiled expression
+ *
+ *  Argument vars points to the variables' values, at least code->vars of
+ *  them.  The result is written to answer.  Returns RDP_OK, RDP_DIVIDE_0
+ *  (answer is left alone), or RDP_NO_EXP if code did not compile.
+ */
+uint32_t		rdp_eval(const rdp_code_t  *code, const int32_t  *vars, int32_t  *answer);
+
+#endif
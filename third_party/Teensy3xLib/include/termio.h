@@ -14,20 +14,59 @@
  *  corresponding uart.h and uart.c files for details.
  *
  *  xprintf, xatoi, and xatoi are limited to integer values, with a maximum of
- *  32 bits, signed or unsigned.
+ *  32 bits, signed or unsigned; xprintf also takes 64-bit values with %llu,
+ *  %lld and %llx.
  */
 
 #ifndef  TERM_IO_H
 #define  TERM_IO_H
 
 
+/*
+ *  xdev_out and xdev_in redirect terminal output and input away from the
+ *  active UART.  Each function must follow the same conventions as the
+ *  matching UARTWrite, UARTRead and UARTAvail routine.
+ */
+void			xdev_out(int32_t (*write)(const char *ptr, int32_t len));
+void			xdev_in(int32_t (*read)(char *ptr, int32_t len), int32_t (*avail)(void));
+
+
 int32_t			xatoi (char **str, long *res);
 void			xitoa (long val, int32_t radix, int32_t len);
 void			xputc (char c);
 uint8_t			xgetc(void);
 int32_t			xavail(void);
 void			xputs (const char* str);
-void			xprintf (const char* str, ...);
+
+
+
+/*
+ *  xprintf      integer-only printf to the terminal device
+ *
+ *  Conversions are %d, %u, %x, %X, %b (binary), %c, %s, %p and %%, with
+ *  optional -, 0 and width; %l... is the same as %..., and %ll... takes a
+ *  64-bit argument.  %x, %X and %p all print upper case hex digits.
+ *  \n goes out as \r\n.  The whole line is formatted into a buffer on
+ *  the stack and sent with one write (one per XPRINTF_BUF chars for
+ *  longer output).
+ *
+ *  Returns the number of chars written.
+ */
+int32_t			xprintf (const char* str, ...);
+
+
+
+/*
+ *  xsnprintf      xprintf into buf, of size chars, always ended with a null
+ *
+ *  Output that does not fit is dropped; \n is left as it is.  Returns
+ *  the length the whole output would have had, as snprintf does, so a
+ *  return of size or more means it was cut short.
+ */
+int32_t			xsnprintf (char *buf, int32_t size, const char* str, ...);
+
+
+
 void			put_dump (const uint8_t *buff, uint32_t ofs, int32_t cnt);
 int32_t			get_line (char *buff, int32_t len);
 int32_t			get_line_r (char *buff, int32_t len, int32_t *idx);
@@ -14,79 +14,315 @@
 
 
 /*
- *  These routines support access to all UARTs on the Teensy 3.x (K20).
- *  To use a UART, first call UARTInit() with the UART number (0-2) and
- *  a desired baud rate; this call marks the selected UART as active.
- *  You can then call UARTWrite() to send chars to the active UART.  Use
- *  UARTAvail() to check for received chars.  Use UARTRead() to read
- *  chars (with blocking) from the active UART.
+ *  These routines support access to all UARTs on the K20: UART0-2 on
+ *  the Teensy 3.x, plus UART3 and UART4 on the 100-pin parts.  Open a
+ *  UART with uart_open(), which returns a handle (uart_t) for all other
+ *  calls on that UART.  Each UART has its own queues, DMA setup and stats,
+ *  so any number of them can be used at once.
  *
- *  To use a different UART as the active UART, call UARTAssignActiveUART().
+ *  Writes are queued and sent by the UART's interrupt handler, so
+ *  uart_write() returns as soon as the chars are queued.  Use uart_flush()
+ *  to wait until they have actually gone out.
+ *
+ *  The original calls, UARTInit(), UARTWrite() and so on, still work; they
+ *  act on one active UART, chosen by UARTInit() or UARTAssignActiveUART().
  */
+typedef struct uart_s  uart_t;
+
 
 
 /*
- *  UARTInit      setup selected UART, including baud rate
+ *  uart_open      setup selected UART, including baud rate
  *
  *  Uses system core or peripheral clock (depending on UART) to calc
- *  divisors for selected baud rate.  Configures UART for polled I/O.
- *  Sets up GPIO lines as needed.
+ *  divisors for selected baud rate (see uart_plan_baud()).  Configures
+ *  UART for interrupt-driven I/O.  Sets up GPIO lines as needed.
  *
- *  Upon entry, uartnum selects the UART (0-2) and baud is the
- *  desired baud rate, expressed as a uint32_t.  For example,
- *  a value of 115200 for baud generates a baud clock of 115 Kbaud.
+ *  Upon entry, uartnum selects the UART (0-4) and baud is the
+ *  desired baud rate.  For example, a value of 115200 for baud
+ *  generates a baud clock of 115 Kbaud.
  *
- *  Calls with an illegal UART selector for uartnum are ignored.
+ *  Returns the UART's handle, or 0 for an illegal UART selector or a
+ *  baud rate the UART's clock cannot make.
  */
-void			UARTInit(uint32_t  uartnum, int32_t  baudrate);
+uart_t			*uart_open(uint32_t  uartnum, int32_t  baud);
 
 
 
 /*
- *  UARTAssignActiveUART      assign an active UART for later char read/write
+ *  uart_plan_baud      work out the divisor for a baud rate
  *
- *  This routine assigns an active UART based on the argument uartnum.  This
- *  argument must be in the legal range of UARTs for the device; for Teensy 3.x,
- *  this range is 0-2.
+ *  clock is the UART's clock in Hz: the core clock for UART0 and UART1,
+ *  the peripheral (bus) clock for the others.  Picks the SBR and BRFA
+ *  giving the rate closest to baud, and if ppm is not 0, stores the
+ *  error of that rate there, in parts per million (negative if slow).
+ *  Rates up to clock/16 can be made, so UART0 and UART1 reach 4.5 Mbaud
+ *  with a 72 MHz core, and UART2-4 2.25 Mbaud with a 36 MHz bus; at those
+ *  speeds only rates near clock*2/n are exact.
  *
- *  Upon exit, this routine returns the previous active UART number, if there
- *  was such, else it returns uin32_t -1.
+ *  Returns the rate achieved, or 0 if baud is out of range.
+ */
+uint32_t		uart_plan_baud(uint32_t  clock, uint32_t  baud, uint16_t  *sbr, uint8_t  *brfa, int32_t  *ppm);
+
+
+
+/*
+ *  uart_set_baud      change an open UART's baud rate
  *
- *  If the requested UART number is out of the legal range, this routine does
- *  not change the active UART.  However, it still returns the previous active
- *  UART number.
+ *  Waits for queued chars to be sent, then sets the divisor from
+ *  uart_plan_baud().  If ppm is not 0, the error is stored there.
+ *
+ *  Returns the rate achieved, or 0 (and the rate is left as it was) if
+ *  the UART's clock cannot make baud.
  */
-uint32_t		UARTAssignActiveUART(uint32_t  uartnum);
+uint32_t		uart_set_baud(uart_t  *uart, uint32_t  baud, int32_t  *ppm);
+
+
+
+/*
+ *  uart_get_baud      the rate a UART is running at
+ *
+ *  If ppm is not 0, the error from the rate asked for is stored there.
+ */
+uint32_t		uart_get_baud(uart_t  *uart, int32_t  *ppm);
+
+
+
+/*
+ *  uart_autobaud      set a UART's baud rate from a sync char sent to it
+ *
+ *  Waits up to timeout_ms for the far end to send 0x00, times it with
+ *  an FTM input capture, and sets the baud rate to match, rounded to a
+ *  standard rate within 2%.  The 0x00 only counts once the line has been
+ *  quiet for a char time at UART_AUTOBAUD_MIN (1200 baud unless defined
+ *  otherwise, so 8.3 ms), from the call or from the last traffic seen;
+ *  the far end should leave at least that before it.  Rates from
+ *  UART_AUTOBAUD_MIN up to what the UART can make are measured.  The
+ *  sync char itself is not received.
+ *
+ *  Only UART1, whose RXD pin (PC3) is also FTM0 channel 2, can do this.
+ *  FTM0 is borrowed for the measurement, so it must not be in use.
+ *
+ *  Returns the rate set, or 0 on timeout, for another UART, or if the
+ *  rate measured cannot be made.
+ */
+uint32_t		uart_autobaud(uart_t  *uart, uint32_t  timeout_ms);
 
 
 
 /*
- *  UARTWrite      writes N chars to active UART
+ *  uart_write      writes N chars to a UART
  *
  *  Upon entry, ptr points to a block (not string!) of
- *  chars to write to the active UART and len holds the
- *  number of chars to write.
+ *  chars to write and len holds the number of chars to write.
+ *
+ *  The chars are copied into the UART's transmit queue and
+ *  this routine returns without waiting for them to be sent.
+ *  If the queue fills, the write mode (see uart_set_write_mode())
+ *  decides whether to wait for room or drop the remainder.
+ *
+ *  Chars are queued a few at a time (UART_XMT_CHUNK, 16 by default)
+ *  with interrupts masked, so the main loop and interrupt handlers may
+ *  all write to one UART.  Each writer's chars go out in order, but
+ *  another writer's may come between any two chunks of them.
  *
  *  Returns number of chars written.
  */
+int32_t			uart_write(uart_t  *uart, const char  *ptr, int32_t  len);
 
-int32_t			UARTWrite(const char *ptr, int32_t len);
+
+
+/*
+ *  uart_set_write_mode      choose what uart_write() does when the queue is full
+ *
+ *  UART_WRITE_BLOCK (the default after uart_open()) waits for room, so
+ *  every char is sent.  UART_WRITE_DROP returns at once, and the return
+ *  value of uart_write() shows how many chars were taken; use this mode
+ *  if writing from an interrupt handler.
+ *
+ *  Returns the previous mode.
+ */
+#define  UART_WRITE_BLOCK		0
+#define  UART_WRITE_DROP		1
+
+uint32_t		uart_set_write_mode(uart_t  *uart, uint32_t  mode);
+
+
+
+/*
+ *  uart_flush      waits until all queued chars have left the UART
+ */
+void			uart_flush(uart_t  *uart);
 
 
 
+/*
+ *  uart_avail      returns number of chars waiting in a UART's holding area
+ */
+int32_t			uart_avail(uart_t  *uart);
+
+
 
 /*
- *  UARTAvail      returns number of chars waiting in active UART's holding area
+ *  uart_read      reads (with blocking) len chars from a UART, writes to buffer at ptr
+ */
+int32_t			uart_read(uart_t  *uart, char  *ptr, int32_t  len);
+
+
+
+/*
+ *  uart_read_available      reads (without blocking) up to len chars from a UART
+ *
+ *  Copies whatever is waiting, up to len chars, to the buffer at ptr.
  *
+ *  Returns the number of chars read, which may be 0.
  */
-int32_t			UARTAvail(void);
+int32_t			uart_read_available(uart_t  *uart, char  *ptr, int32_t  len);
 
 
 
+/*
+ *  uart_set_rx_watermark      set how full the receive FIFO gets before it interrupts
+ *
+ *  UART0 and UART1 have 8-char receive FIFOs; uart_open() sets the
+ *  watermark to half of that.  A higher watermark means fewer interrupts
+ *  (at 8, one for every 8 chars) but less time to answer each one before
+ *  the FIFO overruns: at 8, one char time.  Chars left in the FIFO below
+ *  the watermark are picked up when the line goes idle; after an idle
+ *  line the first char interrupts on its own.  Has no effect on UARTs
+ *  without a FIFO, or with receive DMA.
+ *
+ *  Returns the watermark set, after limiting level to 1 to the FIFO size.
+ */
+uint32_t		uart_set_rx_watermark(uart_t  *uart, uint32_t  level);
+
+
+
+/*
+ *  uart_init_dma      move a UART's transmit and/or receive over to DMA
+ *
+ *  Call after uart_open().  txchan and rxchan are eDMA channels (0-15)
+ *  not used by anything else, or UART_NO_DMA to leave that direction as
+ *  it is.  UART4 has a single DMA request for both directions, so it can
+ *  only use DMA one way; giving it both channels is refused.
+ *
+ *  With transmit DMA, uart_write() still queues chars, but the queue is
+ *  sent by DMA a stretch at a time instead of a char per interrupt, and
+ *  uart_write_dma() can send straight from a caller's buffer.
+ *
+ *  With receive DMA, received chars go round the circular buffer at
+ *  rxbuf, of rxsize chars (a power of two, up to 16384), with no CPU
+ *  involvement.  The idle line interrupt fires once at the end of each
+ *  burst and calls the function set by uart_set_idle_callback(); the
+ *  first char of the next burst takes one interrupt to hand the receiver
+ *  back to the DMA.
+ *  uart_avail() and uart_read() work as before.  Chars not read before
+ *  the DMA comes round again are lost, so size rxbuf for the longest gap
+ *  between reads.
+ *
+ *  The UART's interrupt handler does all the work, so the DMA channels'
+ *  own interrupt vectors are left free.
+ *
+ *  Returns 0, or -1 (and nothing is changed) if an argument is out of
+ *  range or UART4 is given both channels.
+ */
+#define  UART_NO_DMA			0xff
+
+int32_t			uart_init_dma(uart_t  *uart, uint32_t  txchan, uint32_t  rxchan, char  *rxbuf, uint32_t  rxsize);
+
+
+
+/*
+ *  uart_write_dma      send len chars from ptr by DMA, without copying
+ *
+ *  The transmitter must be idle (nothing queued by uart_write() or left
+ *  from an earlier uart_write_dma()), and the chars at ptr must stay put
+ *  until done is called.  done (which may be 0) is called from the UART
+ *  interrupt once the last char has been sent.
+ *
+ *  Returns len, or 0 if the transmitter is busy, len is not 1-32767, or
+ *  the UART has no transmit DMA.
+ */
+int32_t			uart_write_dma(uart_t  *uart, const char  *ptr, int32_t  len, void  (*done)(uart_t  *uart));
+
+
+
+/*
+ *  uart_set_idle_callback      set the function called when the receive line goes idle
+ *
+ *  With receive DMA only.  idle is called from the UART interrupt, with
+ *  the number of chars waiting to be read, once after each burst.
+ */
+void			uart_set_idle_callback(uart_t  *uart, void  (*idle)(uart_t  *uart, int32_t  avail));
+
+
+
+/*
+ *  uart_get_stats      copy out and clear a UART's statistics
+ *
+ *  Chars are counted as they go to or come from the UART.  irqcycles is
+ *  the time spent in the UART interrupt handler, from the DWT cycle counter
+ *  (the application must turn it on), so chars over a known interval give
+ *  the throughput and irqcycles over the same interval the CPU load.
+ *
+ *  overruns, framing and noise count the interrupts that found the
+ *  hardware's overrun, framing error and noise flags set; dropped counts
+ *  received chars lost because the receive queue was full.
+ */
+typedef struct
+{
+	uint32_t			txchars;
+	uint32_t			rxchars;
+	uint32_t			irqs;
+	uint32_t			irqcycles;
+	uint32_t			overruns;
+	uint32_t			framing;
+	uint32_t			noise;
+	uint32_t			dropped;
+}  UART_STATS;
+
+void			uart_get_stats(uart_t  *uart, UART_STATS  *stats);
+
+
+
+/*
+ *  UARTInit      setup selected UART and make it the active UART
+ *
+ *  As uart_open().  Calls with an illegal UART selector for uartnum,
+ *  or a baud rate the UART cannot make, are ignored.
+ */
+void			UARTInit(uint32_t  uartnum, int32_t  baudrate);
+
+
+
+/*
+ *  UARTAssignActiveUART      assign an active UART for later char read/write
+ *
+ *  This routine assigns an active UART based on the argument uartnum.  This
+ *  argument must be in the legal range of UARTs for the device, 0-4.
+ *
+ *  Upon exit, this routine returns the previous active UART number, if there
+ *  was such, else it returns uin32_t -1.
+ *
+ *  If the requested UART number is out of the legal range, this routine does
+ *  not change the active UART.  However, it still returns the previous active
+ *  UART number.
+ */
+uint32_t		UARTAssignActiveUART(uint32_t  uartnum);
+
+
 
 /*
- *  UARTRead      reads (with blocking) len chars from active UART, writes to buffer at ptr
+ *  UARTWrite, UARTSetWriteMode, UARTFlush, UARTAvail, UARTReadAvailable, UARTRead
+ *
+ *  As uart_write(), uart_set_write_mode(), uart_flush(), uart_avail(),
+ *  uart_read_available() and uart_read(), on the active UART.
  */
+int32_t			UARTWrite(const char *ptr, int32_t len);
+uint32_t		UARTSetWriteMode(uint32_t  mode);
+void			UARTFlush(void);
+int32_t			UARTAvail(void);
+int32_t			UARTReadAvailable(char *ptr, int32_t len);
 int32_t			UARTRead(char *ptr, int32_t len);
 
 
@@ -5,6 +5,12 @@
  *  user via the console UART, parse the string using a call to
  *  rdp(), and display the result.
  *
+ *  The string is also compiled with rdp_compile(), with x as a
+ *  variable.  If the string has no x, the compiled result is checked
+ *  against rdp() and both are timed over BENCH_RUNS evaluations, to
+ *  show what compiling once saves.  If it does use x, the compiled
+ *  expression is shown for a few values of x.
+ *
  */
 
 #include  <stdio.h>
@@ -25,6 +31,12 @@ void					MyHandler(char  chnl);
 char					buff[MAX_STR_LEN+1];
 int32_t					answer;
 int32_t					error;
+rdp_code_t				code;
+
+#define  BENCH_RUNS  1000
+
+static void				bench(void);
+static void				show_x(void);
 
 
 int  main(void)
@@ -34,6 +46,8 @@ int  main(void)
 //	LED_OFF;						// start with LED off
 
 	UARTInit(TERM_UART, TERM_BAUD);			// open UART for comms
+	DEMCR |= (1 << 24);						// TRCENA, turn on the DWT...
+	DWT_CTRL |= 1;							// ...and its cycle counter
 	xputs(hello);
 	xputs("\n\rEnter a string to parse...\n\r");
 
@@ -50,6 +64,11 @@ int  main(void)
 			if (error == RDP_OK)
 			{
 				xprintf("Answer = %d 0x%08x\n\r", answer, answer);
+				bench();
+			}
+			else if (error == RDP_NO_VAR)
+			{
+				show_x();
 			}
 			else
 			{
@@ -60,3 +79,69 @@ int  main(void)
 
 	return  0;						// should never get here!
 }
+
+
+
+/*
+ *  bench      compare reparsing the string with running it compiled
+ *
+ *  Prints the evaluations per second each way at the current core clock.
+ */
+static void  bench(void)
+{
+	uint32_t			start;
+	uint32_t			reparse;
+	uint32_t			compiled;
+	uint32_t			n;
+	int32_t				a;
+
+	error = rdp_compile(buff, "x", &code);
+	if (error != RDP_OK)
+	{
+		xprintf("ERROR: rdp_compile() returned %d\n\r", error);
+		return;
+	}
+	error = rdp_eval(&code, &answer, &a);
+	if ((error != RDP_OK) || (a != answer))
+	{
+		xprintf("ERROR: rdp_eval() returned %d, answer %d\n\r", error, a);
+		return;
+	}
+
+	start = DWT_CYCCNT;
+	for (n=0; n<BENCH_RUNS; n++)  rdp(buff, &a);
+	reparse = (DWT_CYCCNT - start) / BENCH_RUNS;
+
+	start = DWT_CYCCNT;
+	for (n=0; n<BENCH_RUNS; n++)  rdp_eval(&code, &answer, &a);
+	compiled = (DWT_CYCCNT - start) / BENCH_RUNS;
+
+	xprintf("%u ops: rdp() %u cycles, %u/s; rdp_eval() %u cycles, %u/s\n\r",
+			code.ops, reparse, core_clk_khz * 1000 / reparse,
+			compiled, core_clk_khz * 1000 / compiled);
+}
+
+
+
+/*
+ *  show_x      print a compiled expression for a few values of x
+ */
+static void  show_x(void)
+{
+	static const int32_t	xs[] = {0, 1, -1, 100, 2048};
+	uint32_t			n;
+	int32_t				a;
+
+	error = rdp_compile(buff, "x", &code);
+	if (error != RDP_OK)
+	{
+		xprintf("ERROR: rdp_compile() returned %d\n\r", error);
+		return;
+	}
+	for (n=0; n<sizeof(xs)/sizeof(xs[0]); n++)
+	{
+		error = rdp_eval(&code, &xs[n], &a);
+		if (error == RDP_OK)  xprintf("x = %d: %d 0x%08x\n\r", xs[n], a, a);
+		else  xprintf("x = %d: ERROR %d\n\r", xs[n], error);
+	}
+}
@@ -2,6 +2,15 @@
 
 /* Recursive descent parser for integer expressions. */
 
+/*
+ *  rdp() evaluates as it parses.  rdp_compile() runs the same parser with
+ *  code pointing at an rdp_code_t; each step then also calls push_op() to
+ *  record what it did, in postfix order, so the program is the expression
+ *  in reverse Polish.  The values the parser works out while compiling are
+ *  thrown away (variables read as 0).  rdp_eval() runs the program on a
+ *  small stack of its own.
+ */
+
 #include  <stdio.h>
 #include  <stdint.h>
 #include  <string.h>
@@ -19,6 +28,29 @@ static char				token[MAX_TOKEN_LEN+1];
 static uint32_t			token_type;
 static char				*instr;
 
+static rdp_code_t		*code;				// program being compiled, else 0
+static const char		*varnames;			// variables it may use
+static uint32_t			depth;				// values it has on the stack so far
+
+
+/*
+ *  Program opcodes.  A number is RDP_OP_LIT, with its value next in lit[];
+ *  variable n is RDP_OP_VAR + n.
+ */
+#define  RDP_OP_LIT			0
+#define  RDP_OP_ADD			1
+#define  RDP_OP_SUB			2
+#define  RDP_OP_MUL			3
+#define  RDP_OP_DIV			4
+#define  RDP_OP_MOD			5
+#define  RDP_OP_AND			6
+#define  RDP_OP_OR			7
+#define  RDP_OP_XOR			8
+#define  RDP_OP_POW			9
+#define  RDP_OP_NEG			10
+#define  RDP_OP_NOT			11
+#define  RDP_OP_VAR			0x80
+
 
 
 /*
@@ -40,6 +72,9 @@ static int32_t			getdec(char  *str);
 static void				putback(void);
 static void				serror(int32_t errenum);
 static char				*rdp_strchr(char  *str, char  c);
+static int32_t			rdp_pow(int32_t  base, int32_t  exp);
+static void				push_op(uint8_t  op);
+static void				push_lit(int32_t  val);
 
 
 /*
@@ -73,6 +108,144 @@ uint32_t  rdp(char  *str, int32_t *answer)
 
 
 
+/*
+ *  rdp_compile      parse an expression into a program for rdp_eval()
+ *
+ *  This runs the same parser as rdp(), with push_op() recording each
+ *  step into argument prog.  See rdp.h.
+ */
+
+uint32_t  rdp_compile(char  *str, const char  *vars, rdp_code_t  *prog)
+{
+	int32_t				answer;
+
+	prog->ops = 0;
+	prog->lits = 0;
+	prog->depth = 0;
+	prog->vars = 0;
+
+	code = prog;					// parser now records as it goes
+	varnames = vars ? vars : "";
+	depth = 0;
+	instr = str;
+	error = RDP_OK;
+	token_type = get_token();
+
+	if (token_type == RDP_UNKNOWN)	// if no token found...
+	{
+		error = RDP_NO_EXP;
+	}
+	else
+	{
+		eval_exp1(&answer);
+		if ((error == RDP_OK) && ((token_type != RDP_DELIMITER) || (*token != '\r')))
+		{
+			serror(RDP_SYNTAX);		// expression did not use the whole string
+		}
+	}
+
+	code = 0;
+	if (error != RDP_OK)  prog->ops = 0;	// rdp_eval() refuses an empty program
+	return  error;
+}
+
+
+
+
+/*
+ *  rdp_eval      run a program made by rdp_compile()
+ *
+ *  The compiler has already checked that the stack cannot overflow, so
+ *  the ops run with no further checks.  Math that could overflow is done
+ *  unsigned, where C defines the wrap; the results are the ones rdp()
+ *  gets on the target.
+ */
+
+uint32_t  rdp_eval(const rdp_code_t  *prog, const int32_t  *vars, int32_t  *answer)
+{
+	int32_t				stack[RDP_MAX_STACK];
+	const int32_t		*lit;
+	uint32_t			n;					// values on the stack
+	uint32_t			i;
+	int32_t				b;
+	uint8_t				op;
+
+	if (prog->ops == 0)  return  RDP_NO_EXP;
+
+	lit = prog->lit;
+	n = 0;
+	for (i=0; i<prog->ops; i++)
+	{
+		op = prog->op[i];
+		if (op >= RDP_OP_VAR)			// push a variable
+		{
+			stack[n++] = vars[op - RDP_OP_VAR];
+			continue;
+		}
+		if (op == RDP_OP_LIT)			// push a number
+		{
+			stack[n++] = *lit++;
+			continue;
+		}
+
+		b = stack[--n];					// only or 2nd argument
+		switch  (op)
+		{
+			case  RDP_OP_NEG :
+			b = -(uint32_t)b;
+			break;
+
+			case  RDP_OP_NOT :
+			b = ~b;
+			break;
+
+			case  RDP_OP_ADD :
+			b = (uint32_t)stack[--n] + (uint32_t)b;
+			break;
+
+			case  RDP_OP_SUB :
+			b = (uint32_t)stack[--n] - (uint32_t)b;
+			break;
+
+			case  RDP_OP_MUL :
+			b = (uint32_t)stack[--n] * (uint32_t)b;
+			break;
+
+			case  RDP_OP_DIV :
+			if (b == 0)  return  RDP_DIVIDE_0;
+			b = stack[--n] / b;
+			break;
+
+			case  RDP_OP_MOD :
+			if (b == 0)  return  RDP_DIVIDE_0;
+			b = stack[--n] % b;
+			break;
+
+			case  RDP_OP_AND :
+			b = stack[--n] & b;
+			break;
+
+			case  RDP_OP_OR :
+			b = stack[--n] | b;
+			break;
+
+			case  RDP_OP_XOR :
+			b = stack[--n] ^ b;
+			break;
+
+			case  RDP_OP_POW :
+			b = rdp_pow(stack[--n], b);
+			break;
+		}
+		stack[n++] = b;
+	}
+	*answer = stack[0];
+	return  RDP_OK;
+}
+
+
+
+
 /*
  *  eval_exp1      perform comparisons (=, >, <)
  *
@@ -185,14 +358,17 @@ static void  eval_exp1(int32_t  *answer)
 		{
 			case  '&' :
 	 		*answer = *answer & temp;
+			push_op(RDP_OP_AND);
 			break;
  		
 			case  '|' :
 			*answer = *answer | temp;
+			push_op(RDP_OP_OR);
 			break;
 			
 	 		case  '^' :
 			*answer = *answer ^ temp;
+			push_op(RDP_OP_XOR);
 			break;
 	 	}
  	}
@@ -223,10 +399,12 @@ static void  eval_exp3(int32_t *answer)
 		{
 			case '-' :				// if subtraction...
 			*answer = *answer - temp;
+			push_op(RDP_OP_SUB);
 			break;
 			
 			case '+':				// if addition...
 			*answer = *answer + temp;
+			push_op(RDP_OP_ADD);
 			break;
 		}
 	}
@@ -249,7 +427,15 @@ static void  eval_exp4(int32_t *answer)
 	{
 		get_token();						// get 2nd argument
 		eval_exp5(&temp);					// save parsed value to temp variable
-		*answer = *answer % temp;
+		if (temp != 0)						// and divisor is legal...
+		{
+			*answer = *answer % temp;
+		}
+		else if (code == 0)					// bad divisor, unless compiling
+		{
+			serror(RDP_DIVIDE_0);
+		}
+		push_op(RDP_OP_MOD);
 	}
 }
 		
@@ -266,8 +452,8 @@ static void  eval_exp5(int32_t *answer)
 	int32_t				temp;
 
 	eval_exp6(answer);						// get first argument
-	while ((op = *token) == '*'				// while doing * or /
-			|| op == '/')
+	while (((op = *token) == '*'			// while doing * or /, but not a
+			&& token[1] != '*') || op == '/')	// 2nd ** that eval_exp6() left
 	{
 		get_token();						// get second argument
 		eval_exp6(&temp);					// save 2nd argument in temp variable
@@ -275,6 +461,7 @@ static void  eval_exp5(int32_t *answer)
 		{
 			case '*' :						// if doing multiply...
 			*answer = *answer * temp;
+			push_op(RDP_OP_MUL);
 			break;
 			
 			case '/':						// if doing divide...
@@ -282,10 +469,11 @@ static void  eval_exp5(int32_t *answer)
 			{
 				*answer = *answer / temp;
 			}
-			else 							// bad dovospr
+			else if (code == 0)				// bad divisor, unless compiling
 			{
 				serror(RDP_DIVIDE_0);
 			}
+			push_op(RDP_OP_DIV);
 			break;
 		}
 	}
@@ -301,19 +489,14 @@ static void  eval_exp5(int32_t *answer)
 static void  eval_exp6(int32_t *answer)
 {
 	int32_t		temp;
-	int32_t		i;
-	int32_t		t;
 	
 	eval_exp7(answer);					// evaluate 1st argument
 	if ((token[0] == '*') && (token[1] == '*'))		// if doing integer exponentiation
 	{
 		get_token(); 					// get 2nd argument
 		eval_exp7(&temp);				// save 2nd argument to temp variable
-		i = *answer;
-		for (t = temp-1; t>0; t--)		// do old-fashioned exponentiation
-		{
-			*answer = *answer  * i;
-		}
+		*answer = rdp_pow(*answer, temp);
+		push_op(RDP_OP_POW);
     }
 }
 
@@ -340,10 +523,12 @@ static void eval_exp7(int32_t *answer)
 	if (op == '-')				// if doing negation...
 	{
 		*answer = -(*answer);
+		push_op(RDP_OP_NEG);
 	}
 	if (op == '~')				// if doing 1's complement...
 	{
 		*answer = ~(*answer);
+		push_op(RDP_OP_NOT);
 	}
 }
 
@@ -390,6 +575,7 @@ static void  eval_exp8(int32_t *answer)
 static void atom(int32_t *answer)
 {
 	int32_t		t;
+	char		*v;
 //	int		fn;
 //	int		usroffset, usropcode;
 //	int		n;
@@ -443,6 +629,7 @@ static void atom(int32_t *answer)
 		case  RDP_NUMBER :				// for a number...
 		t = getdec(token); 				// convert string to an int
 		*answer = t;					// save for parser
+		push_lit(t);
 		get_token();   					// get the next token
 		return;							// and outta here
 
@@ -458,12 +645,14 @@ static void atom(int32_t *answer)
 		case  RDP_HEXNUMBER :			// for a hexadecimal number...
 		t = gethex(token);				// convert hex string to int
 		*answer = t;					// save for parser
+		push_lit(t);
 		get_token();					// get the next token
 		return;							// and outta here
 	
 		case  RDP_BINNUMBER :			// for a binary number...
 		t = getbin(token);				// convert string to an int
 		*answer = t;					// save for parser
+		push_lit(t);
 		get_token();					// get the next token
 		return;							// and outta here
 
@@ -471,6 +660,23 @@ static void atom(int32_t *answer)
 		t = (unsigned char)(*(token+1));
 		t &= 0xff;
 		*answer = t;					// save for parser
+		push_lit(t);
+		get_token();					// get the next token
+		return;							// and outta here
+
+		case  RDP_VARIABLE :			// for a variable...
+		v = rdp_strchr((char *)varnames, *token);
+		if ((code == 0) || (v == 0))	// only compiled expressions have variables
+		{
+			serror(RDP_NO_VAR);
+		}
+		else
+		{
+			t = v - varnames;			// index of its value
+			push_op(RDP_OP_VAR + t);
+			if (t >= code->vars)  code->vars = t + 1;
+		}
+		*answer = 0;					// value isn't known until rdp_eval()
 		get_token();					// get the next token
 		return;							// and outta here
 
@@ -674,6 +880,7 @@ static uint32_t  get_token(void)
 
 	token_type = RDP_UNKNOWN; 
 	pt = token;							// start off at beginning of token buffer
+	*pt = 0;							// so an unknown char leaves no stale token
 
 	while ((*instr == ' ') || (*instr == '\t')) ++instr;  // skip over white space
 
@@ -771,6 +978,16 @@ static uint32_t  get_token(void)
 		token_type = RDP_ASCNUMBER;		// return as constant
 	}		
 
+/*
+ *  A single lower-case letter is a variable.
+ */
+	else if (islower((int)*instr) && !isalnum((int)*(instr+1)))
+	{
+		*pt++ = *instr++;
+		*pt = '\0';
+		token_type = RDP_VARIABLE;
+	}
+
 /*
  *  A token consisting of one or more ASCII digit chars is considered a
  *  decimal constant.  This code moves any preceding minus sign into the
@@ -975,4 +1192,76 @@ static char  *rdp_strchr(char  *str, char  c)
 
 
 
+/*
+ *  rdp_pow      integer exponent
+ *
+ *  As with the original repeated multiply, an exponent of 1 or less gives
+ *  base back.  Squaring wraps the same way the repeated multiply did, but
+ *  takes at most 31 steps instead of up to exp.
+ */
+static int32_t  rdp_pow(int32_t  base, int32_t  exp)
+{
+	uint32_t		b;
+	uint32_t		r;
+
+	if (exp <= 1)  return  base;
 
+	b = base;
+	r = 1;
+	while (exp)
+	{
+		if (exp & 1)  r = r * b;
+		b = b * b;
+		exp = exp >> 1;
+	}
+	return  r;
+}
+
+
+
+/*
+ *  push_op      add an op to the program being compiled
+ *
+ *  Does nothing when rdp() is evaluating.  Keeps track of how deep the
+ *  stack gets, so rdp_eval() need not check.
+ */
+static void  push_op(uint8_t  op)
+{
+	if (code == 0)  return;
+
+	if (code->ops == RDP_MAX_OPS)
+	{
+		serror(RDP_TOO_LONG);
+		return;
+	}
+	code->op[code->ops++] = op;
+
+	if ((op == RDP_OP_LIT) || (op >= RDP_OP_VAR))		// pushes a value
+	{
+		depth++;
+		if (depth > RDP_MAX_STACK)  serror(RDP_TOO_LONG);
+		if (depth > code->depth)  code->depth = depth;
+	}
+	else if ((op != RDP_OP_NEG) && (op != RDP_OP_NOT))	// two values in, one out
+	{
+		depth--;
+	}
+}
+
+
+
+/*
+ *  push_lit      add a number to the program being compiled
+ */
+static void  push_lit(int32_t  val)
+{
+	if (code == 0)  return;
+
+	if (code->lits == RDP_MAX_LITS)
+	{
+		serror(RDP_TOO_LONG);
+		return;
+	}
+	code->lit[code->lits++] = val;
+	push_op(RDP_OP_LIT);
+}
@@ -31,6 +31,31 @@
 #include  "termio.h"
 
 
+/*
+ *  Character device used by xputc, xgetc and xavail.  These default to the
+ *  active UART; use xdev_out() and xdev_in() to redirect terminal I/O to
+ *  some other transport, such as a USB virtual serial port.
+ */
+static int32_t			(*xfunc_write)(const char *ptr, int32_t len) = UARTWrite;
+static int32_t			(*xfunc_read)(char *ptr, int32_t len) = UARTRead;
+static int32_t			(*xfunc_avail)(void) = UARTAvail;
+
+
+
+void  xdev_out(int32_t (*write)(const char *ptr, int32_t len))
+{
+	xfunc_write = write;
+}
+
+
+
+void  xdev_in(int32_t (*read)(char *ptr, int32_t len), int32_t (*avail)(void))
+{
+	xfunc_read = read;
+	xfunc_avail = avail;
+}
+
+
 
 int32_t  xatoi (char **str, long *res)
 {
@@ -114,13 +139,13 @@ int32_t  xatoi (char **str, long *res)
  */
 
 /*
- *  xputc      write a single char to the active UART.
+ *  xputc      write a single char to the terminal device (by default, the active UART).
  */
 
 void xputc (char c)
 {
-	if (c == '\n') UARTWrite("\r", 1);
-	UARTWrite(&c, 1);
+	if (c == '\n')  xfunc_write("\r\n", 2);
+	else  xfunc_write(&c, 1);
 }
 
 
@@ -132,7 +157,7 @@ uint8_t  xgetc(void)
 {
 	char				c;
 
-	UARTRead(&c, 1);
+	xfunc_read(&c, 1);
 	return  c;
 }
 
@@ -147,7 +172,7 @@ uint8_t  xgetc(void)
  */
 int32_t  xavail(void)
 {
-	return  UARTAvail();
+	return  xfunc_avail();
 }
 
 
@@ -158,150 +183,415 @@ int32_t  xavail(void)
  *  chars with the active UART.
  */
 
-void  xputs (const char* str)
+/*
+ *  Formatted output
+ *
+ *  xprintf(), xputs() and xitoa() gather their chars in a buffer on the
+ *  stack and hand it to the terminal device in one write (more only if a
+ *  single call produces over XPRINTF_BUF chars), turning each \n into \r\n
+ *  on the way.  xsnprintf() formats into the caller's buffer instead.
+ *
+ *  Decimal digits come out two at a time from a table of pairs, and the
+ *  divides by 100 and 10000 are multiplies by a scaled reciprocal, so
+ *  converting a decimal number takes no divide instructions.  64-bit values are
+ *  split into 4-digit groups the same way, as the build has no 64-bit
+ *  divide.
+ */
+#ifndef  XPRINTF_BUF
+#define  XPRINTF_BUF		128
+#endif
+
+typedef struct
 {
-	while (*str)
-		xputc(*str++);
+	char				*buf;
+	int32_t				size;			// chars buf holds
+	int32_t				len;			// chars in buf
+	int32_t				total;			// chars produced
+	uint8_t				device;			// flush to the terminal device, \n to \r\n
+}  XOUT;
+
+static const char		xpairs[201] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+static const char		xdigits[37] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+
+
+static void  xout_flush(XOUT  *o)
+{
+	if (o->device && o->len)  xfunc_write(o->buf, o->len);
+	o->len = 0;
+}
+
+
+
+/*
+ *  xout_char      one char to the output; past the end of an xsnprintf()
+ *  buffer, chars are only counted
+ */
+static void  xout_char(XOUT  *o, char  c)
+{
+	if (o->len >= o->size)
+	{
+		if (!o->device)
+		{
+			o->total++;
+			return;
+		}
+		xout_flush(o);
+	}
+	o->buf[o->len++] = c;
+	o->total++;
 }
 
 
 
+static void  xout_put(XOUT  *o, char  c)
+{
+	if (o->device && (c == '\n'))  xout_char(o, '\r');
+	xout_char(o, c);
+}
 
-void  xitoa (long val, int32_t radix, int32_t len)
+
+
+static void  xout_str(XOUT  *o, const char  *s)
 {
-	uint8_t				c;
-	uint32_t			r;
-	uint8_t				sgn;
-	uint8_t				pad;
-	uint8_t				s[20];
-	uint8_t				i;
-	long				v;
+	while (*s)  xout_put(o, *s++);
+}
 
-	pad = ' ';
-	sgn = 0;
-	i = 0;
 
-	if (radix < 0)
+
+/*
+ *  xdiv100      v / 100 for any 32-bit v: 0x51eb851f is 2^37/100 rounded up
+ */
+static inline uint32_t  xdiv100(uint32_t  v)
+{
+	return  (uint32_t) (((uint64_t) v * 0x51eb851f) >> 37);
+}
+
+
+
+/*
+ *  xdiv10000      v / 10000 for any 32-bit v: 0xd1b71759 is 2^45/10000 rounded up
+ */
+static inline uint32_t  xdiv10000(uint32_t  v)
+{
+	return  (uint32_t) (((uint64_t) v * 0xd1b71759) >> 45);
+}
+
+
+
+/*
+ *  xpair      writes the two digits of v (0-99) ending at end
+ */
+static inline char  *xpair(uint32_t  v, char  *end)
+{
+	end -= 2;
+	end[0] = xpairs[v * 2];
+	end[1] = xpairs[v * 2 + 1];
+	return  end;
+}
+
+
+
+/*
+ *  xutoa10      writes v in decimal ending at end; returns the first digit
+ */
+static char  *xutoa10(uint32_t  v, char  *end)
+{
+	uint32_t				q;
+
+	while (v >= 100)
 	{
-		radix = -radix;
-		if (val < 0)
+		q = xdiv100(v);
+		end = xpair(v - q * 100, end);
+		v = q;
+	}
+	if (v >= 10)  return  xpair(v, end);
+	*--end = '0' + v;
+	return  end;
+}
+
+
+
+/*
+ *  xulltoa10      writes the 64-bit hi:lo in decimal ending at end
+ *
+ *  While hi is not 0, hi:lo is divided by 10000 a 16-bit piece at a
+ *  time, from the top; each remainder is below 10000, so remainder << 16
+ *  plus the next piece fits in 32 bits.
+ */
+static char  *xulltoa10(uint32_t  hi, uint32_t  lo, char  *end)
+{
+	uint32_t				cur;
+	uint32_t				q[4];
+	uint32_t				r;
+	uint32_t				i;
+	uint32_t				c;
+
+	while (hi)
+	{
+		r = 0;
+		for (i=0; i<4; i++)
 		{
-			val = -val;
-			sgn = '-';
+			cur = (r << 16) | (((i < 2) ? hi : lo) >> ((i & 1) ? 0 : 16) & 0xffff);
+			q[i] = xdiv10000(cur);
+			r = cur - q[i] * 10000;
 		}
+		hi = (q[0] << 16) | q[1];
+		lo = (q[2] << 16) | q[3];
+		c = xdiv100(r);
+		end = xpair(r - c * 100, end);
+		end = xpair(c, end);
 	}
-	v = val;
-	r = radix;
-	if (len < 0)
+	return  xutoa10(lo, end);
+}
+
+
+
+/*
+ *  xutoa2n      writes hi:lo in binary (shift 1) or hex (shift 4) ending at end
+ */
+static char  *xutoa2n(uint32_t  hi, uint32_t  lo, uint32_t  shift, char  *end)
+{
+	uint32_t				mask = (1 << shift) - 1;
+	uint32_t				n;
+
+	if (hi)
 	{
-		len = -len;
-		pad = '0';
+		for (n=0; n<32; n+=shift)		// every digit of the low word
+		{
+			*--end = xdigits[lo & mask];
+			lo >>= shift;
+		}
+		lo = hi;
 	}
-	if (len > 20) return;
 	do
 	{
-		c = (uint8_t)(v % r);
-		if (c >= 10) c += 7;
-		c += '0';
-		s[i++] = c;
-		v /= r;
-	} while (v);
-
-	if (sgn) s[i++] = sgn;
-	while (i < len)
-		s[i++] = pad;
-	do
-		xputc(s[--i]);
-	while (i);
+		*--end = xdigits[lo & mask];
+		lo >>= shift;
+	} while (lo);
+	return  end;
 }
 
 
 
+/*
+ *  xutoan      writes lo in any other radix up to 36 ending at end, a divide
+ *  per digit
+ */
+static char  *xutoan(uint32_t  lo, uint32_t  radix, char  *end)
+{
+	do
+	{
+		*--end = xdigits[lo % radix];
+		lo /= radix;
+	} while (lo);
+	return  end;
+}
+
+
 
 /*
- *  This is an integer-only version of printf, similar to iprintf.
+ *  xout_num      formats hi:lo in radix 2 to 36 (negative if signed),
+ *  padded to width with zeros (zero) or spaces, on the left unless left;
+ *  hi must be 0 unless the radix is 2, 10 or 16
  */
-void  xprintf (const char* str, ...)
+static void  xout_num(XOUT  *o, uint32_t  hi, uint32_t  lo, int32_t  radix,
+					  int32_t  width, uint8_t  zero, uint8_t  left)
 {
-	va_list					arp;
-	int						d;
-	int						r;
-	int						w;
-	int						s;
-	int						l;
+	char					s[66];
+	char					*p;
+	char					sign = 0;
+	int32_t					n;
+
+	if (radix < 0)
+	{
+		radix = -radix;
+		if ((int32_t) hi < 0)			// negate hi:lo
+		{
+			sign = '-';
+			hi = ~hi + (lo == 0);
+			lo = -lo;
+		}
+	}
+	if (radix == 10)  p = xulltoa10(hi, lo, s + sizeof(s));
+	else if ((radix == 2) || (radix == 16))  p = xutoa2n(hi, lo, (radix == 2) ? 1 : 4, s + sizeof(s));
+	else  p = xutoan(lo, radix, s + sizeof(s));
+
+	n = (s + sizeof(s)) - p + (sign != 0);
+	if (sign && zero)  xout_char(o, sign);
+	if (!left)  for (; n < width; width--)  xout_char(o, zero ? '0' : ' ');
+	if (sign && !zero)  xout_char(o, sign);
+	while (p < s + sizeof(s))  xout_char(o, *p++);
+	for (; n < width; width--)  xout_char(o, ' ');
+}
 
 
-	va_start(arp, str);
+
+/*
+ *  xvformat      the formatter behind xprintf() and xsnprintf()
+ *
+ *  Conversions are %d %u %x %X %b %c %s %p and %%, with an optional - (pad
+ *  on the right), 0 (pad with zeros) and width.  l is accepted and
+ *  ignored, as long is 32 bits; ll takes a 64-bit argument.  Hex digits
+ *  are upper case for %x as well as %X, as they always were here.  A
+ *  negative number padded with zeros has its sign first, as in C, where
+ *  the original put it after the zeros.
+ */
+static void  xvformat(XOUT  *o, const char  *str, va_list  arp)
+{
+	char					d;
+	int32_t					w;
+	int32_t					r;
+	uint8_t					zero;
+	uint8_t					left;
+	uint8_t					ll;
+	uint32_t				hi;
+	uint32_t				lo;
+	uint64_t				v;
+	const char				*s;
 
 	while ((d = *str++) != 0)
 	{
 		if (d != '%')
 		{
-			xputc(d);
+			xout_put(o, d);
 			continue;
 		}
-		if (*str == '%')			// if we need to escape the percent sign...
-		{
-			xputc(d);				// print the one we have in d
-			str++;					// now step over the second one
-			continue;				// and resume
-		}
 
 		d = *str++;
-		w = 0;
-		r = 0;
-		s = 0;
-		l = 0;
-
-		if (d == '0')
+		zero = 0;
+		left = 0;
+		for (;; d = *str++)
 		{
-			d = *str++;
-			s = 1;
+			if (d == '0')  zero = 1;
+			else if (d == '-')  left = 1;
+			else  break;
 		}
-		while ((d >= '0')&&(d <= '9'))
+		if (left)  zero = 0;
+		w = 0;
+		while ((d >= '0') && (d <= '9'))
 		{
-			w += w * 10 + (d - '0');
+			w = w * 10 + (d - '0');
 			d = *str++;
 		}
-
-		if (s)  w = -w;
+		ll = 0;
 		if (d == 'l')
 		{
-			l = 1;
 			d = *str++;
+			if (d == 'l')
+			{
+				ll = 1;
+				d = *str++;
+			}
 		}
-		if (!d)  break;
-		if (d == 's')
+
+		switch (d)
 		{
-			xputs(va_arg(arp, char*));
+			case  0:    return;
+			case  '%':  xout_put(o, d);  continue;
+			case  'c':  xout_put(o, (char) va_arg(arp, int));  continue;
+
+			case  's':
+			s = va_arg(arp, const char *);
+			xout_str(o, s ? s : "(null)");
 			continue;
-		}
-		if (d == 'c')
-		{
-			xputc((char)va_arg(arp, int));
+
+			case  'p':
+			xout_char(o, '0');
+			xout_char(o, 'x');
+			xout_num(o, 0, (uint32_t) va_arg(arp, void *), 16, 8, 1, 0);
 			continue;
+
+			case  'u':  r = 10;   break;
+			case  'd':  r = -10;  break;
+			case  'x':
+			case  'X':  r = 16;   break;
+			case  'b':  r = 2;    break;
+			default:    return;		// not a conversion we know
 		}
-		if (d == 'u') r = 10;
-		if (d == 'd') r = -10;
-		if (d == 'X' || d == 'x') r = 16; // 'x' added by mthomas in increase compatibility
-		if (d == 'b') r = 2;
-		if (!r) break;
-		if (l)
+
+		if (ll)
 		{
-			if (r > 0)
-				xitoa((long)va_arg(arp, unsigned int), r, w);
-			else
-				xitoa((long)va_arg(arp, int), r, w);
-		} else
+			v = va_arg(arp, uint64_t);
+			hi = (uint32_t) (v >> 32);
+			lo = (uint32_t) v;
+		}
+		else
 		{
-			if (r > 0)
-				xitoa((long)va_arg(arp, unsigned int), r, w);
-			else
-				xitoa((long)va_arg(arp, int), r, w);
+			lo = va_arg(arp, uint32_t);
+			hi = ((r < 0) && ((int32_t) lo < 0)) ? 0xffffffff : 0;	// sign extend
 		}
+		xout_num(o, hi, lo, r, w, zero, left);
+	}
+}
+
+
+
+void  xputs (const char* str)
+{
+	char					buf[XPRINTF_BUF];
+	XOUT					o = {buf, XPRINTF_BUF, 0, 0, 1};
+
+	xout_str(&o, str);
+	xout_flush(&o);
+}
+
+
+
+/*
+ *  xitoa      writes val in radix 2 to 36 (negative for signed), padded
+ *  to len chars with spaces, or with zeros if len is negative; digits past
+ *  9 are upper case letters
+ */
+void  xitoa (long val, int32_t radix, int32_t len)
+{
+	char					buf[24];
+	XOUT					o = {buf, sizeof(buf), 0, 0, 1};
+	uint8_t					zero = 0;
+
+	if ((radix < -36) || ((radix > -2) && (radix < 2)) || (radix > 36))  return;
+	if (len < 0)
+	{
+		len = -len;
+		zero = 1;
 	}
+	if (len > 20)  return;
+	xout_num(&o, ((radix < 0) && (val < 0)) ? 0xffffffff : 0, (uint32_t) val, radix, len, zero, 0);
+	xout_flush(&o);
+}
+
+
+
+int32_t  xprintf (const char* str, ...)
+{
+	char					buf[XPRINTF_BUF];
+	XOUT					o = {buf, XPRINTF_BUF, 0, 0, 1};
+	va_list					arp;
+
+	va_start(arp, str);
+	xvformat(&o, str, arp);
+	va_end(arp);
+	xout_flush(&o);
+	return  o.total;
+}
+
 
+
+int32_t  xsnprintf (char *buf, int32_t size, const char* str, ...)
+{
+	XOUT					o = {buf, size - 1, 0, 0, 0};
+	va_list					arp;
+
+	if (size <= 0)  o.size = 0;
+	va_start(arp, str);
+	xvformat(&o, str, arp);
 	va_end(arp);
+	if (size > 0)  buf[o.len] = 0;
+	return  o.total;
 }
 
 
@@ -10,6 +10,18 @@
  *  library.  As far as I know, all parent code was in the
  *  public domain or was some variant of GPL.
  *  Karl Lunt, 11 May 2014
+ *
+ *  Each UART is a uart_t holding its own queues, DMA state and stats,
+ *  and the five interrupt handlers share one routine, so any number of
+ *  UARTs can run at once.  The original UARTxxx() calls work on the
+ *  active UART's uart_t.
+ *
+ *  Where a UART has hardware FIFOs (UART0 and UART1, 8 chars each way),
+ *  they are turned on, and each interrupt moves as many chars as the
+ *  FIFOs hold or have room for.
+ *
+ *  Baud rate divisors are chosen for the lowest error (uart_plan_baud()),
+ *  and the achieved rate and its error are kept for the caller.
  */
 
 #include  <stdio.h>
@@ -25,167 +37,784 @@
 #define  TRUE  !FALSE
 #endif
 
-#define  MAX_RCV_Q_CHARS	64
+#ifndef  UART_RCV_Q_CHARS
+#define  UART_RCV_Q_CHARS	64				// must be a power of two
+#endif
+#ifndef  UART_XMT_Q_CHARS
+#define  UART_XMT_Q_CHARS	256				// must be a power of two
+#endif
+#ifndef  UART_XMT_CHUNK
+#define  UART_XMT_CHUNK		16				// most chars uart_write() copies with interrupts masked
+#endif
+#ifndef  UART_AUTOBAUD_MIN
+#define  UART_AUTOBAUD_MIN	1200			// lowest rate uart_autobaud() measures
+#endif
+#define  RCV_Q_MASK			(UART_RCV_Q_CHARS-1)
+#define  XMT_Q_MASK			(UART_XMT_Q_CHARS-1)
 
+#define  NUM_UARTS			5
 
 
-volatile char				UART0RcvQ[MAX_RCV_Q_CHARS];
-volatile uint8_t			UART0RcvOutIndex;
-volatile uint8_t			UART0RcvInIndex;
 
-volatile char				UART1RcvQ[MAX_RCV_Q_CHARS];
-volatile uint8_t			UART1RcvOutIndex;
-volatile uint8_t			UART1RcvInIndex;
+/*
+ *  One UART.
+ *
+ *  Both queues use free-running indices, so in-out is the number of
+ *  queued chars and the mask picks the cell.  The transmit queue's in is
+ *  only moved by uart_write() and its out only by the interrupt handler
+ *  (or the DMA completion).  uart_write() reserves, fills and publishes
+ *  its cells with interrupts masked, UART_XMT_CHUNK chars at a time, so a
+ *  main-loop writer and an interrupt handler can write to the same UART;
+ *  their chars interleave only at chunk boundaries.  busy is set while
+ *  the transmitter is running and cleared once the last char has left the
+ *  shifter.
+ *
+ *  For transmit DMA, dmalen is the size of the transfer in progress and
+ *  fromq says whether it is a stretch of the transmit queue or a caller's
+ *  buffer (uart_write_dma()).  For receive DMA, the channel writes round
+ *  and round rxbuf; rxout is where the reader is and rxseen where the
+ *  DMA was at the last idle line, for the stats.
+ */
+struct uart_s
+{
+	UART_MemMapPtr				base;
+	uint8_t						num;
+	uint8_t						rxdepth;		// hardware FIFO sizes, 1 if none
+	uint8_t						txdepth;
+	uint8_t						rxwater;		// receive watermark, when not parked
+	volatile uint8_t			rxparked;		// idle line, waiting for a char
+	uint32_t					baud;			// rate achieved, and its error
+	int32_t						ppm;
+
+	volatile char				rq[UART_RCV_Q_CHARS];
+	volatile uint16_t			rin;
+	volatile uint16_t			rout;
+
+	volatile char				xq[UART_XMT_Q_CHARS];
+	volatile uint16_t			xin;
+	volatile uint16_t			xout;
+	volatile uint8_t			busy;
+	uint8_t						mode;
+
+	uint8_t						txon;
+	uint8_t						txchan;
+	uint8_t						fromq;
+	uint16_t					dmalen;
+	void						(*txdone)(uart_t  *uart);
+
+	uint8_t						rxon;
+	uint8_t						rxchan;
+	volatile char				*rxbuf;
+	uint16_t					rxmask;
+	volatile uint16_t			rxout;
+	uint16_t					rxseen;
+	void						(*rxidle)(uart_t  *uart, int32_t  avail);
+
+	UART_STATS					stats;
+};
 
-volatile char				UART2RcvQ[MAX_RCV_Q_CHARS];
-volatile uint8_t			UART2RcvOutIndex;
-volatile uint8_t			UART2RcvInIndex;
 
-static  UART_MemMapPtr		ActiveUARTBasePtr = 0;
+
+/*
+ *  Fixed details of each UART: its status interrupt (the IRQ number, not
+ *  the vector), its DMA request sources and its clock (K20 Reference
+ *  Manual, NVIC, DMA request multiplexer and clock distribution sections).
+ *  UART0 and UART1 run from the core (system) clock, the others from the
+ *  bus (peripheral) clock.
+ */
+typedef struct
+{
+	UART_MemMapPtr				base;
+	uint8_t						irq;
+	uint8_t						rxsrc;
+	uint8_t						txsrc;
+	uint8_t						coreclk;
+}  UART_PORT;
+
+static const UART_PORT		UARTPorts[NUM_UARTS] =
+{
+	{UART0_BASE_PTR, 45, 2, 3, TRUE},
+	{UART1_BASE_PTR, 47, 4, 5, TRUE},
+	{UART2_BASE_PTR, 49, 6, 7, FALSE},
+	{UART3_BASE_PTR, 51, 8, 9, FALSE},
+	{UART4_BASE_PTR, 53, 10, 10, FALSE},	// UART4 shares one request for both
+};
 
 
 /*
- *  Local functions
+ *  The rates uart_autobaud() rounds a measurement to, if it is within
+ *  2% of one.
  */
-static UART_MemMapPtr		XlateUARTNumToBasePtr(uint32_t  uartn);
-static uint32_t				uart_char_avail(void);
-static uint32_t				uart_putchar(char ch);
-static char					uart_getchar(void);
+static const uint32_t		UARTStdBauds[] =
+{
+	1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600,
+	1000000, 1500000, 2000000, 3000000, 4000000
+};
 
+static  uart_t				UARTs[NUM_UARTS];
 
+static  uart_t				*ActiveUART = 0;
 
-void  UARTInit(uint32_t  uartnum, int32_t baud)
+
+/*
+ *  Local functions
+ */
+static char					uart_getchar(uart_t  *uart);
+static uint32_t				uart_irq_save(void);
+static void					uart_irq_restore(uint32_t  primask);
+static void					uart_tx_start(uart_t  *uart);
+static void					uart_tx_service(uart_t  *uart);
+static void					uart_tx_wait(uart_t  *uart);
+static void					uart_tx_dma(uart_t  *uart, const volatile char  *ptr, uint32_t  len);
+static void					uart_tx_dma_next(uart_t  *uart);
+static void					uart_tx_dma_service(uart_t  *uart);
+static uint32_t				uart_rx_dma_avail(uart_t  *uart);
+static uint32_t				uart_fifo_depth(uint32_t  field);
+static uint32_t				uart_clock(uint32_t  uartnum);
+static void					uart_set_divisor(UART_MemMapPtr  uartbase, uint16_t  sbr, uint8_t  brfa);
+static void					uart_rx_park(uart_t  *uart);
+static void					uart_rx_unpark(uart_t  *uart);
+static void					uart_isr(uart_t  *uart);
+
+
+
+uart_t  *uart_open(uint32_t  uartnum, int32_t  baud)
 {
+	uart_t							*uart;
 	UART_MemMapPtr					uartbase;
-    register uint16_t				sbr;
-	register uint16_t				brfa;
-	uint32_t						sysclk;
-    uint8_t							temp;
+	uint16_t						sbr;
+	uint8_t							brfa;
+	uint32_t						achieved;
+	int32_t							ppm;
+	uint32_t						irq;
+	uint8_t							pfifo;
 
-	uartbase = XlateUARTNumToBasePtr(uartnum);	// convert num (0-2) to UART base pointer
-	if (uartbase == (UART_MemMapPtr) 0)  return;		// if no such UART, ignore
+	if (uartnum >= NUM_UARTS)  return  0;		// if no such UART, ignore
 
 /*
- *  UART0 and UART1 are clocked from the core clock, but all other UARTs are
- *  clocked from the peripheral clock. So we have to determine which clock
- *  to use in baud rate calcs.
+ *  Work out the baud rate divisor first, so a rate this UART's clock
+ *  cannot make leaves the UART untouched.
  */
-    if ((uartbase == UART0_BASE_PTR) | (uartbase == UART1_BASE_PTR))
-		sysclk = core_clk_khz;
-    else
-		sysclk = periph_clk_khz;
+	achieved = uart_plan_baud(uart_clock(uartnum), (uint32_t) baud, &sbr, &brfa, &ppm);
+	if (achieved == 0)  return  0;
+
+	uart = &UARTs[uartnum];
+	uartbase = UARTPorts[uartnum].base;
+	irq = UARTPorts[uartnum].irq;
 
 /*
  *  Enable the clock to the selected UART
  */
-    if      (uartbase == UART0_BASE_PTR)  SIM_SCGC4 |= SIM_SCGC4_UART0_MASK;
-    else if (uartbase == UART1_BASE_PTR)  SIM_SCGC4 |= SIM_SCGC4_UART1_MASK;
-    else                                  SIM_SCGC4 |= SIM_SCGC4_UART2_MASK;
+	switch  (uartnum)
+	{
+		case  0:  SIM_SCGC4 |= SIM_SCGC4_UART0_MASK;  break;
+		case  1:  SIM_SCGC4 |= SIM_SCGC4_UART1_MASK;  break;
+		case  2:  SIM_SCGC4 |= SIM_SCGC4_UART2_MASK;  break;
+		case  3:  SIM_SCGC4 |= SIM_SCGC4_UART3_MASK;  break;
+		case  4:  SIM_SCGC1 |= SIM_SCGC1_UART4_MASK;  break;
+	}
 
-    /* Make sure that the transmitter and receiver are disabled while we 
+    /* Make sure that the transmitter and receiver are disabled while we
      * change settings.
      */
     UART_C2_REG(uartbase) &= ~(UART_C2_TE_MASK		// disable transmitter
 							 | UART_C2_RE_MASK		// disable receiver
-							 | UART_C2_RIE_MASK);	// disable receive interrupt on buffer full
+							 | UART_C2_RIE_MASK		// disable receive interrupt on buffer full
+							 | UART_C2_TIE_MASK		// disable transmit interrupts
+							 | UART_C2_TCIE_MASK
+							 | UART_C2_ILIE_MASK);	// disable idle line interrupt
+	UART_C5_REG(uartbase) &= ~(UART_C5_TDMAS_MASK | UART_C5_RDMAS_MASK);	// no DMA
+
+	if (uart->txon)  DMA_CERQ = uart->txchan;		// stop any DMA left from before
+	if (uart->rxon)  DMA_CERQ = uart->rxchan;
+
+	uart->base = uartbase;
+	uart->num = uartnum;
+	uart->rin = 0;							// empty the queues
+	uart->rout = 0;
+	uart->xin = 0;
+	uart->xout = 0;
+	uart->busy = 0;
+	uart->mode = UART_WRITE_BLOCK;
+	uart->txon = 0;
+	uart->rxon = 0;
+	uart->rxparked = 0;
+	uart->baud = achieved;
+	uart->ppm = ppm;
 
     /* Configure the UART for 8-bit mode, no parity */
     UART_C1_REG(uartbase) = 0;	/* We need all default settings, so entire register is cleared */
-    
-    /* Calculate baud settings */
-    sbr = (uint16_t)((sysclk*1000)/(baud * 16));
-        
-    /* Save off the current value of the UARTx_BDH except for the SBR field */
-    temp = UART_BDH_REG(uartbase) & ~(UART_BDH_SBR(0x1F));
-    
-    UART_BDH_REG(uartbase) = temp |  UART_BDH_SBR(((sbr & 0x1F00) >> 8));
-    UART_BDL_REG(uartbase) = (uint8_t)(sbr & UART_BDL_SBR_MASK);
-    
-    /* Determine if a fractional divider is needed to get closer to the baud rate */
-    brfa = (((sysclk*32000)/(baud * 16)) - (sbr * 32));
-    
-    /* Save off the current value of the UARTx_C4 register except for the BRFA field */
-    temp = UART_C4_REG(uartbase) & ~(UART_C4_BRFA(0x1F));
-    
-    UART_C4_REG(uartbase) = temp |  UART_C4_BRFA(brfa);    
+
+	uart_set_divisor(uartbase, sbr, brfa);
+
+/*
+ *  Turn on whichever FIFOs this UART has (this needs the transmitter and
+ *  receiver disabled) and empty them.  The transmit interrupt comes with
+ *  two chars left, to keep the line busy; the receive interrupt comes
+ *  with the FIFO half full, and the idle line interrupt picks up any
+ *  chars left below that at the end of a burst.
+ */
+	pfifo = UART_PFIFO_REG(uartbase);
+	uart->rxdepth = uart_fifo_depth((pfifo & UART_PFIFO_RXFIFOSIZE_MASK) >> UART_PFIFO_RXFIFOSIZE_SHIFT);
+	uart->txdepth = uart_fifo_depth((pfifo & UART_PFIFO_TXFIFOSIZE_MASK) >> UART_PFIFO_TXFIFOSIZE_SHIFT);
+	if (uart->rxdepth > 1)  pfifo |= UART_PFIFO_RXFE_MASK;
+	if (uart->txdepth > 1)  pfifo |= UART_PFIFO_TXFE_MASK;
+	UART_PFIFO_REG(uartbase) = pfifo;
+	UART_CFIFO_REG(uartbase) |= UART_CFIFO_RXFLUSH_MASK | UART_CFIFO_TXFLUSH_MASK;
+	UART_TWFIFO_REG(uartbase) = (uart->txdepth > 1) ? 2 : 0;
+	uart->rxwater = (uart->rxdepth > 1) ? uart->rxdepth / 2 : 1;
+	UART_RWFIFO_REG(uartbase) = uart->rxwater;
 
     /* Enable receiver, transmitter and receiver interrupts */
 	UART_C2_REG(uartbase) |= (UART_C2_TE_MASK
 							| UART_C2_RE_MASK
 							| UART_C2_RIE_MASK
 							);
+	if (uart->rxdepth > 1)  UART_C2_REG(uartbase) |= UART_C2_ILIE_MASK;
 
 /*
- *  Make the connection to the external pins, based on the base pointer.
+ *  Make the connection to the external pins.  UART3 and UART4 only
+ *  come out on the larger (100-pin) K20 packages; the Teensy 3.x has
+ *  UART0-2.
  */
-	if (uartbase == UART0_BASE_PTR)
-    {
-        PORTB_PCR17 = PORT_PCR_MUX(0x3); // UART0 TXD is alt3 function on PB17
-        PORTB_PCR16 = PORT_PCR_MUX(0x3); // UART0 RXD is alt3 function on PB16
-    }
-    if (uartbase == UART1_BASE_PTR)
-  	{
-       PORTC_PCR4 = PORT_PCR_MUX(0x3); // UART1 TXD is alt3 function on PC4
-       PORTC_PCR3 = PORT_PCR_MUX(0x3); // UART1 RXD is alt3 function on PC3   
+	switch  (uartnum)
+	{
+		case  0:
+		PORTB_PCR17 = PORT_PCR_MUX(0x3);	// UART0 TXD is alt3 function on PB17
+		PORTB_PCR16 = PORT_PCR_MUX(0x3);	// UART0 RXD is alt3 function on PB16
+		break;
+
+		case  1:
+		PORTC_PCR4 = PORT_PCR_MUX(0x3);		// UART1 TXD is alt3 function on PC4
+		PORTC_PCR3 = PORT_PCR_MUX(0x3);		// UART1 RXD is alt3 function on PC3
+		break;
+
+		case  2:
+		PORTD_PCR3 = PORT_PCR_MUX(0x3);		// UART2 TXD is alt3 function on PD3
+		PORTD_PCR2 = PORT_PCR_MUX(0x3);		// UART2 RXD is alt3 function on PD2
+		break;
+
+		case  3:
+		PORTC_PCR17 = PORT_PCR_MUX(0x3);	// UART3 TXD is alt3 function on PC17
+		PORTC_PCR16 = PORT_PCR_MUX(0x3);	// UART3 RXD is alt3 function on PC16
+		break;
+
+		case  4:
+		PORTC_PCR15 = PORT_PCR_MUX(0x3);	// UART4 TXD is alt3 function on PC15
+		PORTC_PCR14 = PORT_PCR_MUX(0x3);	// UART4 RXD is alt3 function on PC14
+		break;
+	}
+
+/*
+ *  Update NVIC to handle this UART's status interrupt (receive, transmit
+ *  and idle line).  The status IRQs are 45, 47, 49, 51 and 53 for UART0-4
+ *  (vectors 61-69, odd); each IRQ's bit is irq mod 32 in NVIC register
+ *  irq / 32.  Priority is 0-15 (0 is highest), written to the high four
+ *  bits of NVICIPx.
+ */
+	NVIC_ICPR_REG(NVIC_BASE_PTR, irq / 32) = 1 << (irq % 32);	// clear any pending interrupt
+	NVIC_ISER_REG(NVIC_BASE_PTR, irq / 32) = 1 << (irq % 32);	// enable status source interrupt
+	NVIC_IP_REG(NVIC_BASE_PTR, irq) = 0x30;					// set priority level for this IRQ to (pppp 0000)
+
+	return  uart;
+}
+
+
+
+
+int32_t  uart_write(uart_t  *uart, const char  *ptr, int32_t  len)
+{
+	int32_t					n;
+	uint16_t				in;
+	uint16_t				room;
+	uint32_t				primask;
+
+	n = 0;
+	while (n < len)
+	{
+		primask = uart_irq_save();				// no other writer between here and xin
+		in = uart->xin;
+		room = UART_XMT_Q_CHARS - (uint16_t)(in - uart->xout);
+		if (room == 0)							// queue is full...
+		{
+			uart_irq_restore(primask);
+			if (uart->mode == UART_WRITE_DROP)  break;	// ...so lose the rest
+			uart_tx_wait(uart);							// ...or wait for room
+			continue;
+		}
+		if (room > UART_XMT_CHUNK)  room = UART_XMT_CHUNK;	// keep the masked time short
+		while (room && (n < len))				// copy as much as fits
+		{
+			uart->xq[in & XMT_Q_MASK] = ptr[n++];
+			in++;
+			room--;
+		}
+		uart->xin = in;							// publish to the interrupt handler
+		uart_tx_start(uart);
+		uart_irq_restore(primask);
+	}
+	return  n;
+}
+
+
+
+
+uint32_t  uart_set_write_mode(uart_t  *uart, uint32_t  mode)
+{
+	uint32_t				oldmode;
+
+	oldmode = uart->mode;
+	uart->mode = mode;
+	return  oldmode;
+}
+
+
+
+
+void  uart_flush(uart_t  *uart)
+{
+	while (uart->busy)  uart_tx_wait(uart);
+}
+
+
+
+
+int32_t  uart_avail(uart_t  *uart)
+{
+	if (uart->rxon)  return  uart_rx_dma_avail(uart);
+
+	return  (uint16_t)(uart->rin - uart->rout);
+}
+
+
+
+
+uint32_t  uart_set_rx_watermark(uart_t  *uart, uint32_t  level)
+{
+	uint32_t				primask;
+
+	if (level < 1)  level = 1;
+	if (level > uart->rxdepth)  level = uart->rxdepth;
+	primask = uart_irq_save();					// not while the handler parks
+	uart->rxwater = level;
+	if (!uart->rxon && !uart->rxparked)  UART_RWFIFO_REG(uart->base) = level;	// receive DMA keeps 1
+	uart_irq_restore(primask);
+	return  level;
+}
+
+
+
+
+int32_t  uart_read_available(uart_t  *uart, char  *ptr, int32_t  len)
+{
+	uint32_t				avail;
+	uint16_t				out;
+	int32_t					n;
+
+	avail = uart_avail(uart);
+	if (len > (int32_t) avail)  len = avail;
+
+	if (uart->rxon)
+	{
+		out = uart->rxout;
+		for (n=0; n<len; n++)
+		{
+			ptr[n] = uart->rxbuf[out];
+			out = (out + 1) & uart->rxmask;
+		}
+		uart->rxout = out;
+	}
+	else
+	{
+		out = uart->rout;
+		for (n=0; n<len; n++)
+		{
+			ptr[n] = uart->rq[out & RCV_Q_MASK];
+			out++;
+		}
+		uart->rout = out;						// hand the cells back in one go
+	}
+	return  len;
+}
+
+
+
+
+int32_t  uart_read(uart_t  *uart, char  *ptr, int32_t  len)
+{
+	int						chars;
+
+	for (chars=0; chars<len; chars++)
+	{
+		*ptr = uart_getchar(uart);					// go get a char
+		ptr++;										// move to next cell
 	}
-  	if (uartbase == UART2_BASE_PTR)
-  	{
-  		PORTD_PCR3 = PORT_PCR_MUX(0x3); // UART2 TXD is alt3 function on PD3
-  		PORTD_PCR2 = PORT_PCR_MUX(0x3); // UART2 RXD is alt3 function on PD2
-  	}
+	return  chars;
+}
 
 
+
+
+int32_t  uart_init_dma(uart_t  *uart, uint32_t  txchan, uint32_t  rxchan, char  *rxbuf, uint32_t  rxsize)
+{
+	UART_MemMapPtr			uartbase;
+
+	if ((txchan >= 16) && (txchan != UART_NO_DMA))  return  -1;
+	if (rxchan != UART_NO_DMA)
+	{
+		if (rxchan >= 16)  return  -1;
+		if ((rxsize < 2) || (rxsize > 16384) || (rxsize & (rxsize - 1)))  return  -1;
+		if ((txchan != UART_NO_DMA)
+			&& (UARTPorts[uart->num].rxsrc == UARTPorts[uart->num].txsrc))  return  -1;	// one request, one way
+	}
+
+	uartbase = uart->base;
+	uart_flush(uart);						// let any queued chars go
+	SIM_SCGC6 |= SIM_SCGC6_DMAMUX_MASK;		// clock the DMA and its request mux
+	SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
+
 /*
- *  Update NVIC to handle receiver interrupts
- *  (Refer to K20 Reference Manual and K20 Quick Reference Guide from Freescale)
+ *  Transmit: one byte per request from memory into D, ending each transfer
+ *  with the request disabled.  The source and count are filled in for
+ *  each transfer.
  */
+	if (txchan != UART_NO_DMA)
+	{
+		DMA_CERQ = txchan;
+		DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, txchan) = 0;
+		DMA_SOFF(txchan) = 1;
+		DMA_ATTR(txchan) = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+		DMA_NBYTES_MLNO(txchan) = 1;
+		DMA_SLAST(txchan) = 0;
+		DMA_DADDR(txchan) = (uint32_t) &UART_D_REG(uartbase);
+		DMA_DOFF(txchan) = 0;
+		DMA_DLAST_SGA(txchan) = 0;
+		DMA_CSR(txchan) = DMA_CSR_DREQ_MASK;
+		DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, txchan) = DMAMUX_CHCFG_SOURCE(UARTPorts[uart->num].txsrc)
+												  | DMAMUX_CHCFG_ENBL_MASK;
+		uart->txchan = txchan;
+		uart->txon = 1;
+		UART_C5_REG(uartbase) |= UART_C5_TDMAS_MASK;	// TIE now requests DMA
+	}
+
 /*
- *  UART0 single interrupt vector for status sources
- *  Vector = 61
- *  IRQ = 45
- *  UART0 bit = IRQ mod 32 = 45 mod 32 = 13
- *  NVIC register offset (NVICSERx, etc) = IRQ / 32 = 45 / 32 = 1
- *  Priority is 0-15 (0 is highest), written to high four bits of NVICIP45.
- *
+ *  Receive: one byte per request from D into rxbuf, going back to the
+ *  start of rxbuf at the end of each major loop and never stopping.
+ */
+	if (rxchan != UART_NO_DMA)
+	{
+		UART_C2_REG(uartbase) &= ~UART_C2_RIE_MASK;
+		DMA_CERQ = rxchan;
+		DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, rxchan) = 0;
+		DMA_SADDR(rxchan) = (uint32_t) &UART_D_REG(uartbase);
+		DMA_SOFF(rxchan) = 0;
+		DMA_ATTR(rxchan) = DMA_ATTR_SSIZE(0) | DMA_ATTR_DSIZE(0);
+		DMA_NBYTES_MLNO(rxchan) = 1;
+		DMA_SLAST(rxchan) = 0;
+		DMA_DADDR(rxchan) = (uint32_t) rxbuf;
+		DMA_DOFF(rxchan) = 1;
+		DMA_CITER_ELINKNO(rxchan) = rxsize;
+		DMA_BITER_ELINKNO(rxchan) = rxsize;
+		DMA_DLAST_SGA(rxchan) = -rxsize;
+		DMA_CSR(rxchan) = 0;
+		DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, rxchan) = DMAMUX_CHCFG_SOURCE(UARTPorts[uart->num].rxsrc)
+												  | DMAMUX_CHCFG_ENBL_MASK;
+		uart->rxchan = rxchan;
+		uart->rxbuf = rxbuf;
+		uart->rxmask = rxsize - 1;
+		uart->rxout = 0;
+		uart->rxseen = 0;
+		uart->rxparked = 0;
+		uart->rxon = 1;
+		UART_RWFIFO_REG(uartbase) = 1;			// a DMA request per char
+		DMA_SERQ = rxchan;
+		UART_C5_REG(uartbase) |= UART_C5_RDMAS_MASK;	// RIE now requests DMA
+		UART_C2_REG(uartbase) |= UART_C2_RIE_MASK | UART_C2_ILIE_MASK;
+	}
+	return  0;
+}
+
+
+
+
+int32_t  uart_write_dma(uart_t  *uart, const char  *ptr, int32_t  len, void  (*done)(uart_t  *uart))
+{
+	uint32_t				primask;
+
+	if (!uart->txon || (len <= 0) || (len > 32767))  return  0;
+
+	primask = uart_irq_save();
+	if (uart->busy || (uart->xin != uart->xout))	// something else is being sent
+	{
+		uart_irq_restore(primask);
+		return  0;
+	}
+	uart->busy = 1;
+	uart->fromq = 0;
+	uart->txdone = done;
+	uart_tx_dma(uart, ptr, len);
+	uart_irq_restore(primask);
+	return  len;
+}
+
+
+
+
+void  uart_set_idle_callback(uart_t  *uart, void  (*idle)(uart_t  *uart, int32_t  avail))
+{
+	uart->rxidle = idle;
+}
+
+
+
+
+void  uart_get_stats(uart_t  *uart, UART_STATS  *stats)
+{
+	uint32_t				primask;
+
+	primask = uart_irq_save();
+	*stats = uart->stats;
+	uart->stats.txchars = 0;
+	uart->stats.rxchars = 0;
+	uart->stats.irqs = 0;
+	uart->stats.irqcycles = 0;
+	uart->stats.overruns = 0;
+	uart->stats.framing = 0;
+	uart->stats.noise = 0;
+	uart->stats.dropped = 0;
+	uart_irq_restore(primask);
+}
+
+
+
+
+/*
+ *  The UART divides its clock by 16 * (SBR + BRFA/32), so in 32nds the
+ *  divisor is D = SBR*32 + BRFA and the rate is 2 * clock / D.  The
+ *  error only grows moving away from 2 * clock / baud, so the best D is
+ *  that rounded down or up; checking both covers every SBR and BRFA.
+ *  Because D is at least 32, the error is at most 1/64 of the rate, which
+ *  keeps the ppm sum within 32 bits without a 64-bit divide.
  */
-	if (uartbase == UART0_BASE_PTR)
-    {
-		NVICICPR1 |= (1<<13);				// clear any pending interrupt
-		NVICISER1 |= (1<<13);				// enable UART0 status source interrupt
-		NVICIP45 = 0x30;					// set priority level for this IRQ to (pppp 0000)
+uint32_t  uart_plan_baud(uint32_t  clock, uint32_t  baud, uint16_t  *sbr, uint8_t  *brfa, int32_t  *ppm)
+{
+	uint32_t				d;
+	uint32_t				best;
+	uint32_t				rate;
+	uint32_t				achieved;
+	uint32_t				diff;
+	uint32_t				bestdiff;
+
+	if ((baud < 64) || (baud > clock / 16))  return  0;
+
+	best = 0;
+	achieved = 0;
+	bestdiff = 0xffffffff;
+	for (d = (2 * clock) / baud;  d <= (2 * clock) / baud + 1;  d++)
+	{
+		if ((d < 32) || (d > (0x1fff * 32 + 31)))  continue;	// SBR is 1-8191
+		rate = (2 * clock + d / 2) / d;
+		diff = (rate > baud) ? (rate - baud) : (baud - rate);
+		if (diff < bestdiff)
+		{
+			best = d;
+			achieved = rate;
+			bestdiff = diff;
+		}
 	}
+	if (best == 0)  return  0;
+
+	*sbr = best / 32;
+	*brfa = best % 32;
+	if (ppm)
+	{
+		*ppm = (int32_t) ((bestdiff * 15625) / (baud >> 6));	// 1e6/64 over baud/64
+		if (achieved < baud)  *ppm = -*ppm;
+	}
+	return  achieved;
+}
+
+
+
+
+uint32_t  uart_set_baud(uart_t  *uart, uint32_t  baud, int32_t  *ppm)
+{
+	uint16_t				sbr;
+	uint8_t					brfa;
+	uint32_t				achieved;
+	int32_t					err;
+	uint8_t					c2;
+
+	achieved = uart_plan_baud(uart_clock(uart->num), baud, &sbr, &brfa, &err);
+	if (achieved == 0)  return  0;
+
+	uart_flush(uart);						// let queued chars go at the old rate
+	c2 = UART_C2_REG(uart->base);
+	UART_C2_REG(uart->base) = c2 & ~(UART_C2_TE_MASK | UART_C2_RE_MASK);
+	uart_set_divisor(uart->base, sbr, brfa);
+	UART_C2_REG(uart->base) = c2;
+
+	uart->baud = achieved;
+	uart->ppm = err;
+	if (ppm)  *ppm = err;
+	return  achieved;
+}
+
+
+
+
+uint32_t  uart_get_baud(uart_t  *uart, int32_t  *ppm)
+{
+	if (ppm)  *ppm = uart->ppm;
+	return  uart->baud;
+}
+
+
+
+
 /*
- *  UART1 single interrupt vector for status sources
- *  Vector = 63
- *  IRQ = 47
- *  UART0 bit = IRQ mod 32 = 47 mod 32 = 15
- *  NVIC register offset (NVICSERx, etc) = IRQ / 32 = 45 / 32 = 1
- *  Priority is 0-15 (0 is highest), written to high four bits of NVICIP47.
+ *  A 0x00 char holds the line low for the start bit and eight data bits,
+ *  nine bit times in all.  FTM0 channels 2 and 3, combined for dual edge
+ *  capture, timestamp a falling edge and the rising edge after it on the
+ *  same pin, so for the sync char their difference is nine bit times in
+ *  bus clocks.
+ *
+ *  The counter is 16 bits, which at 48 MHz is under 7 Kbaud for nine bit
+ *  times.  So the loop keeps its own count of the times the counter has
+ *  wrapped, and each edge's time is taken from when its capture flag is
+ *  first seen: the counter now, less how far it has moved since the edge.
+ *  That holds as long as the loop comes round within a wrap (65536 bus
+ *  clocks, 1.3 ms at 48 MHz), which it does unless interrupts hold it up
+ *  for longer.
+ *
+ *  Only a low pulse that starts after the line has been quiet (no edges)
+ *  for a char time at UART_AUTOBAUD_MIN counts as the sync char; any
+ *  other pulse, from traffic in progress when this is called, just
+ *  restarts the wait for a quiet line.
  *
+ *  UART1 RXD on PC3 doubles as FTM0_CH2 (alt4), so the pin is switched
+ *  over for the measurement with the receiver off, and switched back
+ *  after.  No other UART has an RXD pin with an FTM capture function.
  */
-    if (uartbase == UART1_BASE_PTR)
-  	{
-		NVICICPR1 |= (1<<15);				// clear any pending interrupt
-		NVICISER1 |= (1<<15);				// enable UART1 status source interrupt
-		NVICIP47 = 0x30;					// set priority level for this IRQ to (pppp 0000)
+uint32_t  uart_autobaud(uart_t  *uart, uint32_t  timeout_ms)
+{
+	uint32_t				limit;
+	uint32_t				wraps;
+	uint32_t				now;
+	uint32_t				quiet;
+	uint32_t				idle;
+	uint32_t				fell;
+	uint32_t				rose;
+	uint32_t				counts;
+	uint32_t				rate;
+	uint32_t				diff;
+	uint32_t				n;
+	uint16_t				cnt;
+	uint16_t				last;
+	uint8_t					c2f;
+	uint8_t					c3f;
+	uint8_t					c2;
+	uint8_t					falling;
+	uint8_t					captured;
+
+	if (uart->num != 1)  return  0;
+
+	limit = ((timeout_ms * ((uint32_t) periph_clk_khz >> 6)) >> 10) + 1;	// counter wraps every 65536 bus clocks
+	idle = (uint32_t) periph_clk_khz * 10000 / UART_AUTOBAUD_MIN;		// ten bit times, in bus clocks
+
+	c2 = UART_C2_REG(uart->base);
+	UART_C2_REG(uart->base) = c2 & ~UART_C2_RE_MASK;
+
+	SIM_SCGC6 |= SIM_SCGC6_FTM0_MASK;
+	FTM0_SC = 0;							// stop the counter while setting up
+	FTM0_MODE = FTM_MODE_WPDIS_MASK | FTM_MODE_FTMEN_MASK;
+	FTM0_CNTIN = 0;
+	FTM0_MOD = 0xffff;
+	FTM0_CNT = 0;
+	(void) FTM0_C3SC;						// read, so the write below clears CHF
+	FTM0_C2SC = FTM_CnSC_ELSB_MASK;			// first edge: falling (start bit)
+	FTM0_C3SC = FTM_CnSC_ELSA_MASK;			// second edge: rising (end of the 0x00)
+	FTM0_COMBINE = FTM_COMBINE_DECAPEN1_MASK;
+	FTM0_COMBINE |= FTM_COMBINE_DECAP1_MASK;	// arm a one-shot capture
+	PORTC_PCR3 = PORT_PCR_MUX(0x4);			// PC3 is FTM0_CH2 on alt4
+	FTM0_SC = FTM_SC_CLKS(1) | FTM_SC_PS(0);	// count bus clocks
+
+	wraps = 0;
+	last = 0;
+	quiet = 0;								// the line is quiet from now on, so far
+	fell = 0;
+	falling = FALSE;
+	captured = FALSE;
+	counts = 0;
+	while (wraps < limit)
+	{
+		c2f = FTM0_C2SC & FTM_CnSC_CHF_MASK;	// flags before the counter, so
+		c3f = FTM0_C3SC & FTM_CnSC_CHF_MASK;	// their edges are in the past
+		cnt = FTM0_CNT;
+		if (cnt < last)  wraps++;
+		last = cnt;
+		now = (wraps << 16) | cnt;
+
+		if (c2f && !falling)
+		{
+			fell = now - (uint16_t) (cnt - FTM0_C2V);
+			falling = TRUE;
+		}
+		if (c3f && falling)
+		{
+			rose = now - (uint16_t) (cnt - FTM0_C3V);
+			if (fell - quiet >= idle)			// quiet long enough: the sync char
+			{
+				counts = rose - fell;
+				captured = TRUE;
+				break;
+			}
+			quiet = rose;						// traffic; wait for quiet again
+			falling = FALSE;
+			FTM0_C2SC &= ~FTM_CnSC_CHF_MASK;
+			FTM0_C3SC &= ~FTM_CnSC_CHF_MASK;
+			FTM0_COMBINE |= FTM_COMBINE_DECAP1_MASK;	// one-shot cleared it; arm again
+		}
 	}
+
+	FTM0_SC = 0;							// give FTM0 back as it was
+	FTM0_COMBINE = 0;
+	FTM0_C2SC = 0;
+	FTM0_C3SC = 0;
+
+	PORTC_PCR3 = PORT_PCR_MUX(0x3);			// back to UART1 RXD
+	if (uart->rxdepth > 1)  UART_CFIFO_REG(uart->base) |= UART_CFIFO_RXFLUSH_MASK;
+	UART_C2_REG(uart->base) = c2;
+
+	if (!captured || (counts == 0))  return  0;
+
+	rate = ((uint32_t) periph_clk_khz * 9000 + counts / 2) / counts;
+	for (n=0; n<sizeof(UARTStdBauds)/sizeof(UARTStdBauds[0]); n++)
+	{
+		diff = (rate > UARTStdBauds[n]) ? (rate - UARTStdBauds[n]) : (UARTStdBauds[n] - rate);
+		if (diff * 50 <= UARTStdBauds[n])
+		{
+			rate = UARTStdBauds[n];
+			break;
+		}
+	}
+	if (rate < UART_AUTOBAUD_MIN)  return  0;
+	return  uart_set_baud(uart, rate, 0);
+}
+
+
+
+
 /*
- *  UART2 single interrupt vector for status sources
- *  Vector = 65
- *  IRQ = 49
- *  UART0 bit = IRQ mod 32 = 45 mod 32 = 17
- *  NVIC register offset (NVICSERx, etc) = IRQ / 32 = 45 / 32 = 1
- *  Priority is 0-15 (0 is highest), written to high four bits of NVICIP49.
- *
+ *    -------------------  calls on the active UART  -------------------------
  */
-  	if (uartbase == UART2_BASE_PTR)
-  	{
-		NVICICPR1 |= (1<<17);				// clear any pending interrupt
-		NVICISER1 |= (1<<17);				// enable UART2 status source interrupt
-		NVICIP49 = 0x30;					// set priority level for this IRQ to (pppp 0000)
-  	}
 
-	ActiveUARTBasePtr = uartbase;			// done, record inited UART as active UART
+void  UARTInit(uint32_t  uartnum, int32_t baud)
+{
+	uart_t					*uart;
+
+	uart = uart_open(uartnum, baud);
+	if (uart)  ActiveUART = uart;			// done, record inited UART as active UART
 }
 
 
@@ -194,15 +823,11 @@ void  UARTInit(uint32_t  uartnum, int32_t baud)
 uint32_t  UARTAssignActiveUART(uint32_t  uartnum)
 {
 	uint32_t				olduartnum;
-	UART_MemMapPtr			tptr;
 
-	if      (ActiveUARTBasePtr == UART0_BASE_PTR)  olduartnum = 0;
-	else if (ActiveUARTBasePtr == UART1_BASE_PTR)  olduartnum = 1;
-	else if (ActiveUARTBasePtr == UART2_BASE_PTR)  olduartnum = 2;
+	if (ActiveUART)  olduartnum = ActiveUART->num;
 	else     olduartnum = (uint32_t) -1;
 
-	tptr = XlateUARTNumToBasePtr(uartnum);
-	if (tptr)  ActiveUARTBasePtr = tptr;
+	if (uartnum < NUM_UARTS)  ActiveUART = &UARTs[uartnum];
 	return  olduartnum;
 }
 
@@ -211,43 +836,59 @@ uint32_t  UARTAssignActiveUART(uint32_t  uartnum)
 
 int32_t  UARTWrite(const char  *ptr, int32_t  len)
 {
-	int32_t					n;
+	if (ActiveUART == 0)  return  0;
 
-	if (ActiveUARTBasePtr == 0)  return  0;
+	return  uart_write(ActiveUART, ptr, len);
+}
 
-	n = 0;
-	while (len)
-	{
-		n = n + uart_putchar(*ptr++ & (uint16_t)0xff);
-		len--;
-	}
-	return  n;
+
+
+
+uint32_t  UARTSetWriteMode(uint32_t  mode)
+{
+	if (ActiveUART == 0)  return  UART_WRITE_BLOCK;
+
+	return  uart_set_write_mode(ActiveUART, mode);
+}
+
+
+
+
+void  UARTFlush(void)
+{
+	if (ActiveUART == 0)  return;
+
+	uart_flush(ActiveUART);
 }
 
 
+
+
 int32_t  UARTAvail(void)
 {
-	if (ActiveUARTBasePtr == 0)  return  0;
+	if (ActiveUART == 0)  return  0;
 
-	return  uart_char_avail();
+	return  uart_avail(ActiveUART);
 }
 
 
 
-int32_t  UARTRead(char *ptr, int32_t len)
+
+int32_t  UARTReadAvailable(char *ptr, int32_t len)
 {
-	volatile char			c;
-	int						chars;
+	if (ActiveUART == 0)  return  0;
 
-	if (ActiveUARTBasePtr == 0)  return  0;			// don't try to read if no active UART
+	return  uart_read_available(ActiveUART, ptr, len);
+}
 
-	for (chars=0; chars<len; chars++)
-	{
-		c = uart_getchar();							// go get a char
-		*ptr = c;									// save the char we got
-		ptr++;										// move to next cell
-	}
-	return  chars;
+
+
+
+int32_t  UARTRead(char *ptr, int32_t len)
+{
+	if (ActiveUART == 0)  return  0;			// don't try to read if no active UART
+
+	return  uart_read(ActiveUART, ptr, len);
 }
 
 
@@ -257,147 +898,341 @@ int32_t  UARTRead(char *ptr, int32_t len)
 
 
 /*
- *  XlateUARTNumToBasePtr      calc base pointer for selected UART
+ *  uart_irq_save      mask interrupts, returning the previous mask state
  *
- *  This routine translates a UART number (0-2) to a standard base
- *  pointer, for use with the Freescale register access macros.
- *
- *  If argument uartn is outside the legal range, this routine
- *  returns 0.
+ *  uart_write() may be called before interrupts are first enabled, so
+ *  the critical sections here must not turn them on unconditionally.
  */
-static UART_MemMapPtr  XlateUARTNumToBasePtr(uint32_t  uartn)
+static uint32_t  uart_irq_save(void)
 {
-	UART_MemMapPtr				r;
+	uint32_t				primask;
+
+	primask = InterruptsDisabled();
+	DisableInterrupts;
+	return  primask;
+}
 
-	if (uartn == 0)       r = UART0_BASE_PTR;
-	else if (uartn == 1)  r = UART1_BASE_PTR;
-	else if (uartn == 2)  r = UART2_BASE_PTR;
-	else  r = (UART_MemMapPtr) 0;
 
-	return  r;
+
+/*
+ *  uart_irq_restore      undo uart_irq_save()
+ */
+static void  uart_irq_restore(uint32_t  primask)
+{
+	if ((primask & 1) == 0)  EnableInterrupts;
 }
 
 
+
 /*
- *  uart_putchar      generic UART output routine
- *
- *  This routine locks until the requested UART has space available
- *  in its transmit FIFO, then writes the specified character to the
- *  transmit FIFO.
+ *  uart_tx_start      make sure the transmit queue is being drained
  *
- *  Upon entry, ch holds the character to send.
- *
- *  Returns 1 if able to write char to UART, else returns 0.
+ *  Switches the UART from the transmission complete interrupt (if the
+ *  queue had run dry) back to the transmit data register empty interrupt.
+ *  C2 is also written by the interrupt handler, hence the critical section.
+ *  With transmit DMA, starts a transfer if none is running.
  */
-static uint32_t  uart_putchar(char ch)
+static void  uart_tx_start(uart_t  *uart)
 {
-	if (ActiveUARTBasePtr == 0)  return 0;		// if no active UART, show no chars sent
+	uint32_t				primask;
 
-    while (!(UART_S1_REG(ActiveUARTBasePtr) & UART_S1_TDRE_MASK))  ;	// lock until ready
-    UART_D_REG(ActiveUARTBasePtr) = (uint8_t)ch;	// write char to UART
-	return  1;					// return number of chars sent
- }
+	primask = uart_irq_save();
+	if (uart->txon)
+	{
+		if (!uart->busy)
+		{
+			uart->busy = 1;
+			uart_tx_dma_next(uart);
+		}
+	}
+	else
+	{
+		uart->busy = 1;
+		UART_C2_REG(uart->base) = (UART_C2_REG(uart->base) & ~UART_C2_TCIE_MASK) | UART_C2_TIE_MASK;
+	}
+	uart_irq_restore(primask);
+}
 
 
 
 /*
- *  uart_char_avail      return state of receive FIFO
- *
- *  This routine checks the active UART for available chars and returns
- *  the available count.
+ *  uart_tx_service      move queued chars into the UART
  *
- *  If receive interrupts are enabled, the value returned is the number of
- *  chars in the receive queue.  If recieve interrupts are not enabled,
- *  the value returned is 1 if there is at least one char in the UART
- *  recieve FIFO.
+ *  Called from the interrupt handler while busy is set.  Fills the
+ *  UART's transmit FIFO (or its data register, if it has no FIFO).  Once
+ *  the queue is empty, trades TIE for TCIE so the next interrupt comes
+ *  when the last char has been shifted out, and clears busy then.
+ */
+static void  uart_tx_service(uart_t  *uart)
+{
+	UART_MemMapPtr			uartbase;
+	uint16_t				out;
+	uint32_t				room;
+	uint8_t					s1;
+
+	uartbase = uart->base;
+	s1 = UART_S1_REG(uartbase);					// S1 read, then D write clears TDRE
+	if (uart->txdepth > 1)  room = uart->txdepth - UART_TCFIFO_REG(uartbase);
+	else  room = (s1 & UART_S1_TDRE_MASK) ? 1 : 0;
+
+	out = uart->xout;
+	while (room && (out != uart->xin))
+	{
+		UART_D_REG(uartbase) = uart->xq[out & XMT_Q_MASK];
+		out++;
+		room--;
+	}
+	uart->stats.txchars += (uint16_t)(out - uart->xout);
+	uart->xout = out;
+
+	if (out == uart->xin)						// nothing left to send
+	{
+		UART_C2_REG(uartbase) = (UART_C2_REG(uartbase) & ~UART_C2_TIE_MASK) | UART_C2_TCIE_MASK;
+		if (UART_S1_REG(uartbase) & UART_S1_TC_MASK)	// and the last char is gone
+		{
+			UART_C2_REG(uartbase) &= ~UART_C2_TCIE_MASK;
+			uart->busy = 0;
+		}
+	}
+}
+
+
+
+/*
+ *  uart_tx_dma      start a DMA transfer of len chars at ptr
  *
- *  If there is no active UART, this routine returns 0.
+ *  The channel is not given an interrupt; the library does not own the
+ *  DMA vectors.  Instead TCIE is enabled along with the DMA requests, and
+ *  the end of the transfer is seen by the UART's own interrupt handler
+ *  once the DMA is done and the last char has left the shifter.  Reading
+ *  S1 here is the first half of clearing TC; the first DMA write to D is
+ *  the second.
+ */
+static void  uart_tx_dma(uart_t  *uart, const volatile char  *ptr, uint32_t  len)
+{
+	uart->dmalen = len;
+	DMA_CDNE = uart->txchan;
+	DMA_SADDR(uart->txchan) = (uint32_t) ptr;
+	DMA_CITER_ELINKNO(uart->txchan) = len;
+	DMA_BITER_ELINKNO(uart->txchan) = len;
+	(void) UART_S1_REG(uart->base);
+	DMA_SERQ = uart->txchan;
+	UART_C2_REG(uart->base) |= UART_C2_TIE_MASK | UART_C2_TCIE_MASK;
+}
+
+
+
+/*
+ *  uart_tx_dma_next      send the next contiguous stretch of the transmit queue
  *
+ *  Clears busy if the queue is empty.
  */
-static uint32_t  uart_char_avail(void)
+static void  uart_tx_dma_next(uart_t  *uart)
 {
-	int32_t					c;
+	uint16_t				out;
+	uint16_t				len;
 
-	if (UART_C2_REG(ActiveUARTBasePtr) & UART_C2_RIE_MASK)	// if rcv interrupt is enabled...
+	out = uart->xout;
+	len = uart->xin - out;
+	if (len == 0)
 	{
-		switch  ((uint32_t)ActiveUARTBasePtr)
-		{
-			case  (uint32_t)UART0_BASE_PTR:
-			c = (UART0RcvInIndex - UART0RcvOutIndex);	// race condition!  need to turn off interrupts?
-			if (c < 0)  c = -c;
-			break;
+		uart->busy = 0;
+		return;
+	}
+	if (len > UART_XMT_Q_CHARS - (out & XMT_Q_MASK))	// stop at the end of the queue
+		len = UART_XMT_Q_CHARS - (out & XMT_Q_MASK);
 
-			case  (uint32_t)UART1_BASE_PTR:
-			c = (UART1RcvInIndex - UART1RcvOutIndex);	// race condition!  need to turn off interrupts?
-			if (c < 0)  c = -c;
-			break;
+	uart->fromq = 1;
+	uart_tx_dma(uart, &uart->xq[out & XMT_Q_MASK], len);
+}
 
-			case  (uint32_t)UART2_BASE_PTR:
-			c = (UART2RcvInIndex - UART2RcvOutIndex);	// race condition!  need to turn off interrupts?
-			if (c < 0)  c = -c;
-			break;
 
-			default:								// not a known UART, skip it
-			c = 0;
-			break;
-		}
+
+/*
+ *  uart_tx_dma_service      finish a DMA transfer once the UART is done with it
+ *
+ *  Called from the interrupt handler while busy is set.  TC alone is not
+ *  enough: it can still be set from before the transfer started.
+ */
+static void  uart_tx_dma_service(uart_t  *uart)
+{
+	UART_MemMapPtr			uartbase;
+	void					(*done)(uart_t  *uart);
+
+	uartbase = uart->base;
+	if (!(UART_C2_REG(uartbase) & UART_C2_TCIE_MASK))  return;
+	if (!(DMA_CSR(uart->txchan) & DMA_CSR_DONE_MASK))  return;
+	if (!(UART_S1_REG(uartbase) & UART_S1_TC_MASK))  return;
+
+	UART_C2_REG(uartbase) &= ~(UART_C2_TIE_MASK | UART_C2_TCIE_MASK);
+	DMA_CDNE = uart->txchan;
+	uart->stats.txchars += uart->dmalen;
+
+	if (uart->fromq)
+	{
+		uart->xout += uart->dmalen;
+		uart_tx_dma_next(uart);
 	}
 	else
 	{
-		if (UART_S1_REG(ActiveUARTBasePtr) & UART_S1_RDRF_MASK)  c = 1;
-		else  c = 0;
+		done = uart->txdone;
+		uart->busy = 0;
+		if (done)  done(uart);
+	}
+}
+
+
+
+/*
+ *  uart_tx_wait      let the transmitter make some progress
+ *
+ *  Normally the interrupt handler does the work and this just spins.  If
+ *  the caller has interrupts masked (for example, before the first
+ *  EnableInterrupts), the handler cannot run, so service the UART by
+ *  polling instead of locking up.
+ *
+ *  Called from an interrupt handler of the same or higher priority than
+ *  the UART, a blocking write would wait forever; handlers should use
+ *  UART_WRITE_DROP.
+ */
+static void  uart_tx_wait(uart_t  *uart)
+{
+	if (InterruptsDisabled() && uart->busy)
+	{
+		if (uart->txon)  uart_tx_dma_service(uart);
+		else  uart_tx_service(uart);
 	}
+}
+
+
 
-	return  (uint32_t) c;
+/*
+ *  uart_rx_dma_avail      number of chars the receive DMA has written that
+ *  have not been read
+ *
+ *  The DMA counts CITER down from the buffer size to 1, so the size less
+ *  CITER is where it writes next.  If the reader falls a whole buffer
+ *  behind, the chars are overwritten and the count starts again from 0.
+ */
+static uint32_t  uart_rx_dma_avail(uart_t  *uart)
+{
+	uint32_t				in;
+
+	in = (uart->rxmask + 1) - DMA_CITER_ELINKNO(uart->rxchan);
+	return  (in - uart->rxout) & uart->rxmask;
 }
 
 
 
+/*
+ *  uart_clock      the clock a UART runs from, in Hz
+ */
+static uint32_t  uart_clock(uint32_t  uartnum)
+{
+	if (UARTPorts[uartnum].coreclk)  return  (uint32_t) core_clk_khz * 1000;
+	return  (uint32_t) periph_clk_khz * 1000;
+}
+
+
 
 /*
- *  uart_getchar      get one char (with blocking) from active UART
+ *  uart_set_divisor      write a UART's baud rate divisor
  *
- *  This routine waits until a char is available in the receive
- *  FIFO of the active UART, then returns the oldest char.
+ *  The transmitter and receiver must be disabled.  BDL must be written
+ *  after BDH for the new SBR to take effect.
+ */
+static void  uart_set_divisor(UART_MemMapPtr  uartbase, uint16_t  sbr, uint8_t  brfa)
+{
+	UART_BDH_REG(uartbase) = (UART_BDH_REG(uartbase) & ~UART_BDH_SBR(0x1F)) | UART_BDH_SBR(sbr >> 8);
+	UART_BDL_REG(uartbase) = (uint8_t) (sbr & UART_BDL_SBR_MASK);
+	UART_C4_REG(uartbase) = (UART_C4_REG(uartbase) & ~UART_C4_BRFA(0x1F)) | UART_C4_BRFA(brfa);
+}
+
+
+
+/*
+ *  uart_fifo_depth      number of chars a FIFO holds, from its PFIFO size field
+ */
+static uint32_t  uart_fifo_depth(uint32_t  field)
+{
+	if (field == 0)  return  1;
+	return  2 << field;
+}
+
+
+
+/*
+ *  uart_rx_park      stop an idle line interrupting, without reading D
  *
- *  If there is no active UART, this routine returns NULL.
+ *  IDLE is cleared by reading S1 (already done by the caller) then D.
+ *  With the receive FIFO empty, reading D underflows it and leaves it
+ *  returning garbage until flushed, and on the part the line keeps
+ *  running while the handler does: a char landing just before the read of
+ *  D would be taken, or thrown away by the flush.  With receive DMA, D is
+ *  the DMA's to read.  So D is not read.  The idle line interrupt is
+ *  turned off, and the next char interrupts the CPU: the receive
+ *  watermark goes to 1 or, with receive DMA, the receiver stops
+ *  requesting DMA.  That char's interrupt unparks (uart_rx_unpark()), and
+ *  the read of D that takes it, the handler's or the DMA's, clears IDLE.
  *
+ *  The DMA may have taken a char before it stopped; that cleared IDLE,
+ *  so if IDLE is clear by now, unpark at once.
  */
-static char  uart_getchar(void)
+static void  uart_rx_park(uart_t  *uart)
 {
-	char				c;
-
-	while (uart_char_avail() == 0)  ;				// lock until char is available
+	UART_MemMapPtr			uartbase;
 
-	if (UART_C2_REG(ActiveUARTBasePtr) & UART_C2_RIE_MASK)	// if rcv interrupt is enabled...
+	uartbase = uart->base;
+	uart->rxparked = 1;
+	UART_C2_REG(uartbase) &= ~UART_C2_ILIE_MASK;
+	if (uart->rxon)
 	{
-		switch  ((uint32_t) ActiveUARTBasePtr)
-		{
-			case  (uint32_t)UART0_BASE_PTR:
-			c = UART0RcvQ[UART0RcvOutIndex];		// get next available char
-			UART0RcvOutIndex++;						// bump the index
-			UART0RcvOutIndex %= MAX_RCV_Q_CHARS;	// keep index legal
-			break;
+		UART_C5_REG(uartbase) &= ~UART_C5_RDMAS_MASK;
+		if (!(UART_S1_REG(uartbase) & UART_S1_IDLE_MASK))  uart_rx_unpark(uart);
+	}
+	else  UART_RWFIFO_REG(uartbase) = 1;
+}
 
-			case  (uint32_t)UART1_BASE_PTR:
-			c = UART1RcvQ[UART1RcvOutIndex];		// get next available char
-			UART1RcvOutIndex++;						// bump the index
-			UART1RcvOutIndex %= MAX_RCV_Q_CHARS;	// keep index legal
-			break;
 
-			case  (uint32_t)UART2_BASE_PTR:
-			c = UART2RcvQ[UART2RcvOutIndex];		// get next available char
-			UART2RcvOutIndex++;						// bump the index
-			UART2RcvOutIndex %= MAX_RCV_Q_CHARS;	// keep index legal
-			break;
 
-			default:
-			return  0;
-		}
+/*
+ *  uart_rx_unpark      a char after an idle line, so back to the watermark
+ *  (or receive DMA) and the idle line interrupt
+ */
+static void  uart_rx_unpark(uart_t  *uart)
+{
+	UART_MemMapPtr			uartbase;
+
+	uartbase = uart->base;
+	if (uart->rxon)  UART_C5_REG(uartbase) |= UART_C5_RDMAS_MASK;
+	else  UART_RWFIFO_REG(uartbase) = uart->rxwater;
+	UART_C2_REG(uartbase) |= UART_C2_ILIE_MASK;
+	uart->rxparked = 0;
+}
+
+
+
+/*
+ *  uart_getchar      get one char (with blocking) from a UART
+ *
+ *  This routine waits until a char is available in the UART's
+ *  receive queue (or DMA buffer), then returns the oldest char.
+ */
+static char  uart_getchar(uart_t  *uart)
+{
+	char				c;
+
+	while (uart_avail(uart) == 0)  ;				// lock until char is available
+
+	if (uart->rxon)
+	{
+		c = uart->rxbuf[uart->rxout];
+		uart->rxout = (uart->rxout + 1) & uart->rxmask;
 	}
 	else
 	{
-		c = UART_D_REG(ActiveUARTBasePtr);		// get char from UART FIFO
+		c = uart->rq[uart->rout & RCV_Q_MASK];		// get next available char
+		uart->rout++;								// bump the index
 	}
 	return  c;
 }
@@ -408,65 +1243,123 @@ static char  uart_getchar(void)
  *    -------------------  UART interrupt handlers  -------------------------
  */
 
-void  UART0_RX_TX_IRQHandler(void)
+/*
+ *  uart_isr      the body of each UART's status interrupt handler
+ *
+ *  Handles the transmit side, then the receive side: all received chars
+ *  go into the receive queue or, with receive DMA, the idle line
+ *  interrupt calls the idle callback.  Chars that do not fit in the
+ *  queue are dropped and counted.
+ *
+ *  D is never read to clear IDLE, which could lose a char (see
+ *  uart_rx_park()); an idle line with nothing left to read parks the
+ *  receiver until the next char.  Without receive DMA, a UART with no
+ *  FIFO takes an interrupt per char anyway and has no idle line
+ *  interrupt to park.
+ *
+ *  Cycles spent here come from the DWT cycle counter, which reads 0
+ *  unless the application has turned it on.
+ */
+static void  uart_isr(uart_t  *uart)
 {
-	char			d;
+	UART_MemMapPtr			uartbase;
+	uint32_t				start;
+	uint32_t				avail;
+	uint32_t				in;
+	uint32_t				n;
+	uint8_t					s1;
+	char					d;
+
+	start = DWT_CYCCNT;
+	uartbase = uart->base;
+
+	if (uart->busy)
+	{
+		if (uart->txon)  uart_tx_dma_service(uart);
+		else  uart_tx_service(uart);
+	}
 
-	d = UART_S1_REG(UART0_BASE_PTR);			// first part of clearing the interrupt
-	if ((d & UART_S1_RDRF_MASK) == 0)			// if this is not a rcv interrupt...
-		return;
+	s1 = UART_S1_REG(uartbase);					// first part of clearing the interrupt
+	if (s1 & UART_S1_OR_MASK)  uart->stats.overruns++;
+	if (s1 & UART_S1_FE_MASK)  uart->stats.framing++;
+	if (s1 & UART_S1_NF_MASK)  uart->stats.noise++;
 
-	d = UART_D_REG(UART0_BASE_PTR);				// get the received char
-	UART0RcvQ[UART0RcvInIndex] = d;				// save in queue
-	UART0RcvInIndex++;							// move to next cell
-	UART0RcvInIndex %= MAX_RCV_Q_CHARS;			// keep index in legal range
-	if (UART0RcvInIndex == UART0RcvOutIndex)	// if we filled the buffer...
+	if (uart->rxparked)
+	{
+		if (s1 & UART_S1_RDRF_MASK)  uart_rx_unpark(uart);	// a char after an idle line
+		s1 &= ~UART_S1_IDLE_MASK;					// that idle line is dealt with
+	}
+
+	if (uart->rxon)
+	{
+		if (s1 & UART_S1_IDLE_MASK)
+		{
+			if (!(s1 & UART_S1_RDRF_MASK))  uart_rx_park(uart);
+			in = (uart->rxmask + 1) - DMA_CITER_ELINKNO(uart->rxchan);
+			uart->stats.rxchars += (in - uart->rxseen) & uart->rxmask;
+			uart->rxseen = in;
+			avail = uart_rx_dma_avail(uart);
+			if (uart->rxidle && avail)  uart->rxidle(uart, avail);
+		}
+	}
+	else if (s1 & (UART_S1_RDRF_MASK | UART_S1_IDLE_MASK))
 	{
-		UART0RcvOutIndex++;						// wipe out oldest char in buffer (good as any other solution)
-		UART0RcvOutIndex %= MAX_RCV_Q_CHARS;	// keep index in legal range
+		if (uart->rxdepth > 1)  n = UART_RCFIFO_REG(uartbase);
+		else  n = (s1 & UART_S1_RDRF_MASK) ? 1 : 0;
+
+		if ((n == 0) && (uart->rxdepth > 1))  uart_rx_park(uart);	// idle, and nothing left
+		in = uart->rin;
+		while (n--)
+		{
+			d = UART_D_REG(uartbase);				// get the received char
+			if ((uint16_t)(in - uart->rout) < UART_RCV_Q_CHARS)
+			{
+				uart->rq[in & RCV_Q_MASK] = d;		// save in queue
+				in++;								// move to next cell
+				uart->stats.rxchars++;
+			}
+			else  uart->stats.dropped++;			// queue full, lose it
+		}
+		uart->rin = in;
 	}
+
+	uart->stats.irqs++;
+	uart->stats.irqcycles += DWT_CYCCNT - start;
 }
 
 
 
-void  UART1_RX_TX_IRQHandler(void)
+void  UART0_RX_TX_IRQHandler(void)
 {
-	char			d;
+	uart_isr(&UARTs[0]);
+}
 
-	d = UART_S1_REG(UART1_BASE_PTR);			// first part of clearing the interrupt
-	if ((d & UART_S1_RDRF_MASK) == 0)			// if this is not a rcv interrupt...
-		return;
 
-	d = UART_D_REG(UART1_BASE_PTR);				// get the received char
-	UART1RcvQ[UART1RcvInIndex] = d;				// save in queue
-	UART1RcvInIndex++;							// move to next cell
-	UART1RcvInIndex %= MAX_RCV_Q_CHARS;			// keep index in legal range
-	if (UART1RcvInIndex == UART1RcvOutIndex)	// if we filled the buffer...
-	{
-		UART1RcvOutIndex++;						// wipe out oldest char in buffer (good as any other solution)
-		UART1RcvOutIndex %= MAX_RCV_Q_CHARS;	// keep index in legal range
-	}
+
+void  UART1_RX_TX_IRQHandler(void)
+{
+	uart_isr(&UARTs[1]);
 }
 
 
 
 void  UART2_RX_TX_IRQHandler(void)
 {
-	char			d;
+	uart_isr(&UARTs[2]);
+}
 
-	d = UART_S1_REG(UART2_BASE_PTR);			// first part of clearing the interrupt
-	if ((d & UART_S1_RDRF_MASK) == 0)			// if this is not a rcv interrupt...
-		return;
 
-	d = UART_D_REG(UART2_BASE_PTR);				// get the received char
-	UART2RcvQ[UART2RcvInIndex] = d;				// save in queue
-	UART2RcvInIndex++;							// move to next cell
-	UART2RcvInIndex %= MAX_RCV_Q_CHARS;			// keep index in legal range
-	if (UART2RcvInIndex == UART0RcvOutIndex)	// if we filled the buffer...
-	{
-		UART2RcvOutIndex++;						// wipe out oldest char in buffer (good as any other solution)
-		UART2RcvOutIndex %= MAX_RCV_Q_CHARS;	// keep index in legal range
-	}
+
+void  UART3_RX_TX_IRQHandler(void)
+{
+	uart_isr(&UARTs[3]);
+}
+
+
+
+void  UART4_RX_TX_IRQHandler(void)
+{
+	uart_isr(&UARTs[4]);
 }
 
 
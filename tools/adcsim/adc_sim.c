@@ -0,0 +1,357 @@
+/**
+ * The ADC acquisition engine on the k20sim register model
+ *
+ * The firmware side is adc.c, unchanged. First sweeps adc_plan() over the
+ * whole range of sample rates and checks each plan: the smallest prescaler
+ * that fits, a period within half a tick of the one asked for, and the rate
+ * it reports being the one those settings give.
+ *
+ * Then runs captures against a model of the eDMA engine: each conversion is
+ * a DMA request that stores a sample counter through the channel's transfer
+ * descriptor, and at the end of a major loop the engine loads the next
+ * descriptor through the scatter/gather link and raises the channel's
+ * interrupt if asked to. A consumer takes ready buffers after every request,
+ * the way the USB interrupt would, and checks each one is complete when it
+ * is handed over: the right length, every sample in order, and in the dual
+ * modes both converters' halves. It stops taking buffers now and then so
+ * the pool runs dry, and each capture is stopped and restarted once part
+ * way. Every sample converted must then be in a buffer received, in a
+ * buffer dropped and counted as an overrun, or in a partly filled buffer
+ * that a stop discarded.
+ *
+ * adc_sim [buffers]
+ *
+ * Exits nonzero if a check fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "k20sim.h"
+#include "adc.h"
+#include "buffers.h"
+#include "slab.h"
+
+#define DMA_ADDRESS 0x40008000u
+#define DMA ((DMA_MemMapPtr) k20sim_reg(DMA_ADDRESS))
+
+#define RATE 100000
+
+// consumer stalls STALL of every PHASE buffers' worth of periods
+#define PHASE 200
+#define STALL 40
+
+// eDMA transfer control descriptor, as laid out in the channel's registers
+typedef struct {
+  uint32_t saddr;
+  int16_t soff;
+  uint16_t attr;
+  uint32_t nbytes;
+  int32_t slast;
+  uint32_t daddr;
+  int16_t doff;
+  uint16_t citer;
+  int32_t dlastsga;
+  uint16_t csr;
+  uint16_t biter;
+} tcd_t;
+
+void DMA0_IRQHandler(void);
+void DMA1_IRQHandler(void);
+
+static void (*const handlers[2]) (void) = {
+DMA0_IRQHandler, DMA1_IRQHandler};
+
+static int failures = 0;
+static uint32_t dlog_records = 0;
+
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+// adc.c's DLOG() calls land here
+void dlog_write(uint32_t id, const uint32_t * args, uint32_t n)
+{
+  dlog_records++;
+}
+
+/*
+ * adc_plan()
+ */
+
+// Checks one plan; returns nonzero if it is wrong
+static int plan_check(uint32_t rate)
+{
+  uint32_t bus = K20SIM_PERIPH_HZ, achieved, counts, step;
+  uint8_t prescaler;
+  double ideal;
+
+  achieved = adc_plan(rate, &prescaler, &counts);
+  if (rate == 0 || rate > bus || (double) bus / rate > 65536.5 * 128)
+    return achieved != 0;
+  if (achieved == 0 || prescaler > 7 || counts < 1 || counts > 65536)
+    return 1;
+
+  //smallest prescaler: one less would need more than 65536 counts
+  if (prescaler > 0 && (double) bus / ((double) rate * (1 << (prescaler - 1)))
+      < 65536.5)
+    return 1;
+  //nearest period, and the rate it gives
+  ideal = (double) bus / ((double) rate * (1 << prescaler));
+  if (counts < ideal - 0.5 || counts > ideal + 0.5)
+    return 1;
+  step = counts << prescaler;
+  return achieved != (bus + step / 2) / step;
+}
+
+static void plans(void)
+{
+  static const uint32_t rates[] = {1000, 8000, 44100, 48000, 100000, 250000,
+                                   1000000};
+  static const uint32_t edges[] = {0, 1, 5, 6, 732, 733, 23999999, 24000000,
+                                   47999999, 48000000, 48000001, 0xffffffff};
+  uint32_t rate, counts, achieved, bad = 0, tried = 0;
+  uint8_t prescaler;
+  double r;
+  unsigned int i;
+
+  for (r = 1; r < 50e6; r = r * 1.003 + 1, tried++)
+    bad += plan_check(r);
+  for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++, tried++)
+    bad += plan_check(edges[i]);
+
+  printf("%10s %4s %8s %12s %10s\n", "rate", "pre", "counts", "achieved",
+         "error ppm");
+  for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+    rate = rates[i];
+    achieved = adc_plan(rate, &prescaler, &counts);
+    printf("%10u %4u %8u %12u %10.1f\n", rate, prescaler, counts, achieved,
+           ((double) K20SIM_PERIPH_HZ / (counts << prescaler) - rate) * 1e6
+           / rate);
+  }
+  printf("%u of %u plans wrong\n", bad, tried);
+  check("adc_plan", bad == 0);
+}
+
+/*
+ * eDMA model
+ */
+
+static void dma_write(uint32_t addr, uint32_t old, uint32_t value)
+{
+  DMA_MemMapPtr dma = DMA;
+  uint8_t channel = (value >> ((addr & 3) * 8)) & 0x0f;
+
+  switch (addr - DMA_ADDRESS) {
+  case 0x1a:                   //CERQ
+    dma->ERQ &= ~(1 << channel);
+    break;
+  case 0x1b:                   //SERQ
+    dma->ERQ |= 1 << channel;
+    break;
+  case 0x1f:                   //CINT
+    dma->INT &= ~(1 << channel);
+    break;
+  }
+}
+
+static const k20sim_hooks_t dma_hooks = {
+  .read = NULL,
+  .write = dma_write,
+};
+
+static tcd_t *dma_tcd(uint8_t c)
+{
+  return (tcd_t *) & DMA->TCD[ADC_DMA_CHANNEL + c];
+}
+
+// One conversion result from converter c
+static void dma_request(uint8_t c, uint16_t sample)
+{
+  DMA_MemMapPtr dma = DMA;
+  uint8_t channel = ADC_DMA_CHANNEL + c;
+  tcd_t *tcd = dma_tcd(c);
+  uint16_t csr;
+
+  if (!(dma->ERQ & (1 << channel)))
+    return;
+
+  *(uint16_t *) (uintptr_t) tcd->daddr = sample;
+  tcd->daddr += tcd->doff;
+  if (--tcd->citer > 0)
+    return;
+
+  //major loop done
+  csr = tcd->csr;
+  if (csr & DMA_CSR_ESG_MASK) {
+    memcpy(tcd, (void *) (uintptr_t) tcd->dlastsga, sizeof(*tcd));
+  } else {
+    tcd->citer = tcd->biter;
+    tcd->daddr += tcd->dlastsga;
+  }
+  if (csr & DMA_CSR_INTMAJOR_MASK) {
+    dma->INT |= 1 << channel;
+    k20sim_irq(handlers[c]);
+  }
+}
+
+/*
+ * Captures
+ */
+
+// what the consumer has seen
+static struct {
+  uint16_t next[2];             //next sample expected from each converter
+  uint64_t samples;             //per converter
+  uint32_t buffers;
+  uint32_t gaps;
+  uint32_t short_buffers;
+  uint32_t out_of_order;
+  uint32_t unpaired;
+} rx;
+
+static void consume(uint8_t converters)
+{
+  uint16_t *buf;
+  uint16_t length, want, i;
+  uint8_t index, c;
+
+  want = converters == 1 ? BUFFER_LENGTH : ADC_PAIRS * 2;
+  while ((buf = buffers_get_next_ready(&index)) != NULL) {
+    length = buffers_length(index);
+    if (length != want) {
+      rx.short_buffers++;
+    } else {
+      for (i = 0; i < length; i++) {
+        c = i % converters;
+        //samples lost to an overrun or a stop only ever start a buffer
+        if (buf[i] != rx.next[c] && i < converters) {
+          rx.gaps++;
+          rx.next[c] = buf[i];
+        }
+        if (buf[i] != rx.next[c]) {
+          rx.out_of_order++;
+          break;
+        }
+        if (c == 1 && buf[i] != buf[i - 1])
+          rx.unpaired++;
+        rx.next[c]++;
+      }
+      rx.samples += length / converters;
+    }
+    rx.buffers++;
+    buffer_free(index);
+  }
+}
+
+// Samples converter 0 has put in the buffer it is filling
+static uint32_t in_flight(void)
+{
+  tcd_t *tcd = dma_tcd(0);
+
+  return tcd->biter - tcd->citer;
+}
+
+static void capture(const char *name, adc_mode_t mode, uint32_t buffers)
+{
+  static const uint8_t order[3][2] = {
+    [ADC_SINGLE] = {0},
+    [ADC_PAIRED] = {1, 0},      //both at once, and channel 1 has priority
+    [ADC_INTERLEAVED] = {0, 1}, //half a period apart
+  };
+  adc_config_t config = {
+    .mode = mode,
+    .channel = {0, 3},
+    .rate = RATE,
+    .calibrate = 0,
+    .average = 0
+  };
+  uint8_t converters = mode == ADC_SINGLE ? 1 : 2;
+  uint32_t per_buffer = converters == 1 ? BUFFER_LENGTH : ADC_PAIRS;
+  uint64_t period, periods, converted = 0, lost = 0, end;
+  adc_stats_t stats;
+  uint8_t i, c, stalled, dmamux = 1;
+  char what[64];
+
+  memset(&rx, 0, sizeof(rx));
+  dlog_records = 0;
+  buffers_init();
+  adc_stats(&stats);
+
+  if (adc_start(&config) == 0) {
+    check(name, 0);
+    return;
+  }
+  for (c = 0; c < converters; c++)
+    dmamux &= DMAMUX_CHCFG_REG(DMAMUX_BASE_PTR, ADC_DMA_CHANNEL + c) ==
+        (DMAMUX_CHCFG_SOURCE(ADC_DMAMUX_ADC0 + c) | DMAMUX_CHCFG_ENBL_MASK);
+
+  periods = (uint64_t) buffers * per_buffer;
+  for (period = 0; period < periods; period++) {
+    //a stop part way through a buffer discards what is in it
+    if (period == periods / 2 + per_buffer / 3) {
+      lost += in_flight();
+      adc_stop();
+      adc_start(&config);
+    }
+    stalled = (period / per_buffer) % PHASE >= PHASE - STALL;
+    for (i = 0; i < converters; i++) {
+      dma_request(order[mode][i], converted);
+      if (!stalled)
+        consume(converters);
+    }
+    converted++;
+  }
+  end = in_flight();
+  adc_stop();
+  consume(converters);
+  adc_stats(&stats);
+
+  printf("%s: %llu samples per converter, %u buffers received, %u overruns,"
+         " %llu lost to the stop, %llu in flight\n", name,
+         (unsigned long long) converted, rx.buffers, stats.overruns,
+         (unsigned long long) lost, (unsigned long long) end);
+  printf("  %u gaps, %u short, %u out of order, %u unpaired, %u logged\n",
+         rx.gaps, rx.short_buffers, rx.out_of_order, rx.unpaired,
+         dlog_records);
+
+  snprintf(what, sizeof(what), "%s DMA requests routed", name);
+  check(what, dmamux);
+  snprintf(what, sizeof(what), "%s buffers complete when ready", name);
+  check(what, rx.short_buffers == 0 && rx.out_of_order == 0
+        && rx.unpaired == 0 && rx.buffers > 0);
+  snprintf(what, sizeof(what), "%s every sample accounted for", name);
+  check(what, converted == rx.samples + (uint64_t) stats.overruns * per_buffer
+        + lost + end);
+  snprintf(what, sizeof(what), "%s buffers counted", name);
+  check(what, stats.buffers == rx.buffers && stats.overruns > 0
+        && dlog_records == stats.overruns);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t buffers = 1000;
+
+  if (argc > 1)
+    buffers = atoi(argv[1]);
+  if (buffers < 2) {
+    fprintf(stderr, "usage: adc_sim [buffers]\n");
+    return 2;
+  }
+
+  k20sim_init();
+  k20sim_hook(DMA_ADDRESS, &dma_hooks);
+  slab_init();
+
+  plans();
+  capture("single", ADC_SINGLE, buffers);
+  capture("paired", ADC_PAIRED, buffers);
+  capture("interleaved", ADC_INTERLEAVED, buffers);
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
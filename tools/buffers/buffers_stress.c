@@ -0,0 +1,178 @@
+/**
+ * Stress test for the lock-free sample buffer exchange
+ *
+ * buffers.c is written for one producer and one consumer, each either the
+ * main loop or an interrupt handler. Here each side is a thread, so they
+ * really do run at the same time and the ring counters' acquire/release
+ * ordering is all that keeps them apart.
+ *
+ * The producer fills buffers of varying length with a pattern keyed to a
+ * sequence number and sets them ready; the consumer checks every buffer
+ * arrives in order with its length and contents intact, tries to free a
+ * buffer other than the oldest ready one (which must fail and change
+ * nothing), and frees it. With -s, a third thread runs buffers_process()
+ * with a stage that halves each buffer and bumps its samples.
+ *
+ * Threads only overlap for real on more than one core, and x86 keeps stores
+ * in order anyway; a multi-core ARM host is the sharpest test of the
+ * barriers. Anywhere, it catches buffers lost, repeated or handed over
+ * before their contents and length.
+ *
+ * buffers_stress [-s] [buffers]
+ *
+ * Exits nonzero on any lost, reordered or corrupted buffer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "buffers.h"
+#include "slab.h"
+
+#define PATTERN(seq, i) ((uint16_t) ((seq) * 31 + (i)))
+
+static uint32_t count = 1000000;
+static int staged = 0;
+static volatile int done = 0;
+
+static uint32_t bad_length = 0, bad_data = 0, bad_free = 0, misuse = 0;
+
+static uint16_t length_of(uint32_t seq)
+{
+  return 1 + seq % BUFFER_LENGTH;
+}
+
+static uint16_t stage(uint16_t * buf, uint16_t length)
+{
+  uint16_t i;
+
+  length = (length + 1) / 2;
+  for (i = 0; i < length; i++)
+    buf[i]++;
+  return length;
+}
+
+static void *producer(void *arg)
+{
+  uint32_t seq;
+  uint16_t *buf, length, i;
+  uint8_t index;
+
+  for (seq = 0; seq < count; seq++) {
+    while ((buf = buffers_get_next_free(&index)) == NULL)
+      sched_yield();
+    length = length_of(seq);
+    for (i = 0; i < length; i++)
+      buf[i] = PATTERN(seq, i);
+    buffers_set_length(index, length);
+    buffers_set_ready(index);
+  }
+  return NULL;
+}
+
+static void *processor(void *arg)
+{
+  while (!done) {
+    buffers_process();
+    sched_yield();
+  }
+  return NULL;
+}
+
+static void *consumer(void *arg)
+{
+  uint32_t seq;
+  uint16_t *buf, length, i, add = staged;
+  uint8_t index, again;
+
+  for (seq = 0; seq < count; seq++) {
+    while ((buf = buffers_get_next_ready(&index)) == NULL)
+      sched_yield();
+    length = length_of(seq);
+    if (staged)
+      length = (length + 1) / 2;
+    if (buffers_length(index) != length) {
+      bad_length++;
+    } else {
+      for (i = 0; i < length; i++) {
+        if (buf[i] != (uint16_t) (PATTERN(seq, i) + add)) {
+          bad_data++;
+          break;
+        }
+      }
+    }
+
+    //freeing out of order is refused and leaves the ring alone
+    if ((seq & 15) == 0) {
+      misuse++;
+      if (buffer_free(index ^ 1) != -1
+          || buffers_get_next_ready(&again) != buf || again != index)
+        bad_free++;
+    }
+    if (buffer_free(index) != 0)
+      bad_free++;
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  pthread_t threads[3];
+  struct timespec start, end;
+  uint16_t *held[BUFFER_CAPACITY];
+  uint8_t index;
+  uint32_t total, back;
+  double seconds;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s")) != -1) {
+    switch (opt) {
+    case 's':
+      staged = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: buffers_stress [-s] [buffers]\n");
+      return 2;
+    }
+  }
+  if (optind < argc)
+    count = strtoul(argv[optind], NULL, 0);
+
+  slab_init();
+  buffers_init();
+  if (staged)
+    buffers_set_stage(stage);
+
+  //every buffer must come back to the free ring
+  for (total = 0; total < BUFFER_CAPACITY
+       && (held[total] = buffers_get_next_free(&index)) != NULL; total++) ;
+  buffers_init();
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&threads[0], NULL, producer, NULL);
+  pthread_create(&threads[1], NULL, consumer, NULL);
+  if (staged)
+    pthread_create(&threads[2], NULL, processor, NULL);
+  pthread_join(threads[0], NULL);
+  pthread_join(threads[1], NULL);
+  done = 1;
+  if (staged)
+    pthread_join(threads[2], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  for (back = 0; back < BUFFER_CAPACITY
+       && (held[back] = buffers_get_next_free(&index)) != NULL; back++) ;
+
+  printf("%u buffers%s through %u slots in %.2f s (%.0f buffers/s)\n", count,
+         staged ? " staged" : "", total, seconds, count / seconds);
+  printf("bad length %u, bad data %u, bad free %u (of %u out-of-order frees "
+         "refused), %u of %u slots back\n", bad_length, bad_data, bad_free,
+         misuse, back, total);
+
+  return bad_length || bad_data || bad_free || back != total || total == 0;
+}
@@ -0,0 +1,207 @@
+/**
+ * Host-side printer for deferred log records
+ *
+ * Reads the .dlog section (the DLOG() format strings) from the firmware's
+ * .elf, then decodes a telem.h stream from a file, a serial port or stdin
+ * and prints each log record as the text the format string describes.
+ * Records of other types are counted and skipped.
+ *
+ * Arguments arrive as 32-bit words, so length modifiers (%lu, %hd) are
+ * ignored and %s and %p print the raw word.
+ *
+ * usage: dlog_rx firmware.elf [capture-file|/dev/ttyACM0]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <elf.h>
+#include "telem.h"
+#include "dlog.h"
+
+static char *strings;           //the .dlog section
+static uint32_t strings_addr, strings_size;
+static uint32_t others;         //records of other types
+
+// Loads the .dlog section of a 32-bit ELF file; returns 0 or -1
+static int load_strings(const char *path)
+{
+  Elf32_Ehdr eh;
+  Elf32_Shdr *sh;
+  char *names;
+  FILE *f;
+  int i, found = -1;
+
+  f = fopen(path, "rb");
+  if (!f) {
+    perror(path);
+    return -1;
+  }
+  if (fread(&eh, sizeof(eh), 1, f) != 1 || memcmp(eh.e_ident, ELFMAG, SELFMAG)
+      || eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_shstrndx >= eh.e_shnum) {
+    fprintf(stderr, "%s: not a 32-bit ELF file\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  sh = calloc(eh.e_shnum, sizeof(Elf32_Shdr));
+  fseek(f, eh.e_shoff, SEEK_SET);
+  if (fread(sh, sizeof(Elf32_Shdr), eh.e_shnum, f) != eh.e_shnum) {
+    fprintf(stderr, "%s: truncated\n", path);
+    fclose(f);
+    return -1;
+  }
+  names = malloc(sh[eh.e_shstrndx].sh_size);
+  fseek(f, sh[eh.e_shstrndx].sh_offset, SEEK_SET);
+  if (fread(names, 1, sh[eh.e_shstrndx].sh_size, f) !=
+      sh[eh.e_shstrndx].sh_size) {
+    fprintf(stderr, "%s: truncated\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  for (i = 0; i < eh.e_shnum; i++)
+    if (sh[i].sh_name < sh[eh.e_shstrndx].sh_size
+        && !strcmp(names + sh[i].sh_name, ".dlog"))
+      found = i;
+  if (found < 0) {
+    fprintf(stderr, "%s: no .dlog section (no DLOG() calls linked in?)\n",
+            path);
+    fclose(f);
+    return -1;
+  }
+
+  strings_addr = sh[found].sh_addr;
+  strings_size = sh[found].sh_size;
+  strings = malloc(strings_size + 1);
+  fseek(f, sh[found].sh_offset, SEEK_SET);
+  if (fread(strings, 1, strings_size, f) != strings_size) {
+    fprintf(stderr, "%s: truncated\n", path);
+    fclose(f);
+    return -1;
+  }
+  strings[strings_size] = 0;
+
+  free(names);
+  free(sh);
+  fclose(f);
+  return 0;
+}
+
+// printf with fmt, taking each conversion's argument from the n words
+static void print_log(const char *fmt, const uint32_t * args, uint32_t n)
+{
+  char spec[32];
+  uint32_t a = 0;
+  size_t len;
+  int i;
+
+  while (*fmt) {
+    if (*fmt != '%') {
+      putchar(*fmt++);
+      continue;
+    }
+    fmt++;
+    if (*fmt == '%') {
+      putchar(*fmt++);
+      continue;
+    }
+
+    //flags, width and precision are kept; a * takes an argument
+    spec[0] = '%';
+    len = 1;
+    while (*fmt && strchr("-+ #0123456789.*", *fmt)) {
+      if (*fmt == '*')
+        len += snprintf(spec + len, sizeof(spec) - len - 2, "%d",
+                        (int32_t) (a < n ? args[a++] : 0));
+      else if (len < sizeof(spec) - 3)
+        spec[len++] = *fmt;
+      fmt++;
+    }
+    while (*fmt && strchr("hlLqjzt", *fmt))
+      fmt++;
+    if (!*fmt)
+      break;
+
+    spec[len + 1] = 0;
+    if (a >= n) {
+      printf("<missing>");
+    } else if (*fmt == 'd' || *fmt == 'i') {
+      spec[len] = *fmt;
+      printf(spec, (int32_t) args[a++]);
+    } else if (strchr("ouxXc", *fmt)) {
+      spec[len] = *fmt;
+      printf(spec, args[a++]);
+    } else {
+      printf("<0x%08x>", args[a++]);    //%s, %p and anything else
+    }
+    fmt++;
+  }
+  for (i = a; i < (int) n; i++)
+    printf(" <extra 0x%08x>", args[i]);
+  putchar('\n');
+}
+
+static void record(void *ctx, uint8_t type, const uint8_t * data, uint32_t len)
+{
+  uint32_t args[DLOG_MAX_ARGS];
+  uint32_t w, id, n, i;
+
+  if (type != DLOG_RECORD) {
+    others++;
+    return;
+  }
+
+  for (w = 0; w + 4 <= len; w += 4 * (n + 1)) {
+    id = telem_get32(data + w) & DLOG_ID_MASK;
+    n = (telem_get32(data + w) >> DLOG_NARGS_SHIFT) & DLOG_NARGS_MASK;
+    if (w + 4 * (n + 1) > len) {
+      printf("dlog: truncated record\n");
+      return;
+    }
+    for (i = 0; i < n; i++)
+      args[i] = telem_get32(data + w + 4 * (i + 1));
+
+    if (id == 0 && n == 1)
+      printf("dlog: %u records dropped\n", args[0]);
+    else if (id < strings_addr || id >= strings_addr + strings_size)
+      printf("dlog: unknown id 0x%04x (firmware and .elf differ?)\n", id);
+    else
+      print_log(strings + id - strings_addr, args, n);
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+  uint8_t buf[4096];
+  telem_rx_t rx;
+  telem_rx_stats_t rs;
+  ssize_t got;
+  int fd = 0;
+
+  if (argc < 2) {
+    fprintf(stderr, "usage: dlog_rx firmware.elf [capture-file|tty]\n");
+    return 1;
+  }
+  if (load_strings(argv[1]))
+    return 1;
+  if (argc > 2) {
+    fd = open(argv[2], O_RDONLY);
+    if (fd < 0) {
+      perror(argv[2]);
+      return 1;
+    }
+  }
+
+  telem_rx_init(&rx, record, NULL);
+  while ((got = read(fd, buf, sizeof(buf))) > 0)
+    telem_rx_put(&rx, buf, got);
+
+  telem_rx_stats(&rx, &rs);
+  fprintf(stderr, "%u frames, %u lost, %u bad CRC, %u malformed; %u other "
+          "records\n", rs.frames, rs.lost, rs.crc, rs.bad, others);
+  return 0;
+}
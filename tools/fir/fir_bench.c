@@ -0,0 +1,167 @@
+/**
+ * Host-side check and benchmark for the FIR/decimate stage
+ *
+ * fir.c is built with FIR_EMULATE_DSP, so fir_decimate() takes the same
+ * SMLAD/SSAT path as on the M4, with C models of the two instructions, and
+ * fir_decimate_ref() stays plain C. Random filters (any tap count, any
+ * decimation, coefficients from gentle to full scale so the accumulator
+ * wraps and the output saturates) run over random input split into random
+ * block lengths. Both paths must agree bit for bit with each other and
+ * with a direct convolution of the whole stream.
+ *
+ * Then times both paths on device-sized buffers. These are host numbers,
+ * good for comparing changes, not for M4 cycle counts.
+ *
+ * usage: fir_bench [trials]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fir.h"
+
+#define BUFFER_LENGTH 1023      //samples per device buffer, see buffers.h
+#define MAX_STREAM    8192
+#define PASSES        2000
+
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The whole stream at once, straight from the definition in fir.h
+static uint32_t direct(const int16_t * h, uint32_t taps, uint32_t decimate,
+                       const int16_t * x, uint32_t length, int16_t * y)
+{
+  uint32_t i, k, out = 0, acc;
+  int32_t v;
+
+  for (i = 0; i < length; i += decimate) {
+    acc = 1 << 14;
+    for (k = 0; k < taps && k <= i; k++)
+      acc += (uint32_t) ((int32_t) h[k] * x[i - k]);
+    v = (int32_t) acc >> 15;
+    y[out++] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+  }
+  return out;
+}
+
+// One random filter over one random stream; returns nonzero on a mismatch
+static int trial(void)
+{
+  static int16_t x[MAX_STREAM], dsp[MAX_STREAM], ref[MAX_STREAM],
+      want[MAX_STREAM];
+  int16_t h[FIR_MAX_TAPS];
+  fir_t a, b;
+  uint32_t taps, decimate, length, scale, block, in, n_dsp = 0, n_ref = 0,
+      n_want, i;
+
+  taps = 1 + rnd() % FIR_MAX_TAPS;
+  decimate = rnd() % 8 ? 1 + rnd() % 16 : 1 + rnd() % 255;
+  length = 1 + rnd() % MAX_STREAM;
+
+  //gentle, unity-ish gain, or anything at all
+  scale = rnd() % 3 == 0 ? 65536 : 2 * 32768 / taps;
+  for (i = 0; i < taps; i++)
+    h[i] = (int32_t) (rnd() % scale) - (int32_t) scale / 2;
+  for (i = 0; i < length; i++) {
+    if (rnd() % 5 == 0)
+      x[i] = rnd() & 1 ? 32767 : -32768;
+    else
+      x[i] = rnd();
+  }
+
+  if (fir_init(&a, h, taps, decimate) || fir_init(&b, h, taps, decimate))
+    return 1;
+
+  //the same blocks through both, each filtered in place
+  for (in = 0; in < length; in += block) {
+    block = rnd() % 4 == 0 ? 1 + rnd() % 8 : 1 + rnd() % 1500;
+    if (block > length - in)
+      block = length - in;
+    memcpy(dsp + n_dsp, x + in, block * sizeof(int16_t));
+    n_dsp += fir_decimate(&a, dsp + n_dsp, block);
+    memcpy(ref + n_ref, x + in, block * sizeof(int16_t));
+    n_ref += fir_decimate_ref(&b, ref + n_ref, block);
+  }
+
+  n_want = direct(h, taps, decimate, x, length, want);
+  if (n_dsp != n_want || n_ref != n_want
+      || memcmp(dsp, want, n_want * sizeof(int16_t))
+      || memcmp(ref, want, n_want * sizeof(int16_t))) {
+    printf("mismatch: %u taps, decimate %u, %u samples: %u/%u/%u outputs\n",
+           taps, decimate, length, n_dsp, n_ref, n_want);
+    return 1;
+  }
+  return 0;
+}
+
+// Returns the host Msamples/s of one path on device buffers
+static double speed(uint32_t (*run) (fir_t *, int16_t *, uint32_t),
+                    uint32_t taps, uint32_t decimate)
+{
+  static int16_t x[BUFFER_LENGTH], buf[BUFFER_LENGTH];
+  int16_t h[FIR_MAX_TAPS];
+  fir_t fir;
+  uint32_t i;
+  double t0;
+
+  for (i = 0; i < taps; i++)
+    h[i] = 32768 / taps;
+  for (i = 0; i < BUFFER_LENGTH; i++)
+    x[i] = rnd() % 4096;
+  fir_init(&fir, h, taps, decimate);
+
+  t0 = now();
+  for (i = 0; i < PASSES; i++) {
+    memcpy(buf, x, sizeof(buf));
+    run(&fir, buf, BUFFER_LENGTH);
+  }
+  return (double) BUFFER_LENGTH * PASSES / (now() - t0) / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+  static const uint32_t configs[][2] = {{8, 1}, {16, 2}, {31, 4}, {32, 4},
+                                        {32, 8}};
+  int16_t h[FIR_MAX_TAPS] = {0};
+  fir_t fir;
+  uint32_t trials = 20000, t, bad = 0, i;
+
+  if (argc > 1)
+    trials = atoi(argv[1]);
+
+  //out of range settings are refused
+  if (fir_init(&fir, h, 0, 1) != -1 || fir_init(&fir, h, FIR_MAX_TAPS + 1, 1)
+      != -1 || fir_init(&fir, h, 1, 0) != -1 || fir_init(&fir, h, 1, 256) != -1) {
+    printf("fir_init accepts bad settings\n");
+    bad++;
+  }
+
+  for (t = 0; t < trials; t++)
+    bad += trial();
+  printf("%u random filters: %u mismatches\n", trials, bad);
+
+  printf("%5s %9s %16s %16s\n", "taps", "decimate", "SMLAD Msamples/s",
+         "C Msamples/s");
+  for (i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+    printf("%5u %9u %16.1f %16.1f\n", configs[i][0], configs[i][1],
+           speed(fir_decimate, configs[i][0], configs[i][1]),
+           speed(fir_decimate_ref, configs[i][0], configs[i][1]));
+
+  return bad ? 2 : 0;
+}
@@ -0,0 +1,26 @@
+/**
+ * Host build of arm_cm4.h for firmware run under k20sim
+ *
+ * Everything comes from the real header except the interrupt mask macros,
+ * which drive and read the simulated PRIMASK instead of CPSIE/CPSID/MRS,
+ * and the firmware's main() prototype, which would clash with the host
+ * program's.
+ */
+#ifndef _K20SIM_ARM_CM4_H_
+#define _K20SIM_ARM_CM4_H_
+
+#define main k20sim_firmware_main
+#include_next "arm_cm4.h"
+#undef main
+#include "k20sim.h"
+
+#undef EnableInterrupts
+#undef DisableInterrupts
+#undef InterruptsBlocked
+#undef InterruptsDisabled
+#define EnableInterrupts k20sim_cpsie();
+#define DisableInterrupts k20sim_cpsid();
+#define InterruptsBlocked() k20sim_masked()
+#define InterruptsDisabled() k20sim_primask()
+
+#endif                          // _K20SIM_ARM_CM4_H_
@@ -0,0 +1,362 @@
+/**
+ * Host-side model of the parts of the K20 that firmware talks to directly
+ *
+ * See k20sim.h. A store to a hooked page raises SIGSEGV; the handler makes
+ * the page writable and sets the trap flag, so the store runs and SIGTRAP
+ * follows one instruction later. The SIGTRAP handler then calls the write
+ * hook and protects the page again. SIGALRM is held off in between so a
+ * ticker cannot run a model (and an interrupt handler) half way through a
+ * firmware register access.
+ */
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "k20sim.h"
+#include "arm_cm4.h"
+
+#define PAGE_SIZE 4096
+#define EFLAGS_TF 0x100
+
+#define N_REGIONS 2
+#define REGION_SIZE 0x100000
+#define REGION_PAGES (REGION_SIZE / PAGE_SIZE)
+
+// peripheral space, private peripheral bus
+static const uint32_t region_base[N_REGIONS] = {0x40000000, 0xe0000000};
+static uint8_t *region_alias[N_REGIONS];
+static const k20sim_hooks_t *region_hooks[N_REGIONS][REGION_PAGES];
+
+// the register access being single-stepped
+static struct {
+  uint8_t *page;                //NULL when no access is pending
+  uint32_t addr;
+  uint32_t old;
+  int write;
+  int alarm_blocked;            //SIGALRM was already blocked before the trap
+  const k20sim_hooks_t *hooks;
+} step;
+
+static volatile int counting = 0;
+static volatile uint64_t counted;
+static uint64_t count_overhead;
+
+#define N_IRQS 8
+static void (*volatile irq_handlers[N_IRQS]) (void);
+static volatile sig_atomic_t irq_pending[N_IRQS];
+static volatile sig_atomic_t primask = 0;
+static volatile sig_atomic_t active = 0;   //a handler is running
+
+static void (*ticker) (void);
+
+static volatile uint64_t now;
+
+// what sysinit.c would have measured
+int32_t mcg_clk_hz = K20SIM_CORE_HZ;
+int32_t mcg_clk_khz = K20SIM_CORE_HZ / 1000;
+int32_t core_clk_khz = K20SIM_CORE_HZ / 1000;
+int32_t periph_clk_khz = K20SIM_PERIPH_HZ / 1000;
+
+/*
+ * Register traps
+ */
+
+static int k20sim_region(uintptr_t addr)
+{
+  int i;
+
+  for (i = 0; i < N_REGIONS; i++) {
+    if (addr >= region_base[i] && addr < region_base[i] + REGION_SIZE)
+      return i;
+  }
+  return -1;
+}
+
+static int k20sim_protection(const k20sim_hooks_t * hooks)
+{
+  if (hooks == NULL)
+    return PROT_READ | PROT_WRITE;
+  return hooks->read ? PROT_NONE : PROT_READ;
+}
+
+static void k20sim_segv(int sig, siginfo_t * info, void *context)
+{
+  ucontext_t *uc = context;
+  uintptr_t addr = (uintptr_t) info->si_addr;
+  int region = k20sim_region(addr);
+  const k20sim_hooks_t *hooks;
+
+  if (region < 0 || step.page != NULL) {
+    //a real fault, let it kill us
+    signal(SIGSEGV, SIG_DFL);
+    return;
+  }
+
+  hooks = region_hooks[region][(addr - region_base[region]) / PAGE_SIZE];
+  step.page = (uint8_t *) (addr & ~(uintptr_t) (PAGE_SIZE - 1));
+  step.addr = addr;
+  step.hooks = hooks;
+  step.write = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+  if (!step.write && hooks->read)
+    hooks->read(addr);
+  step.old = K20SIM_REG32(addr & ~3u);
+
+  mprotect(step.page, PAGE_SIZE, PROT_READ | PROT_WRITE);
+  uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+  step.alarm_blocked = sigismember(&uc->uc_sigmask, SIGALRM);
+  sigaddset(&uc->uc_sigmask, SIGALRM);
+}
+
+static void k20sim_trap(int sig, siginfo_t * info, void *context)
+{
+  ucontext_t *uc = context;
+  uint32_t value;
+  uint8_t *page = step.page;
+
+  if (page != NULL) {
+    value = K20SIM_REG32(step.addr & ~3u);
+    //a read-modify-write instruction may have faulted on its read
+    if ((step.write || value != step.old) && step.hooks->write)
+      step.hooks->write(step.addr, step.old, value);
+    mprotect(page, PAGE_SIZE, k20sim_protection(step.hooks));
+    if (!step.alarm_blocked)
+      sigdelset(&uc->uc_sigmask, SIGALRM);
+    step.page = NULL;
+  }
+
+  if (counting) {
+    counted++;
+    uc->uc_mcontext.gregs[REG_EFL] |= EFLAGS_TF;
+  } else {
+    uc->uc_mcontext.gregs[REG_EFL] &= ~EFLAGS_TF;
+  }
+}
+
+/*
+ * Cycle counter
+ */
+
+static void k20sim_dwt_read(uint32_t addr)
+{
+  K20SIM_REG32((uint32_t) (uintptr_t) & DWT_CYCCNT) = (uint32_t) now;
+}
+
+static const k20sim_hooks_t dwt_hooks = {
+  .read = k20sim_dwt_read,
+  .write = NULL,
+};
+
+void k20sim_init(void)
+{
+  struct sigaction sa;
+  uint8_t *real;
+  int fd, i;
+
+  fd = memfd_create("k20sim", 0);
+  if (fd < 0 || ftruncate(fd, N_REGIONS * REGION_SIZE) < 0) {
+    perror("k20sim: memfd");
+    exit(1);
+  }
+  for (i = 0; i < N_REGIONS; i++) {
+    real = mmap((void *) (uintptr_t) region_base[i], REGION_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE, fd,
+                i * REGION_SIZE);
+    region_alias[i] = mmap(NULL, REGION_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, i * REGION_SIZE);
+    if (real != (void *) (uintptr_t) region_base[i]
+        || region_alias[i] == MAP_FAILED) {
+      fprintf(stderr, "k20sim: cannot map 0x%08x\n", region_base[i]);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  sigemptyset(&sa.sa_mask);
+  sa.sa_sigaction = k20sim_segv;
+  sigaction(SIGSEGV, &sa, NULL);
+  sa.sa_sigaction = k20sim_trap;
+  sigaction(SIGTRAP, &sa, NULL);
+
+  k20sim_hook((uint32_t) (uintptr_t) & DWT_CYCCNT, &dwt_hooks);
+
+  //what an empty start/stop pair costs
+  k20sim_count_start();
+  count_overhead = k20sim_count_stop();
+}
+
+void k20sim_hook(uint32_t addr, const k20sim_hooks_t * hooks)
+{
+  int region = k20sim_region(addr);
+  uint32_t page;
+
+  if (region < 0)
+    return;
+  page = (addr - region_base[region]) / PAGE_SIZE;
+  region_hooks[region][page] = hooks;
+  mprotect((void *) (uintptr_t) (region_base[region] + page * PAGE_SIZE),
+           PAGE_SIZE, k20sim_protection(hooks));
+}
+
+volatile void *k20sim_reg(uint32_t addr)
+{
+  int region = k20sim_region(addr);
+
+  if (region < 0)
+    return NULL;
+  return region_alias[region] + (addr - region_base[region]);
+}
+
+/*
+ * Interrupts
+ */
+
+// Runs pending handlers, highest slot last, while nothing masks them
+static void k20sim_dispatch(void)
+{
+  int i, again;
+
+  if (primask || active)
+    return;
+  active = 1;
+  do {
+    again = 0;
+    for (i = 0; i < N_IRQS && irq_handlers[i]; i++) {
+      if (irq_pending[i]) {
+        irq_pending[i] = 0;
+        irq_handlers[i] ();
+        again = 1;
+      }
+    }
+  } while (again);
+  active = 0;
+}
+
+void k20sim_cpsid(void)
+{
+  primask = 1;
+}
+
+void k20sim_cpsie(void)
+{
+  primask = 0;
+  k20sim_dispatch();
+}
+
+int k20sim_masked(void)
+{
+  return primask || active;
+}
+
+int k20sim_primask(void)
+{
+  return primask;
+}
+
+void k20sim_irq(void (*handler) (void))
+{
+  void (*none) (void) = NULL;
+  int i;
+
+  for (i = 0; i < N_IRQS; i++) {
+    if (irq_handlers[i] == handler
+        || __atomic_compare_exchange_n(&irq_handlers[i], &none, handler, 0,
+                                       __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+      break;
+    none = NULL;
+  }
+  if (i == N_IRQS)
+    abort();
+  irq_pending[i] = 1;
+  k20sim_dispatch();
+}
+
+static uint32_t ticker_period;
+
+static void k20sim_arm(uint32_t period_us)
+{
+  struct itimerval it;
+
+  memset(&it, 0, sizeof(it));
+  it.it_value.tv_usec = period_us % 1000000;
+  it.it_value.tv_sec = period_us / 1000000;
+  setitimer(ITIMER_REAL, &it, NULL);
+}
+
+static void k20sim_alarm(int sig)
+{
+  if (ticker == NULL)
+    return;
+  ticker();
+  //one shot at a time, so a slow tick cannot starve the firmware
+  if (ticker_period)
+    k20sim_arm(ticker_period);
+}
+
+void k20sim_ticker(void (*tick) (void), uint32_t period_us)
+{
+  ticker_period = 0;
+  k20sim_arm(0);
+  ticker = tick;
+  if (period_us == 0)
+    return;
+
+  signal(SIGALRM, k20sim_alarm);
+  ticker_period = period_us;
+  k20sim_arm(period_us);
+}
+
+/*
+ * Time
+ */
+
+uint64_t k20sim_now(void)
+{
+  return now;
+}
+
+void k20sim_advance(uint64_t cycles)
+{
+  now += cycles;
+}
+
+/*
+ * Instruction counting
+ */
+
+void k20sim_count_start(void)
+{
+  counted = 0;
+  counting = 1;
+  asm volatile ("pushfq; orq %0, (%%rsp); popfq"::"i" (EFLAGS_TF):"memory", "cc");
+}
+
+uint64_t k20sim_count_stop(void)
+{
+  asm volatile ("pushfq; andq %0, (%%rsp); popfq"::"i" (~EFLAGS_TF):"memory", "cc");
+  counting = 0;
+  return counted > count_overhead ? counted - count_overhead : 0;
+}
+
+/*
+ * arm_cm4.c stand-ins; the NVIC is not modelled
+ */
+
+void enable_irq(int irq)
+{
+}
+
+void disable_irq(int irq)
+{
+}
+
+void set_irq_priority(int irq, int prio)
+{
+}
@@ -0,0 +1,119 @@
+/**
+ * Host-side model of the parts of the K20 that firmware talks to directly
+ *
+ * Firmware sources are compiled for the host unchanged. The peripheral space
+ * (0x40000000-0x400fffff) and the private peripheral bus (0xe0000000-
+ * 0xe00fffff) are mapped at their real addresses, so the mk20d7.h register
+ * macros work as they are. Plain registers are plain memory. A peripheral
+ * model hooks the 4 KB pages whose registers have side effects: writes to a
+ * hooked page trap, the store is single-stepped, and the model's write hook
+ * sees the old and new contents of the register word (so write-1-to-clear
+ * flags and FIFO pushes can be applied). A read hook, if given, runs before
+ * every read of the page.
+ *
+ * Interrupts are modelled with a simulated PRIMASK: include/arm_cm4.h in this
+ * folder routes EnableInterrupts/DisableInterrupts to k20sim_cpsie() and
+ * k20sim_cpsid(), and a model raises an interrupt with k20sim_irq(), which
+ * runs the handler at once or when the mask is lifted.
+ *
+ * Time is simulated too: DWT_CYCCNT reads return k20sim_now(), which only
+ * moves when a model calls k20sim_advance().
+ *
+ * x86-64 Linux only.
+ */
+#ifndef _K20SIM_H_
+#define _K20SIM_H_
+
+#include <stdint.h>
+
+// clocks the firmware sees (sysinit.c values for the Teensy 3.1)
+#define K20SIM_CORE_HZ   96000000u
+#define K20SIM_PERIPH_HZ 48000000u
+
+typedef struct {
+  /** Called before the firmware reads from the page; may update registers */
+  void (*read) (uint32_t addr);
+  /**
+   * Called after the firmware wrote to the page, with the aligned 32-bit
+   * word holding addr before and after the store. The model puts the
+   * register's real new contents back with k20sim_reg().
+   */
+  void (*write) (uint32_t addr, uint32_t old, uint32_t value);
+} k20sim_hooks_t;
+
+/**
+ * Maps the peripheral space and installs the trap handlers. Call before any
+ * firmware code runs.
+ */
+void k20sim_init(void);
+
+/**
+ * Hooks the 4 KB page holding addr
+ */
+void k20sim_hook(uint32_t addr, const k20sim_hooks_t * hooks);
+
+/**
+ * The simulator's own view of a register, which never traps
+ */
+volatile void *k20sim_reg(uint32_t addr);
+
+#define K20SIM_REG8(addr)  (*(volatile uint8_t *) k20sim_reg(addr))
+#define K20SIM_REG32(addr) (*(volatile uint32_t *) k20sim_reg(addr))
+
+/*
+ * Interrupts
+ */
+
+void k20sim_cpsid(void);
+void k20sim_cpsie(void);
+
+/**
+ * Nonzero while the firmware has interrupts disabled, or while a handler
+ * runs
+ */
+int k20sim_masked(void);
+
+/**
+ * Nonzero while the firmware has interrupts disabled (PRIMASK alone)
+ */
+int k20sim_primask(void);
+
+/**
+ * Raises an interrupt: the handler runs now if interrupts are enabled and no
+ * handler is running, else as soon as that changes. Safe from signal
+ * handlers.
+ */
+void k20sim_irq(void (*handler) (void));
+
+/**
+ * Calls tick from SIGALRM, period_us of host time after the previous call
+ * returned, until stopped with a period of zero. Models use this for
+ * hardware that runs while firmware waits in a loop; however long a tick
+ * takes, the firmware gets period_us to run before the next.
+ */
+void k20sim_ticker(void (*tick) (void), uint32_t period_us);
+
+/*
+ * Time
+ */
+
+/**
+ * Simulated core clock cycles since k20sim_init()
+ */
+uint64_t k20sim_now(void);
+
+void k20sim_advance(uint64_t cycles);
+
+/*
+ * Instruction counting
+ *
+ * Single-steps the calling thread and counts host instructions until
+ * k20sim_count_stop(). This is slow (a trap per instruction) but exact and
+ * repeatable, so it suits regression checks on short paths such as an
+ * interrupt handler. The counts are for the host build of the firmware, so
+ * compare them with each other, not with Cortex-M4 cycles.
+ */
+void k20sim_count_start(void);
+uint64_t k20sim_count_stop(void);
+
+#endif                          // _K20SIM_H_
@@ -0,0 +1,502 @@
+/**
+ * Host-side check of rdp_compile() and rdp_eval() against rdp()
+ *
+ * Random expressions are built from the grammar rdp.h gives, with decimal,
+ * hex, binary and quoted char numbers and variables, in random spacing. As
+ * each one is built its value is worked out as the part does it (32-bit wrap,
+ * a divisor of 0 leaving the left side), along with the ops, numbers and
+ * stack depth its program needs. rdp() must give that value, or RDP_DIVIDE_0,
+ * with each variable written in as a number; rdp_compile() must give
+ * RDP_TOO_LONG exactly when the program would not fit an rdp_code_t, and
+ * rdp_eval() must then agree with rdp().
+ *
+ * Some expressions get junk after them: a number, or a second % or ** (each
+ * is taken once, not chained). rdp() stops before it and gives the value so
+ * far; rdp_compile() must refuse it with RDP_SYNTAX. Fixed cases check the
+ * same at each of the limits.
+ *
+ * usage: rdp_check [expressions]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rdp.h"
+
+#define VARS     "uvw"
+#define MAX_TEXT 8192
+
+typedef struct {
+  int32_t value;        // as rdp() works it out
+  uint32_t ops, lits, depth;    // what its program needs
+} term_t;
+
+static uint32_t seed = 1;
+static int failures = 0;
+
+// The expression as rdp_compile() gets it, and with the variables' values
+static char src[MAX_TEXT], sub[MAX_TEXT];
+static size_t src_len, sub_len;
+static int32_t vals[sizeof(VARS) - 1];
+static int budget, nesting, div0, hazard;
+
+static uint32_t rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void check(const char *what, int ok)
+{
+  printf("%-44s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+static void emit2(const char *s, const char *t)
+{
+  static const char *const spaces[] = {"", "", " ", "\t", "  "};
+  const char *space = spaces[rnd() % 5];
+
+  src_len += snprintf(src + src_len, MAX_TEXT - src_len, "%s%s", space, s);
+  sub_len += snprintf(sub + sub_len, MAX_TEXT - sub_len, "%s%s", space, t);
+}
+
+static void emit(const char *s)
+{
+  emit2(s, s);
+}
+
+// Mostly small numbers, so divisors of 0 and -1 turn up
+static int32_t number(void)
+{
+  switch (rnd() % 4) {
+  case 0:
+  case 1:
+    return rnd() % 10;
+  case 2:
+    return rnd() % 256;
+  }
+  return rnd();
+}
+
+static int32_t power(int32_t base, int32_t exp)
+{
+  uint32_t r = base;
+
+  if (exp <= 1)
+    return base;
+  // repeated multiply, as the original rdp_pow(), while that is quick
+  if (exp < 65536) {
+    while (--exp)
+      r *= (uint32_t) base;
+    return r;
+  }
+  for (r = 1; exp; exp >>= 1, base = (uint32_t) base * base)
+    if (exp & 1)
+      r *= (uint32_t) base;
+  return r;
+}
+
+static int32_t apply(char op, int32_t a, int32_t b)
+{
+  switch (op) {
+  case '&':
+    return a & b;
+  case '|':
+    return a | b;
+  case '^':
+    return a ^ b;
+  case '+':
+    return (uint32_t) a + b;
+  case '-':
+    return (uint32_t) a - b;
+  case '*':
+    return (uint32_t) a * b;
+  case 'p':
+    return power(a, b);
+  }
+  if (b == 0) {
+    div0 = 1;
+    return a;
+  }
+  // SDIV gives INT32_MIN, but the host traps
+  if (a == INT32_MIN && b == -1) {
+    hazard = 1;
+    return a;
+  }
+  return op == '/' ? a / b : a % b;
+}
+
+static term_t binary(char op, term_t a, term_t b)
+{
+  a.value = apply(op, a.value, b.value);
+  a.ops += b.ops + 1;
+  a.lits += b.lits;
+  if (b.depth + 1 > a.depth)
+    a.depth = b.depth + 1;
+  return a;
+}
+
+static term_t bitwise(void);
+
+static term_t atom(void)
+{
+  term_t t = {0, 1, 1, 1};
+  char s[48], v[16];
+  int n;
+
+  budget--;
+  switch (rnd() % 6) {
+  case 0:
+  case 1:
+    n = rnd() % (sizeof(vals) / sizeof(vals[0]));
+    snprintf(s, sizeof(s), "%c", VARS[n]);
+    snprintf(v, sizeof(v), "0x%x", (uint32_t) vals[n]);
+    emit2(s, v);
+    t.value = vals[n];
+    t.lits = 0;
+    return t;
+  case 2:
+    t.value = number();
+    snprintf(s, sizeof(s), "0%c%x", rnd() % 2 ? 'x' : 'X', (uint32_t) t.value);
+    break;
+  case 3:
+    t.value = number();
+    strcpy(s, "0b");
+    for (n = 31; n > 0 && !(t.value >> n & 1); n--) ;
+    for (; n >= 0; n--)
+      strcat(s, t.value >> n & 1 ? "1" : "0");
+    break;
+  case 4:
+    do
+      t.value = ' ' + rnd() % 95;
+    while (t.value == '\'');
+    snprintf(s, sizeof(s), "'%c'", t.value);
+    break;
+  default:
+    t.value = number() & INT32_MAX;
+    snprintf(s, sizeof(s), "%d", t.value);
+    break;
+  }
+  emit(s);
+  return t;
+}
+
+static term_t group(void)
+{
+  term_t t;
+
+  if (budget > 1 && nesting < 40 && rnd() % 4 == 0) {
+    emit("(");
+    nesting++;
+    t = bitwise();
+    nesting--;
+    emit(")");
+    return t;
+  }
+  return atom();
+}
+
+static term_t unary_term(void)
+{
+  static const char unary[] = "+-~";
+  char op[2] = {0, 0};
+  term_t t;
+
+  if (rnd() % 5 == 0) {
+    op[0] = unary[rnd() % 3];
+    emit(op);
+  }
+  t = group();
+  if (op[0] == '-') {
+    t.value = -(uint32_t) t.value;
+    t.ops++;
+  } else if (op[0] == '~') {
+    t.value = ~t.value;
+    t.ops++;
+  }
+  return t;
+}
+
+static term_t exponent(void)
+{
+  term_t t = unary_term();
+
+  if (budget > 0 && rnd() % 6 == 0) {
+    emit("**");
+    t = binary('p', t, unary_term());
+  }
+  return t;
+}
+
+static term_t product(void)
+{
+  term_t t = exponent();
+  char op[2] = {0, 0};
+
+  while (budget > 0 && rnd() % 3 == 0) {
+    op[0] = rnd() % 2 ? '*' : '/';
+    emit(op);
+    t = binary(op[0], t, exponent());
+  }
+  return t;
+}
+
+static term_t modulus(void)
+{
+  term_t t = product();
+
+  if (budget > 0 && rnd() % 5 == 0) {
+    emit("%");
+    t = binary('%', t, product());
+  }
+  return t;
+}
+
+static term_t sum(void)
+{
+  term_t t = modulus();
+  char op[2] = {0, 0};
+
+  while (budget > 0 && rnd() % 2 == 0) {
+    op[0] = rnd() % 2 ? '+' : '-';
+    emit(op);
+    t = binary(op[0], t, modulus());
+  }
+  return t;
+}
+
+static term_t bitwise(void)
+{
+  static const char ops[] = "&|^";
+  term_t t = sum();
+  char op[2] = {0, 0};
+
+  while (budget > 0 && rnd() % 3 == 0) {
+    op[0] = ops[rnd() % 3];
+    emit(op);
+    t = binary(op[0], t, sum());
+  }
+  return t;
+}
+
+/*
+ * A random expression, perhaps with junk after it; sets what rdp() and
+ * rdp_compile() should return
+ */
+static term_t expression(uint32_t * want_rdp, uint32_t * want_compile,
+                         int *junk)
+{
+  term_t t;
+  int kind = rnd() % 8;
+
+  src_len = sub_len = 0;
+  div0 = hazard = nesting = 0;
+  budget = 1 + rnd() % 40;
+  *junk = kind < 3;
+  if (kind == 1 || kind == 2)
+    emit("(");
+  t = bitwise();
+  switch (kind) {
+  case 0:
+    emit(" ");
+    atom();
+    break;
+  case 1:
+    emit(")");
+    emit("%");
+    budget = 1;
+    t = binary('%', t, product());
+    emit("%");
+    atom();
+    break;
+  case 2:
+    emit(")");
+    emit("**");
+    budget = 1;
+    t = binary('p', t, unary_term());
+    emit("**");
+    atom();
+    break;
+  }
+  *want_rdp = div0 ? RDP_DIVIDE_0 : RDP_OK;
+  if (t.ops > RDP_MAX_OPS || t.lits > RDP_MAX_LITS || t.depth > RDP_MAX_STACK)
+    *want_compile = RDP_TOO_LONG;
+  else
+    *want_compile = *junk ? RDP_SYNTAX : RDP_OK;
+  return t;
+}
+
+// One random expression; returns nonzero on a mismatch
+static int trial(uint32_t * counts)
+{
+  rdp_code_t code;
+  term_t t;
+  uint32_t want_rdp, want_compile, got_rdp, got_compile, got_eval = RDP_OK;
+  int32_t rdp_answer = 0, eval_answer = 0;
+  char text[MAX_TEXT];
+  unsigned int i;
+  int junk;
+
+  for (i = 0; i < sizeof(vals) / sizeof(vals[0]); i++)
+    vals[i] = number();
+  t = expression(&want_rdp, &want_compile, &junk);
+  if (hazard) {
+    counts[4]++;
+    return 0;
+  }
+
+  strcpy(text, sub);
+  got_rdp = rdp(text, &rdp_answer);
+  strcpy(text, src);
+  got_compile = rdp_compile(text, VARS, &code);
+  if (got_compile == RDP_OK)
+    got_eval = rdp_eval(&code, vals, &eval_answer);
+
+  if (got_rdp != want_rdp || (got_rdp == RDP_OK && rdp_answer != t.value)
+      || got_compile != want_compile
+      || (got_compile == RDP_OK
+          && (code.ops != t.ops || code.lits != t.lits
+              || code.depth != t.depth || got_eval != want_rdp
+              || (got_eval == RDP_OK && eval_answer != t.value)))) {
+    printf("%s\n  u %d v %d w %d: want %u %d, compile %u (%u ops %u lits"
+           " depth %u)\n  rdp %u %d, compile %u (%u ops %u lits depth %u),"
+           " eval %u %d\n", src, vals[0], vals[1], vals[2], want_rdp, t.value,
+           want_compile, t.ops, t.lits, t.depth, got_rdp, rdp_answer,
+           got_compile, code.ops, code.lits, code.depth, got_eval,
+           eval_answer);
+    return 1;
+  }
+  counts[got_compile == RDP_TOO_LONG ? 2 : junk ? 3 : div0 ? 1 : 0]++;
+  return 0;
+}
+
+// rdp() and rdp_compile() of str, and rdp_eval() of what compiled
+static int agree(const char *what, const char *str, uint32_t want_rdp,
+                 int32_t want_value, uint32_t want_compile)
+{
+  rdp_code_t code;
+  char text[MAX_TEXT];
+  uint32_t got_rdp, got_compile, got_eval;
+  int32_t rdp_answer = 0, eval_answer = 0;
+  int ok;
+
+  strcpy(text, str);
+  got_rdp = rdp(text, &rdp_answer);
+  strcpy(text, str);
+  got_compile = rdp_compile(text, "", &code);
+  got_eval = rdp_eval(&code, 0, &eval_answer);
+  ok = got_rdp == want_rdp && (got_rdp != RDP_OK || rdp_answer == want_value)
+      && got_compile == want_compile
+      && got_eval == (got_compile == RDP_OK ? want_rdp : RDP_NO_EXP)
+      && (got_eval != RDP_OK || eval_answer == want_value);
+  check(what, ok);
+  return ok;
+}
+
+// var n times, as a left-to-right sum or as v+(v+(v ... ))
+static void chain(char *s, const char *var, int n, int nested)
+{
+  int i;
+
+  *s = 0;
+  for (i = 1; i < n; i++) {
+    strcat(s, var);
+    strcat(s, nested ? "+(" : "+");
+  }
+  strcat(s, var);
+  for (i = 1; nested && i < n; i++)
+    strcat(s, ")");
+}
+
+// Compile str with variable u and evaluate it with u of 3
+static int compiles(const char *str, uint32_t want, int32_t want_value)
+{
+  rdp_code_t code;
+  char text[MAX_TEXT];
+  int32_t u = 3, answer = 0;
+  uint32_t got;
+
+  strcpy(text, str);
+  got = rdp_compile(text, "u", &code);
+  if (got != want)
+    return 0;
+  if (got != RDP_OK)
+    return rdp_eval(&code, &u, &answer) == RDP_NO_EXP;
+  return rdp_eval(&code, &u, &answer) == RDP_OK && answer == want_value;
+}
+
+static void limits(void)
+{
+  char s[MAX_TEXT], t[MAX_TEXT];
+  int32_t answer;
+
+  agree("7 % 4 % 3: rdp() 3, compile RDP_SYNTAX", "7 % 4 % 3", RDP_OK, 3,
+        RDP_SYNTAX);
+  agree("2 ** 3 ** 2: rdp() 8, compile RDP_SYNTAX", "2 ** 3 ** 2", RDP_OK, 8,
+        RDP_SYNTAX);
+  agree("2 ** 3 * 2 is 16 both ways", "2 ** 3 * 2", RDP_OK, 16, RDP_OK);
+  agree("1 2: rdp() 1, compile RDP_SYNTAX", "1 2", RDP_OK, 1, RDP_SYNTAX);
+  agree("(1 + 2: RDP_UNBAL_PARENS both ways", "(1 + 2", RDP_UNBAL_PARENS, 0,
+        RDP_UNBAL_PARENS);
+  agree("10 / (3 - 3): RDP_DIVIDE_0 from rdp_eval()", "10 / (3 - 3)",
+        RDP_DIVIDE_0, 0, RDP_OK);
+
+  chain(s, "u", RDP_MAX_STACK, 1);
+  chain(t, "u", RDP_MAX_STACK + 1, 1);
+  check("nested RDP_MAX_STACK deep compiles", compiles(s, RDP_OK,
+                                                       3 * RDP_MAX_STACK));
+  check("one deeper: RDP_TOO_LONG", compiles(t, RDP_TOO_LONG, 0));
+  chain(t, "1", RDP_MAX_STACK + 1, 1);
+  check("which rdp() evaluates", rdp(t, &answer) == RDP_OK
+        && answer == RDP_MAX_STACK + 1);
+
+  chain(s, "1", RDP_MAX_LITS, 0);
+  chain(t, "1", RDP_MAX_LITS + 1, 0);
+  check("RDP_MAX_LITS numbers compile", compiles(s, RDP_OK, RDP_MAX_LITS));
+  check("one more: RDP_TOO_LONG", compiles(t, RDP_TOO_LONG, 0));
+
+  chain(s, "u", (RDP_MAX_OPS + 1) / 2, 0);
+  chain(t, "u", (RDP_MAX_OPS + 1) / 2 + 1, 0);
+  check("RDP_MAX_OPS ops or less compile",
+        compiles(s, RDP_OK, 3 * ((RDP_MAX_OPS + 1) / 2)));
+  check("more: RDP_TOO_LONG", compiles(t, RDP_TOO_LONG, 0));
+
+  strcpy(s, "u + 1");
+  check("variable in rdp(): RDP_NO_VAR", rdp(s, &answer) == RDP_NO_VAR);
+  check("variable not listed: RDP_NO_VAR", compiles("u + v", RDP_NO_VAR, 0));
+}
+
+int main(int argc, char **argv)
+{
+  static const char *const names[] = {
+    "ok", "divide by 0", "too long", "junk after", "skipped"
+  };
+  uint32_t expressions = 300000, counts[5] = {0}, i;
+  char what[64];
+  int failed = 0;
+
+  if (argc > 1)
+    expressions = atoi(argv[1]);
+  if (expressions == 0) {
+    fprintf(stderr, "usage: rdp_check [expressions]\n");
+    return 2;
+  }
+
+  limits();
+
+  for (i = 0; i < expressions && failed < 10; i++)
+    failed += trial(counts);
+  for (i = 0; i < 5; i++)
+    printf("  %-12s %u\n", names[i], counts[i]);
+  snprintf(what, sizeof(what), "%u random expressions agree", expressions);
+  check(what, !failed && counts[0] && counts[1] && counts[2] && counts[3]);
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
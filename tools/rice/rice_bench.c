@@ -0,0 +1,129 @@
+/**
+ * Host-side benchmark for the sample stream codec
+ *
+ * Encodes and decodes device-sized blocks of a few synthetic signals (or of
+ * a capture file of little-endian 16-bit samples, such as stream_rx output),
+ * checks every block round-trips exactly, and reports the compression ratio
+ * and throughput each way.
+ *
+ * usage: rice_bench [capture-file]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "rice.h"
+
+#define BUFFER_LENGTH 1023      //samples per device buffer, see buffers.h
+#define SIGNAL_LENGTH (BUFFER_LENGTH * 1024)
+#define PASSES        8
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns nonzero if any block failed to round-trip
+static int bench(const char *name, const uint16_t * signal, size_t length)
+{
+  uint16_t dec[BUFFER_LENGTH];
+  uint16_t *coded;
+  size_t *sizes;
+  size_t blocks = (length + BUFFER_LENGTH - 1) / BUFFER_LENGTH;
+  size_t b, n, words = 0, raw = 0;
+  double t0, t1, t2;
+  int pass, bad = 0;
+
+  coded = malloc(blocks * (BUFFER_LENGTH + 1) * sizeof(uint16_t));
+  sizes = malloc(blocks * sizeof(size_t));
+  if (!coded || !sizes) {
+    fprintf(stderr, "rice_bench: out of memory\n");
+    exit(1);
+  }
+
+  t0 = now();
+  for (pass = 0; pass < PASSES; pass++) {
+    words = raw = 0;
+    for (b = 0; b < blocks; b++) {
+      n = length - b * BUFFER_LENGTH;
+      if (n > BUFFER_LENGTH)
+        n = BUFFER_LENGTH;
+      sizes[b] = rice_encode(signal + b * BUFFER_LENGTH, n,
+                             coded + b * (BUFFER_LENGTH + 1),
+                             BUFFER_LENGTH + 1);
+      words += sizes[b];
+      if (!(coded[b * (BUFFER_LENGTH + 1)] & RICE_CODED))
+        raw++;
+    }
+  }
+  t1 = now();
+  for (pass = 0; pass < PASSES; pass++) {
+    for (b = 0; b < blocks; b++) {
+      n = length - b * BUFFER_LENGTH;
+      if (n > BUFFER_LENGTH)
+        n = BUFFER_LENGTH;
+      if (rice_decode(coded + b * (BUFFER_LENGTH + 1), sizes[b], dec,
+                      BUFFER_LENGTH) != (int32_t) n
+          || memcmp(dec, signal + b * BUFFER_LENGTH, n * sizeof(uint16_t)))
+        bad++;
+    }
+  }
+  t2 = now();
+
+  printf("%-10s ratio %5.2f  %4zu/%zu raw blocks  encode %7.1f Msamples/s"
+         "  decode %7.1f Msamples/s  %s\n", name,
+         (double) length / words, raw, blocks,
+         length * PASSES / (t1 - t0) / 1e6, length * PASSES / (t2 - t1) / 1e6,
+         bad ? "MISMATCH" : "ok");
+
+  free(coded);
+  free(sizes);
+  return bad;
+}
+
+int main(int argc, char **argv)
+{
+  uint16_t *signal;
+  size_t i, n;
+  FILE *f;
+  int bad = 0;
+
+  signal = malloc(SIGNAL_LENGTH * sizeof(uint16_t));
+  if (!signal)
+    return 1;
+
+  if (argc > 1) {
+    f = fopen(argv[1], "rb");
+    if (!f) {
+      perror(argv[1]);
+      return 1;
+    }
+    n = fread(signal, sizeof(uint16_t), SIGNAL_LENGTH, f);
+    fclose(f);
+    return bench(argv[1], signal, n) ? 2 : 0;
+  }
+
+  //what the 12-bit ADC sees: a slow sine with a few LSBs of noise
+  srand(1);
+  for (i = 0; i < SIGNAL_LENGTH; i++)
+    signal[i] = 2048 + 1500 * sin(i * 2 * M_PI / 5000) + rand() % 8;
+  bad |= bench("adc", signal, SIGNAL_LENGTH);
+
+  //the RAMP=1 test stream
+  for (i = 0; i < SIGNAL_LENGTH; i++)
+    signal[i] = i;
+  bad |= bench("ramp", signal, SIGNAL_LENGTH);
+
+  //nothing to find: every block falls back to raw
+  for (i = 0; i < SIGNAL_LENGTH; i++)
+    signal[i] = rand();
+  bad |= bench("noise", signal, SIGNAL_LENGTH);
+
+  free(signal);
+  return bad ? 2 : 0;
+}
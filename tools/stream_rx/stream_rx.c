@@ -0,0 +1,131 @@
+/**
+ * Host-side receiver for the mouse_mover sample stream
+ *
+ * Reads the vendor bulk IN endpoint, reports sustained throughput once per
+ * second and checks that the 16-bit ramp produced by the device firmware
+ * (built with make RAMP=1) is continuous, so any dropped or repeated sample
+ * shows up as a gap.
+ *
+ * Uses the same libusb (0.1 API) as teensy_loader_cli.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <usb.h>
+
+#define STREAM_VID       0x0f62
+#define STREAM_PID       0x1001
+#define STREAM_INTERFACE 1
+#define STREAM_ENDPOINT  0x82
+
+#define BUFFER_LENGTH 1023      //samples per device buffer, see buffers.h
+#define READ_SIZE     2048      //one device buffer, rounded up to 64 bytes
+#define TIMEOUT_MS    1000
+
+static usb_dev_handle *open_stream(void)
+{
+  struct usb_bus *bus;
+  struct usb_device *dev;
+  usb_dev_handle *h;
+
+  usb_init();
+  usb_find_busses();
+  usb_find_devices();
+
+  for (bus = usb_get_busses(); bus; bus = bus->next) {
+    for (dev = bus->devices; dev; dev = dev->next) {
+      if (dev->descriptor.idVendor != STREAM_VID
+          || dev->descriptor.idProduct != STREAM_PID)
+        continue;
+      h = usb_open(dev);
+      if (!h)
+        continue;
+#ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
+      usb_detach_kernel_driver_np(h, STREAM_INTERFACE);
+#endif
+      if (usb_claim_interface(h, STREAM_INTERFACE) < 0) {
+        usb_close(h);
+        continue;
+      }
+      return h;
+    }
+  }
+  return NULL;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  usb_dev_handle *h;
+  unsigned char buf[READ_SIZE];
+  uint16_t sample, expected = 0;
+  int synced = 0;
+  int n, i;
+  unsigned long long total = 0, window = 0, samples = 0, gaps = 0;
+  unsigned long long short_reads = 0;
+  double start, last, t;
+  double seconds = 0;
+
+  if (argc > 1)
+    seconds = atof(argv[1]);
+
+  h = open_stream();
+  if (!h) {
+    fprintf(stderr, "stream_rx: no device %04x:%04x found\n", STREAM_VID,
+            STREAM_PID);
+    return 1;
+  }
+
+  start = last = now();
+  for (;;) {
+    n = usb_bulk_read(h, STREAM_ENDPOINT, (char *) buf, sizeof(buf),
+                      TIMEOUT_MS);
+    if (n < 0) {
+      fprintf(stderr, "stream_rx: read failed: %s\n", usb_strerror());
+      break;
+    }
+
+    //every device buffer ends in a short packet, so each read is one buffer
+    if (n != BUFFER_LENGTH * 2)
+      short_reads++;
+
+    for (i = 0; i + 1 < n; i += 2) {
+      sample = buf[i] | (buf[i + 1] << 8);
+      if (synced && sample != expected)
+        gaps++;
+      expected = sample + 1;
+      synced = 1;
+    }
+    samples += n / 2;
+    total += n;
+    window += n;
+
+    t = now();
+    if (t - last >= 1.0) {
+      printf("%8.3f MB/s  %llu samples  %llu gaps  %llu odd-sized reads\n",
+             window / (t - last) / 1e6, samples, gaps, short_reads);
+      fflush(stdout);
+      window = 0;
+      last = t;
+    }
+    if (seconds > 0 && t - start >= seconds)
+      break;
+  }
+
+  t = now();
+  printf("total: %llu bytes in %.1f s (%.3f MB/s), %llu gaps\n", total,
+         t - start, total / (t - start) / 1e6, gaps);
+
+  usb_release_interface(h, STREAM_INTERFACE);
+  usb_close(h);
+  return gaps ? 2 : 0;
+}
@@ -0,0 +1,238 @@
+/**
+ * Host-side benchmark for the telemetry framing
+ *
+ * Batches a stream of typed records into frames, decodes them again in
+ * 64-byte pieces (as CDC packets arrive), checks every record comes back in
+ * order, and reports the wire overhead and throughput each way. A second
+ * pass damages some frames and drops others to show what the receiver
+ * counts. The stats records are also sized as decimal text, as xprintf
+ * would send them, for comparison.
+ *
+ * Given a capture file of the wire bytes (such as the output of the
+ * mouse_mover 'y' command saved from the serial port), decodes it and
+ * prints the records instead.
+ *
+ * usage: telem_bench [capture-file]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "telem.h"
+
+#define RECORDS (1 << 20)
+#define PASSES  4
+#define PIECE   64              //bytes per receive call, a CDC packet
+
+#define TYPE_STATS   1          //eight 32-bit counters
+#define TYPE_SAMPLES 2          //a run of 16-bit samples
+#define TYPE_EVENT   3          //one 32-bit word
+
+static uint8_t *wire;
+static size_t wire_len, wire_size;
+
+static uint32_t expect;         //index of the next record to decode
+static uint32_t mismatches;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The transport: appends to the wire buffer
+static int32_t sink(const char *ptr, int32_t len)
+{
+  if (wire_len + len > wire_size) {
+    fprintf(stderr, "telem_bench: wire buffer full\n");
+    exit(1);
+  }
+  memcpy(wire + wire_len, ptr, len);
+  wire_len += len;
+  return len;
+}
+
+// Record k: its type, length and contents all follow from k, so the
+// decoder can check them without keeping a copy
+static uint32_t record_len(uint32_t k, uint8_t * type)
+{
+  switch (k % 8) {
+  case 0:
+    *type = TYPE_SAMPLES;
+    return 64;
+  case 3:
+  case 6:
+    *type = TYPE_STATS;
+    return 32;
+  default:
+    *type = TYPE_EVENT;
+    return 4;
+  }
+}
+
+static void record_fill(uint32_t k, uint8_t * p, uint32_t len)
+{
+  uint32_t i;
+
+  telem_le32(p, k);
+  for (i = 4; i < len; i += 2)
+    telem_le16(p + i, (uint16_t) (2048 + ((k + i) * 2731 >> 8 & 0x3ff)));
+}
+
+static void check(void *ctx, uint8_t type, const uint8_t * data, uint32_t len)
+{
+  uint8_t want[TELEM_MAX_RECORD];
+  uint8_t t;
+  uint32_t n;
+
+  //skip records of frames the damaged pass lost
+  if (len >= 4 && telem_get32(data) > expect)
+    expect = telem_get32(data);
+
+  n = record_len(expect, &t);
+  record_fill(expect, want, n);
+  if (type != t || len != n || memcmp(data, want, n))
+    mismatches++;
+  expect++;
+}
+
+static void print_record(void *ctx, uint8_t type, const uint8_t * data,
+                         uint32_t len)
+{
+  uint32_t i;
+
+  printf("type %3u len %3u:", type, len);
+  for (i = 0; i + 4 <= len; i += 4)
+    printf(" %u", telem_get32(data + i));
+  printf("\n");
+}
+
+static void decode(telem_rx_t * rx)
+{
+  size_t i, n;
+
+  for (i = 0; i < wire_len; i += n) {
+    n = wire_len - i < PIECE ? wire_len - i : PIECE;
+    telem_rx_put(rx, wire + i, n);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static telem_tx_t tx;
+  telem_rx_t rx;
+  telem_rx_stats_t rs;
+  uint8_t *p;
+  uint8_t type;
+  uint32_t k, len, i;
+  size_t data_bytes = 0, stats_bytes = 0, text_bytes = 0, frames = 0, hits;
+  char text[16];
+  double t0, t1, t2;
+  int pass;
+  FILE *f;
+
+  wire_size = (size_t) RECORDS * 80;
+  wire = malloc(wire_size);
+  if (!wire)
+    return 1;
+
+  if (argc > 1) {
+    f = fopen(argv[1], "rb");
+    if (!f) {
+      perror(argv[1]);
+      return 1;
+    }
+    wire_len = fread(wire, 1, wire_size, f);
+    fclose(f);
+    telem_rx_init(&rx, print_record, NULL);
+    decode(&rx);
+    telem_rx_stats(&rx, &rs);
+    printf("%u frames, %u records, %u lost, %u bad CRC, %u malformed\n",
+           rs.frames, rs.records, rs.lost, rs.crc, rs.bad);
+    return 0;
+  }
+
+  //what xprintf("%lu ") would send for the stats records
+  for (k = 0; k < RECORDS; k++) {
+    len = record_len(k, &type);
+    data_bytes += len;
+    if (type == TYPE_STATS) {
+      stats_bytes += 2 + len;
+      record_fill(k, wire, len);
+      for (i = 0; i < len; i += 4)
+        text_bytes += snprintf(text, sizeof(text), "%u ",
+                               telem_get32(wire + i));
+    }
+  }
+
+  t0 = now();
+  for (pass = 0; pass < PASSES; pass++) {
+    wire_len = 0;
+    telem_tx_init(&tx, sink);
+    for (k = 0; k < RECORDS; k++) {
+      len = record_len(k, &type);
+      p = telem_record(&tx, type, len);
+      record_fill(k, p, len);
+    }
+    telem_flush(&tx);
+    frames = tx.stats.frames;
+  }
+  t1 = now();
+  for (pass = 0; pass < PASSES; pass++) {
+    expect = 0;
+    mismatches = 0;
+    telem_rx_init(&rx, check, NULL);
+    decode(&rx);
+  }
+  t2 = now();
+  telem_rx_stats(&rx, &rs);
+
+  printf("%u records, %zu frames: %zu record bytes, %zu on the wire (%.1f%%"
+         " overhead)\n", RECORDS, frames, data_bytes, wire_len,
+         100.0 * (wire_len - data_bytes) / data_bytes);
+  printf("stats records: %zu bytes binary, %zu as text\n", stats_bytes,
+         text_bytes);
+  printf("encode %7.1f MB/s  decode %7.1f MB/s  %s\n",
+         data_bytes * PASSES / (t1 - t0) / 1e6,
+         data_bytes * PASSES / (t2 - t1) / 1e6,
+         rs.frames == frames && rs.records == RECORDS && !mismatches
+         && !rs.lost && !rs.crc && !rs.bad ? "ok" : "MISMATCH");
+  if (rs.frames != frames || mismatches)
+    return 2;
+
+  //damage every 97th frame and drop every 101st
+  hits = 0;
+  for (i = 0, k = 0; i < wire_len; i++) {
+    if (wire[i] == 0) {
+      k++;
+      continue;
+    }
+    if (k % 97 == 50 && wire[i + 1] && wire[i + 1] != 0x10) {
+      wire[i + 1] ^= 0x10;
+      hits++;
+      while (wire[i])
+        i++;
+      k++;
+    }
+  }
+  for (i = 0, k = 0, len = 0; i < wire_len; i++) {
+    if (k % 101 != 100)
+      wire[len++] = wire[i];
+    if (wire[i] == 0)
+      k++;
+  }
+  wire_len = len;
+
+  expect = 0;
+  mismatches = 0;
+  telem_rx_init(&rx, check, NULL);
+  decode(&rx);
+  telem_rx_stats(&rx, &rs);
+  printf("damaged %zu frames, dropped %zu: %u lost, %u bad CRC, %u malformed,"
+         " %u records wrong\n", hits, frames / 101, rs.lost, rs.crc, rs.bad,
+         mismatches);
+  return 0;
+}
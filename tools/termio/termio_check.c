@@ -0,0 +1,482 @@
+/**
+ * Teensy3xLib's xprintf, xsnprintf and xitoa against the C library and the
+ * original xprintf
+ *
+ * termio.c is built unchanged, with its output sent through xdev_out() to a
+ * buffer here that counts the writes. Each check runs random values through
+ * a set of conversions:
+ *
+ *   xprintf against snprintf with the same conversion, \n as \r\n and hex
+ *   upper case for %x as for %X; %b against a binary conversion here
+ *   xprintf against xprintf_ref, the original kept in xprintf_ref.c here,
+ *   for the conversions and widths the original handles
+ *   xsnprintf cut short at every size, which must keep to its buffer, end
+ *   it with a null and return the whole length
+ *   xitoa in every radix from 2 to 36, signed and unsigned, padded with
+ *   spaces and zeros
+ *   one write per xprintf call for a line shorter than XPRINTF_BUF
+ *
+ * Then a console line is timed through xprintf and xprintf_ref, in host
+ * time, with the writes each makes.
+ *
+ * termio_check [values]
+ *
+ * Exits nonzero if a check fails.
+ */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "termio.h"
+#include "xprintf_ref.h"
+
+#define OUT_SIZE 4096
+#define LINE 512
+
+static char out[OUT_SIZE];
+static int32_t out_len;
+static uint32_t writes;
+
+static uint32_t seed = 1;
+static int failures = 0;
+
+static uint32_t rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// A value of random magnitude, so short numbers come up as often as long
+static uint32_t rnd_value(void)
+{
+  return rnd() >> (rnd() % 32);
+}
+
+static uint64_t rnd_value64(void)
+{
+  return ((uint64_t) rnd() << 32 | rnd()) >> (rnd() % 64);
+}
+
+static int32_t dev_write(const char *ptr, int32_t len)
+{
+  if (out_len + len <= OUT_SIZE) {
+    memcpy(out + out_len, ptr, len);
+    out_len += len;
+  }
+  writes++;
+  return len;
+}
+
+// termio.c's default device; nothing here reads
+int32_t UARTWrite(const char *ptr, int32_t len)
+{
+  return dev_write(ptr, len);
+}
+
+int32_t UARTRead(char *ptr, int32_t len)
+{
+  return 0;
+}
+
+int32_t UARTAvail(void)
+{
+  return 0;
+}
+
+static void out_reset(void)
+{
+  out_len = 0;
+  writes = 0;
+}
+
+static int out_is(const char *expect)
+{
+  return out_len == (int32_t) strlen(expect)
+      && memcmp(out, expect, out_len) == 0;
+}
+
+static void fail(const char *what, const char *fmt, const char *expect)
+{
+  if (failures++ < 10)
+    printf("%s \"%s\": got \"%.*s\", expected \"%s\"\n", what, fmt,
+           (int) out_len, out, expect);
+}
+
+static void check(const char *what, int ok)
+{
+  printf("%-44s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+// snprintf, with \n as \r\n as the terminal device gets it
+static void expect_printf(char *buf, const char *fmt, ...)
+{
+  char line[LINE], *p = line;
+  va_list ap;
+
+  va_start(ap, fmt);
+  vsnprintf(line, sizeof(line), fmt, ap);
+  va_end(ap);
+  while (*p) {
+    if (*p == '\n')
+      *buf++ = '\r';
+    *buf++ = *p++;
+  }
+  *buf = 0;
+}
+
+// v in binary, padded to width with zeros
+static void binary(char *buf, uint64_t v, int width)
+{
+  char digits[64];
+  int n = 0;
+
+  do {
+    digits[n++] = '0' + (v & 1);
+    v >>= 1;
+  } while (v);
+  for (; width > n; width--)
+    *buf++ = '0';
+  while (n)
+    *buf++ = digits[--n];
+  *buf = 0;
+}
+
+/*
+ * xprintf against snprintf; each format takes one argument of the kind
+ * given, and the C library's format is the same with %x as %X
+ */
+enum { INT, UINT, LL, STR, CHAR, PTR, BIN, BIN_LL };
+
+static const struct {
+  const char *fmt;
+  const char *cfmt;
+  int kind;
+} formats[] = {
+  {"%d", "%d", INT},
+  {"%5d\n", "%5d\n", INT},
+  {"[%-12d]", "[%-12d]", INT},
+  {"%012d", "%012d", INT},
+  {"%ld", "%d", INT},
+  {"%u", "%u", UINT},
+  {"%10u", "%10u", UINT},
+  {"%-10u|", "%-10u|", UINT},
+  {"%lu\n", "%u\n", UINT},
+  {"%X", "%X", UINT},
+  {"%x", "%X", UINT},
+  {"%08X", "%08X", UINT},
+  {"%08lx", "%08X", UINT},
+  {"%lld", "%lld", LL},
+  {"%llu", "%llu", LL},
+  {"%24llu", "%24llu", LL},
+  {"%llx", "%llX", LL},
+  {"%016llX", "%016llX", LL},
+  {"%c%c", "%c%c", CHAR},
+  {"<%s>\n", "<%s>\n", STR},
+  {"%%%u%%", "%%%u%%", UINT},
+  {"%p", "0x%08X", PTR},
+  {"%b", NULL, BIN},
+  {"%032b", NULL, BIN},
+  {"%llb", NULL, BIN_LL},
+};
+
+static void check_formats(uint32_t values)
+{
+  static const char *const strs[] = {"", "a", "hello, world", "\n\n"};
+  char expect[LINE], buf[LINE];
+  unsigned int f;
+  int32_t ret, len;
+  uint32_t i, v, w;
+  uint64_t v64;
+  const char *s;
+  int failed = 0;
+
+  xdev_out(dev_write);
+  for (f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+    for (i = 0; i < values; i++) {
+      v = rnd_value();
+      w = rnd();
+      v64 = rnd_value64();
+      s = strs[rnd() % 4];
+      out_reset();
+      switch (formats[f].kind) {
+      case INT:
+        if (rnd() & 1)
+          v = -v;
+        ret = xprintf(formats[f].fmt, v);
+        expect_printf(expect, formats[f].cfmt, (int32_t) v);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, v);
+        break;
+      case UINT:
+        ret = xprintf(formats[f].fmt, v);
+        expect_printf(expect, formats[f].cfmt, v);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, v);
+        break;
+      case LL:
+        ret = xprintf(formats[f].fmt, v64);
+        expect_printf(expect, formats[f].cfmt, v64);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, v64);
+        break;
+      case STR:
+        ret = xprintf(formats[f].fmt, s);
+        expect_printf(expect, formats[f].cfmt, s);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, s);
+        break;
+      case CHAR:
+        v = ' ' + v % 95;
+        w = ' ' + w % 95;
+        ret = xprintf(formats[f].fmt, v, w);
+        expect_printf(expect, formats[f].cfmt, v, w);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, v, w);
+        break;
+      case PTR:
+        ret = xprintf(formats[f].fmt, (void *) (uintptr_t) v);
+        expect_printf(expect, formats[f].cfmt, v);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt,
+                        (void *) (uintptr_t) v);
+        break;
+      case BIN:
+        ret = xprintf(formats[f].fmt, v);
+        binary(expect, v, strcmp(formats[f].fmt, "%b") ? 32 : 0);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, v);
+        break;
+      default:
+        ret = xprintf(formats[f].fmt, v64);
+        binary(expect, v64, 0);
+        len = xsnprintf(buf, sizeof(buf), formats[f].fmt, v64);
+        break;
+      }
+      if (!out_is(expect) || ret != out_len) {
+        fail("xprintf", formats[f].fmt, expect);
+        failed = 1;
+      }
+      //xsnprintf leaves \n as it is
+      out_len = len;
+      memcpy(out, buf, len < LINE ? len : 0);
+      if (strchr(formats[f].fmt, '\n') == NULL
+          && (!out_is(expect) || buf[len] != 0)) {
+        fail("xsnprintf", formats[f].fmt, expect);
+        failed = 1;
+      }
+    }
+  check("xprintf and xsnprintf against snprintf", !failed);
+}
+
+/*
+ * xprintf against the original, which pads a negative number with zeros
+ * after its sign, reads widths of a digit only, handles no - and has room
+ * for 20 digits, so %b only gets values that fit
+ */
+static void check_ref(uint32_t values)
+{
+  static const char *const fmts[] = {
+    "%d", "%5d", "%u\n", "%9u", "%X", "%08X", "%x", "%lx", "%b", "%08b",
+    "%ld", "%lu", "<%s>", "%c", "%%"
+  };
+  char expect[LINE], conv;
+  unsigned int f;
+  uint32_t i, v;
+  int failed = 0;
+
+  xdev_out(dev_write);
+  for (f = 0; f < sizeof(fmts) / sizeof(fmts[0]); f++)
+    for (i = 0; i < values; i++) {
+      conv = strpbrk(strchr(fmts[f], '%') + 1, "%bcdsuxX")[0];
+      v = rnd_value();
+      if (conv == 'd' && (rnd() & 1))
+        v = -v;
+      if (conv == 'c')
+        v = ' ' + v % 95;
+      if (conv == 'b')
+        v &= 0xfffff;
+      out_reset();
+      if (conv == 's')
+        xprintf_ref(fmts[f], "some text");
+      else
+        xprintf_ref(fmts[f], v);
+      memcpy(expect, out, out_len);
+      expect[out_len] = 0;
+      out_reset();
+      if (conv == 's')
+        xprintf(fmts[f], "some text");
+      else
+        xprintf(fmts[f], v);
+      if (!out_is(expect)) {
+        fail("xprintf against xprintf_ref", fmts[f], expect);
+        failed = 1;
+      }
+    }
+  check("xprintf against xprintf_ref", !failed);
+}
+
+static void check_truncation(void)
+{
+  const char *fmt = "%s %d %08X %llu\n";
+  char full[LINE], buf[LINE + 8];
+  int32_t size, len, whole;
+  int failed = 0;
+
+  whole = snprintf(full, sizeof(full), "%s %d %08X %llu\n", "text", -1234,
+                   0xbeefu, 12345678901234567890ull);
+  for (size = 0; size <= whole + 2; size++) {
+    memset(buf, 'z', sizeof(buf));
+    len = xsnprintf(buf, size, fmt, "text", -1234, 0xbeef,
+                    12345678901234567890ull);
+    if (len != whole || buf[size] != 'z'
+        || (size > 0 && (buf[size < whole + 1 ? size - 1 : whole] != 0
+                         || memcmp(buf, full, size < whole + 1 ? size - 1
+                                   : whole) != 0)))
+      failed = 1;
+  }
+  check("xsnprintf cut short at every size", !failed);
+}
+
+// val in radix as the original xitoa wrote it, on 32-bit values
+static void expect_itoa(char *buf, int32_t val, int32_t radix, int32_t len)
+{
+  char s[40];
+  uint32_t v = val, r = radix;
+  char pad = ' ';
+  int i = 0, sign = 0, c;
+
+  if (radix < 0) {
+    r = -radix;
+    if (val < 0) {
+      v = -val;
+      sign = 1;
+    }
+  }
+  if (len < 0) {
+    len = -len;
+    pad = '0';
+  }
+  do {
+    c = v % r;
+    s[i++] = c < 10 ? '0' + c : 'A' + c - 10;
+    v /= r;
+  } while (v);
+  //zeros go before the sign, as C has it
+  if (sign && pad == ' ')
+    s[i++] = '-';
+  while (i + (sign && pad == '0') < len)
+    s[i++] = pad;
+  if (sign && pad == '0')
+    s[i++] = '-';
+  while (i)
+    *buf++ = s[--i];
+  *buf = 0;
+}
+
+static void check_itoa(uint32_t values)
+{
+  char expect[LINE], fmt[32];
+  int32_t radix, len, sign;
+  uint32_t i, v;
+  int failed = 0;
+
+  xdev_out(dev_write);
+  for (radix = 2; radix <= 36; radix++)
+    for (sign = 1; sign >= -1; sign -= 2)
+      for (i = 0; i < values / 16 + 1; i++) {
+        v = rnd_value();
+        len = rnd() % 41 - 20;
+        out_reset();
+        xitoa((long) (int32_t) v, sign * radix, len);
+        expect_itoa(expect, v, sign * radix, len);
+        if (!out_is(expect)) {
+          snprintf(fmt, sizeof(fmt), "%d %d %d", (int32_t) v, sign * radix,
+                   len);
+          fail("xitoa", fmt, expect);
+          failed = 1;
+        }
+      }
+  out_reset();
+  xitoa(5, 10, 21);
+  xitoa(5, 1, 0);
+  xitoa(5, 37, 0);
+  check("xitoa in radix 2 to 36", !failed && out_len == 0);
+}
+
+static void check_writes(void)
+{
+  char line[300];
+  int32_t ret;
+
+  xdev_out(dev_write);
+  out_reset();
+  ret = xprintf("adc %u samples, %d lost, rate %u Hz, buffer %08X\n", 123456,
+                -2, 48000, 0x20001000);
+  check("one write for a short line", writes == 1 && ret == out_len);
+
+  memset(line, 'x', sizeof(line) - 1);
+  line[sizeof(line) - 1] = 0;
+  out_reset();
+  ret = xprintf("%s\n", line);
+  check("a long line in XPRINTF_BUF pieces",
+        writes == (sizeof(line) + 1 + 127) / 128 && ret == (int32_t) sizeof(line) + 1
+        && out_len == ret);
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// A console line through xprintf and xprintf_ref, in host ns
+static void bench(uint32_t lines)
+{
+  double t, fast, ref;
+  uint32_t i, fast_writes, ref_writes;
+
+  xdev_out(dev_write);
+  t = now();
+  for (i = 0; i < lines; i++) {
+    out_reset();
+    xprintf("adc %u samples, %d lost, rate %u Hz, buffer %08X\n", i * 977,
+            -(int32_t) (i & 7), 48000, 0x20001000 + i);
+  }
+  fast = (now() - t) / lines * 1e9;
+  fast_writes = writes;
+  t = now();
+  for (i = 0; i < lines; i++) {
+    out_reset();
+    xprintf_ref("adc %u samples, %d lost, rate %u Hz, buffer %08X\n",
+                i * 977, -(int32_t) (i & 7), 48000, 0x20001000 + i);
+  }
+  ref = (now() - t) / lines * 1e9;
+  ref_writes = writes;
+  printf("console line: xprintf %.0f ns, %u writes; xprintf_ref %.0f ns,"
+         " %u writes\n", fast, fast_writes, ref, ref_writes);
+}
+
+int main(int argc, char **argv)
+{
+  uint32_t values = 20000;
+
+  if (argc > 1)
+    values = atoi(argv[1]);
+  if (values == 0) {
+    fprintf(stderr, "usage: termio_check [values]\n");
+    return 2;
+  }
+
+  check_formats(values);
+  check_ref(values);
+  check_truncation();
+  check_itoa(values);
+  check_writes();
+  bench(values * 10);
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,161 @@
+/*
+ *  xprintf_ref.c      the original termio xprintf(), for comparison
+ *
+ *  xputs(), xitoa() and xprintf() as Teensy3xLib's termio.c had them
+ *  before output was buffered: every char goes out through xputc(), a
+ *  write each, and every digit takes a divide.  termio_check compares the
+ *  current formatter with it on the host, and a mouse_mover built with
+ *  PRINTF_BENCH=1 times the two on the part.  Not part of the library.
+ *
+ *  Kept as it was, faults included: widths are read as w * 11 + digit, so
+ *  only one-digit widths work, - is not handled, and xitoa_ref() has room
+ *  for 20 digits only, so %b of a value of 2^20 or more writes past s[].
+ */
+
+#include  <stdarg.h>
+#include  <stdint.h>
+#include  "termio.h"
+#include  "xprintf_ref.h"
+
+
+
+static void  xputs_ref (const char* str)
+{
+	while (*str)
+		xputc(*str++);
+}
+
+
+
+static void  xitoa_ref (long val, int32_t radix, int32_t len)
+{
+	uint8_t				c;
+	uint32_t			r;
+	uint8_t				sgn;
+	uint8_t				pad;
+	uint8_t				s[20];
+	uint8_t				i;
+	long				v;
+
+	pad = ' ';
+	sgn = 0;
+	i = 0;
+
+	if (radix < 0)
+	{
+		radix = -radix;
+		if (val < 0)
+		{
+			val = -val;
+			sgn = '-';
+		}
+	}
+	v = val;
+	r = radix;
+	if (len < 0)
+	{
+		len = -len;
+		pad = '0';
+	}
+	if (len > 20) return;
+	do
+	{
+		c = (uint8_t)(v % r);
+		if (c >= 10) c += 7;
+		c += '0';
+		s[i++] = c;
+		v /= r;
+	} while (v);
+
+	if (sgn) s[i++] = sgn;
+	while (i < len)
+		s[i++] = pad;
+	do
+		xputc(s[--i]);
+	while (i);
+}
+
+
+
+void  xprintf_ref (const char* str, ...)
+{
+	va_list					arp;
+	int						d;
+	int						r;
+	int						w;
+	int						s;
+	int						l;
+
+
+	va_start(arp, str);
+
+	while ((d = *str++) != 0)
+	{
+		if (d != '%')
+		{
+			xputc(d);
+			continue;
+		}
+		if (*str == '%')			// if we need to escape the percent sign...
+		{
+			xputc(d);				// print the one we have in d
+			str++;					// now step over the second one
+			continue;				// and resume
+		}
+
+		d = *str++;
+		w = 0;
+		r = 0;
+		s = 0;
+		l = 0;
+
+		if (d == '0')
+		{
+			d = *str++;
+			s = 1;
+		}
+		while ((d >= '0')&&(d <= '9'))
+		{
+			w += w * 10 + (d - '0');
+			d = *str++;
+		}
+
+		if (s)  w = -w;
+		if (d == 'l')
+		{
+			l = 1;
+			d = *str++;
+		}
+		if (!d)  break;
+		if (d == 's')
+		{
+			xputs_ref(va_arg(arp, char*));
+			continue;
+		}
+		if (d == 'c')
+		{
+			xputc((char)va_arg(arp, int));
+			continue;
+		}
+		if (d == 'u') r = 10;
+		if (d == 'd') r = -10;
+		if (d == 'X' || d == 'x') r = 16; // 'x' added by mthomas in increase compatibility
+		if (d == 'b') r = 2;
+		if (!r) break;
+		if (l)
+		{
+			if (r > 0)
+				xitoa_ref((long)va_arg(arp, unsigned int), r, w);
+			else
+				xitoa_ref((long)va_arg(arp, int), r, w);
+		} else
+		{
+			if (r > 0)
+				xitoa_ref((long)va_arg(arp, unsigned int), r, w);
+			else
+				xitoa_ref((long)va_arg(arp, int), r, w);
+		}
+	}
+
+	va_end(arp);
+}
@@ -0,0 +1,13 @@
+/*
+ *  xprintf_ref.h      the original termio xprintf(), for comparison
+ *
+ *  See xprintf_ref.c.  Writes through xputc(), so xdev_out() redirects it
+ *  as it does xprintf().
+ */
+
+#ifndef  XPRINTF_REF_H
+#define  XPRINTF_REF_H
+
+void			xprintf_ref (const char* str, ...);
+
+#endif
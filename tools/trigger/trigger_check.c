@@ -0,0 +1,207 @@
+/**
+ * Host-side check of the trigger stage
+ *
+ * trigger.c runs unchanged on k20sim, which only supplies DWT_CYCCNT. For
+ * each mode and a range of pre and post lengths, a known signal (a sine of
+ * random period and amplitude with noise, starting with a step so the first
+ * window triggers before pre samples of history exist) is fed through
+ * trigger_stage() in random block lengths, in place as buffers.c runs it.
+ * The samples kept must match a direct reference on the whole signal: each
+ * trigger, searched for from the end of the window before, keeps the pre
+ * samples before it (zeros where the signal had not started) and post from
+ * it on. Window counts must match too, and trigger_init() must refuse pre
+ * or post out of range.
+ *
+ * usage: trigger_check [trials]
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "k20sim.h"
+#include "trigger.h"
+
+#define BUFFER_LENGTH 1023      //samples per device buffer, see buffers.h
+#define MAX_SIGNAL    65536
+
+static uint32_t seed = 1;
+static int failures = 0;
+
+static uint32_t rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+static void check(const char *what, int ok)
+{
+  printf("%-44s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+static int hit(const trigger_config_t * t, uint16_t previous, uint16_t x)
+{
+  switch (t->mode) {
+  case TRIGGER_RISING:
+    return previous < t->level && x >= t->level;
+  case TRIGGER_FALLING:
+    return previous > t->level && x <= t->level;
+  case TRIGGER_LEVEL:
+    return x >= t->level;
+  case TRIGGER_WINDOW:
+    return x < t->low || x > t->high;
+  }
+  return 0;
+}
+
+/*
+ * The windows of the whole signal, as trigger.h describes them; returns the
+ * samples kept and counts the windows started, completed and started with
+ * less than pre samples behind them
+ */
+static uint32_t reference(const trigger_config_t * t, const uint16_t * x,
+                          uint32_t length, uint16_t * y, uint32_t * started,
+                          uint32_t * completed, uint32_t * early)
+{
+  uint32_t from = 0, at, i, out = 0;
+  int64_t k;
+
+  *started = *completed = *early = 0;
+  while (from < length) {
+    for (at = from; at < length && !hit(t, at ? x[at - 1] : 0, x[at]); at++) ;
+    if (at == length)
+      break;
+    (*started)++;
+    if (at < t->pre)
+      (*early)++;
+    //the window goes out pre samples late, so it ends that much later
+    for (i = 0; i < (uint32_t) t->pre + t->post && at + i < length; i++) {
+      k = (int64_t) at - t->pre + i;
+      y[out++] = k < 0 ? 0 : x[k];
+    }
+    if (i == (uint32_t) t->pre + t->post)
+      (*completed)++;
+    from = at + t->pre + t->post;
+  }
+  return out;
+}
+
+// A sine with noise, starting low then stepping up at a random sample
+static void make_signal(uint16_t * x, uint32_t length)
+{
+  double period = 20 + rnd() % 4000, amplitude = 200 + rnd() % 1800;
+  uint32_t step = rnd() % 16, i;
+  int32_t v;
+
+  for (i = 0; i < length; i++) {
+    v = 2048 + amplitude * sin(2 * M_PI * i / period)
+        + (int32_t) (rnd() % 64) - 32;
+    if (i < step)
+      v = 0;
+    else if (i < step + 4)
+      v = 4095;
+    x[i] = v < 0 ? 0 : v > 4095 ? 4095 : v;
+  }
+}
+
+// One configuration over one signal; returns nonzero on a mismatch
+static int trial(const trigger_config_t * t, uint32_t * early_total)
+{
+  static uint16_t x[MAX_SIGNAL], want[2 * MAX_SIGNAL], got[2 * MAX_SIGNAL];
+  uint16_t buf[BUFFER_LENGTH];
+  uint32_t length, in, block, n_got = 0, n_want, started, completed, early;
+  uint16_t n;
+  trigger_stats_t stats;
+
+  length = 1 + rnd() % MAX_SIGNAL;
+  make_signal(x, length);
+  n_want = reference(t, x, length, want, &started, &completed, &early);
+  *early_total += early;
+
+  if (trigger_init(t) != 0)
+    return 1;
+  trigger_stats(&stats);
+  for (in = 0; in < length; in += block) {
+    block = rnd() % 4 ? 1 + rnd() % BUFFER_LENGTH : rnd() % 8;
+    if (block > length - in)
+      block = length - in;
+    memcpy(buf, x + in, block * sizeof(buf[0]));
+    n = trigger_stage(buf, block);
+    if (n > block)
+      return 1;
+    memcpy(got + n_got, buf, n * sizeof(buf[0]));
+    n_got += n;
+  }
+  trigger_stats(&stats);
+
+  if (n_got != n_want || memcmp(got, want, n_got * sizeof(got[0])) != 0
+      || stats.triggers != started || stats.windows != completed
+      || stats.samples != n_got) {
+    printf("mode %d level %u window %u-%u pre %u post %u, %u samples:"
+           " kept %u of %u, %u/%u triggers, %u/%u windows\n", t->mode,
+           t->level, t->low, t->high, t->pre, t->post, length, n_got, n_want,
+           stats.triggers, started, stats.windows, completed);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const char *const mode_names[] = {
+    "rising", "falling", "level", "window"
+  };
+  static const uint16_t pres[] = {0, 1, 37, 256, TRIGGER_HISTORY - 1};
+  static const uint16_t posts[] = {1, 5, 300, 2000};
+  trigger_config_t t;
+  uint32_t trials = 4, i, early;
+  unsigned int p, q;
+  char what[64];
+  int mode, failed;
+
+  if (argc > 1)
+    trials = atoi(argv[1]);
+  if (trials == 0) {
+    fprintf(stderr, "usage: trigger_check [trials]\n");
+    return 2;
+  }
+
+  k20sim_init();
+
+  t.mode = TRIGGER_RISING;
+  t.level = 2048;
+  t.pre = TRIGGER_HISTORY;
+  t.post = 1;
+  check("pre of TRIGGER_HISTORY refused", trigger_init(&t) == -1);
+  t.pre = 0;
+  t.post = 0;
+  check("post of 0 refused", trigger_init(&t) == -1);
+
+  for (mode = TRIGGER_RISING; mode <= TRIGGER_WINDOW; mode++) {
+    failed = 0;
+    early = 0;
+    for (p = 0; p < sizeof(pres) / sizeof(pres[0]); p++)
+      for (q = 0; q < sizeof(posts) / sizeof(posts[0]); q++)
+        for (i = 0; i < trials; i++) {
+          t.mode = mode;
+          t.level = 1024 + rnd() % 2048;
+          t.low = 1024 + rnd() % 1024;
+          t.high = t.low + rnd() % 1024;
+          t.pre = pres[p];
+          t.post = posts[q];
+          failed |= trial(&t, &early);
+        }
+    snprintf(what, sizeof(what), "%s against the reference (%u early)",
+             mode_names[mode], early);
+    check(what, !failed && early > 0);
+  }
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,257 @@
+/**
+ * uart_autobaud() against a model of FTM0's dual edge capture
+ *
+ * The firmware side is Teensy3xLib's uart.c, unchanged. The model's FTM0
+ * counts bus clocks in its 16-bit counter, setting TOF as it wraps, and with
+ * channels 2 and 3 combined for one-shot dual edge capture timestamps the
+ * first falling and the next rising edge of the line on PC3. The line is a
+ * list of edges in simulated time, made from chars sent at a given rate;
+ * time moves a fixed step per k20sim ticker tick, so uart_autobaud()'s loop
+ * runs in between as it would on the part.
+ *
+ * Each case says what the far end sends from the call on and what
+ * uart_autobaud() must return:
+ *
+ *   the sync char after a quiet line, at rates from 1200 baud (where nine
+ *   bit times are many wraps of the counter) to 3 Mbaud
+ *   the same with traffic already on the line at the call, which must not
+ *   be taken for the sync char
+ *   traffic with no quiet gap, a quiet line, and a sync char below 1200
+ *   baud, all of which must give 0
+ *
+ * uart_autobaud
+ *
+ * Exits nonzero if a case fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uartsim.h"
+#include "arm_cm4.h"
+#include "uart.h"
+
+// host time between steps, and the bus clocks each moves on
+#define TICK_US 20
+#define STEP 1000
+
+#define FTM0_ADDRESS 0x40038000u
+#define FTM ((FTM_MemMapPtr) k20sim_reg(FTM0_ADDRESS))
+
+#define MAX_EDGES 16384
+
+// the line: its edges from the call on, oldest first
+static struct {
+  uint64_t t;                   //in bus clocks
+  uint8_t level;
+} edges[MAX_EDGES];
+static volatile uint32_t n_edges, next_edge;
+
+// the counter runs from start, in bus clocks; armed is 1 while channel 2
+// waits for its falling edge, 2 while channel 3 waits for its rising edge
+static uint8_t running, armed;
+static uint64_t start, armed_at;
+static uint64_t wrapped;        //wraps of the counter TOF has been set for
+
+static uint64_t bus_now(void)
+{
+  return k20sim_now() / (K20SIM_CORE_HZ / K20SIM_PERIPH_HZ);
+}
+
+/*
+ * FTM0
+ */
+
+static void ftm_edge(uint64_t t, uint8_t level)
+{
+  FTM_MemMapPtr ftm = FTM;
+
+  //edges are looked at when the firmware next reads, so skip any from
+  //before the counter started or the capture was armed
+  if (!running || t < start || t < armed_at)
+    return;
+  if (armed == 1 && level == 0) {
+    ftm->CONTROLS[2].CnV = (t - start) & 0xffff;
+    ftm->CONTROLS[2].CnSC |= FTM_CnSC_CHF_MASK;
+    armed = 2;
+  } else if (armed == 2 && level == 1) {
+    ftm->CONTROLS[3].CnV = (t - start) & 0xffff;
+    ftm->CONTROLS[3].CnSC |= FTM_CnSC_CHF_MASK;
+    //one-shot: done until armed again
+    ftm->COMBINE &= ~FTM_COMBINE_DECAP1_MASK;
+    armed = 0;
+  }
+}
+
+// Edges up to now, in order
+static void ftm_update(void)
+{
+  uint64_t now = bus_now();
+
+  while (next_edge < n_edges && edges[next_edge].t <= now) {
+    ftm_edge(edges[next_edge].t, edges[next_edge].level);
+    next_edge++;
+  }
+  if (!running)
+    return;
+  FTM->CNT = (now - start) & 0xffff;
+  if ((now - start) >> 16 != wrapped) {
+    wrapped = (now - start) >> 16;
+    FTM->SC |= FTM_SC_TOF_MASK;
+  }
+}
+
+static void ftm_read(uint32_t addr)
+{
+  ftm_update();
+}
+
+static void ftm_write(uint32_t addr, uint32_t old, uint32_t value)
+{
+  FTM_MemMapPtr ftm = FTM;
+  uint64_t now = bus_now();
+
+  switch (addr - FTM0_ADDRESS) {
+  case 0x00:                   //SC
+    if (!running && (value & FTM_SC_CLKS_MASK)) {
+      start = now - ftm->CNT;
+      wrapped = 0;
+    }
+    running = (value & FTM_SC_CLKS_MASK) != 0;
+    break;
+  case 0x04:                   //CNT, any write loads CNTIN (0)
+    ftm->CNT = 0;
+    start = now;
+    break;
+  case 0x64:                   //COMBINE
+    if ((value & FTM_COMBINE_DECAP1_MASK) && !(old & FTM_COMBINE_DECAP1_MASK)) {
+      armed = 1;
+      armed_at = now;
+    } else if (!(value & FTM_COMBINE_DECAP1_MASK))
+      armed = 0;
+    break;
+  }
+}
+
+static const k20sim_hooks_t ftm_hooks = {
+  .read = ftm_read,
+  .write = ftm_write,
+};
+
+/*
+ * The far end
+ */
+
+// Sends chars at baud from bus time t, each followed by gap idle bits
+static uint64_t line_send(uint64_t t, uint32_t baud, uint8_t c, uint32_t count,
+                          uint32_t gap)
+{
+  double bit = (double) K20SIM_PERIPH_HZ / baud;
+  uint8_t level = 1, b;
+  uint32_t i, n;
+
+  for (n = 0; n < count; n++) {
+    for (i = 0; i < 10 + gap; i++) {
+      b = i == 0 ? 0 : i <= 8 ? (c >> (i - 1)) & 1 : 1;
+      if (b != level && n_edges < MAX_EDGES) {
+        edges[n_edges].t = t + (uint64_t) (i * bit + 0.5);
+        edges[n_edges].level = b;
+        n_edges++;
+        level = b;
+      }
+    }
+    t += (uint64_t) ((10 + gap) * bit + 0.5);
+  }
+  return t;
+}
+
+static uint64_t ms(double ms)
+{
+  return (uint64_t) (ms * K20SIM_PERIPH_HZ / 1000);
+}
+
+static void tick(void)
+{
+  k20sim_advance(STEP * (K20SIM_CORE_HZ / K20SIM_PERIPH_HZ));
+}
+
+enum { SYNC, BUSY_SYNC, NO_GAP, QUIET };
+
+static const char *const case_names[] = {
+  "sync", "traffic then sync", "traffic, no gap", "quiet line"
+};
+
+static int failures = 0;
+
+/*
+ * One case; uart_autobaud() must return the rate uart_plan_baud() gets for
+ * baud, or 0 if expect_none
+ */
+static void run(uart_t * uart, int kind, uint32_t baud, int expect_none)
+{
+  uint64_t t, begin;
+  uint32_t got, expect = 0, timeout = 200;
+  uint16_t sbr;
+  uint8_t brfa;
+  int32_t ppm;
+
+  n_edges = next_edge = 0;
+  running = armed = 0;
+  begin = t = bus_now();
+  switch (kind) {
+  case SYNC:
+    line_send(t + ms(12), baud, 0x00, 1, 1);
+    break;
+  case BUSY_SYNC:
+    //traffic at the call, a quiet gap, then the sync char
+    t = line_send(t, baud, 0x55, 4, 0);
+    t = line_send(t, baud, 0xf0, 4, 2);
+    line_send(t + ms(12), baud, 0x00, 1, 1);
+    break;
+  case NO_GAP:
+    //sync chars among traffic, never after a quiet line
+    timeout = 20;
+    while (t < begin + ms(timeout + 5) && n_edges + 20 < MAX_EDGES) {
+      t = line_send(t, baud, 0x55, 3, 0);
+      t = line_send(t, baud, 0x00, 1, 1);
+    }
+    break;
+  case QUIET:
+    timeout = 20;
+    break;
+  }
+
+  if (!expect_none)
+    expect = uart_plan_baud(K20SIM_CORE_HZ, baud, &sbr, &brfa, &ppm);
+  got = uart_autobaud(uart, timeout);
+  printf("%-20s %8u baud: %8u %s\n", case_names[kind], baud, got,
+         got == expect ? "ok" : "FAIL");
+  if (got != expect)
+    failures++;
+}
+
+int main(int argc, char **argv)
+{
+  static const uint32_t bauds[] = {1200, 2400, 4800, 9600, 115200, 1000000,
+                                   3000000};
+  uart_t *uart;
+  unsigned int i;
+
+  k20sim_init();
+  uartsim_init(1, NULL, NULL);
+  k20sim_hook(FTM0_ADDRESS, &ftm_hooks);
+  uart = uart_open(1, 115200);
+  k20sim_ticker(tick, TICK_US);
+
+  for (i = 0; i < sizeof(bauds) / sizeof(bauds[0]); i++) {
+    run(uart, SYNC, bauds[i], 0);
+    run(uart, BUSY_SYNC, bauds[i], 0);
+  }
+  run(uart, NO_GAP, 115200, 1);
+  run(uart, QUIET, 0, 1);
+  run(uart, SYNC, 600, 1);
+  k20sim_ticker(NULL, 0);
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * Chars arriving while the UART library clears an idle line, on the
+ * uartsim model
+ *
+ * The firmware side is Teensy3xLib's uart.c, unchanged. When the line goes
+ * idle with the receive FIFO empty, the interrupt handler clears IDLE, which
+ * takes a read of D. On the part the line keeps running while the handler
+ * does, so a char can land between the handler looking at the FIFO and
+ * reading D; that read must not take it, nor a FIFO flush throw it away.
+ * With receive DMA, D is the DMA's and the handler must not read it at all,
+ * yet the idle line must not keep interrupting and the next burst must still
+ * bring the idle callback.
+ *
+ * Each trial sends a burst, goes idle and has one char arrive just before
+ * the handler's n-th register read, for n from 1 until the handler reads no
+ * further, then sends another burst. That is done on UART0 (8-char FIFOs)
+ * and UART2 (none), with the receive interrupt and with receive DMA. Every
+ * char must arrive, in order, without the handler running more than a few
+ * times, and with DMA each burst must bring an idle callback, which is
+ * when the chars are read.
+ *
+ * uart_idle
+ *
+ * Exits nonzero if a trial fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uartsim.h"
+#include "uart.h"
+
+#define BAUD 115200
+// host time between characters, for the application to run in
+#define TICK_US 20
+
+#define RX_CHANNEL 1
+#define RXBUF 64
+
+// UART0's receive watermark, so the first burst leaves its FIFO empty
+#define BURST 4
+#define CHARS (2 * BURST + 1)
+#define MAX_READS 16
+// handler calls a trial may take: a few per burst and per idle line
+#define MAX_IRQS 12
+
+#define PATTERN(offset) ((uint8_t) (0x40 + (offset)))
+
+static uart_t *uart;
+static char rxbuf[RXBUF];
+
+static volatile int sending;
+static volatile uint32_t far_sent, idle_ticks, early_reads;
+static volatile uint32_t idle_calls;
+
+/*
+ * A burst, then idle line with the early char due, then the second burst;
+ * the early char is asked for from inside a register read
+ */
+static int far_tx(uint8_t * c)
+{
+  if (!sending)
+    return 0;
+  if (far_sent == BURST && idle_ticks == 0) {
+    idle_ticks++;
+    uartsim_rx_early(early_reads);
+    return 0;
+  }
+  if (far_sent == BURST + 1 && idle_ticks < 3) {
+    idle_ticks++;
+    return 0;
+  }
+  if (far_sent == CHARS)
+    return 0;
+  *c = PATTERN(far_sent);
+  far_sent++;
+  return 1;
+}
+
+static void idle_callback(uart_t * u, int32_t avail)
+{
+  idle_calls++;
+}
+
+static void tick(void)
+{
+  uartsim_tick();
+}
+
+// One trial; returns nonzero if it fails
+static int trial(uint8_t num, int dma, uint32_t reads)
+{
+  uartsim_stats_t stats;
+  uint32_t got = 0, errors = 0, seen = 0;
+  uint64_t end;
+  char buf[CHARS];
+  int32_t n, i;
+
+  sending = 0;
+  uartsim_init(num, NULL, far_tx);
+  uart = uart_open(num, BAUD);
+  uart_set_idle_callback(uart, idle_callback);
+  if (dma && uart_init_dma(uart, UART_NO_DMA, RX_CHANNEL, rxbuf, RXBUF) < 0)
+    errors++;
+  far_sent = idle_ticks = 0;
+  idle_calls = 0;
+  early_reads = reads;
+  uartsim_stats(&stats, 1);
+  sending = 1;
+
+  end = k20sim_now() + (CHARS + 8) * uartsim_char_cycles();
+  while (k20sim_now() < end) {
+    //with DMA, the chars are read when the idle callback says
+    if (dma && idle_calls == seen)
+      continue;
+    seen = idle_calls;
+    n = uart_read_available(uart, buf, sizeof(buf));
+    for (i = 0; i < n; i++) {
+      if ((uint8_t) buf[i] != PATTERN(got))
+        errors++;
+      got++;
+    }
+  }
+  uartsim_stats(&stats, 1);
+
+  if (got != CHARS || errors || stats.rx_overruns
+      || stats.irqs > MAX_IRQS || (dma && idle_calls < 2)) {
+    printf("UART%u %s, char before read %u: %u of %u chars, %u wrong,"
+           " %u overruns, %u idle callbacks, %u interrupts\n", num,
+           dma ? "dma" : "irq", reads, got, CHARS, errors,
+           stats.rx_overruns, idle_calls, stats.irqs);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const uint8_t uarts[] = {0, 2};
+  unsigned int u, failed = 0, trials = 0;
+  uint32_t reads;
+  int dma;
+
+  k20sim_init();
+  k20sim_ticker(tick, TICK_US);
+
+  for (u = 0; u < sizeof(uarts); u++)
+    for (dma = 0; dma < 2; dma++)
+      for (reads = 1; reads <= MAX_READS; reads++) {
+        failed += trial(uarts[u], dma, reads);
+        trials++;
+      }
+  k20sim_ticker(NULL, 0);
+
+  printf("%u of %u trials failed: %s\n", failed, trials,
+         failed ? "FAIL" : "ok");
+  return failed != 0;
+}
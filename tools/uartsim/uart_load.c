@@ -0,0 +1,261 @@
+/**
+ * Sustained throughput and interrupt load of the UART library per baud
+ * rate, with and without DMA, on the uartsim model
+ *
+ * The firmware side is Teensy3xLib's uart.c, unchanged. Each rate is run on
+ * UART0 (8-char FIFOs, core clock) and UART2 (no FIFO, bus clock), in five
+ * ways, each moving the same number of chars:
+ *
+ *   tx irq    uart_write() flat out; the interrupt fills the FIFO
+ *   tx dmaq   uart_write() flat out with transmit DMA, which sends the
+ *             queue a stretch at a time
+ *   tx dma    uart_write_dma() of 1 KB blocks back to back, no copying
+ *   rx irq    the far end sends bursts of 64 chars with two idle character
+ *             times between; the interrupt drains the FIFO into the queue
+ *             and the main loop reads it with uart_read_available()
+ *   rx dma    the same bursts into a 1 KB circular buffer, read by the main
+ *             loop once per burst when the idle callback fires
+ *
+ * Every char is checked at the other end. chars/s is in simulated time,
+ * in which firmware instructions take none, so it is what the line carries
+ * with a CPU that keeps up. The load is what says whether it does:
+ * UARTn_RX_TX_IRQHandler's instructions per second of line time as a share
+ * of the 96 MHz core clock. The counts are for the host build, so take one
+ * instruction as roughly one M4 cycle: good for comparing modes and rates,
+ * not for a cycle budget. Where the load passes 100% the part cannot
+ * sustain that mode at that rate. The main loop's own work (uart_write()
+ * copying into the queue, the reads) is not counted.
+ *
+ * UART4 has one DMA request for both directions; uart_init_dma() must
+ * refuse both channels for it and accept either alone.
+ *
+ * uart_load [chars]
+ *
+ * Exits nonzero if a char arrives wrong or missing, or a check fails.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uartsim.h"
+#include "uart.h"
+
+// host time between characters, for the application to run in
+#define TICK_US 20
+
+#define TX_CHANNEL 0
+#define RX_CHANNEL 1
+
+#define BLOCK 1024              //uart_write_dma() size
+#define RXBUF 1024              //receive DMA buffer, a power of two
+#define BURST 64
+#define GAP 2
+
+#define PATTERN(offset) ((uint8_t) ((offset) * 7 + ((offset) >> 8)))
+
+enum { TX_IRQ, TX_DMAQ, TX_DMA, RX_IRQ, RX_DMA, MODES };
+
+static const char *const mode_names[MODES] = {
+  "tx irq", "tx dmaq", "tx dma", "rx irq", "rx dma"
+};
+
+static uart_t *uart;
+static char rxbuf[RXBUF];
+
+// what the far end has sent and received
+static volatile uint64_t far_sent, far_received, far_limit;
+static volatile uint32_t errors;
+static volatile uint32_t gap;
+
+static volatile uint32_t idle_calls;
+
+static int failures = 0;
+
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+static void far_rx(uint8_t c)
+{
+  if (c != PATTERN(far_received))
+    errors++;
+  far_received++;
+}
+
+static int far_tx(uint8_t * c)
+{
+  if (far_sent == far_limit || gap) {
+    if (gap)
+      gap--;
+    return 0;
+  }
+  *c = PATTERN(far_sent);
+  far_sent++;
+  if (far_sent % BURST == 0)
+    gap = GAP;
+  return 1;
+}
+
+static void idle_callback(uart_t * u, int32_t avail)
+{
+  idle_calls++;
+}
+
+static void tick(void)
+{
+  uartsim_tick();
+}
+
+/*
+ * Moves chars one way in the given mode; returns the simulated cycles it
+ * took, or 0 if the UART cannot make the rate
+ */
+static uint64_t run(uint8_t num, uint32_t baud, int mode, uint32_t chars)
+{
+  static char block[2][BLOCK];
+  uartsim_stats_t stats;
+  uint64_t begin, end, sent = 0, got = 0;
+  char buf[BURST];
+  int32_t n, i;
+
+  uartsim_init(num, far_rx, far_tx);
+  uart = uart_open(num, baud);
+  if (uart == NULL)
+    return 0;
+  far_limit = far_sent = far_received = 0;
+  gap = 0;
+  errors = 0;
+  idle_calls = 0;
+  uart_set_idle_callback(uart, idle_callback);
+
+  switch (mode) {
+  case TX_DMAQ:
+  case TX_DMA:
+    if (uart_init_dma(uart, TX_CHANNEL, UART_NO_DMA, NULL, 0) < 0)
+      errors++;
+    break;
+  case RX_DMA:
+    if (uart_init_dma(uart, UART_NO_DMA, RX_CHANNEL, rxbuf, RXBUF) < 0)
+      errors++;
+    break;
+  }
+
+  uartsim_count(1);
+  uartsim_stats(&stats, 1);
+  //the far end starts sending once the UART is set up
+  far_limit = mode >= RX_IRQ ? chars : 0;
+  begin = k20sim_now();
+  switch (mode) {
+  case TX_IRQ:
+  case TX_DMAQ:
+    while (sent < chars) {
+      n = chars - sent < BLOCK ? chars - sent : BLOCK;
+      for (i = 0; i < n; i++)
+        block[0][i] = PATTERN(sent + i);
+      sent += uart_write(uart, block[0], n);
+    }
+    uart_flush(uart);
+    break;
+  case TX_DMA:
+    while (sent < chars) {
+      n = chars - sent < BLOCK ? chars - sent : BLOCK;
+      //one block fills while the other goes
+      for (i = 0; i < n; i++)
+        block[sent / BLOCK % 2][i] = PATTERN(sent + i);
+      //returns 0 until the block before has gone
+      while (uart_write_dma(uart, block[sent / BLOCK % 2], n, NULL) == 0) ;
+      sent += n;
+    }
+    uart_flush(uart);
+    break;
+  case RX_IRQ:
+  case RX_DMA:
+    end = k20sim_now() + (chars + chars / BURST * GAP + 8)
+        * uartsim_char_cycles();
+    while (got < chars && k20sim_now() < end) {
+      if (mode == RX_DMA && idle_calls == 0)
+        continue;
+      idle_calls = 0;
+      while ((n = uart_read_available(uart, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < n; i++) {
+          if ((uint8_t) buf[i] != PATTERN(got))
+            errors++;
+          got++;
+        }
+      }
+    }
+    if (got != chars)
+      errors++;
+    break;
+  }
+  end = k20sim_now();
+  uartsim_count(0);
+  if (mode < RX_IRQ && far_received != chars)
+    errors++;
+  return end - begin;
+}
+
+static int report(uint8_t num, uint32_t baud, int mode, uint32_t chars)
+{
+  uartsim_stats_t stats;
+  uint64_t cycles;
+  double seconds;
+
+  cycles = run(num, baud, mode, chars);
+  if (cycles == 0)
+    return 0;
+  uartsim_stats(&stats, 1);
+  seconds = (double) cycles / K20SIM_CORE_HZ;
+  printf("UART%u %8u %8s %9.0f %9.0f %9.1f %7.1f %6u\n", num, baud,
+         mode_names[mode], chars / seconds, stats.irqs / seconds,
+         (double) stats.irq_instructions / chars,
+         stats.irq_instructions / seconds / K20SIM_CORE_HZ * 100, errors);
+  return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const uint8_t uarts[] = {0, 2};
+  static const uint32_t bauds[] = {115200, 460800, 1000000, 2000000,
+                                   3000000, 4000000, 6000000};
+  uint32_t chars = 2048;
+  uart_t *uart4;
+  unsigned int u, b;
+  int mode, failed = 0;
+
+  if (argc > 1)
+    chars = atoi(argv[1]);
+  if (chars < BURST) {
+    fprintf(stderr, "usage: uart_load [chars]\n");
+    return 2;
+  }
+
+  k20sim_init();
+  k20sim_ticker(tick, TICK_US);
+
+  //UART4 is not modelled; its registers are plain memory
+  uartsim_init(0, NULL, NULL);
+  uart4 = uart_open(4, 115200);
+  check("UART4 DMA both ways refused",
+        uart_init_dma(uart4, 4, 5, rxbuf, RXBUF) == -1);
+  check("UART4 DMA one way accepted",
+        uart_init_dma(uart4, 4, UART_NO_DMA, NULL, 0) == 0
+        && uart_init_dma(uart4, UART_NO_DMA, 5, rxbuf, RXBUF) == 0);
+
+  printf("%5s %8s %8s %9s %9s %9s %7s %6s\n", "", "baud", "", "chars/s",
+         "irqs/s", "instr/ch", "load %", "errors");
+  for (u = 0; u < sizeof(uarts); u++)
+    for (b = 0; b < sizeof(bauds) / sizeof(bauds[0]); b++)
+      for (mode = 0; mode < MODES; mode++)
+        failed |= report(uarts[u], bauds[b], mode, chars);
+  k20sim_ticker(NULL, 0);
+
+  if (failed)
+    failures++;
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
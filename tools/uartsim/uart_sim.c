@@ -0,0 +1,290 @@
+/**
+ * Transmit queue throughput, caller latency and shared writers on the
+ * uartsim model
+ *
+ * The firmware side is Teensy3xLib's uart.c, unchanged. The line moves a
+ * character per k20sim ticker tick, so the application runs in between as it
+ * would on the part, and UARTn_RX_TX_IRQHandler fills the FIFO (or the data
+ * register, on a UART without one) from the TIE and TCIE interrupts.
+ *
+ * First the application writes a byte pattern with uart_write() in chunks
+ * of a fixed size, flat out or paced to leave the line half idle, and each
+ * write is timed twice in simulated time: how long uart_write() held the
+ * caller (waiting for queue space), and how long until the write's last char
+ * had left the line. For comparison, "polled" is how long sending the chunk
+ * a char at a time on TDRE would hold the caller. Firmware instructions take
+ * no simulated time, so these only count line time.
+ *
+ * Then an interrupt handler writes too, every few ticks, while the main
+ * loop writes flat out. The UART is in UART_WRITE_DROP mode, as a handler
+ * needs, so the main loop retries what was not taken. Each writer's chars
+ * carry their own sequence, and both sequences must arrive whole and in
+ * order.
+ *
+ * uart_sim [seconds]
+ *
+ * Seconds are simulated line time per run (default 0.2). Exits nonzero if a
+ * char arrives wrong or missing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "uartsim.h"
+#include "uart.h"
+
+#define BAUD 115200
+// host time between characters, for the application to run in
+#define TICK_US 20
+// ticks between writes from the interrupt handler
+#define ISR_EVERY 3
+#define ISR_MAX_WRITE 24
+
+// uart.c's UART_XMT_Q_CHARS, plus the FIFO and the shifter
+#define QUEUED_MAX (256 + 8 + 1)
+
+#define MAX_WRITE 1024
+#define N_WRITES 4096           //writes in flight, must be a power of two
+
+// each writer's chars: seven bits of pattern, the top bit says whose
+#define PATTERN(offset) ((uint8_t) (((offset) * 7 + ((offset) >> 7)) & 0x7f))
+#define ISR_CHAR 0x80
+
+static uart_t *uart;
+
+// main loop writes the line has not finished, oldest first
+static struct {
+  uint64_t end;                 //offset just past the write
+  uint64_t start;               //when uart_write() was called
+} writes[N_WRITES];
+static volatile uint32_t writes_head = 0, writes_tail = 0;
+
+static uint64_t sent = 0;
+static volatile uint64_t received = 0, isr_received = 0;
+static volatile uint32_t errors = 0;
+static volatile uint64_t latency_sum = 0, latency_max = 0;
+static volatile uint32_t latency_count = 0;
+
+static volatile int isr_writing = 0;
+static uint64_t isr_sent = 0;
+static uint32_t isr_writes = 0, isr_dropped = 0;
+static uint32_t seed = 1;
+
+static uint32_t rnd(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Each char as its stop bit goes out
+static void line_rx(uint8_t c)
+{
+  uint64_t latency;
+
+  if (c & ISR_CHAR) {
+    if (c != (ISR_CHAR | PATTERN(isr_received)))
+      errors++;
+    isr_received++;
+    return;
+  }
+  if (c != PATTERN(received))
+    errors++;
+  received++;
+
+  while (writes_tail != writes_head
+         && writes[writes_tail & (N_WRITES - 1)].end <= received) {
+    latency = k20sim_now() - writes[writes_tail & (N_WRITES - 1)].start;
+    latency_sum += latency;
+    if (latency > latency_max)
+      latency_max = latency;
+    latency_count++;
+    writes_tail++;
+  }
+}
+
+// A writer in an interrupt handler; takes whatever the queue has room for
+static void isr_write(void)
+{
+  char chunk[ISR_MAX_WRITE];
+  int32_t size, n, i;
+
+  size = 1 + rnd() % ISR_MAX_WRITE;
+  for (i = 0; i < size; i++)
+    chunk[i] = ISR_CHAR | PATTERN(isr_sent + i);
+  n = uart_write(uart, chunk, size);
+  isr_sent += n;
+  isr_dropped += size - n;
+  isr_writes++;
+}
+
+static void tick(void)
+{
+  static uint32_t ticks = 0;
+
+  uartsim_tick();
+  if (isr_writing && ++ticks % ISR_EVERY == 0)
+    k20sim_irq(isr_write);
+}
+
+/*
+ * Waits for the line to send everything written, or for as long as that can
+ * take; what has not arrived by then never will
+ */
+static void drain(void)
+{
+  uint64_t end = k20sim_now() + (QUEUED_MAX + 1) * uartsim_char_cycles();
+
+  while ((received < sent || isr_received < isr_sent) && k20sim_now() < end) ;
+  if (received < sent || isr_received < isr_sent) {
+    errors += (sent - received) + (isr_sent - isr_received);
+    received = sent;
+    isr_received = isr_sent;
+  }
+}
+
+static double us(double cycles)
+{
+  return cycles * 1e6 / K20SIM_CORE_HZ;
+}
+
+/*
+ * Runs writes of size chars for the given time, flat out or paced to every
+ * other write's worth of line time; returns nonzero on errors
+ */
+static int run(uint8_t num, int size, int paced, double seconds)
+{
+  static char chunk[MAX_WRITE];
+  uint64_t start, end, begin, next, held, held_sum = 0, held_max = 0;
+  uint64_t first, char_cycles;
+  uint32_t count = 0;
+  int32_t n;
+  int i;
+
+  latency_sum = latency_max = 0;
+  latency_count = 0;
+  first = received;
+  char_cycles = uartsim_char_cycles();
+  begin = next = k20sim_now();
+  end = begin + (uint64_t) (seconds * K20SIM_CORE_HZ);
+
+  while (k20sim_now() < end) {
+    while (k20sim_now() < next) ;
+    for (i = 0; i < size; i++)
+      chunk[i] = PATTERN(sent + i);
+    //the line cannot get ahead of the record, there is always room
+    while (writes_head - writes_tail == N_WRITES) ;
+
+    start = k20sim_now();
+    writes[writes_head & (N_WRITES - 1)].start = start;
+    writes[writes_head & (N_WRITES - 1)].end = sent + size;
+    writes_head++;
+    n = uart_write(uart, chunk, size);
+    held = k20sim_now() - start;
+
+    sent += n;
+    if (n != size)
+      errors++;
+    held_sum += held;
+    if (held > held_max)
+      held_max = held;
+    count++;
+    if (paced)
+      next = start + 2 * size * char_cycles;
+  }
+
+  //let the line catch up before the next size
+  drain();
+
+  printf("UART%u %6d %6s %8.0f %10.1f %10.1f %10.1f %10.1f %10.1f %6u\n",
+         num, size, paced ? "paced" : "flat", (received - first)
+         / (us(k20sim_now() - begin) / 1e6), us(size * char_cycles),
+         us((double) held_sum / count), us(held_max),
+         us((double) latency_sum / latency_count), us(latency_max), errors);
+  return errors != 0;
+}
+
+/*
+ * The main loop and an interrupt handler writing at once; returns nonzero
+ * if either's chars arrive wrong or missing
+ */
+static int shared(uint8_t num, double seconds)
+{
+  static char chunk[MAX_WRITE];
+  uint64_t end, main_first, isr_first;
+  uartsim_stats_t stats;
+  int32_t size, n;
+  int i, failed;
+
+  uart_set_write_mode(uart, UART_WRITE_DROP);
+  main_first = received;
+  isr_first = isr_received;
+  isr_writes = isr_dropped = 0;
+  end = k20sim_now() + (uint64_t) (seconds * K20SIM_CORE_HZ);
+  isr_writing = 1;
+
+  while (k20sim_now() < end) {
+    size = 1 + rnd() % 300;
+    for (i = 0; i < size; i++)
+      chunk[i] = PATTERN(sent + i);
+    for (n = 0; n < size;)
+      n += uart_write(uart, chunk + n, size - n);
+    sent += size;
+  }
+
+  isr_writing = 0;
+  drain();
+  uart_set_write_mode(uart, UART_WRITE_BLOCK);
+  uartsim_stats(&stats, 1);
+
+  failed = errors != 0 || stats.tx_overflows != 0;
+  printf("UART%u shared: main loop %llu chars, handler %llu chars in %u writes"
+         " (%u dropped), %u errors, %u overflows: %s\n", num,
+         (unsigned long long) (received - main_first),
+         (unsigned long long) (isr_received - isr_first), isr_writes,
+         isr_dropped, errors, stats.tx_overflows, failed ? "FAIL" : "ok");
+  return failed;
+}
+
+int main(int argc, char **argv)
+{
+  static const uint8_t uarts[] = {0, 2};
+  static const int sizes[] = {1, 16, 100, 256, 1024};
+  double seconds = 0.2;
+  uartsim_stats_t stats;
+  int failed = 0;
+  unsigned int u, i;
+
+  if (argc > 1)
+    seconds = atof(argv[1]);
+  if (seconds <= 0) {
+    fprintf(stderr, "usage: uart_sim [seconds]\n");
+    return 2;
+  }
+
+  k20sim_init();
+  k20sim_ticker(tick, TICK_US);
+
+  printf("%5s %6s %6s %8s %10s %10s %10s %10s %10s %6s\n", "", "write", "",
+         "chars/s", "polled us", "held us", "max", "latency us", "max",
+         "errors");
+  for (u = 0; u < sizeof(uarts); u++) {
+    uartsim_init(uarts[u], line_rx, NULL);
+    uart = uart_open(uarts[u], BAUD);
+    sent = received = isr_sent = isr_received = 0;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      failed |= run(uarts[u], sizes[i], 0, seconds);
+      failed |= run(uarts[u], sizes[i], 1, seconds);
+    }
+    uartsim_stats(&stats, 1);
+    if (stats.tx_overflows) {
+      printf("UART%u: %u chars written to a full FIFO\n", uarts[u],
+             stats.tx_overflows);
+      failed = 1;
+    }
+    failed |= shared(uarts[u], seconds);
+  }
+  k20sim_ticker(NULL, 0);
+
+  return failed;
+}
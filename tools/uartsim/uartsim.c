@@ -0,0 +1,454 @@
+/**
+ * K20 UART model, and the line at the other end
+ *
+ * See uartsim.h. The registers that change on their own (S1, TCFIFO,
+ * RCFIFO, SFIFO) are worked out from the model's state before every read of
+ * the UART's page, and a read of D takes a char from the receive FIFO. The
+ * write hook applies D, CFIFO, SFIFO and PFIFO writes, and the eDMA page's
+ * hook SERQ, CERQ and CDNE. Interrupts and DMA requests are only looked at
+ * from uartsim_tick(): a hook runs in the middle of a firmware register
+ * access and must not start a handler.
+ */
+#include <string.h>
+
+#include "uartsim.h"
+#include "arm_cm4.h"
+
+#define UART_N 5
+#define FIFO_MAX 8
+
+#define DMA_ADDRESS 0x40008000u
+#define DMA ((DMA_MemMapPtr) k20sim_reg(DMA_ADDRESS))
+#define DMAMUX ((DMAMUX_MemMapPtr) k20sim_reg((uint32_t) (uintptr_t) \
+                                              DMAMUX_BASE_PTR))
+#define DMA_CHANNELS 16
+
+void UART0_RX_TX_IRQHandler(void);
+void UART1_RX_TX_IRQHandler(void);
+void UART2_RX_TX_IRQHandler(void);
+void UART3_RX_TX_IRQHandler(void);
+void UART4_RX_TX_IRQHandler(void);
+
+static const struct {
+  UART_MemMapPtr base;
+  void (*handler) (void);
+  uint8_t fifo;                 //PFIFO size field, both ways
+  uint8_t coreclk;
+  uint8_t rxsrc;                //DMA request sources
+  uint8_t txsrc;
+} ports[UART_N] = {
+  {UART0_BASE_PTR, UART0_RX_TX_IRQHandler, 2, 1, 2, 3},
+  {UART1_BASE_PTR, UART1_RX_TX_IRQHandler, 2, 1, 4, 5},
+  {UART2_BASE_PTR, UART2_RX_TX_IRQHandler, 0, 0, 6, 7},
+  {UART3_BASE_PTR, UART3_RX_TX_IRQHandler, 0, 0, 8, 9},
+  {UART4_BASE_PTR, UART4_RX_TX_IRQHandler, 0, 0, 10, 10},
+};
+
+// UART_N until uartsim_init() is done, so that ticks leave it alone
+static volatile uint8_t num = UART_N;
+static uint32_t address;
+static void (*line_tx) (uint8_t c);
+static int (*line_rx) (uint8_t * c);
+
+static uint8_t depth;
+static uint8_t tx_fifo[FIFO_MAX];
+static uint8_t tx_out, tx_count;
+static uint8_t shifter, shifting;
+static uint8_t rx_fifo[FIFO_MAX];
+static uint8_t rx_out, rx_count;
+static uint8_t rx_active;       //a char has come in since the line was idle
+static uint8_t idle, overrun;   //the S1 flags that stay set until cleared
+static uint8_t s1_seen;         //...and which of them the last S1 read saw
+static uint32_t early;          //reads until the far end's next char comes
+
+// a read hook is running; SIGALRM is not held off until it is done
+static volatile int in_hook = 0;
+
+static int counting = 0;
+static uartsim_stats_t stats;
+
+#define UART ((UART_MemMapPtr) k20sim_reg(address))
+
+/*
+ * Device side
+ */
+
+static void uartsim_isr(void)
+{
+  uint64_t n;
+
+  stats.irqs++;
+  if (!counting) {
+    ports[num].handler();
+    return;
+  }
+
+  k20sim_count_start();
+  ports[num].handler();
+  n = k20sim_count_stop();
+  stats.irq_instructions += n;
+  if (n > stats.irq_max)
+    stats.irq_max = n;
+}
+
+static int uartsim_tdre(void)
+{
+  return tx_count <= UART->TWFIFO;
+}
+
+static int uartsim_tc(void)
+{
+  return tx_count == 0 && !shifting;
+}
+
+static int uartsim_rdrf(void)
+{
+  uint8_t water = UART->RWFIFO;
+
+  return rx_count >= (water ? water : 1);
+}
+
+static uint8_t uartsim_s1(void)
+{
+  uint8_t s1 = 0;
+
+  if (uartsim_tdre())
+    s1 |= UART_S1_TDRE_MASK;
+  if (uartsim_tc())
+    s1 |= UART_S1_TC_MASK;
+  if (uartsim_rdrf())
+    s1 |= UART_S1_RDRF_MASK;
+  if (idle)
+    s1 |= UART_S1_IDLE_MASK;
+  if (overrun)
+    s1 |= UART_S1_OR_MASK;
+  return s1;
+}
+
+// A char into the transmit FIFO, from the firmware or the DMA
+static void uartsim_push(uint8_t c)
+{
+  if (tx_count == depth) {
+    UART->SFIFO |= UART_SFIFO_TXOF_MASK;
+    stats.tx_overflows++;
+    return;
+  }
+  tx_fifo[(tx_out + tx_count) % depth] = c;
+  tx_count++;
+}
+
+// A read of D, by the firmware or the DMA
+static uint8_t uartsim_pop(void)
+{
+  uint8_t c = 0;
+
+  //S1 then D clears IDLE and OR, if S1 showed them
+  if (s1_seen & UART_S1_IDLE_MASK)
+    idle = 0;
+  if (s1_seen & UART_S1_OR_MASK)
+    overrun = 0;
+  s1_seen = 0;
+
+  if (rx_count == 0) {
+    if (depth > 1)
+      UART->SFIFO |= UART_SFIFO_RXUF_MASK;
+    return c;
+  }
+  c = rx_fifo[rx_out];
+  rx_out = (rx_out + 1) % depth;
+  rx_count--;
+  return c;
+}
+
+// Starts the next char if the shifter is free
+static void uartsim_shift(void)
+{
+  if (shifting || tx_count == 0 || !(UART->C2 & UART_C2_TE_MASK))
+    return;
+  shifter = tx_fifo[tx_out];
+  tx_out = (tx_out + 1) % depth;
+  tx_count--;
+  shifting = 1;
+}
+
+static void uartsim_receive_char(uint8_t c);
+
+static void uartsim_read(uint32_t addr)
+{
+  UART_MemMapPtr uart = UART;
+  uint8_t c;
+
+  in_hook = 1;
+  if (early && --early == 0 && line_rx != NULL && line_rx(&c))
+    uartsim_receive_char(c);
+  uart->S1 = uartsim_s1();
+  uart->TCFIFO = tx_count;
+  uart->RCFIFO = rx_count;
+  uart->SFIFO = (uart->SFIFO & ~(UART_SFIFO_TXEMPT_MASK
+                                 | UART_SFIFO_RXEMPT_MASK))
+      | (tx_count == 0 ? UART_SFIFO_TXEMPT_MASK : 0)
+      | (rx_count == 0 ? UART_SFIFO_RXEMPT_MASK : 0);
+
+  switch (addr - address) {
+  case 0x04:                   //S1
+    s1_seen = uart->S1;
+    break;
+  case 0x07:                   //D
+    uart->D = uartsim_pop();
+    break;
+  }
+  in_hook = 0;
+}
+
+static void uartsim_write(uint32_t addr, uint32_t old, uint32_t value)
+{
+  UART_MemMapPtr uart = UART;
+  uint32_t offset = addr - address;
+  uint8_t before = old >> ((addr & 3) * 8);
+  uint8_t after = value >> ((addr & 3) * 8);
+
+  switch (offset) {
+  case 0x07:                   //D
+    uartsim_push(after);
+    uartsim_shift();
+    break;
+  case 0x10:                   //PFIFO, sizes are read-only
+    uart->PFIFO = (after & (UART_PFIFO_TXFE_MASK | UART_PFIFO_RXFE_MASK))
+        | (before & (UART_PFIFO_TXFIFOSIZE_MASK | UART_PFIFO_RXFIFOSIZE_MASK));
+    break;
+  case 0x11:                   //CFIFO, flushes are one-shot
+    if (after & UART_CFIFO_TXFLUSH_MASK)
+      tx_count = 0;
+    if (after & UART_CFIFO_RXFLUSH_MASK)
+      rx_count = 0;
+    uart->CFIFO = after & ~(UART_CFIFO_TXFLUSH_MASK | UART_CFIFO_RXFLUSH_MASK);
+    break;
+  case 0x12:                   //SFIFO
+    uart->SFIFO = before & ~after;
+    break;
+  case 0x03:                   //C2, TE may have been set
+    uartsim_shift();
+    break;
+  }
+}
+
+static const k20sim_hooks_t uartsim_hooks = {
+  .read = uartsim_read,
+  .write = uartsim_write,
+};
+
+/*
+ * eDMA
+ */
+
+static void uartsim_dma_write(uint32_t addr, uint32_t old, uint32_t value)
+{
+  DMA_MemMapPtr dma = DMA;
+  uint8_t channel = (value >> ((addr & 3) * 8)) & 0x0f;
+
+  switch (addr - DMA_ADDRESS) {
+  case 0x1a:                   //CERQ
+    dma->ERQ &= ~(1 << channel);
+    break;
+  case 0x1b:                   //SERQ
+    dma->ERQ |= 1 << channel;
+    break;
+  case 0x1c:                   //CDNE
+    dma->TCD[channel].CSR &= ~DMA_CSR_DONE_MASK;
+    break;
+  }
+}
+
+static const k20sim_hooks_t uartsim_dma_hooks = {
+  .read = NULL,
+  .write = uartsim_dma_write,
+};
+
+// The channel source is routed to, if its requests are enabled, or -1
+static int uartsim_dma_channel(uint8_t source)
+{
+  int c;
+
+  for (c = 0; c < DMA_CHANNELS; c++) {
+    if (DMAMUX->CHCFG[c] == (DMAMUX_CHCFG_SOURCE(source)
+                             | DMAMUX_CHCFG_ENBL_MASK))
+      return (DMA->ERQ & (1 << c)) ? c : -1;
+  }
+  return -1;
+}
+
+// One minor loop of one byte; ends the major loop when it is due
+static void uartsim_dma_move(int c, int tx)
+{
+  DMA_MemMapPtr dma = DMA;
+
+  if (tx) {
+    uartsim_push(*(uint8_t *) (uintptr_t) dma->TCD[c].SADDR);
+    dma->TCD[c].SADDR += (int16_t) dma->TCD[c].SOFF;
+  } else {
+    *(uint8_t *) (uintptr_t) dma->TCD[c].DADDR = uartsim_pop();
+    dma->TCD[c].DADDR += (int16_t) dma->TCD[c].DOFF;
+  }
+  stats.dma_requests++;
+  if (--dma->TCD[c].CITER_ELINKNO > 0)
+    return;
+
+  dma->TCD[c].SADDR += dma->TCD[c].SLAST;
+  dma->TCD[c].DADDR += dma->TCD[c].DLAST_SGA;
+  dma->TCD[c].CITER_ELINKNO = dma->TCD[c].BITER_ELINKNO;
+  dma->TCD[c].CSR |= DMA_CSR_DONE_MASK;
+  if (dma->TCD[c].CSR & DMA_CSR_DREQ_MASK)
+    dma->ERQ &= ~(1 << c);
+}
+
+// Serves the UART's DMA requests for as long as they stay asserted
+static void uartsim_dma(void)
+{
+  UART_MemMapPtr uart = UART;
+  int c;
+
+  while ((uart->C5 & UART_C5_TDMAS_MASK) && (uart->C2 & UART_C2_TIE_MASK)
+         && uartsim_tdre() && tx_count < depth
+         && (c = uartsim_dma_channel(ports[num].txsrc)) >= 0) {
+    uartsim_dma_move(c, 1);
+    uartsim_shift();
+  }
+  while ((uart->C5 & UART_C5_RDMAS_MASK) && (uart->C2 & UART_C2_RIE_MASK)
+         && uartsim_rdrf()
+         && (c = uartsim_dma_channel(ports[num].rxsrc)) >= 0)
+    uartsim_dma_move(c, 0);
+}
+
+static void uartsim_interrupt(void)
+{
+  UART_MemMapPtr uart = UART;
+  uint8_t c2 = uart->C2, c5 = uart->C5;
+
+  if (((c2 & UART_C2_TIE_MASK) && !(c5 & UART_C5_TDMAS_MASK)
+       && uartsim_tdre())
+      || ((c2 & UART_C2_TCIE_MASK) && uartsim_tc())
+      || ((c2 & UART_C2_RIE_MASK) && !(c5 & UART_C5_RDMAS_MASK)
+          && uartsim_rdrf())
+      || ((c2 & UART_C2_ILIE_MASK) && idle))
+    k20sim_irq(uartsim_isr);
+}
+
+void uartsim_init(uint8_t n, void (*tx) (uint8_t c), int (*rx) (uint8_t * c))
+{
+  UART_MemMapPtr uart;
+
+  if (num < UART_N)
+    k20sim_hook(address, NULL);
+  num = UART_N;
+  address = (uint32_t) (uintptr_t) ports[n].base;
+  line_tx = tx;
+  line_rx = rx;
+  depth = ports[n].fifo ? 2 << ports[n].fifo : 1;
+  tx_out = tx_count = shifting = 0;
+  rx_out = rx_count = rx_active = idle = overrun = s1_seen = 0;
+  early = 0;
+  memset(&stats, 0, sizeof(stats));
+
+  uart = UART;
+  memset((void *) uart, 0, sizeof(*uart));
+  uart->PFIFO = UART_PFIFO_TXFIFOSIZE(ports[n].fifo)
+      | UART_PFIFO_RXFIFOSIZE(ports[n].fifo);
+  uart->BDL = 4;
+  uart->RWFIFO = 1;
+  k20sim_hook(address, &uartsim_hooks);
+  k20sim_hook(DMA_ADDRESS, &uartsim_dma_hooks);
+  num = n;
+}
+
+void uartsim_rx_early(uint32_t reads)
+{
+  early = reads;
+}
+
+void uartsim_count(int on)
+{
+  counting = on;
+}
+
+void uartsim_stats(uartsim_stats_t * s, int clear)
+{
+  *s = stats;
+  if (clear)
+    memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ * Line side
+ */
+
+uint64_t uartsim_char_cycles(void)
+{
+  UART_MemMapPtr uart = UART;
+  uint64_t d, clock;
+
+  //the divisor in 32nds, as uart_plan_baud() has it
+  d = ((uart->BDH & 0x1f) << 8 | uart->BDL) * 32 + (uart->C4 & 0x1f);
+  if (d < 32)
+    d = 32;
+  clock = ports[num].coreclk ? K20SIM_CORE_HZ : K20SIM_PERIPH_HZ;
+  return 10 * 16 * d * K20SIM_CORE_HZ / 32 / clock;
+}
+
+// A char from the far end into the receive FIFO
+static void uartsim_receive_char(uint8_t c)
+{
+  stats.rxchars++;
+  rx_active = 1;
+  if (!(UART->C2 & UART_C2_RE_MASK))
+    return;
+  if (rx_count == depth) {
+    overrun = 1;
+    stats.rx_overruns++;
+    return;
+  }
+  rx_fifo[(rx_out + rx_count) % depth] = c;
+  rx_count++;
+}
+
+// What the far end sends in one character time
+static void uartsim_receive(void)
+{
+  uint8_t c;
+
+  if (line_rx == NULL || !line_rx(&c)) {
+    //a character time of idle line after a char
+    if (rx_active)
+      idle = 1;
+    rx_active = 0;
+    return;
+  }
+  uartsim_receive_char(c);
+}
+
+void uartsim_tick(void)
+{
+  //the firmware is in a critical section or a handler, which on the part
+  //lasts a few instructions rather than a character, or part way through a
+  //register read; come back once it is out
+  if (k20sim_masked() || in_hook || num >= UART_N)
+    return;
+
+  //anything the firmware started since the last tick happens now
+  uartsim_dma();
+  uartsim_interrupt();
+
+  k20sim_advance(uartsim_char_cycles());
+  if (shifting) {
+    shifting = 0;
+    stats.txchars++;
+    if (line_tx)
+      line_tx(shifter);
+  }
+  uartsim_shift();
+  //a char due early that the firmware did not read far enough to see
+  early = 0;
+  uartsim_receive();
+
+  uartsim_dma();
+  uartsim_interrupt();
+}
@@ -0,0 +1,85 @@
+/**
+ * K20 UART model, and the line at the other end
+ *
+ * Runs on k20sim. Models one UART at a time, with what
+ * third_party/Teensy3xLib/support/uart/uart.c relies on: the transmit and
+ * receive FIFOs (8 deep on UART0 and UART1, the data register alone on the
+ * others, as PFIFO reports), TDRE against the TWFIFO watermark, TC once the
+ * FIFO and the shifter are both empty, RDRF against RWFIFO, IDLE after a
+ * character time of idle line following a char, OR on a char arriving to a
+ * full FIFO, IDLE and OR cleared by reading S1 then D, TCFIFO/RCFIFO, CFIFO
+ * flushes and SFIFO write-1-to-clear. The status interrupt (TIE, TCIE, RIE,
+ * ILIE) is raised through k20sim_irq(), so UARTn_RX_TX_IRQHandler runs just
+ * as it would on the part.
+ *
+ * With C5 TDMAS or RDMAS set, TIE or RIE request DMA rather than the
+ * interrupt, and the model's eDMA engine moves a byte per request through
+ * the channel's transfer descriptor: the DMA request multiplexer routes the
+ * UART's sources to channels, SERQ/CERQ enable requests, DREQ disables them
+ * at the end of the major loop, and DONE is set then and cleared by CDNE.
+ *
+ * The line moves one character each way per uartsim_tick(), which advances
+ * the k20sim clock by a character time at the rate the divisor registers
+ * give (ten bits, 16 * (SBR + BRFA/32) UART clocks each). A test calls it
+ * from a k20sim ticker so that the firmware runs in between. Firmware
+ * instructions take no simulated time.
+ */
+#ifndef _UARTSIM_H_
+#define _UARTSIM_H_
+
+#include <stdint.h>
+#include "k20sim.h"
+
+typedef struct {
+  uint32_t txchars;             //chars that finished on the line
+  uint32_t rxchars;             //chars that arrived, kept or not
+  uint32_t tx_overflows;        //writes to D with no room, lost
+  uint32_t rx_overruns;         //chars that arrived to a full FIFO, lost
+  uint32_t dma_requests;        //bytes the eDMA moved, both ways
+  uint32_t irqs;                //UARTn_RX_TX_IRQHandler calls
+  uint64_t irq_instructions;    //their instructions, while counting
+  uint32_t irq_max;             //most instructions in one call
+} uartsim_stats_t;
+
+/**
+ * Hooks UART num's registers (and unhooks the UART modelled before), and
+ * the eDMA's, and presets the FIFO sizes. Call after k20sim_init() and
+ * before uart_open().
+ *
+ * @param tx Called with each char as its stop bit finishes
+ * @param rx Called once a character time for what the far end sends: puts
+ * a char in *c and returns nonzero, or returns 0 to leave the line idle.
+ * May be NULL.
+ */
+void uartsim_init(uint8_t num, void (*tx) (uint8_t c), int (*rx) (uint8_t * c));
+
+/**
+ * One character time on the line
+ */
+void uartsim_tick(void);
+
+/**
+ * A character time in core clock cycles, at the divisor now set
+ */
+uint64_t uartsim_char_cycles(void);
+
+/**
+ * Has the far end's next char arrive in the middle of the firmware's
+ * register accesses, as on the part it can in the middle of a handler:
+ * rx is asked for it just before the firmware's reads-th read of the UART
+ * from now. If the firmware has not read that far by the next character
+ * time, rx is asked then as usual.
+ */
+void uartsim_rx_early(uint32_t reads);
+
+/**
+ * Counts instructions for every interrupt handler call while on
+ */
+void uartsim_count(int on);
+
+/**
+ * Copies out the statistics, and with clear set zeroes them
+ */
+void uartsim_stats(uartsim_stats_t * stats, int clear);
+
+#endif                          // _UARTSIM_H_
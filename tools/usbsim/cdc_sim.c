@@ -0,0 +1,204 @@
+/**
+ * Throughput and per-write latency of the CDC-ACM serial port on the usb0sim
+ * model
+ *
+ * The firmware side is usb_cdc.c, unchanged. The application writes a byte
+ * pattern with usb_cdc_write() in chunks of a fixed size, as fast as the
+ * ring takes them. The host runs from a k20sim ticker, one transaction per
+ * tick so that the application runs in between as it would on the part: it
+ * reads the data IN endpoint until it NAKs or the frame is full, waits for
+ * the next frame, and checks the pattern.
+ *
+ * Each write is timed twice, in simulated time: how long usb_cdc_write()
+ * held the caller (waiting for ring space), and how long until the host had
+ * the write's last byte. Firmware instructions take no simulated time, so
+ * both only count bus time.
+ *
+ * cdc_sim [-w bytes] [seconds]
+ *
+ * Without -w, runs a range of write sizes. Seconds are simulated bus time
+ * per size (default 0.2). Exits nonzero if a byte arrives wrong or missing.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "k20sim.h"
+#include "usb0sim.h"
+#include "usb.h"
+#include "usb_config.h"
+#include "buffers.h"
+#include "slab.h"
+
+#define EP_CDC_IN (USB_CDC_ENDPOINT + 2)
+
+// bulk packets a full-speed frame has room for
+#define PACKETS_PER_FRAME 19
+// host time between transactions, for the application to run in
+#define TICK_US 40
+
+#define MAX_WRITE 4096
+#define N_WRITES 4096           //writes in flight, must be a power of two
+
+#define PATTERN(offset) ((uint8_t) ((offset) * 7 + ((offset) >> 8)))
+
+// writes the host has not seen the end of, oldest first
+static struct {
+  uint64_t end;                 //offset just past the write
+  uint64_t start;               //when usb_cdc_write() was called
+} writes[N_WRITES];
+static volatile uint32_t writes_head = 0, writes_tail = 0;
+
+static volatile uint64_t received = 0;
+static volatile uint32_t errors = 0;
+static volatile uint64_t latency_sum = 0, latency_max = 0;
+static volatile uint32_t latency_count = 0;
+
+// One transaction of host traffic, from the ticker
+static void host_tick(void)
+{
+  static int packets = PACKETS_PER_FRAME;
+  static uint32_t nak_head = 0;
+  uint8_t packet[64];
+  uint64_t latency;
+  uint16_t n;
+  int j;
+
+  //the application is in a critical section, which on the part lasts a few
+  //instructions rather than a transaction; come back once it is out
+  if (k20sim_masked())
+    return;
+
+  //a NAK or a full frame leaves the endpoint alone until the next one
+  if (packets == PACKETS_PER_FRAME) {
+    usb0sim_frame();
+    packets = 0;
+  }
+  n = sizeof(packet);
+  if (usb0sim_transaction(PID_IN, EP_CDC_IN, packet, &n) != USB0SIM_ACK) {
+    //a real application refills the ring in microseconds; until this one
+    //has had the host CPU to do so, keep the bus clock where it is
+    if (writes_head != nak_head)
+      packets = PACKETS_PER_FRAME;
+    nak_head = writes_head;
+    return;
+  }
+  packets++;
+  for (j = 0; j < n; j++) {
+    if (packet[j] != PATTERN(received))
+      errors++;
+    received++;
+  }
+
+  while (writes_tail != writes_head
+         && writes[writes_tail & (N_WRITES - 1)].end <= received) {
+    latency = k20sim_now() - writes[writes_tail & (N_WRITES - 1)].start;
+    latency_sum += latency;
+    if (latency > latency_max)
+      latency_max = latency;
+    latency_count++;
+    writes_tail++;
+  }
+}
+
+static double us(double cycles)
+{
+  return cycles * 1e6 / K20SIM_CORE_HZ;
+}
+
+// Writes in chunks of size for the given time; returns nonzero on errors
+static int run(int size, double seconds)
+{
+  static char chunk[MAX_WRITE];
+  static uint64_t sent = 0;
+  uint64_t start, end, begin, held, held_sum = 0, held_max = 0;
+  uint64_t first;
+  uint32_t count = 0;
+  int32_t n;
+  int i;
+
+  latency_sum = latency_max = 0;
+  latency_count = 0;
+  first = received;
+  begin = k20sim_now();
+  end = begin + (uint64_t) (seconds * K20SIM_CORE_HZ);
+
+  while (k20sim_now() < end) {
+    for (i = 0; i < size; i++)
+      chunk[i] = PATTERN(sent + i);
+    //the host cannot get ahead of the record, there is always room
+    while (writes_head - writes_tail == N_WRITES) ;
+
+    start = k20sim_now();
+    writes[writes_head & (N_WRITES - 1)].start = start;
+    writes[writes_head & (N_WRITES - 1)].end = sent + size;
+    writes_head++;
+    n = usb_cdc_write(chunk, size);
+    held = k20sim_now() - start;
+
+    sent += n;
+    if (n != size)
+      errors++;
+    held_sum += held;
+    if (held > held_max)
+      held_max = held;
+    count++;
+  }
+
+  //let the host catch up before the next size
+  while (received < sent) ;
+
+  printf("%6d %10.0f %10.1f %10.1f %10.1f %10.1f %6u\n", size,
+         (received - first) / (us(k20sim_now() - begin) / 1e6),
+         us((double) held_sum / count), us(held_max),
+         us((double) latency_sum / latency_count), us(latency_max), errors);
+  return errors != 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const int sizes[] = {1, 16, 63, 64, 200, 512, 2048};
+  double seconds = 0.2;
+  int size = 0, failed = 0;
+  int opt, i;
+
+  while ((opt = getopt(argc, argv, "w:")) != -1) {
+    switch (opt) {
+    case 'w':
+      size = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: cdc_sim [-w bytes] [seconds]\n");
+      return 2;
+    }
+  }
+  if (optind < argc)
+    seconds = atof(argv[optind]);
+  if (size < 0 || size > MAX_WRITE) {
+    fprintf(stderr, "cdc_sim: writes are 1 to %d bytes\n", MAX_WRITE);
+    return 2;
+  }
+
+  k20sim_init();
+  usb0sim_init();
+  slab_init();
+  buffers_init();
+  usb_init();
+  if (usb0sim_enumerate() < 0) {
+    fprintf(stderr, "cdc_sim: enumeration failed\n");
+    return 1;
+  }
+
+  printf("%6s %10s %10s %10s %10s %10s %6s\n", "write", "bytes/s",
+         "held us", "max", "latency us", "max", "errors");
+  k20sim_ticker(host_tick, TICK_US);
+  if (size) {
+    failed = run(size, seconds);
+  } else {
+    for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+      failed |= run(sizes[i], seconds);
+  }
+  k20sim_ticker(NULL, 0);
+
+  return failed;
+}
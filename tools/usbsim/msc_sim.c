@@ -0,0 +1,430 @@
+/**
+ * Mass storage over the usb0sim model, with a RAM disk standing in for the
+ * SD card
+ *
+ * The firmware side is usb_msc.c, unchanged. The host runs Bulk-Only
+ * Transport commands one transaction at a time: CBW, data, CSW, clearing
+ * halts the way usb-storage does. The media functions copy to and from a
+ * RAM image and take a configurable time per sector. While they do, the
+ * host keeps the bus going, just as the USB interrupt keeps moving packets
+ * while the main loop waits on SPI.
+ *
+ * First checks the error paths: a read that fails part way, a write that
+ * fails part way, and a host that cuts a WRITE(10) short with a short
+ * packet, each for the CSW status, residue and sense data. Then writes and
+ * reads back an area of the image at a range of media speeds and prints
+ * the MB/s of simulated bus time.
+ *
+ * msc_sim [-l us per sector] [KB]
+ *
+ * Without -l, runs a range of media speeds. Exits nonzero if a check fails
+ * or data reads back wrong.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "k20sim.h"
+#include "usb0sim.h"
+#include "usb.h"
+#include "usb_config.h"
+#include "buffers.h"
+#include "slab.h"
+
+#define EP_MSC_OUT USB_MSC_ENDPOINT
+#define EP_MSC_IN  (USB_MSC_ENDPOINT + 1)
+
+#define SECTOR USB_MSC_SECTOR_SIZE
+#define SECTORS 4096            //2 MB image
+#define COMMAND_SECTORS 64      //what usb-storage asks for at a time
+
+// commands that never finish, in simulated time
+#define TIMEOUT_CYCLES ((uint64_t) K20SIM_CORE_HZ)
+
+static uint8_t image[SECTORS][SECTOR];
+static uint32_t latency = 0;    //media cycles per sector
+static uint32_t fail_read = SECTORS, fail_write = SECTORS;
+
+typedef enum {
+  BOT_CBW,
+  BOT_DATA,
+  BOT_CSW,
+  BOT_DONE
+} bot_stage_t;
+
+// the command the host is running
+static struct {
+  bot_stage_t stage;
+  uint8_t cbw[31];
+  uint8_t in;                   //data phase is device to host
+  uint8_t *data;
+  uint32_t length;              //dCBWDataTransferLength
+  uint32_t send;                //data OUT the host actually sends
+  uint32_t moved;               //data phase bytes that went across
+  uint8_t csw[13];
+  uint32_t tag;
+} bot;
+
+static int failures = 0;
+
+static void check(const char *what, int ok)
+{
+  printf("%-40s %s\n", what, ok ? "ok" : "FAIL");
+  if (!ok)
+    failures++;
+}
+
+/*
+ * Host
+ */
+
+static void clear_halt(uint8_t endpoint)
+{
+  setup_t setup = {
+    .wRequestAndType = 0x0102,
+    .wValue = 0,
+    .wIndex = endpoint,
+    .wLength = 0
+  };
+
+  usb0sim_control(&setup, NULL);
+}
+
+// One transaction of the current command
+static void host_step(void)
+{
+  uint8_t packet[64];
+  uint16_t n;
+  int result;
+
+  switch (bot.stage) {
+  case BOT_CBW:
+    n = sizeof(bot.cbw);
+    if (usb0sim_transaction(PID_OUT, EP_MSC_OUT, bot.cbw, &n) ==
+        USB0SIM_ACK)
+      bot.stage = bot.length ? BOT_DATA : BOT_CSW;
+    break;
+  case BOT_DATA:
+    if (bot.in) {
+      n = sizeof(packet);
+      result = usb0sim_transaction(PID_IN, EP_MSC_IN, packet, &n);
+      if (result == USB0SIM_ACK) {
+        if (n > bot.length - bot.moved)
+          n = bot.length - bot.moved;
+        memcpy(bot.data + bot.moved, packet, n);
+        bot.moved += n;
+        if (n < sizeof(packet) || bot.moved == bot.length)
+          bot.stage = BOT_CSW;
+      }
+    } else {
+      n = bot.send - bot.moved;
+      if (n > sizeof(packet))
+        n = sizeof(packet);
+      result = usb0sim_transaction(PID_OUT, EP_MSC_OUT,
+                                   bot.data + bot.moved, &n);
+      if (result == USB0SIM_ACK) {
+        bot.moved += n;
+        if (bot.moved == bot.send)
+          bot.stage = BOT_CSW;
+      }
+    }
+    if (result == USB0SIM_STALL) {
+      clear_halt(bot.in ? 0x80 | EP_MSC_IN : EP_MSC_OUT);
+      bot.stage = BOT_CSW;
+    }
+    break;
+  case BOT_CSW:
+    n = sizeof(bot.csw);
+    result = usb0sim_transaction(PID_IN, EP_MSC_IN, bot.csw, &n);
+    if (result == USB0SIM_ACK)
+      bot.stage = BOT_DONE;
+    else if (result == USB0SIM_STALL)
+      clear_halt(0x80 | EP_MSC_IN);
+    break;
+  case BOT_DONE:
+    break;
+  }
+}
+
+/**
+ * Runs a command to its CSW
+ *
+ * @param send Data OUT bytes to actually send, less than length to end
+ *        the data phase early
+ * @return CSW status, or -1 if the command timed out or the CSW is bad
+ */
+static int command(const uint8_t * cb, uint8_t cb_length, uint8_t in,
+                   void *data, uint32_t length, uint32_t send)
+{
+  uint64_t end = k20sim_now() + TIMEOUT_CYCLES;
+
+  memset(bot.cbw, 0, sizeof(bot.cbw));
+  memset(bot.csw, 0, sizeof(bot.csw));
+  bot.tag++;
+  bot.cbw[0] = 'U';
+  bot.cbw[1] = 'S';
+  bot.cbw[2] = 'B';
+  bot.cbw[3] = 'C';
+  memcpy(&bot.cbw[4], &bot.tag, 4);
+  memcpy(&bot.cbw[8], &length, 4);
+  bot.cbw[12] = in ? 0x80 : 0x00;
+  bot.cbw[14] = cb_length;
+  memcpy(&bot.cbw[15], cb, cb_length);
+  bot.stage = BOT_CBW;
+  bot.in = in;
+  bot.data = data;
+  bot.length = length;
+  bot.send = in ? length : send;
+  bot.moved = 0;
+
+  //the main loop gets a turn between transactions
+  while (bot.stage != BOT_DONE && k20sim_now() < end) {
+    usb_msc_task();
+    host_step();
+  }
+
+  if (bot.stage != BOT_DONE || memcmp(bot.csw, "USBS", 4) != 0
+      || memcmp(&bot.csw[4], &bot.tag, 4) != 0)
+    return -1;
+  return bot.csw[12];
+}
+
+static uint32_t residue(void)
+{
+  uint32_t r;
+
+  memcpy(&r, &bot.csw[8], 4);
+  return r;
+}
+
+static int transfer(uint8_t op, uint32_t lba, uint16_t blocks, void *data,
+                    uint32_t send)
+{
+  uint8_t cb[10] = {op, 0, lba >> 24, lba >> 16, lba >> 8, lba, 0,
+                    blocks >> 8, blocks, 0};
+
+  return command(cb, sizeof(cb), op == 0x28, data, blocks * SECTOR, send);
+}
+
+static int read10(uint32_t lba, uint16_t blocks, void *data)
+{
+  return transfer(0x28, lba, blocks, data, 0);
+}
+
+static int write10(uint32_t lba, uint16_t blocks, void *data, uint32_t send)
+{
+  return transfer(0x2a, lba, blocks, data, send);
+}
+
+// Sense key and additional sense code, as key << 8 | asc
+static int sense(void)
+{
+  uint8_t cb[6] = {0x03, 0, 0, 0, 18, 0};
+  uint8_t reply[18];
+
+  if (command(cb, sizeof(cb), 1, reply, sizeof(reply), 0) != 0)
+    return -1;
+  return reply[2] << 8 | reply[12];
+}
+
+static int test_unit_ready(void)
+{
+  uint8_t cb[6] = {0};
+
+  return command(cb, sizeof(cb), 0, NULL, 0, 0);
+}
+
+/*
+ * Media
+ */
+
+// The main loop is busy on SPI; the bus carries on
+static void media_wait(void)
+{
+  uint64_t end = k20sim_now() + latency;
+
+  while (k20sim_now() < end) {
+    if (bot.stage == BOT_DONE) {
+      k20sim_advance(end - k20sim_now());
+      break;
+    }
+    host_step();
+  }
+}
+
+static int32_t media_read(uint32_t block, uint8_t * buff)
+{
+  media_wait();
+  if (block >= SECTORS || block == fail_read)
+    return -1;
+  memcpy(buff, image[block], SECTOR);
+  return 0;
+}
+
+static int32_t media_write(uint32_t block, uint8_t * buff)
+{
+  media_wait();
+  if (block >= SECTORS || block == fail_write)
+    return -1;
+  memcpy(image[block], buff, SECTOR);
+  return 0;
+}
+
+/*
+ * Tests
+ */
+
+static void fill(uint8_t * data, uint32_t lba, uint32_t blocks, uint8_t seed)
+{
+  uint32_t i;
+
+  for (i = 0; i < blocks * SECTOR; i++)
+    data[i] = (lba * SECTOR + i) * 7 + seed + (i >> 9);
+}
+
+static void checks(void)
+{
+  static uint8_t data[8 * SECTOR], back[8 * SECTOR];
+  int status;
+
+  sense();                      //clears the medium changed attention
+  check("test unit ready", test_unit_ready() == 0);
+
+  fill(data, 0, 8, 1);
+  check("write 8 sectors", write10(0, 8, data, 8 * SECTOR) == 0
+        && residue() == 0);
+  check("read them back", read10(0, 8, back) == 0 && residue() == 0
+        && memcmp(data, back, sizeof(data)) == 0);
+
+  //the host takes some sectors before sector 5 fails; the residue is what
+  //it did not get
+  fail_read = 5;
+  status = read10(0, 8, back);
+  printf("  read failing at sector 5: status %d, %u of %u bytes moved, "
+         "residue %u\n", status, bot.moved, bot.length, residue());
+  check("read error status and residue", status == 1
+        && residue() == bot.length - bot.moved);
+  check("read error sense", sense() == 0x0311);
+  fail_read = SECTORS;
+
+  //sectors before the one that fails are written
+  fill(data, 10, 4, 2);
+  fail_write = 12;
+  status = write10(10, 4, data, 4 * SECTOR);
+  printf("  write failing at sector 12: status %d, residue %u\n", status,
+         residue());
+  check("write error status and residue", status == 1
+        && residue() == 2 * SECTOR);
+  check("write error sense", sense() == 0x0303);
+  check("sectors before the error written",
+        memcmp(image[10], data, 2 * SECTOR) == 0);
+  fail_write = SECTORS;
+
+  //two and a bit sectors, then a short packet
+  memset(image[20], 0xee, 4 * SECTOR);
+  fill(data, 20, 4, 3);
+  status = write10(20, 4, data, 2 * SECTOR + 100);
+  printf("  write cut short after %u bytes: status %d, residue %u\n",
+         bot.moved, status, residue());
+  check("short write status and residue", status == 1
+        && residue() == 2 * SECTOR);
+  check("short write sense", sense() == 0x0b4b);
+  check("whole sectors written", memcmp(image[20], data, 2 * SECTOR) == 0);
+  check("cut off sector untouched", image[22][0] == 0xee
+        && image[22][SECTOR - 1] == 0xee);
+  check("next command", test_unit_ready() == 0);
+}
+
+static void bench(uint32_t us, uint32_t kb)
+{
+  static uint8_t data[COMMAND_SECTORS * SECTOR], back[COMMAND_SECTORS * SECTOR];
+  uint32_t sectors = kb * 1024 / SECTOR, lba, n, bad = 0, errors = 0;
+  uint64_t start, write_cycles, read_cycles;
+
+  latency = (uint64_t) us * K20SIM_CORE_HZ / 1000000;
+
+  start = k20sim_now();
+  for (lba = 100; lba < 100 + sectors; lba += n) {
+    n = 100 + sectors - lba;
+    if (n > COMMAND_SECTORS)
+      n = COMMAND_SECTORS;
+    fill(data, lba, n, us);
+    if (write10(lba, n, data, n * SECTOR) != 0)
+      errors++;
+  }
+  write_cycles = k20sim_now() - start;
+
+  start = k20sim_now();
+  for (lba = 100; lba < 100 + sectors; lba += n) {
+    n = 100 + sectors - lba;
+    if (n > COMMAND_SECTORS)
+      n = COMMAND_SECTORS;
+    if (read10(lba, n, back) != 0)
+      errors++;
+    fill(data, lba, n, us);
+    if (memcmp(data, back, n * SECTOR) != 0)
+      bad++;
+  }
+  read_cycles = k20sim_now() - start;
+
+  printf("%8u %10.3f %10.3f %8u %8u\n", us,
+         sectors * SECTOR / (write_cycles / (double) K20SIM_CORE_HZ) / 1e6,
+         sectors * SECTOR / (read_cycles / (double) K20SIM_CORE_HZ) / 1e6,
+         errors, bad);
+  if (errors || bad)
+    failures++;
+  latency = 0;
+}
+
+int main(int argc, char **argv)
+{
+  static const uint32_t speeds[] = {0, 50, 100, 250, 500, 1000};
+  int32_t us = -1;
+  uint32_t kb = 512;
+  int opt;
+  unsigned int i;
+
+  while ((opt = getopt(argc, argv, "l:")) != -1) {
+    switch (opt) {
+    case 'l':
+      us = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: msc_sim [-l us per sector] [KB]\n");
+      return 2;
+    }
+  }
+  if (optind < argc)
+    kb = atoi(argv[optind]);
+  if (kb == 0 || kb * 1024 / SECTOR > SECTORS - 100) {
+    fprintf(stderr, "msc_sim: 1 to %u KB\n", (SECTORS - 100) * SECTOR / 1024);
+    return 2;
+  }
+
+  k20sim_init();
+  usb0sim_init();
+  slab_init();
+  buffers_init();
+  usb_init();
+  usb_msc_media(media_read, media_write, SECTORS);
+  if (usb0sim_enumerate() < 0) {
+    fprintf(stderr, "msc_sim: enumeration failed\n");
+    return 1;
+  }
+
+  checks();
+
+  printf("%8s %10s %10s %8s %8s\n", "us/sect", "write MB/s", "read MB/s",
+         "errors", "bad");
+  if (us >= 0) {
+    bench(us, kb);
+  } else {
+    for (i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++)
+      bench(speeds[i], kb);
+  }
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
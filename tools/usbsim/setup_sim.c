@@ -0,0 +1,137 @@
+/**
+ * Endpoint 0 round trips for a scripted SETUP sequence on the usb0sim model
+ *
+ * Built once per endpoint 0 packet size (setup_sim8, setup_sim64), each
+ * against its own build of usb.c. Replays the requests Linux makes to
+ * enumerate the device and prints, per request, the transactions on the
+ * bus (every token, NAKed ones included) and the bus time they took.
+ *
+ * Then moves data stages of various lengths through the usb_loop test
+ * class, out to the device and back, which exercises the DATA0/DATA1
+ * sequence of multi-packet OUT stages.
+ *
+ * setup_sim8, setup_sim64
+ *
+ * Exits nonzero if a request fails or data comes back wrong.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "k20sim.h"
+#include "usb0sim.h"
+#include "usb.h"
+#include "usb_config.h"
+#include "buffers.h"
+#include "slab.h"
+
+static int failures = 0;
+static uint32_t total_transactions = 0, total_naks = 0;
+static uint64_t total_cycles = 0;
+static uint64_t step_start;
+
+static void report(const char *step, int ok)
+{
+  usb0sim_stats_t s;
+  uint64_t cycles = k20sim_now() - step_start;
+
+  usb0sim_stats(&s, 1);
+  printf("%-28s %-4s %6u %5u %5u %8.1f\n", step, ok ? "ok" : "FAIL",
+         s.transactions, s.naks, s.no_response + s.toggle_errors + s.overruns,
+         cycles * 1e6 / K20SIM_CORE_HZ);
+  total_transactions += s.transactions;
+  total_naks += s.naks;
+  total_cycles += cycles;
+  if (!ok || s.no_response + s.toggle_errors + s.overruns)
+    failures++;
+  step_start = k20sim_now();
+}
+
+static int control(const char *step, uint16_t request, uint16_t value,
+                   uint16_t index, uint16_t length, void *data)
+{
+  setup_t setup;
+  int n;
+
+  setup.wRequestAndType = request;
+  setup.wValue = value;
+  setup.wIndex = index;
+  setup.wLength = length;
+  n = usb0sim_control(&setup, data);
+  report(step, n >= 0);
+  return n;
+}
+
+static void enumerate(void)
+{
+  static uint8_t buf[1024];
+  int total;
+
+  usb0sim_reset();
+  step_start = k20sim_now();
+  //the first look at address 0 only trusts the first packet
+  control("get device (64)", 0x0680, 0x0100, 0, 64, buf);
+  usb0sim_reset();
+  step_start = k20sim_now();
+  control("set address", 0x0500, 7, 0, 0, NULL);
+  control("get device", 0x0680, 0x0100, 0, 18, buf);
+  control("get configuration (9)", 0x0680, 0x0200, 0, 9, buf);
+  total = buf[2] | (buf[3] << 8);
+  control("get configuration", 0x0680, 0x0200, 0, total, buf);
+  control("get string 0", 0x0680, 0x0300, 0, 255, buf);
+  control("get string 2", 0x0680, 0x0302, 0x0409, 255, buf);
+  control("get string 1", 0x0680, 0x0301, 0x0409, 255, buf);
+  control("set configuration", 0x0900, 1, 0, 0, NULL);
+}
+
+static void loop(uint16_t length)
+{
+  static uint8_t out[USB_LOOP_SIZE], in[USB_LOOP_SIZE];
+  char step[32];
+  uint32_t count, before;
+  int i, n;
+
+  for (i = 0; i < length; i++)
+    out[i] = i * 13 + length;
+  memset(in, 0, sizeof(in));
+
+  usb_loop_stored(&before);
+  snprintf(step, sizeof(step), "loop out %u", length);
+  n = control(step, USB_LOOP_STORE, 0, USB_LOOP_INTERFACE, length, out);
+  if (n != length || usb_loop_stored(&count) != length || count != before + 1) {
+    printf("  stored %u bytes\n", usb_loop_stored(&count));
+    failures++;
+  }
+  snprintf(step, sizeof(step), "loop in %u", length);
+  n = control(step, USB_LOOP_FETCH, 0, USB_LOOP_INTERFACE, length, in);
+  if (n != length || memcmp(in, out, length) != 0) {
+    printf("  data back wrong\n");
+    failures++;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  static const uint16_t lengths[] = {1, 7, 8, 9, 63, 64, 65, 128, 200, 512};
+  unsigned int i;
+
+  k20sim_init();
+  usb0sim_init();
+  slab_init();
+  buffers_init();
+  usb_init();
+
+  printf("endpoint 0 packet size %u\n", ENDP0_SIZE);
+  printf("%-28s %-4s %6s %5s %5s %8s\n", "request", "", "trans", "naks",
+         "errs", "bus us");
+  enumerate();
+  printf("enumeration: %u transactions (%u NAKed), %.1f us of bus time\n",
+         total_transactions, total_naks, total_cycles * 1e6 / K20SIM_CORE_HZ);
+
+  for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    loop(lengths[i]);
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -0,0 +1,151 @@
+/**
+ * Sustained throughput of the bulk sample stream on the usb0sim model
+ *
+ * The firmware side is usb_stream.c and buffers.c, unchanged. A producer
+ * stands in for the ADC: it fills free buffers with a 16-bit ramp, either as
+ * fast as buffers come back or at a fixed sample rate, and counts the
+ * buffers it had to drop because none was free. The host reads the bulk IN
+ * endpoint for as long as the bus allows and checks the ramp, as
+ * tools/stream_rx does against a board.
+ *
+ * stream_sim [-c] [-r samples/s] [seconds]
+ *
+ * Seconds are simulated bus time (default 1). -c also counts instructions
+ * per USB interrupt, which is slow. Exits nonzero on a gap in the ramp, a
+ * buffer of the wrong size, or a dropped buffer.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "k20sim.h"
+#include "usb0sim.h"
+#include "usb.h"
+#include "usb_config.h"
+#include "buffers.h"
+#include "slab.h"
+
+static uint32_t rate = 0;
+static uint16_t produced = 0;
+static uint64_t owed = 0;      //samples due from the producer, times the core clock
+static uint64_t last;
+static uint32_t drops = 0;
+
+// Fills buffers the way the ADC would
+static void produce(void)
+{
+  uint64_t now = k20sim_now();
+  uint16_t *buf;
+  uint8_t index;
+  int i;
+
+  if (rate) {
+    owed += (now - last) * rate;
+    last = now;
+  }
+
+  while (!rate || owed >= (uint64_t) BUFFER_LENGTH * K20SIM_CORE_HZ) {
+    if (rate)
+      owed -= (uint64_t) BUFFER_LENGTH *K20SIM_CORE_HZ;
+
+    buf = buffers_get_next_free(&index);
+    if (buf == NULL) {
+      if (!rate)
+        break;
+      //the ADC overruns and the ramp skips a buffer
+      drops++;
+      produced += BUFFER_LENGTH;
+      continue;
+    }
+    for (i = 0; i < BUFFER_LENGTH; i++)
+      buf[i] = produced++;
+    buffers_set_ready(index);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  uint8_t packet[64];
+  uint16_t n, sample, expected = 0;
+  uint64_t end, bytes = 0, samples = 0;
+  uint32_t gaps = 0, buffers = 0, odd_sized = 0, length = 0;
+  double seconds = 1;
+  int synced = 0, count = 0;
+  int opt, i;
+  usb0sim_stats_t s;
+
+  while ((opt = getopt(argc, argv, "cr:")) != -1) {
+    switch (opt) {
+    case 'c':
+      count = 1;
+      break;
+    case 'r':
+      rate = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: stream_sim [-c] [-r samples/s] [seconds]\n");
+      return 2;
+    }
+  }
+  if (optind < argc)
+    seconds = atof(argv[optind]);
+
+  k20sim_init();
+  usb0sim_init();
+  slab_init();
+  buffers_init();
+  usb_init();
+  if (usb0sim_enumerate() < 0) {
+    fprintf(stderr, "stream_sim: enumeration failed\n");
+    return 1;
+  }
+  usb0sim_count(count);
+  usb0sim_stats(&s, 1);
+
+  last = k20sim_now();
+  end = last + (uint64_t) (seconds * K20SIM_CORE_HZ);
+  while (k20sim_now() < end) {
+    produce();
+    n = sizeof(packet);
+    if (usb0sim_transaction(PID_IN, USB_STREAM_ENDPOINT, packet, &n) !=
+        USB0SIM_ACK) {
+      //nothing ready, come back next frame
+      usb0sim_frame();
+      continue;
+    }
+
+    for (i = 0; i + 1 < n; i += 2) {
+      sample = packet[i] | (packet[i + 1] << 8);
+      if (synced && sample != expected)
+        gaps++;
+      expected = sample + 1;
+      synced = 1;
+    }
+    bytes += n;
+    samples += n / 2;
+    length += n;
+
+    //a short packet ends each buffer
+    if (n < sizeof(packet)) {
+      if (length != BUFFER_LENGTH * 2)
+        odd_sized++;
+      buffers++;
+      length = 0;
+    }
+  }
+
+  usb0sim_stats(&s, 0);
+  printf("%.3f MB/s over %.2f s: %llu samples in %u buffers, %u gaps, "
+         "%u odd-sized, %u dropped by the producer\n",
+         bytes / seconds / 1e6, seconds, (unsigned long long) samples,
+         buffers, gaps, odd_sized, drops);
+  printf("%u transactions, %u NAKs, %u errors, %u frames, %u interrupts",
+         s.transactions, s.naks, s.no_response + s.toggle_errors, s.frames,
+         s.irqs);
+  if (count)
+    printf(", %.0f instructions per interrupt (max %u)",
+           (double) s.irq_instructions / s.irqs, s.irq_max);
+  printf("\n");
+
+  return gaps || odd_sized || drops ? 2 : 0;
+}
@@ -0,0 +1,392 @@
+/**
+ * USB0 full-speed device controller model, and the host at the other end
+ *
+ * See usb0sim.h. The SIE finds the buffer descriptor table through the
+ * firmware's usb_bdt symbol rather than BDTPAGE1-3, which cannot hold a host
+ * address.
+ */
+#include <string.h>
+
+#include "usb0sim.h"
+#include "usb.h"
+
+// the vector table entry in usb.c
+void USBOTG_IRQHandler(void);
+
+#define USB0_ADDRESS 0x40072000u
+#define SIE ((USB_MemMapPtr) k20sim_reg(USB0_ADDRESS))
+
+// a USB bit time in core clock cycles
+#define BIT_CYCLES (K20SIM_CORE_HZ / 12000000)
+
+// token, handshake, two turnarounds, and the data packet's own overhead
+#define TRANSACTION_BITS (35 + 19 + 16 + 35)
+
+// NAKs a control transfer stage puts up with, about five frames' worth
+#define CONTROL_RETRIES 500
+
+// where the SIE puts the next packet, per endpoint and direction
+static uint8_t sie_odd[USB_N_ENDPOINTS + 1][2];
+
+// tokens completed but not yet retired by clearing TOKDNE
+static uint8_t sie_fifo[4];
+static uint8_t sie_fifo_count;
+
+static uint8_t host_address;
+static uint8_t host_data[USB_N_ENDPOINTS + 1][2];
+static uint16_t host_ep0_size;
+
+static uint64_t frame_end;
+static uint16_t frame_number;
+
+static int counting = 0;
+static usb0sim_stats_t stats;
+
+/*
+ * Device side
+ */
+
+static void usb0sim_isr(void)
+{
+  uint64_t n;
+
+  stats.irqs++;
+  if (!counting) {
+    USBOTG_IRQHandler();
+    return;
+  }
+
+  k20sim_count_start();
+  USBOTG_IRQHandler();
+  n = k20sim_count_stop();
+  stats.irq_instructions += n;
+  if (n > stats.irq_max)
+    stats.irq_max = n;
+}
+
+static void usb0sim_interrupt(void)
+{
+  if (SIE->ISTAT & SIE->INTEN)
+    k20sim_irq(usb0sim_isr);
+}
+
+static void usb0sim_write(uint32_t addr, uint32_t old, uint32_t value)
+{
+  USB_MemMapPtr usb = SIE;
+
+  switch (addr - USB0_ADDRESS) {
+  case 0x10:                   //OTGISTAT
+    usb->OTGISTAT = old & ~value;
+    break;
+  case 0x80:                   //ISTAT
+    usb->ISTAT = old & ~value;
+    //retiring a token brings up the next one
+    if (old & value & USB_ISTAT_TOKDNE_MASK && sie_fifo_count > 0) {
+      memmove(sie_fifo, sie_fifo + 1, --sie_fifo_count);
+      if (sie_fifo_count > 0) {
+        usb->STAT = sie_fifo[0];
+        usb->ISTAT |= USB_ISTAT_TOKDNE_MASK;
+      }
+    }
+    break;
+  case 0x88:                   //ERRSTAT
+    usb->ERRSTAT = old & ~value;
+    break;
+  case 0x94:                   //CTL
+    if (value & USB_CTL_ODDRST_MASK)
+      memset(sie_odd, 0, sizeof(sie_odd));
+    break;
+  case 0x10c:                  //USBTRC0, the module reset completes at once
+    if (value & USB_USBTRC0_USBRESET_MASK) {
+      memset(sie_odd, 0, sizeof(sie_odd));
+      sie_fifo_count = 0;
+      usb->USBTRC0 = value & ~USB_USBTRC0_USBRESET_MASK;
+    }
+    break;
+  }
+}
+
+static const k20sim_hooks_t usb0sim_hooks = {
+  .read = NULL,
+  .write = usb0sim_write,
+};
+
+void usb0sim_init(void)
+{
+  k20sim_hook(USB0_ADDRESS, &usb0sim_hooks);
+  host_ep0_size = 64;
+  frame_end = k20sim_now() + USB0SIM_FRAME_CYCLES;
+}
+
+void usb0sim_count(int on)
+{
+  counting = on;
+}
+
+void usb0sim_stats(usb0sim_stats_t * out, int clear)
+{
+  *out = stats;
+  if (clear)
+    memset(&stats, 0, sizeof(stats));
+}
+
+/*
+ * Bus
+ */
+
+void usb0sim_frame(void)
+{
+  USB_MemMapPtr usb = SIE;
+
+  k20sim_advance(frame_end - k20sim_now());
+  frame_end += USB0SIM_FRAME_CYCLES;
+  frame_number = (frame_number + 1) & 0x7ff;
+  stats.frames++;
+
+  usb->FRMNUML = frame_number & 0xff;
+  usb->FRMNUMH = frame_number >> 8;
+  usb->ISTAT |= USB_ISTAT_SOFTOK_MASK;
+  k20sim_advance(35 * BIT_CYCLES);
+  usb0sim_interrupt();
+}
+
+// Takes the bus for a transaction that may carry up to bytes of data,
+// starting a new frame if it will not fit. Data is charged as it moves.
+static void usb0sim_bus(uint16_t bytes)
+{
+  if (k20sim_now() + (TRANSACTION_BITS + 8 * bytes) * BIT_CYCLES > frame_end)
+    usb0sim_frame();
+  k20sim_advance(TRANSACTION_BITS * BIT_CYCLES);
+}
+
+void usb0sim_reset(void)
+{
+  USB_MemMapPtr usb = SIE;
+
+  //10 ms of SE0
+  k20sim_advance(10 * USB0SIM_FRAME_CYCLES);
+  frame_end = k20sim_now() + USB0SIM_FRAME_CYCLES;
+
+  host_address = 0;
+  host_ep0_size = 64;
+  memset(host_data, 0, sizeof(host_data));
+
+  usb->ISTAT |= USB_ISTAT_USBRST_MASK;
+  usb0sim_interrupt();
+}
+
+// Hands a completed token to the firmware
+static void usb0sim_complete(uint8_t stat)
+{
+  USB_MemMapPtr usb = SIE;
+
+  sie_fifo[sie_fifo_count++] = stat;
+  if (sie_fifo_count == 1) {
+    usb->STAT = stat;
+    usb->ISTAT |= USB_ISTAT_TOKDNE_MASK;
+  }
+}
+
+int usb0sim_transaction(uint8_t pid, uint8_t ep, void *data,
+                        uint16_t * length)
+{
+  USB_MemMapPtr usb = SIE;
+  uint8_t tx = (pid == PID_IN);
+  uint8_t endpt, odd, toggle;
+  uint16_t count;
+  uint32_t desc;
+  bdt_t *bdt;
+  int result = USB0SIM_ACK;
+
+  usb0sim_bus(*length);
+  stats.transactions++;
+
+  endpt = usb->ENDPOINT[ep].ENDPT;
+  if ((usb->ADDR & 0x7f) != host_address
+      || !(endpt & (tx ? USB_ENDPT_EPTXEN_MASK : USB_ENDPT_EPRXEN_MASK))) {
+    stats.no_response++;
+    return USB0SIM_NONE;
+  }
+
+  odd = sie_odd[ep][tx];
+  bdt = &usb_bdt[BDT_INDEX(ep, tx, odd)];
+  desc = bdt->desc;
+
+  if (pid != PID_SETUP
+      && (endpt & USB_ENDPT_EPSTALL_MASK
+          || (desc & (BDT_OWN_MASK | BDT_STALL_MASK)) ==
+          (BDT_OWN_MASK | BDT_STALL_MASK))) {
+    stats.stalls++;
+    usb->ISTAT |= USB_ISTAT_STALL_MASK;
+    usb0sim_interrupt();
+    return USB0SIM_STALL;
+  }
+
+  //the SIE holds off while the STAT FIFO is full or after a SETUP
+  if (sie_fifo_count == sizeof(sie_fifo)
+      || usb->CTL & USB_CTL_TXSUSPENDTOKENBUSY_MASK
+      || !(desc & BDT_OWN_MASK)) {
+    if (!(endpt & USB_ENDPT_EPHSHK_MASK)) {
+      stats.no_response++;
+      return USB0SIM_NONE;
+    }
+    stats.naks++;
+    return USB0SIM_NAK;
+  }
+
+  count = BDT_BC(desc);
+  if (tx) {
+    toggle = (desc & BDT_DATA1_MASK) != 0;
+    if (count > 0)
+      memcpy(data, bdt->addr, count < *length ? count : *length);
+    *length = count;
+  } else {
+    toggle = (pid == PID_SETUP) ? 0 : host_data[ep][0];
+    //SETUP is always taken; anything else has to carry the expected toggle
+    if (pid != PID_SETUP && desc & BDT_DTS_MASK
+        && toggle != ((desc & BDT_DATA1_MASK) != 0)) {
+      //acknowledged, and silently dropped
+      stats.toggle_errors++;
+      host_data[ep][0] ^= 1;
+      return USB0SIM_ACK;
+    }
+    if (*length > count) {
+      stats.overruns++;
+      usb->ERRSTAT |= USB_ERRSTAT_DMAERR_MASK;
+      usb->ISTAT |= USB_ISTAT_ERROR_MASK;
+    } else {
+      count = *length;
+    }
+    if (count > 0)
+      memcpy(bdt->addr, data, count);
+  }
+
+  k20sim_advance(8 * count * BIT_CYCLES);
+  bdt->desc = (count << BDT_BC_SHIFT) | (toggle ? BDT_DATA1_MASK : 0) |
+      (pid << 2);
+  sie_odd[ep][tx] ^= 1;
+  usb0sim_complete((ep << USB_STAT_ENDP_SHIFT) | (tx << USB_STAT_TX_SHIFT) |
+                   (odd << USB_STAT_ODD_SHIFT));
+  if (pid == PID_SETUP)
+    usb->CTL |= USB_CTL_TXSUSPENDTOKENBUSY_MASK;
+
+  //the host's half: isochronous has no toggles, a stale IN is dropped
+  if (pid == PID_SETUP) {
+    host_data[ep][0] = host_data[ep][1] = 1;
+  } else if (!(endpt & USB_ENDPT_EPHSHK_MASK)) {
+  } else if (!tx) {
+    host_data[ep][0] ^= 1;
+  } else if (toggle != host_data[ep][1]) {
+    stats.toggle_errors++;
+    result = USB0SIM_NAK;
+  } else {
+    host_data[ep][1] ^= 1;
+  }
+
+  usb0sim_interrupt();
+  return result;
+}
+
+/*
+ * Host side
+ */
+
+static int usb0sim_retry(uint8_t pid, void *data, uint16_t * length)
+{
+  uint16_t n;
+  int i, result = USB0SIM_NAK;
+
+  for (i = 0; i < CONTROL_RETRIES && result == USB0SIM_NAK; i++) {
+    n = *length;
+    result = usb0sim_transaction(pid, 0, data, &n);
+  }
+  *length = n;
+  return result;
+}
+
+// Keeps the host in step with a request that went through
+static void usb0sim_follow(const setup_t * setup, const uint8_t * data,
+                           uint16_t length)
+{
+  uint8_t ep = setup->wIndex & 0x0f;
+
+  switch (setup->wRequestAndType) {
+  case 0x0500:                 //set address
+    host_address = setup->wValue;
+    break;
+  case 0x0900:                 //set configuration
+    memset(host_data[1], 0, sizeof(host_data) - sizeof(host_data[0]));
+    break;
+  case 0x0102:                 //clear feature (endpoint halt)
+    if (setup->wValue == 0)
+      host_data[ep][(setup->wIndex & 0x80) != 0] = 0;
+    break;
+  case 0x0680:                 //get descriptor (device)
+    if (setup->wValue == 0x0100 && length >= 8)
+      host_ep0_size = data[7];
+    break;
+  }
+}
+
+int usb0sim_control(const setup_t * setup, void *data)
+{
+  uint8_t packet[1024];
+  uint8_t *p = data;
+  uint16_t n, total = 0;
+  int result;
+
+  n = sizeof(*setup);
+  result = usb0sim_retry(PID_SETUP, (void *) setup, &n);
+
+  if (result == USB0SIM_ACK && setup->bmRequestType & 0x80) {
+    //data IN, ended by a short packet or by having all we asked for
+    while (result == USB0SIM_ACK && total < setup->wLength) {
+      n = host_ep0_size;
+      result = usb0sim_retry(PID_IN, packet, &n);
+      if (result != USB0SIM_ACK)
+        break;
+      if (n > setup->wLength - total)
+        n = setup->wLength - total;
+      memcpy(p + total, packet, n);
+      total += n;
+      if (n < host_ep0_size)
+        break;
+    }
+    n = 0;
+    if (result == USB0SIM_ACK)
+      result = usb0sim_retry(PID_OUT, NULL, &n);
+  } else if (result == USB0SIM_ACK) {
+    //data OUT, then a zero length IN
+    while (result == USB0SIM_ACK && total < setup->wLength) {
+      n = setup->wLength - total;
+      if (n > host_ep0_size)
+        n = host_ep0_size;
+      result = usb0sim_retry(PID_OUT, p + total, &n);
+      total += n;
+    }
+    n = host_ep0_size;
+    if (result == USB0SIM_ACK)
+      result = usb0sim_retry(PID_IN, packet, &n);
+  }
+
+  if (result == USB0SIM_STALL)
+    return USB0SIM_STALLED;
+  if (result != USB0SIM_ACK)
+    return USB0SIM_TIMEOUT;
+
+  usb0sim_follow(setup, data, total);
+  return total;
+}
+
+int usb0sim_enumerate(void)
+{
+  setup_t setup = {.wRequestAndType = 0x0500,.wValue = 1 };
+
+  usb0sim_reset();
+  if (usb0sim_control(&setup, NULL) < 0)
+    return -1;
+  setup.wRequestAndType = 0x0900;
+  if (usb0sim_control(&setup, NULL) < 0)
+    return -1;
+  return 0;
+}
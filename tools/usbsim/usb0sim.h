@@ -0,0 +1,108 @@
+/**
+ * USB0 full-speed device controller model, and the host at the other end
+ *
+ * Runs on k20sim. The device side models what projects/mouse_mover/usb.c
+ * relies on: ISTAT/ERRSTAT/OTGISTAT write-1-to-clear, the four-entry STAT
+ * FIFO behind TOKDNE, CTL ODDRST and TXSUSPENDTOKENBUSY, ADDR, ENDPTn
+ * enables, stall and handshake bits, and the buffer descriptor table: the
+ * per-endpoint EVEN/ODD pointer, OWN, DTS toggle checking on OUT, and the
+ * BC/PID/DATA1 write-back on completion. Each completed token raises the
+ * USB interrupt through k20sim_irq(), so USBOTG_IRQHandler runs just as it
+ * would on the part.
+ *
+ * The host side issues one transaction at a time and keeps the data toggles
+ * a real host would. Bus time is modelled at 12 Mbit/s: every transaction
+ * advances the k20sim clock by its length on the wire, and a start of frame
+ * goes out each millisecond.
+ */
+#ifndef _USB0SIM_H_
+#define _USB0SIM_H_
+
+#include <stdint.h>
+#include "k20sim.h"
+#include "usb_dev.h"
+
+// handshakes, as seen by the host
+#define USB0SIM_ACK     0
+#define USB0SIM_NAK     1
+#define USB0SIM_STALL   2
+#define USB0SIM_NONE    3       //no handshake: endpoint off or isochronous
+
+// usb0sim_control() failures
+#define USB0SIM_STALLED (-1)
+#define USB0SIM_TIMEOUT (-2)
+
+#define USB0SIM_FRAME_CYCLES (K20SIM_CORE_HZ / 1000)
+
+typedef struct {
+  uint32_t transactions;        //tokens sent, retries included
+  uint32_t naks;
+  uint32_t stalls;
+  uint32_t no_response;         //tokens nothing answered (isochronous aside)
+  uint32_t toggle_errors;       //packets dropped for a DATA0/DATA1 mismatch
+  uint32_t overruns;            //OUT packets longer than their buffer
+  uint32_t frames;
+  uint32_t irqs;                //USBOTG_IRQHandler calls
+  uint64_t irq_instructions;    //their instructions, while counting
+  uint32_t irq_max;             //most instructions in one call
+} usb0sim_stats_t;
+
+/**
+ * Hooks the USB0 registers. Call after k20sim_init() and before usb_init().
+ */
+void usb0sim_init(void);
+
+/**
+ * Counts instructions for every USBOTG_IRQHandler call while on
+ */
+void usb0sim_count(int on);
+
+/**
+ * Copies out the statistics, and with clear set zeroes them
+ */
+void usb0sim_stats(usb0sim_stats_t * stats, int clear);
+
+/**
+ * Signals a bus reset; the host goes back to address 0
+ */
+void usb0sim_reset(void);
+
+/**
+ * Lets the bus idle until the next start of frame, and sends it
+ */
+void usb0sim_frame(void);
+
+/**
+ * One transaction
+ *
+ * @param pid PID_SETUP, PID_OUT or PID_IN
+ * @param ep Endpoint number
+ * @param data Data to send, or where to put what is received
+ * @param length Bytes to send; for IN, the most to accept, and on return
+ *        the bytes received
+ * @return USB0SIM_ACK, USB0SIM_NAK, USB0SIM_STALL or USB0SIM_NONE. An IN
+ *         that arrives with the wrong toggle is acknowledged to the device
+ *         but dropped, and returned as USB0SIM_NAK.
+ */
+int usb0sim_transaction(uint8_t pid, uint8_t ep, void *data,
+                        uint16_t * length);
+
+/**
+ * A whole control transfer on endpoint 0, retrying NAKs. Follows what the
+ * request does to the host's state: SET_ADDRESS moves the host to the new
+ * address, SET_CONFIGURATION and CLEAR_FEATURE(ENDPOINT_HALT) reset data
+ * toggles, and a device descriptor sets the endpoint 0 size (64 until then).
+ *
+ * @return Bytes moved in the data stage, USB0SIM_STALLED or USB0SIM_TIMEOUT
+ */
+int usb0sim_control(const setup_t * setup, void *data);
+
+/**
+ * The least a host does before using the device: bus reset, SET_ADDRESS and
+ * SET_CONFIGURATION(1)
+ *
+ * @return Zero once configured
+ */
+int usb0sim_enumerate(void);
+
+#endif                          // _USB0SIM_H_
@@ -0,0 +1,60 @@
+/**
+ * Loopback test class for control transfers
+ */
+#include "usb_loop.h"
+
+static uint8_t loop_data[USB_LOOP_SIZE];
+static uint16_t loop_length = 0;
+static uint32_t loop_count = 0;
+
+static uint8_t usb_loop_store(const setup_t * setup, uint8_t ** data,
+                              uint16_t * length)
+{
+  *data = loop_data;
+  *length = sizeof(loop_data);
+  return setup->wLength <= sizeof(loop_data);
+}
+
+// the whole data stage is in
+static void usb_loop_stored_all(const setup_t * setup)
+{
+  loop_length = setup->wLength;
+  loop_count++;
+}
+
+static uint8_t usb_loop_fetch(const setup_t * setup, uint8_t ** data,
+                              uint16_t * length)
+{
+  *data = loop_data;
+  *length = loop_length;
+  return 1;
+}
+
+static const request_entry_t requests[] = {
+  {USB_LOOP_STORE, usb_loop_store, usb_loop_stored_all},
+  {USB_LOOP_FETCH, usb_loop_fetch, NULL},
+  {0x0000, NULL, NULL}
+};
+
+static void usb_loop_configure(uint8_t config)
+{
+}
+
+void usb_loop_handler(uint8_t stat)
+{
+}
+
+const usb_class_t usb_loop_class = {
+  .configure = usb_loop_configure,
+  .sof = NULL,
+  .clear_halt = NULL,
+  .set_interface = NULL,
+  .requests = requests,
+  .descriptors = NULL,
+};
+
+uint16_t usb_loop_stored(uint32_t * count)
+{
+  *count = loop_count;
+  return loop_length;
+}
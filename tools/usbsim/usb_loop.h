@@ -0,0 +1,44 @@
+/**
+ * Loopback test class for control transfers, host builds only
+ *
+ * A vendor interface with no endpoints of its own: a vendor OUT request
+ * stores up to USB_LOOP_SIZE bytes of data stage, and a vendor IN request
+ * returns them. setup_sim uses it for data stages longer than endpoint 0's
+ * packet size in both directions. Added to the configuration with
+ * -include usb_loop.h -DUSB_EXTRA_FUNCTIONS(X)=X(LOOP), after the
+ * mouse_mover interfaces and endpoints in usb_config.h.
+ */
+#ifndef _USB_LOOP_H_
+#define _USB_LOOP_H_
+
+#include "usb_dev.h"
+
+#define USB_LOOP_INTERFACE 5
+#define USB_LOOP_ENDPOINT  8
+
+#define USB_LOOP_N_INTERFACES 1
+// one endpoint number is held so the dispatch table has a range to fill
+#define USB_LOOP_N_ENDPOINTS  1
+
+#define USB_LOOP_SIZE 512
+
+#define USB_LOOP_STORE 0x0141   //bRequest 1, vendor, interface, OUT
+#define USB_LOOP_FETCH 0x01c1   //bRequest 1, vendor, interface, IN
+
+#define USB_LOOP_DESC_SIZE USB_DESC_INTERFACE_SIZE
+#define USB_LOOP_DESC(iface, ep) \
+  USB_DESC_INTERFACE(iface, 0, 0, 0xff, 0x00, 0x00)
+
+#define USB_LOOP_CLASS usb_loop_class
+#define USB_LOOP_HANDLER usb_loop_handler
+
+extern const usb_class_t usb_loop_class;
+void usb_loop_handler(uint8_t stat);
+
+/**
+ * Bytes stored by the last completed USB_LOOP_STORE, and how many there
+ * have been
+ */
+uint16_t usb_loop_stored(uint32_t * count);
+
+#endif                          // _USB_LOOP_H_
@@ -0,0 +1,293 @@
+/**
+ * Replays enumeration and class traffic against the mouse_mover USB stack
+ * running on the usb0sim model, and reports what each step cost the USB
+ * interrupt: transactions on the bus, USBOTG_IRQHandler calls, and host
+ * instructions per call.
+ *
+ * usbsim [-m max]
+ *
+ * Exits nonzero if a request fails, data comes back wrong, or with -m, if a
+ * single interrupt takes more than max instructions.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "k20sim.h"
+#include "usb0sim.h"
+#include "usb.h"
+#include "usb_config.h"
+#include "buffers.h"
+#include "slab.h"
+
+#define EP_STREAM USB_STREAM_ENDPOINT
+#define EP_CDC_OUT (USB_CDC_ENDPOINT + 1)
+#define EP_CDC_IN (USB_CDC_ENDPOINT + 2)
+#define CDC_MAX 1024
+
+static uint32_t max_instructions = 0;
+static int failures = 0;
+
+static void report(const char *step, const char *result)
+{
+  usb0sim_stats_t s;
+
+  usb0sim_stats(&s, 1);
+  printf("%-28s %-6s %6u %5u %5u %5u %8.0f %8u\n", step, result,
+         s.transactions, s.naks, s.no_response + s.toggle_errors + s.overruns,
+         s.irqs, s.irqs ? (double) s.irq_instructions / s.irqs : 0.0,
+         s.irq_max);
+  if (max_instructions && s.irq_max > max_instructions) {
+    printf("  interrupt over %u instructions\n", max_instructions);
+    failures++;
+  }
+}
+
+static int control(const char *step, uint16_t request, uint16_t value,
+                   uint16_t index, uint16_t length, void *data)
+{
+  setup_t setup;
+  int n;
+
+  setup.wRequestAndType = request;
+  setup.wValue = value;
+  setup.wIndex = index;
+  setup.wLength = length;
+  n = usb0sim_control(&setup, data);
+  report(step, n == USB0SIM_STALLED ? "stall" : n < 0 ? "FAIL" : "ok");
+  if (n == USB0SIM_TIMEOUT)
+    failures++;
+  return n;
+}
+
+static void check(const char *what, int ok)
+{
+  if (!ok) {
+    printf("  %s: FAIL\n", what);
+    failures++;
+  }
+}
+
+static void enumerate(void)
+{
+  static uint8_t buf[1024];
+  uint8_t line_coding[7] = {0x00, 0xc2, 0x01, 0x00, 0, 0, 8};
+  int n, total;
+
+  //what Linux does: a first look at the device descriptor at address 0,
+  //another reset, then the rest at the new address
+  usb0sim_reset();
+  report("bus reset", "ok");
+  n = control("get device (64)", 0x0680, 0x0100, 0, 64, buf);
+  check("device descriptor", n == 18 && buf[1] == 1);
+  usb0sim_reset();
+  report("bus reset", "ok");
+  control("set address", 0x0500, 7, 0, 0, NULL);
+  control("get device", 0x0680, 0x0100, 0, 18, buf);
+  n = control("get configuration (9)", 0x0680, 0x0200, 0, 9, buf);
+  total = buf[2] | (buf[3] << 8);
+  check("configuration header", n == 9 && buf[1] == 2);
+  n = control("get configuration", 0x0680, 0x0200, 0, total, buf);
+  check("configuration length", n == total);
+  control("get string 0", 0x0680, 0x0300, 0, 255, buf);
+  control("get string 2", 0x0680, 0x0302, 0x0409, 255, buf);
+  control("get string 1", 0x0680, 0x0301, 0x0409, 255, buf);
+  control("set configuration", 0x0900, 1, 0, 0, NULL);
+  check("configured", usb_configured == 1);
+
+  control("hid set idle", 0x0a21, 0, USB_HID_INTERFACE, 0, NULL);
+  n = control("hid get report descriptor", 0x0681, 0x2200,
+              USB_HID_INTERFACE, 255, buf);
+  check("report descriptor", n > 0 && buf[0] == 0x05);
+  n = control("cdc set line coding", 0x2021, 0, USB_CDC_INTERFACE, 7,
+              line_coding);
+  check("line coding", n == 7);
+  n = control("cdc get line coding", 0x21a1, 0, USB_CDC_INTERFACE, 7, buf);
+  check("line coding", n == 7 && memcmp(buf, line_coding, 7) == 0);
+  control("cdc set line state", 0x2221, 3, USB_CDC_INTERFACE, 0, NULL);
+  control("msc get max lun", 0xfea1, 0, USB_MSC_INTERFACE, 1, buf);
+}
+
+// Polls an IN endpoint once per frame
+static int poll_in(uint8_t ep, void *data, uint16_t max, int frames)
+{
+  uint16_t n;
+  int i;
+
+  for (i = 0; i < frames; i++) {
+    n = max;
+    if (usb0sim_transaction(PID_IN, ep, data, &n) == USB0SIM_ACK)
+      return n;
+    usb0sim_frame();
+  }
+  return -1;
+}
+
+// Collects what the device has queued on the CDC data IN endpoint
+static void cdc_write_check(const char *step, const char *data, int length)
+{
+  static uint8_t buf[CDC_MAX];
+  uint16_t n;
+  int got = 0, tries = 0;
+
+  //packets stop short at the end of the ring, so read until the device NAKs
+  while (tries < 3 && got + 64 <= (int) sizeof(buf)) {
+    n = 64;
+    if (usb0sim_transaction(PID_IN, EP_CDC_IN, buf + got, &n) == USB0SIM_ACK)
+      got += n;
+    else
+      tries++;
+  }
+  report(step, got == length && memcmp(buf, data, got) == 0 ? "ok" : "FAIL");
+  check(step, got == length && memcmp(buf, data, got) == 0);
+}
+
+static void cdc_write(const char *step, const char *data, int length)
+{
+  usb_cdc_write(data, length);
+  cdc_write_check(step, data, length);
+}
+
+// Sends data in one packet on the CDC data OUT endpoint and reads it back
+static void cdc_read(const char *step, const char *data, int length)
+{
+  static char buf[CDC_MAX];
+  uint16_t n = length;
+  int got;
+
+  usb0sim_transaction(PID_OUT, EP_CDC_OUT, (void *) data, &n);
+  got = usb_cdc_avail();
+  if (got == length)
+    usb_cdc_read(buf, got);
+  report(step, got == length && memcmp(buf, data, got) == 0 ? "ok" : "FAIL");
+  check(step, got == length && memcmp(buf, data, got) == 0);
+}
+
+static void traffic(void)
+{
+  static uint8_t buf[4096];
+  const char text[] = "the quick brown fox jumps over the lazy dog";
+  int8_t report_[USB_HID_REPORT_SIZE];
+  int32_t x = 0, y = 0;
+  uint16_t *samples;
+  uint16_t n;
+  uint8_t index;
+  int i, got;
+
+  for (i = 0; i < 10; i++)
+    usb0sim_frame();
+  report("idle frames (10)", "ok");
+
+  //once the report sent on configure is in, nothing is left to report and
+  //the host must get a NAK, not silence
+  for (i = 0; i < 3; i++) {
+    n = sizeof(report_);
+    got = usb0sim_transaction(PID_IN, USB_HID_ENDPOINT, report_, &n);
+    if (got != USB0SIM_ACK)
+      break;
+  }
+  report("hid idle", got == USB0SIM_NAK ? "ok" : "FAIL");
+  check("hid idle NAK", got == USB0SIM_NAK);
+
+  //200 counts each way is two full reports and a partial one
+  usb_hid_move(200, -200, 0);
+  for (i = 0; i < 6; i++) {
+    got = poll_in(USB_HID_ENDPOINT, report_, sizeof(report_), 1);
+    if (got == USB_HID_REPORT_SIZE) {
+      x += report_[1];
+      y += report_[2];
+    }
+  }
+  report("hid motion", x == 200 && y == -200 ? "ok" : "FAIL");
+  check("hid motion", x == 200 && y == -200);
+
+  //a caller that masked interrupts must get them back masked
+  k20sim_cpsid();
+  usb_hid_move(0, 0, 0);
+  usb_hid_buttons(0);
+  got = k20sim_primask();
+  k20sim_cpsie();
+  check("hid calls keep the interrupt mask", got);
+
+  samples = buffers_get_next_free(&index);
+  for (i = 0; i < BUFFER_LENGTH; i++)
+    samples[i] = i;
+  buffers_set_ready(index);
+  usb0sim_frame();
+  got = 0;
+  do {
+    n = 64;
+    if (usb0sim_transaction(PID_IN, EP_STREAM, buf + got, &n) ==
+        USB0SIM_ACK)
+      got += n;
+  } while (n == 64 && got < (int) sizeof(buf));
+  report("stream one buffer", "ok");
+  check("stream length", got == BUFFER_LENGTH * 2);
+  for (i = 0; i < BUFFER_LENGTH && ((uint16_t *) buf)[i] == i; i++) ;
+  check("stream data", i == BUFFER_LENGTH);
+
+  cdc_write("cdc write", text, sizeof(text));
+
+  cdc_read("cdc read", text, sizeof(text));
+
+  //the host restarts an endpoint at DATA0 after clearing a halt, and every
+  //endpoint after SET_CONFIGURATION, wherever its EVEN/ODD pointer was
+  control("cdc clear halt (out)", 0x0102, 0, EP_CDC_OUT, 0, NULL);
+  cdc_read("cdc read", text, 10);
+  usb_cdc_write(text, sizeof(text));
+  control("cdc set halt (in)", 0x0302, 0, 0x80 | EP_CDC_IN, 0, NULL);
+  n = control("get status (halted)", 0x0082, 0, 0x80 | EP_CDC_IN, 2, buf);
+  check("endpoint halted", n == 2 && buf[0] == 1);
+  control("cdc clear halt (in)", 0x0102, 0, 0x80 | EP_CDC_IN, 0, NULL);
+  n = control("get status", 0x0082, 0, 0x80 | EP_CDC_IN, 2, buf);
+  check("endpoint not halted", n == 2 && buf[0] == 0);
+  cdc_write_check("cdc write", text, sizeof(text));
+  control("set configuration", 0x0900, 1, 0, 0, NULL);
+  cdc_read("cdc read", text, 5);
+  for (i = 0; i < 70; i++)
+    buf[i] = 'a' + i % 26;
+  cdc_write("cdc write (two packets)", (char *) buf, 70);
+
+  //with interrupts off nothing drains the ring, so what does not fit is
+  //dropped rather than waited for
+  for (i = 0; i < CDC_MAX; i++)
+    buf[i] = 'a' + i % 26;
+  DisableInterrupts;
+  got = usb_cdc_write((char *) buf, CDC_MAX);
+  EnableInterrupts;
+  check("cdc write (masked) length", got > 0 && got < CDC_MAX);
+  cdc_write_check("cdc write (masked)", (char *) buf, got);
+}
+
+int main(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:")) != -1) {
+    switch (opt) {
+    case 'm':
+      max_instructions = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "usage: usbsim [-m max-instructions]\n");
+      return 2;
+    }
+  }
+
+  k20sim_init();
+  usb0sim_init();
+  slab_init();
+  buffers_init();
+  usb_init();
+  usb0sim_count(1);
+
+  printf("%-28s %-6s %6s %5s %5s %5s %8s %8s\n", "step", "result",
+         "trans", "naks", "errs", "irqs", "instr", "max");
+  enumerate();
+  traffic();
+
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures != 0;
+}